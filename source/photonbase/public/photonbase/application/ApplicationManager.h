@@ -10,8 +10,19 @@ namespace pht {
 
 class IApplication;
 
+// The applications a connection can attach to by name, see photon.control.hello
 class ApplicationManager {
 public:
+    /**
+     * @return Return false if an application with the same name is registered
+     */
+    static bool RegisterApplication(const String& appName, IApplication* application);
+
+    static void UnregisterApplication(const String& appName);
+
+    /**
+     * @return The application, nullptr if not found
+     */
     static IApplication* GetApplication(const String& appName);
 
 private:
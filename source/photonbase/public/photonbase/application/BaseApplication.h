@@ -15,6 +15,9 @@ class BaseApplication : public IApplication {
 public:
     const std::set<IProtocol*>& GetClients() const;
 
+    void OnClientAttached(IProtocol* client) override;
+
+    void OnClientDetached(IProtocol* client) override;
 
 private:
     std::set<IProtocol*> clients_;
@@ -0,0 +1,38 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "BaseApplication.h"
+#include "photonbase/core/Types.h"
+#include <map>
+#include <set>
+
+namespace pht {
+
+class PhotonProtocol;
+
+// The counterpart of photonbench, so that the load it generates exercises the whole path of a server. The RMIs are:
+//   void bench.Echo(Uint16 channelId, Uint64 value)
+//   void bench.Reflect(Uint16 channelId)
+// Echo is invoked back on the client in the channel with the same arguments, e.g. to measure round trips. Reflect
+// relays the media received in the channel back to the client in the same channel.
+// All the connections of the application must be served by one thread.
+class BenchApplication : public BaseApplication {
+public:
+    // Misused RMIs, e.g. reflecting a channel that does not exist, fail and the connection is closed
+    bool OnRemoteMethodInvoke(IProtocol* client, const RemoteMethodInfo& method) override;
+
+    // The media of the channels not reflected are dropped
+    bool OnMediaMessage(IProtocol* client, Uint16 channelId, const MessageHeader& header, const ByteArray& payload) override;
+
+    void OnClientDetached(IProtocol* client) override;
+
+private:
+    bool Reflect(PhotonProtocol* client, Uint16 channelId);
+
+    std::map<PhotonProtocol*, std::set<Uint16>> reflected_ {};
+};
+
+}
@@ -4,17 +4,27 @@
 
 #pragma once
 
+#include "photonbase/core/Types.h"
 #include <set>
 
 namespace pht {
 
 class IProtocol;
 class RemoteMethodInfo;
+struct MessageHeader;
 
 class IApplication {
 public:
     virtual bool OnRemoteMethodInvoke(IProtocol* client, const RemoteMethodInfo& method) = 0;
 
+    virtual bool OnMediaMessage(IProtocol* client, Uint16 channelId, const MessageHeader& header, const ByteArray& payload) = 0;
+
+    // Invoked when a connection is attached to the application, e.g. by the hello
+    virtual void OnClientAttached(IProtocol* client) = 0;
+
+    // Invoked when a connection is detached from the application, at the latest when the connection is destroyed
+    virtual void OnClientDetached(IProtocol* client) = 0;
+
 private:
 };
 
@@ -0,0 +1,115 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "BaseApplication.h"
+#include "photonbase/core/Types.h"
+#include "photonbase/media/VideoCompositor.h"
+#include <map>
+#include <vector>
+
+namespace pht {
+
+class PhotonProtocol;
+
+// Composing in rooms, for viewers that can't take a stream of every participant. A client joins a room, publishes
+// its video there and subscribes to the composite of the room, the RMIs are:
+//   void mcu.Join(String room)
+//   void mcu.Leave()
+//   void mcu.Publish(Uint16 channelId)
+//   void mcu.Unpublish()
+//   void mcu.Subscribe(Uint16 channelId)
+//   void mcu.Unsubscribe()
+// The video messages of a published channel carry raw frames, see I420Frame, up to kMaxPublishedWidth x
+// kMaxPublishedHeight, a published channel accepts messages that large. The composite is a grid of
+// the frames of all the publishers in the order they joined, sent as raw frames too, each flagged kKeyFrame.
+// Only the latest frame of a publisher is kept, and Update sends a composite at its own cadence: a publisher whose
+// frames arrive late or in bursts freezes or skips frames in its tile, the output never stutters with it. A room
+// whose frames did not change sends the previous composite again without composing.
+// All the connections of the application must be served by one thread.
+class McuApplication : public BaseApplication {
+public:
+    static const Uint16 kDefaultWidth = 640;
+    static const Uint16 kDefaultHeight = 360;
+    static const Uint32 kDefaultFrameInterval = 66; // About 15 frames per second
+    static const Uint32 kDefaultThreadCount = 4;
+    static const Uint32 kDefaultLatencyBudget = 500;
+    static const Uint16 kMaxPublishedWidth = 1920;
+    static const Uint16 kMaxPublishedHeight = 1080;
+
+    /**
+     * @param width The width of the composite
+     * @param height The height of the composite
+     * @param frameInterval The milliseconds between two composites, Update should be called at this interval
+     * @param threadCount The threads composing, see VideoCompositor
+     * @param latencyBudget The latency budget of the subscribed channels in milliseconds, 0 means never drop
+     */
+    McuApplication(Uint16 width = kDefaultWidth, Uint16 height = kDefaultHeight, Uint32 frameInterval = kDefaultFrameInterval,
+        Uint32 threadCount = kDefaultThreadCount, Uint32 latencyBudget = kDefaultLatencyBudget);
+
+    // Misused RMIs, e.g. publishing without joining a room, fail and the connection is closed
+    bool OnRemoteMethodInvoke(IProtocol* client, const RemoteMethodInfo& method) override;
+
+    // A message of a published channel that is not a raw frame fails and the connection is closed, the media of the
+    // other channels is dropped
+    bool OnMediaMessage(IProtocol* client, Uint16 channelId, const MessageHeader& header, const ByteArray& payload) override;
+
+    // The connection leaves its room
+    void OnClientDetached(IProtocol* client) override;
+
+    // Send a composite to the subscribers of every room
+    void Update();
+
+    Uint32 GetFrameInterval() const
+    {
+        return frameInterval_;
+    }
+
+    size_t GetRoomCount() const
+    {
+        return rooms_.size();
+    }
+
+private:
+    struct Member {
+        String room {};
+        Uint16 publishedChannelId { 0 }; // 0 if not publishing
+        Uint16 subscribedChannelId { 0 }; // 0 if not subscribed
+        I420Frame frame {}; // The latest frame published
+    };
+    struct Room {
+        std::vector<PhotonProtocol*> members {}; // In the order they joined, the tiles follow it
+        I420Frame composite {}; // The latest composite, empty if there is nothing to show
+        bool changed { false }; // The composite is outdated
+        Uint32 timestamp { 0 }; // Of the latest composite sent, advanced by the frame interval
+        Uint32 subscriberCount { 0 };
+    };
+
+    bool Join(PhotonProtocol* client, const String& roomName);
+
+    void Leave(PhotonProtocol* client);
+
+    bool Publish(PhotonProtocol* client, Uint16 channelId);
+
+    bool Unpublish(PhotonProtocol* client);
+
+    bool Subscribe(PhotonProtocol* client, Uint16 channelId);
+
+    bool Unsubscribe(PhotonProtocol* client);
+
+    // Compose the frames of the room again
+    void Compose(Room& room);
+
+    // Send the composite of the room to a subscriber
+    void Send(const Room& room, PhotonProtocol* subscriber);
+
+    Uint32 frameInterval_;
+    Uint32 latencyBudget_;
+    VideoCompositor compositor_;
+    std::map<String, Room> rooms_ {};
+    std::map<PhotonProtocol*, Member> members_ {}; // Every joined connection
+};
+
+}
@@ -0,0 +1,144 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "BaseApplication.h"
+#include "photonbase/core/Types.h"
+#include <map>
+#include <vector>
+
+namespace pht {
+
+class PhotonProtocol;
+
+// Selective forwarding in rooms. A client joins a room, publishes its media channels there as named streams and
+// subscribes to the streams of the others, the RMIs are:
+//   void sfu.Join(String room)
+//   void sfu.Leave()
+//   void sfu.Publish(String stream, Uint16 channelId)
+//   void sfu.PublishLayer(String stream, Uint16 channelId, Uint32 bitrate, Uint16 width, Uint16 height)
+//   void sfu.Unpublish(String stream)
+//   void sfu.Subscribe(String stream, Uint16 channelId)
+//   void sfu.Unsubscribe(String stream)
+//   void sfu.SetViewport(String stream, Uint16 width, Uint16 height)
+//   void sfu.SetBandwidth(Uint32 bitsPerSecond)
+// The channels are created by the client beforehand. A channel carries one published layer or one subscription, a
+// client unsubscribes before reusing the channel for another stream. A subscription may be made before the stream is
+// published, it waits for the stream then.
+// The media of the joined connections is relayed, see PhotonProtocol::SetMediaRelay: a message is received once
+// into a refcounted buffer that the queues of all the subscribers share, and every subscriber drops its own expired
+// messages, so a slow subscriber never delays the others. The latest group of pictures of every stream is cached,
+// a late subscriber gets it first and can start decoding at once, see PhotonProtocol::EnableGopCache.
+// A simulcast stream has several layers, i.e. encodings of one source sent in sibling channels. Every subscriber
+// gets one layer: the largest one its viewport needs, lowered to fit the bandwidth the subscriber reports and to
+// stop the drops of its queue. The layers are switched on key frames only.
+// All the connections of the application must be served by one thread.
+class SfuApplication : public BaseApplication {
+public:
+    static const Uint32 kDefaultLatencyBudget = 1000;
+    static const Uint32 kDefaultGopCacheSize = 4 * 1024 * 1024;
+    // A subscriber whose layer was lowered for drops may try the next layer after this many calls of Update without
+    // drops
+    static const Uint32 kProbeUpdates = 10;
+
+    /**
+     * @param latencyBudget The latency budget of the subscribed channels in milliseconds, 0 means never drop,
+     * see PhotonProtocol::SetChannelLatencyBudget
+     * @param gopCacheSize The limit of the cached group of pictures of a stream in bytes, 0 to cache nothing
+     */
+    explicit SfuApplication(Uint32 latencyBudget = kDefaultLatencyBudget, Uint32 gopCacheSize = kDefaultGopCacheSize);
+
+    // Misused RMIs, e.g. publishing without joining a room, fail and the connection is closed
+    bool OnRemoteMethodInvoke(IProtocol* client, const RemoteMethodInfo& method) override;
+
+    // Only the media of a connection that has not joined a room is handed to the application, it is dropped
+    bool OnMediaMessage(IProtocol* client, Uint16 channelId, const MessageHeader& header, const ByteArray& payload) override;
+
+    // The connection leaves its room
+    void OnClientDetached(IProtocol* client) override;
+
+    // Check the drops of the subscribers and select their layers again, should be called periodically, e.g. every
+    // second
+    void Update();
+
+    size_t GetRoomCount() const
+    {
+        return rooms_.size();
+    }
+
+private:
+    struct Layer {
+        Uint16 channelId { 0 };
+        Uint32 bitrate { 0 }; // In bits per second, 0 if unknown
+        Uint16 width { 0 };
+        Uint16 height { 0 };
+    };
+    struct Stream {
+        PhotonProtocol* publisher { nullptr };
+        std::vector<Layer> layers {}; // By bitrate, the lowest first
+    };
+    struct Subscription {
+        PhotonProtocol* subscriber { nullptr };
+        Uint16 channelId { 0 };
+        Uint16 width { 0 }; // The viewport, 0 if unknown
+        Uint16 height { 0 };
+        Uint16 layerChannelId { 0 }; // The layer forwarded or being switched to, 0 if not published
+        Uint32 bitrateCap { 0 }; // Lowered on drops, 0 means no cap
+        Uint64 droppedMessages { 0 }; // Of the subscriber's channel, when Update was called last
+        Uint32 stableUpdates { 0 }; // Calls of Update without drops since the cap was set
+    };
+    struct Room {
+        std::map<String, Stream> streams {};
+        // By stream name, including the subscriptions waiting for their streams
+        std::map<String, std::vector<Subscription>> subscriptions {};
+        Uint32 memberCount { 0 };
+    };
+    struct Member {
+        String room {};
+        Uint32 bandwidth { 0 }; // Reported by the client, 0 if unknown
+        Uint32 subscriptionCount { 0 }; // The bandwidth is shared by the subscriptions
+    };
+
+    bool Join(PhotonProtocol* client, const String& roomName);
+
+    void Leave(PhotonProtocol* client);
+
+    bool Publish(PhotonProtocol* client, const String& streamName, const Layer& layer);
+
+    bool Unpublish(PhotonProtocol* client, const String& streamName);
+
+    bool Subscribe(PhotonProtocol* client, const String& streamName, Uint16 channelId);
+
+    bool Unsubscribe(PhotonProtocol* client, const String& streamName);
+
+    bool SetViewport(PhotonProtocol* client, const String& streamName, Uint16 width, Uint16 height);
+
+    bool SetBandwidth(PhotonProtocol* client, Uint32 bitsPerSecond);
+
+    // The room the client has joined, nullptr if none
+    Room* GetRoom(PhotonProtocol* client);
+
+    // Whether the client publishes a layer or subscribes a stream in the channel, a channel carries one of them
+    static bool IsChannelBound(const Room& room, PhotonProtocol* client, Uint16 channelId);
+
+    // The layer that suits the subscriber best
+    const Layer& SelectLayer(const Stream& stream, const Subscription& subscription) const;
+
+    // Forward the selected layer to the subscriber, switching on the next key frame if it forwards another one
+    void ApplyLayer(const Stream& stream, Subscription& subscription);
+
+    // Stop forwarding any layer of the stream to the subscriber
+    void Unlink(const Stream& stream, Subscription& subscription);
+
+    // Select the layers again for the subscriptions of a connection, e.g. when its bandwidth changes
+    void ApplyLayers(PhotonProtocol* client);
+
+    Uint32 latencyBudget_;
+    Uint32 gopCacheSize_;
+    std::map<String, Room> rooms_ {};
+    std::map<PhotonProtocol*, Member> members_ {}; // Every joined connection
+};
+
+}
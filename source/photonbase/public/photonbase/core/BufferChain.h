@@ -0,0 +1,94 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "photonbase/core/BufferSlice.h"
+#include "photonbase/core/Types.h"
+#include <SSBase/Buffer.h>
+#include <deque>
+
+namespace pht {
+
+class BufferPool;
+
+// A sequence of slices read as one stream of bytes, like an iovec array. Stacked protocol layers hand chains to each
+// other, so a layer can prepend its headers and pass the payloads through without copying them.
+// Small pieces of data, e.g. headers, are copied into a scratch block shared by the consecutive pieces.
+class BufferChain {
+public:
+    using Slices = std::deque<BufferSlice>;
+
+    BufferChain() = default;
+
+    explicit BufferChain(const BufferSlice& slice);
+
+    // Append the slice without copying
+    void Append(const BufferSlice& slice);
+
+    void Append(BufferChain&& chain);
+
+    // Copy the bytes to the end of the chain
+    void AppendBytes(const void* data, Uint32 size);
+
+    // Take the scratch blocks from a pool, e.g. the one of the loop sending the chain. nullptr to allocate them.
+    void SetBlockPool(BufferPool* pool)
+    {
+        pool_ = pool;
+    }
+
+    // Insert the slice at the beginning without copying
+    void Prepend(const BufferSlice& slice);
+
+    Uint32 Size() const
+    {
+        return size_;
+    }
+
+    bool Empty() const
+    {
+        return size_ == 0;
+    }
+
+    const Slices& GetSlices() const
+    {
+        return slices_;
+    }
+
+    // Remove the first `size` bytes
+    void Skip(Uint32 size);
+
+    // Remove the first `size` bytes and return them, the slices are split without copying
+    BufferChain Split(Uint32 size);
+
+    /**
+     * @param offset The offset of the first byte to copy
+     * @param data The destination, at least `size` bytes
+     * @return Return false if the chain is too short
+     */
+    bool CopyTo(Uint32 offset, void* data, Uint32 size) const;
+
+    // Copy all the bytes to the end of a buffer, e.g. at the bottom of a protocol stack
+    void CopyTo(ss::DynamicBuffer& buffer) const;
+
+    /**
+     * Merge the first `size` bytes into one slice, e.g. to parse a header. Nothing is copied if the first slice
+     * already covers them.
+     * @return The merged slice, or an empty slice if the chain is too short
+     */
+    BufferSlice Coalesce(Uint32 size);
+
+    void Clear();
+
+private:
+    Slices slices_ {};
+    Uint32 size_ { 0 };
+    // The block AppendBytes writes to, the last slice ends at scratchUsed_ if it is the scratch block's
+    std::shared_ptr<ByteArray> scratch_ { nullptr };
+    Uint32 scratchUsed_ { 0 };
+    bool lastIsScratch_ { false };
+    BufferPool* pool_ { nullptr };
+};
+
+}
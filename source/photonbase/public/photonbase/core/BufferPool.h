@@ -0,0 +1,50 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "photonbase/core/Types.h"
+#include <memory>
+#include <vector>
+
+namespace pht {
+
+// Recycles memory blocks of one size. A block returns to the pool when its last reference is released, e.g. when
+// the write that sends it completes, so it can be shared by slices like any other block. Not thread safe, a pool
+// belongs to one loop. Blocks released after the pool is destroyed are freed.
+class BufferPool {
+public:
+    /**
+     * @param blockSize The size of every block
+     * @param maxFreeBlocks The free blocks beyond this are freed instead of kept
+     */
+    explicit BufferPool(Uint32 blockSize, Uint32 maxFreeBlocks = 64);
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // A free block, or a new one if there is none
+    std::shared_ptr<ByteArray> Acquire();
+
+    Uint32 GetBlockSize() const
+    {
+        return blockSize_;
+    }
+
+    Uint32 GetFreeCount() const
+    {
+        return Uint32(freeList_->blocks.size());
+    }
+
+private:
+    struct FreeList {
+        std::vector<std::unique_ptr<ByteArray>> blocks;
+        Uint32 maxBlocks;
+    };
+
+    Uint32 blockSize_;
+    std::shared_ptr<FreeList> freeList_;
+};
+
+}
@@ -0,0 +1,80 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "photonbase/core/Types.h"
+
+namespace pht {
+
+// A view of a refcounted memory block. Copying a slice never copies the bytes, so a message
+// can be queued to many connections at the cost of a refcount.
+class BufferSlice {
+public:
+    BufferSlice() = default;
+
+    // Allocate a new block of `size` bytes
+    explicit BufferSlice(Uint32 size)
+        : block_(size > 0 ? std::make_shared<ByteArray>(size) : nullptr)
+        , offset_(0)
+        , length_(size)
+    {
+    }
+
+    // Take over the bytes without copying
+    explicit BufferSlice(ByteArray&& bytes)
+        : length_(bytes.Size())
+    {
+        if (length_ > 0) {
+            block_ = std::make_shared<ByteArray>(std::move(bytes));
+        }
+    }
+
+    BufferSlice(std::shared_ptr<ByteArray> block, Uint32 offset, Uint32 length)
+        : block_(std::move(block))
+        , offset_(offset)
+        , length_(length)
+    {
+        SSASSERT(length_ == 0 || (block_ != nullptr && offset_ + length_ <= block_->Size()));
+    }
+
+    const Uint8* Data() const
+    {
+        return block_ == nullptr ? nullptr : block_->Data() + offset_;
+    }
+
+    // NOTE: Only write to a slice before it's shared
+    Uint8* MutableData()
+    {
+        return block_ == nullptr ? nullptr : block_->Data() + offset_;
+    }
+
+    Uint32 Size() const
+    {
+        return length_;
+    }
+
+    bool Empty() const
+    {
+        return length_ == 0;
+    }
+
+    BufferSlice Slice(Uint32 offset, Uint32 length) const
+    {
+        SSASSERT(offset + length <= length_);
+        return BufferSlice(block_, offset_ + offset, length);
+    }
+
+    long UseCount() const
+    {
+        return block_.use_count();
+    }
+
+private:
+    std::shared_ptr<ByteArray> block_ { nullptr };
+    Uint32 offset_ { 0 };
+    Uint32 length_ { 0 };
+};
+
+}
@@ -0,0 +1,102 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "photonbase/core/Types.h"
+#include <functional>
+
+namespace pht {
+
+// A hierarchical timing wheel, so that a loop drives the timers of all its connections with one periodic tick.
+// Arming, re-arming and cancelling a timer take constant time. A timer fires on the first tick at or after its
+// deadline, i.e. up to one tick late. Not thread safe, a wheel belongs to one loop.
+class TimingWheel {
+public:
+    class Timer {
+    public:
+        explicit Timer(std::function<void()>&& callback);
+
+        // Cancels the timer
+        ~Timer();
+
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+
+        bool IsArmed() const
+        {
+            return wheel_ != nullptr;
+        }
+
+    private:
+        friend class TimingWheel;
+
+        std::function<void()> callback_;
+        TimingWheel* wheel_ { nullptr }; // The wheel it is armed in
+        Timer** link_ { nullptr }; // The pointer to this timer, in the previous timer or the head of the list
+        Timer* next_ { nullptr };
+        Uint64 expiry_ { 0 }; // In ticks
+    };
+
+    /**
+     * @param tickMilliseconds The resolution of the timers
+     * @param now The current time in milliseconds, of the same clock as Advance
+     */
+    TimingWheel(Uint32 tickMilliseconds, Uint64 now);
+
+    // The armed timers are cancelled
+    ~TimingWheel();
+
+    TimingWheel(const TimingWheel&) = delete;
+    TimingWheel& operator=(const TimingWheel&) = delete;
+
+    /**
+     * Arm the timer, or re-arm it if it's armed
+     * @param delay In milliseconds from the time of the last Advance, the timer fires no earlier than the next tick
+     */
+    void Arm(Timer& timer, Uint32 delay);
+
+    void Cancel(Timer& timer);
+
+    /**
+     * Fire the timers that are due, a callback may arm or cancel any timer
+     * @param now The current time in milliseconds
+     * @return The number of fired timers
+     */
+    Uint32 Advance(Uint64 now);
+
+    Uint32 GetTickMilliseconds() const
+    {
+        return tickMilliseconds_;
+    }
+
+    Uint32 GetTimerCount() const
+    {
+        return timerCount_;
+    }
+
+private:
+    static const Uint32 kLevelBits = 6;
+    static const Uint32 kSlotCount = 1u << kLevelBits;
+    static const Uint32 kLevelCount = 4; // 2^24 ticks, about 19 days of 100ms ticks
+
+    // Put the timer into the slot of its expiry, relative to the current tick
+    void Insert(Timer& timer);
+
+    static void Link(Timer*& head, Timer& timer);
+
+    static void Unlink(Timer& timer);
+
+    // Move the timers of a higher level slot to the lower levels
+    void Cascade(Uint32 level, Uint32 slot);
+
+    Uint32 tickMilliseconds_;
+    Uint64 startTime_;
+    Uint64 currentTick_ { 0 };
+    Uint64 elapsed_ { 0 }; // Milliseconds since startTime_, as of the last Advance
+    Uint32 timerCount_ { 0 };
+    Timer* slots_[kLevelCount][kSlotCount] {};
+};
+
+}
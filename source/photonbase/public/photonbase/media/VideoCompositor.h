@@ -0,0 +1,179 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "photonbase/core/BufferSlice.h"
+#include "photonbase/core/Types.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace pht {
+
+// A raw video frame as carried by a video message: a 4 byte header of the width and the height, Uint16 big-endian
+// each, followed by the Y, U and V planes without padding. The chroma planes are half the width and half the height,
+// rounded up.
+class I420Frame {
+public:
+    static const Uint32 kHeaderSize = 4;
+
+    I420Frame() = default;
+
+    // Allocate a frame with its header written, the planes are not initialized
+    I420Frame(Uint16 width, Uint16 height);
+
+    /**
+     * @param payload The payload of a video message, shared without copying
+     * @return Return false if the payload is not a frame, e.g. its size does not match the header
+     */
+    static bool Parse(const BufferSlice& payload, I420Frame& frame);
+
+    // The payload size of a frame, header included
+    static Uint32 GetPayloadSize(Uint16 width, Uint16 height);
+
+    Uint16 GetWidth() const
+    {
+        return width_;
+    }
+
+    Uint16 GetHeight() const
+    {
+        return height_;
+    }
+
+    bool Empty() const
+    {
+        return payload_.Empty();
+    }
+
+    // The whole payload, header included
+    const BufferSlice& GetPayload() const
+    {
+        return payload_;
+    }
+
+    const Uint8* Y() const
+    {
+        return payload_.Data() + kHeaderSize;
+    }
+
+    const Uint8* U() const
+    {
+        return Y() + Uint32(width_) * height_;
+    }
+
+    const Uint8* V() const
+    {
+        return U() + Uint32(GetChromaWidth()) * GetChromaHeight();
+    }
+
+    // NOTE: Only write to a frame before it's shared
+    Uint8* MutableY()
+    {
+        return const_cast<Uint8*>(Y());
+    }
+
+    Uint8* MutableU()
+    {
+        return const_cast<Uint8*>(U());
+    }
+
+    Uint8* MutableV()
+    {
+        return const_cast<Uint8*>(V());
+    }
+
+    Uint16 GetChromaWidth() const
+    {
+        return Uint16((width_ + 1) / 2);
+    }
+
+    Uint16 GetChromaHeight() const
+    {
+        return Uint16((height_ + 1) / 2);
+    }
+
+private:
+    Uint16 width_ { 0 };
+    Uint16 height_ { 0 };
+    BufferSlice payload_ {};
+};
+
+// Composes frames into a grid, e.g. the pictures of all the participants of a room into one picture for viewers that
+// can't take every stream. Each frame is scaled to fit its tile with libyuv::I420Scale, keeping its aspect ratio.
+// The tiles are scaled in parallel: the calling thread and a pool of workers take the tiles one by one, and Compose
+// returns once all of them are done. Not thread safe, one thread composes at a time.
+class VideoCompositor {
+public:
+    // The position and size of a scaled frame in the output, even numbers so the chroma planes line up
+    struct Rect {
+        Uint16 x { 0 };
+        Uint16 y { 0 };
+        Uint16 width { 0 };
+        Uint16 height { 0 };
+    };
+
+    /**
+     * @param width The width of the output frames, rounded down to an even number
+     * @param height The height of the output frames, rounded down to an even number
+     * @param threadCount The threads scaling the tiles, the calling thread included, at least 1
+     */
+    VideoCompositor(Uint16 width, Uint16 height, Uint32 threadCount);
+
+    // The workers are joined
+    ~VideoCompositor();
+
+    VideoCompositor(const VideoCompositor&) = delete;
+    VideoCompositor& operator=(const VideoCompositor&) = delete;
+
+    /**
+     * Compose the frames into a new one, row by row in a grid of as many columns as rows are needed, the uncovered
+     * area is black
+     * @param frames The frames, an empty one leaves its tile black
+     */
+    I420Frame Compose(const std::vector<I420Frame>& frames);
+
+    /**
+     * The area a frame is scaled to, centered in its tile
+     * @param count The number of tiles
+     * @param index The index of the tile
+     */
+    Rect GetTileRect(Uint32 count, Uint32 index, Uint16 frameWidth, Uint16 frameHeight) const;
+
+    Uint16 GetWidth() const
+    {
+        return width_;
+    }
+
+    Uint16 GetHeight() const
+    {
+        return height_;
+    }
+
+private:
+    void RunWorker();
+
+    // Scale the tiles of the current job until none is left
+    void ScaleTiles();
+
+    Uint16 width_;
+    Uint16 height_;
+    std::vector<std::thread> workers_ {};
+
+    // The current job, published to the workers under the mutex
+    std::mutex mutex_ {};
+    std::condition_variable jobReady_ {};
+    std::condition_variable jobDone_ {};
+    Uint64 jobGeneration_ { 0 };
+    Uint32 runningWorkers_ { 0 };
+    bool stopping_ { false };
+    const std::vector<I420Frame>* frames_ { nullptr };
+    I420Frame* output_ { nullptr };
+    std::atomic<Uint32> nextTile_ { 0 };
+};
+
+}
@@ -14,6 +14,12 @@ public:
 
     bool OnOutBoundData(ss::DynamicBuffer& inputBuffer, ss::DynamicBuffer& outputBuffer) override;
 
+    // Adapters to OnInBoundData, layers that don't override them cost a copy of the data
+    bool OnInBoundChain(BufferChain& input, BufferChain& output) override;
+
+    // Adapter to OnOutBoundData
+    bool OnOutBoundChain(BufferChain& input, BufferChain& output) override;
+
     void SetHighLevelProtocol(IProtocol* protocol);
 
     void SetLowLevelProtocol(IProtocol* protocol);
@@ -26,6 +32,8 @@ public:
 
     IApplication* GetApplication() const override;
 
+    bool GetStats(ProtocolStats& stats) const override;
+
 private:
     IProtocol* highLevelProtocol_ { nullptr };
     IProtocol* lowLevelProtocol_ { nullptr };
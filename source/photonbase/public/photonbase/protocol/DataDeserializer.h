@@ -76,7 +76,7 @@ public:
     template <int N, class T, Uint32 Max = DUIRange<N>::Max, class X = IsUnsignedInteger<T>>
     bool DeserializeFromDUI(T& data)
     {
-        return DeserializeFromDUI(data, [this](const Uint8** ptr, uint32_t len) {
+        return DeserializeFromDUI<N>(data, [this](const Uint8** ptr, uint32_t len) {
             ReadFunc(ptr, len);
         });
     }
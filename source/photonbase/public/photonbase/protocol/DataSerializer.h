@@ -12,6 +12,8 @@ namespace pht {
 
 class Variant;
 class RemoteMethodInfo;
+struct ChunkHeader;
+struct MessageHeader;
 
 class DataSerializer {
     // clang-format off
@@ -60,6 +62,22 @@ public:
      */
     static bool Serialize(const Array& arr, const WriteCallback& write);
 
+    /**
+     *
+     * @param ch The chunk header to serialize
+     * @param write A callback function to receive serialized bytes.
+     * @return Return true on succeed, else false
+     */
+    static bool Serialize(const ChunkHeader& ch, const WriteCallback& write);
+
+    /**
+     *
+     * @param mh The message header to serialize
+     * @param write A callback function to receive serialized bytes.
+     * @return Return true on succeed, else false
+     */
+    static bool Serialize(const MessageHeader& mh, const WriteCallback& write);
+
     /**
      * Serialize an unsigned integer to DUI[N] encoding
      * @tparam N N should be of {1,2,3,4}
@@ -0,0 +1,57 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "photonbase/core/BufferSlice.h"
+#include "photonbase/core/Types.h"
+#include "photonbase/protocol/MessageHeader.h"
+#include <deque>
+
+namespace pht {
+
+// The latest group of pictures of a relayed video channel, i.e. the last key frame message and the messages after
+// it, so that a new subscriber can start decoding right away instead of waiting for the next key frame.
+// The payloads are shared with the send queues, nothing is copied.
+class GopCache {
+public:
+    struct Message {
+        MessageHeader header;
+        BufferSlice payload;
+    };
+
+    /**
+     * @param maxBytes The limit of the cached payloads. A group of pictures that grows beyond it is dropped, and
+     * nothing is cached until the next key frame.
+     */
+    explicit GopCache(Uint32 maxBytes);
+
+    // Cache a message of the channel, a key frame starts over
+    void Push(const MessageHeader& header, const BufferSlice& payload);
+
+    const std::deque<Message>& GetMessages() const
+    {
+        return messages_;
+    }
+
+    // The bytes of the cached payloads
+    Uint32 GetSize() const
+    {
+        return size_;
+    }
+
+    Uint32 GetMaxSize() const
+    {
+        return maxBytes_;
+    }
+
+    void Clear();
+
+private:
+    Uint32 maxBytes_;
+    Uint32 size_ { 0 };
+    std::deque<Message> messages_ {};
+};
+
+}
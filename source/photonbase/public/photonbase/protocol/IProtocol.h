@@ -9,6 +9,8 @@
 namespace pht {
 
 class IApplication;
+class BufferChain;
+struct ProtocolStats;
 
 class IProtocol {
 public:
@@ -18,11 +20,35 @@ public:
 
     virtual bool OnOutBoundData(ss::DynamicBuffer& inputBuffer, ss::DynamicBuffer& outputBuffer) = 0;
 
+    /**
+     * The buffer-chain variant of OnInBoundData for stacked layers. A layer passes slices of the input up, and
+     * prepends its headers to the slices it sends down, without copying the payloads.
+     * @param input The data from the lower layer, the bytes consumed are removed
+     * @param output Receives the data to send to the lower layer
+     * @return Return false on protocol error
+     */
+    virtual bool OnInBoundChain(BufferChain& input, BufferChain& output) = 0;
+
+    /**
+     * The buffer-chain variant of OnOutBoundData
+     * @param input The data from the higher layer, the bytes consumed are removed
+     * @param output Receives the data to send to the lower layer
+     * @return Return false on protocol error
+     */
+    virtual bool OnOutBoundChain(BufferChain& input, BufferChain& output) = 0;
+
     virtual IProtocol* GetHighLevelProtocol() const = 0;
 
     virtual IProtocol* GetLowLevelProtocol() const = 0;
 
     virtual IApplication* GetApplication() const = 0;
+
+    /**
+     * Take a snapshot of the counters, it's cheap enough to be called periodically.
+     * Must be called by the thread the protocol is used in.
+     * @return Return false if the protocol keeps no statistics
+     */
+    virtual bool GetStats(ProtocolStats& stats) const = 0;
 };
 
 }
\ No newline at end of file
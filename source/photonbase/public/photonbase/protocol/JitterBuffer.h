@@ -0,0 +1,123 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "photonbase/core/Types.h"
+#include "photonbase/protocol/MessageHeader.h"
+#include <map>
+
+namespace pht {
+
+// Reorders the media messages of a channel by their timestamps, and releases them on a playout clock.
+// The playout delay follows the inter-arrival jitter (RFC 3550 estimator), so the buffer adds no more
+// latency than the link needs.
+class JitterBuffer {
+public:
+    /**
+     * @param minDelay The minimum playout delay in milliseconds
+     * @param maxDelay The maximum playout delay in milliseconds
+     */
+    explicit JitterBuffer(Uint32 minDelay = 0, Uint32 maxDelay = 1000);
+
+    /**
+     * @param header The message header
+     * @param payload The message payload
+     * @param arrivalTime The local time the message arrived, in milliseconds
+     * @return Return false if the message arrived too late and was dropped
+     */
+    bool Push(const MessageHeader& header, ByteArray&& payload, Uint32 arrivalTime);
+
+    /**
+     * Pop the next message whose playout time has come
+     * @param now The local time in milliseconds
+     * @param header Receives the message header
+     * @param payload Receives the message payload
+     * @return Return false if no message is due
+     */
+    bool Pop(Uint32 now, MessageHeader& header, ByteArray& payload);
+
+    // Milliseconds until the next message is due, 0 if it's due now, -1 if the buffer is empty
+    Int32 GetTimeToNextPlayout(Uint32 now) const;
+
+    Uint32 GetMinDelay() const
+    {
+        return minDelay_;
+    }
+
+    Uint32 GetMaxDelay() const
+    {
+        return maxDelay_;
+    }
+
+    Uint32 GetTargetDelay() const
+    {
+        return currentDelay_;
+    }
+
+    Uint32 GetJitter() const
+    {
+        return Uint32(jitter_);
+    }
+
+    Uint64 GetLateMessages() const
+    {
+        return lateMessages_;
+    }
+
+    size_t Size() const
+    {
+        return messages_.size();
+    }
+
+private:
+    struct Entry {
+        MessageHeader header;
+        ByteArray payload;
+    };
+
+    // Extends a wrapping 32 bits millisecond clock to 64 bits
+    struct Unwrapper {
+        bool valid { false };
+        Uint32 last { 0 };
+        Int64 extended { 0 };
+
+        Int64 Peek(Uint32 value) const
+        {
+            return valid ? extended + Int32(value - last) : Int64(value);
+        }
+
+        Int64 Unwrap(Uint32 value)
+        {
+            extended = Peek(value);
+            last = value;
+            valid = true;
+            return extended;
+        }
+    };
+
+    void UpdateDelay(Int64 timestamp, Int64 arrivalTime);
+
+    Int64 GetPlayoutTime(Int64 timestamp) const
+    {
+        return timestamp + baseTransit_ + currentDelay_;
+    }
+
+    Uint32 minDelay_;
+    Uint32 maxDelay_;
+    Uint32 currentDelay_;
+    double jitter_ { 0 };
+    Unwrapper timestampUnwrapper_ {};
+    Unwrapper clockUnwrapper_ {};
+    bool hasPrevArrival_ { false };
+    Int64 prevTimestamp_ { 0 };
+    Int64 prevArrivalTime_ { 0 };
+    Int64 baseTransit_ { 0 }; // the smallest (arrival time - timestamp) seen
+    bool hasReleased_ { false };
+    Int64 lastReleased_ { 0 };
+    Uint64 lateMessages_ { 0 };
+    std::multimap<Int64, Entry> messages_;
+};
+
+}
@@ -0,0 +1,63 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "photonbase/core/TimingWheel.h"
+#include "photonbase/core/Types.h"
+#include <functional>
+
+namespace pht {
+
+class PhotonProtocol;
+
+// The deadlines a server enforces on a connection, see "Heartbeat" of the protocol document. The handshake must
+// complete in time, and the peer must not be silent for too long. A peer that has been silent for a while is probed
+// with a heartbeat, which a client answers, so a client that only receives, e.g. a viewer, stays connected.
+class KeepAlive {
+public:
+    // In milliseconds
+    static const Uint32 kHandshakeTimeout = 10000;
+    static const Uint32 kIdleTimeout = 60000;
+    static const Uint32 kHeartbeatInterval = 20000;
+
+    enum class Expiry {
+        kHandshake,
+        kIdle,
+    };
+
+    using HeartbeatCallback = std::function<void()>;
+    using ExpiredCallback = std::function<void(Expiry expiry)>;
+
+    /**
+     * @param heartbeatCallback Called when a heartbeat has been queued on the protocol, to write it out
+     * @param expiredCallback Called when a deadline has passed, the connection should be closed
+     */
+    KeepAlive(PhotonProtocol* protocol, HeartbeatCallback&& heartbeatCallback, ExpiredCallback&& expiredCallback);
+
+    KeepAlive(const KeepAlive&) = delete;
+    KeepAlive& operator=(const KeepAlive&) = delete;
+
+    // Arm the deadlines, from the time the connection is accepted
+    void Start(TimingWheel* wheel);
+
+    // Call after the protocol has handled data from the peer
+    void OnReceived();
+
+    // Cancel the deadlines for good, e.g. the connection is closed or handed off
+    void Stop();
+
+private:
+    void OnHeartbeatTimer();
+
+    PhotonProtocol* protocol_;
+    HeartbeatCallback heartbeatCallback_;
+    ExpiredCallback expiredCallback_;
+    TimingWheel* wheel_ { nullptr }; // nullptr if not started or stopped
+    TimingWheel::Timer handshakeTimer_ { [this]() { expiredCallback_(Expiry::kHandshake); } };
+    TimingWheel::Timer idleTimer_ { [this]() { expiredCallback_(Expiry::kIdle); } };
+    TimingWheel::Timer heartbeatTimer_ { [this]() { OnHeartbeatTimer(); } };
+};
+
+}
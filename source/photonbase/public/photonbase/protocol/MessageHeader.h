@@ -11,7 +11,7 @@ namespace pht {
 /*
 | Message ID | DUI[3] | I think Uint16 may be not large enough. Although this field is not very likely to be a small number, for DUI[3] is large enough, and we can save 1 or 2 bytes in some cases |
 | Timestamp | DUI[4] | Milliseconds |
-| Reserved | 3 bit | |
+| Reserved | 3 bit | kCompressed, kKeyFrame or 0 |
 | Message Type | 5 bit | |
 | Message Length | DUI[4] | Bytes |
 
@@ -19,6 +19,7 @@ namespace pht {
 | 1   | Remote Method Invoke | a.k.a. Remote Process Call |
 | 2   | Video Message | This message is a video frame or related parameters |
 | 3   | Audio Message | This message is an audio message |
+| 4   | Remote Method Result | The result of a Remote Method Invoke or a Control Message |
 
  */
 struct MessageHeader {
@@ -26,9 +27,14 @@ struct MessageHeader {
         kControl = 0,
         kRemoteMethodInvoke = 1,
         kVideo = 2,
-        kAudio = 3
+        kAudio = 3,
+        kRemoteMethodResult = 4
     };
 
+    // Bits of `reserved`
+    static const Uint8 kCompressed = 0x01; // The payload is compressed, see photon.control.EnableCompression
+    static const Uint8 kKeyFrame = 0x02; // A video message decoding can start from, e.g. the first of a GOP
+
     Uint32 messageId { 0 };
     Uint32 timestamp { 0 };
     Uint8 reserved { 0 };
@@ -4,21 +4,265 @@
 
 #pragma once
 
+#include "photonbase/core/BufferSlice.h"
+#include "photonbase/core/Types.h"
 #include "photonbase/protocol/BaseProtocol.h"
+#include "photonbase/protocol/MessageHeader.h"
+#include <functional>
+#include <vector>
 
 namespace pht {
 
+class RemoteMethodInfo;
+class ResumptionTokenStore;
+
 class PhotonProtocol : public BaseProtocol {
 public:
+    static const Uint32 kDefaultCompressionThreshold = 64; // Smaller messages hardly shrink
+    // Half of the default channel window less a message header, see SetChannelMaxMessageSize
+    static const Uint32 kDefaultMaxMessageSize = 512 * 1024 - 16;
     enum class Role {
         kServer,
         kClient
     };
+    enum class PeekResult {
+        kFound,
+        kNotEnoughData,
+        kNotHello, // The connection starts with something else, e.g. an unknown Resume, or is broken
+    };
+    struct DropStats {
+        Uint64 droppedMessages { 0 }; // Expired video/audio messages discarded before sending
+        Uint64 droppedBytes { 0 };
+    };
     PhotonProtocol(Role role);
     ~PhotonProtocol();
 
     bool OnInBoundData(ss::DynamicBuffer& inputBuffer, ss::DynamicBuffer& outputBuffer) override;
 
+    /**
+     * Read the application name from the hello a client sends first, without handling anything, e.g. to decide
+     * which thread should serve the connection before a server protocol is fed.
+     * @param data The bytes received from the client so far
+     * @param appName Receives the application name
+     * @param store The store that issued the resumption tokens, the application of a Resume is looked up there.
+     * nullptr to report a Resume as kNotHello.
+     * @return Return kNotEnoughData if the hello is not completely received yet
+     */
+    static PeekResult PeekApplicationName(const Uint8* data, Uint32 size, String& appName, const ResumptionTokenStore* store = nullptr);
+
+    /**
+     * Like OnInBoundData, but for bytes in memory the caller reuses, e.g. a receive buffer shared by the connections
+     * of a loop. The complete chunks are parsed in place, only an incomplete chunk at the end is copied and kept.
+     * Don't mix it with OnInBoundData on one connection.
+     * @param outputBuffer Receives the replies
+     * @return Return false if the data is invalid, the connection should be closed then
+     */
+    bool OnInBoundBytes(const Uint8* data, Uint32 size, ss::DynamicBuffer& outputBuffer);
+
+    // The reply chunks written to `output` refer to the payloads of the queued messages instead of copying them
+    bool OnInBoundBytes(const Uint8* data, Uint32 size, BufferChain& output);
+
+    // The chunks written to `output` refer to the payloads of the queued messages instead of copying them
+    bool OnInBoundChain(BufferChain& input, BufferChain& output) override;
+
+    bool OnOutBoundChain(BufferChain& input, BufferChain& output) override;
+
+    /**
+     * Start the handshake, client only. HELLO, HELLO1 and the CreateChannel calls are sent in one flight without
+     * waiting for the replies, and the channels can be used right away, so media can start after one round trip.
+     * @param appName The application to connect to
+     * @param channelIds The channels to create
+     * @return Return false if this is not a client, or the handshake has been started
+     */
+    bool Connect(const String& appName, const std::vector<Uint16>& channelIds);
+
+    /**
+     * Create a channel, it can be used right away. The connection is closed if the peer refuses it.
+     * @param channelId The channel id, [1, 32767]
+     * @return Return false if the channel is invalid or exists, or the handshake has not been started
+     */
+    bool CreateChannel(Uint16 channelId);
+
+    /**
+     * Server only. Issue resumption tokens to the client, a new one whenever the channels or their configuration
+     * change. A reconnecting client presents the latest token instead of a full handshake.
+     * @param store The store shared by the connections of the server, nullptr to stop issuing
+     */
+    void SetResumptionTokenStore(ResumptionTokenStore* store);
+
+    /**
+     * Resume the session of a broken connection, client only. The token of the previous connection is sent instead
+     * of the handshake, the channels it covers are restored by the server and the creation of the other channels
+     * is replayed. Like Connect, nothing is waited for.
+     * @param previous The protocol of the broken connection
+     * @return Return false if the previous connection has no token, or the handshake has been started
+     */
+    bool Resume(const PhotonProtocol& previous);
+
+    /**
+     * Compress the control, RMI and RMI result messages this endpoint sends on a channel, once the peer agrees.
+     * Video and audio messages are never compressed.
+     * @param channelId The channel id, 0 for the Control Channel
+     * @param threshold Messages smaller than this are sent uncompressed, in bytes
+     * @return Return false if the channel does not exist, compression is enabled or requested, or the handshake has
+     * not been started
+     */
+    bool EnableCompression(Uint16 channelId, Uint32 threshold = kDefaultCompressionThreshold);
+
+    /**
+     * Queue a heartbeat on the Control Channel, so that the peer doesn't consider an idle connection dead. A client
+     * answers the heartbeats of the server by itself, see KeepAlive.
+     * @return Return false if the handshake has not completed
+     */
+    bool SendHeartbeat();
+
+    // Whether the handshake has completed
+    bool IsEstablished() const;
+
+    // Whether the channel has been created, by either endpoint
+    bool HasChannel(Uint16 channelId) const;
+
+    // The protocol version selected by the handshake, 0 if not selected yet
+    Uint16 GetProtocolVersion() const;
+
+    // Write the queued messages to outputBuffer as chunks, as long as the peer's flow control windows allow
+    bool OnOutBoundData(ss::DynamicBuffer& inputBuffer, ss::DynamicBuffer& outputBuffer) override;
+
+    /**
+     * Queue a message to send, the message will be written out by OnOutBoundData
+     * @param channelId The channel to send the message
+     * @param type The message type
+     * @param timestamp The message timestamp, in milliseconds
+     * @param payload The message payload
+     * @return Return false if the channel does not exist or the payload is empty
+     */
+    bool SendMessage(Uint16 channelId, MessageHeader::Type type, Uint32 timestamp, ByteArray&& payload);
+
+    /**
+     * Like the above, with the flags of the header, e.g. kKeyFrame of a video message
+     * @param header The message header, the message id and length will be rewritten
+     * @return Return false if the channel does not exist, the payload is empty or the flags are not allowed
+     */
+    bool SendMessage(Uint16 channelId, const MessageHeader& header, ByteArray&& payload);
+
+    /**
+     * Queue a Remote Method Invoke message, the remote application's OnRemoteMethodInvoke gets it
+     * @param channelId The channel to send the message, the Control Channel is not allowed
+     * @return Return false if the channel does not exist or the method can't be serialized
+     */
+    bool InvokeRemoteMethod(Uint16 channelId, const RemoteMethodInfo& method);
+
+    // Milliseconds since the connection's Base Time, media messages should be stamped with this clock
+    Uint32 GetTimestamp() const;
+
+    /**
+     * Video and audio messages that are still not sent `latencyBudget` milliseconds after their timestamp
+     * are dropped. A message that has been partially sent is never dropped.
+     * @param channelId The channel id, the Control Channel is not allowed
+     * @param latencyBudget In milliseconds, 0 means never drop
+     * @return Return false if the channel does not exist
+     */
+    bool SetChannelLatencyBudget(Uint16 channelId, Uint32 latencyBudget);
+
+    /**
+     * Exempt a channel from flow control, e.g. an unreliable channel of a datagram transport: its lost chunks would
+     * never be credited back, and the windows must not split its messages. It must be called before the channel is
+     * created: the exemption is sent along with photon.control.CreateChannel, and the peer applies it too. The peer
+     * refuses to create a flow controlled channel it has exempted.
+     * @param channelId The channel id, the Control Channel is not allowed
+     * @return Return false if the channel id is invalid, or the channel exists and is flow controlled
+     */
+    bool DisableChannelFlowControl(Uint16 channelId);
+
+    /**
+     * Limit the messages the peer may send in a channel, a larger one closes the connection. The channel window is
+     * credited back only when a message has been handed over, so a flow controlled channel's window grows to twice
+     * the limit: a message never waits for the credits of its own chunks.
+     * @param channelId The channel id
+     * @param maxMessageSize In bytes, kDefaultMaxMessageSize by default
+     * @return Return false if the channel does not exist, or the window would exceed its maximum
+     */
+    bool SetChannelMaxMessageSize(Uint16 channelId, Uint32 maxMessageSize);
+
+    bool GetChannelDropStats(Uint16 channelId, DropStats& stats) const;
+
+    bool GetStats(ProtocolStats& stats) const override;
+
+    /**
+     * Limit the sending rate of all the channels except the Control Channel, e.g. to follow the target bitrate
+     * of a congestion controller. Queued messages wait, and expire as usual when they have a latency budget.
+     * @param bitsPerSecond The pacing rate, 0 means unlimited
+     */
+    void SetPacingRate(Uint32 bitsPerSecond);
+
+    /**
+     * Buffer the video/audio messages received in a channel, and hand them to the application in timestamp
+     * order on a playout clock. The playout delay adapts to the measured jitter within [minDelay, maxDelay].
+     * @param channelId The media channel id
+     * @param minDelay In milliseconds
+     * @param maxDelay In milliseconds
+     * @return Return false if the channel does not exist
+     */
+    bool EnableJitterBuffer(Uint16 channelId, Uint32 minDelay, Uint32 maxDelay);
+
+    /**
+     * Hand the buffered media messages that are due to the application.
+     * @return Milliseconds until the next message is due, -1 if no message is buffered
+     */
+    Int32 PollMediaMessages();
+
+    /**
+     * In relay mode, video/audio messages are never parsed nor handed to the application, the payloads are
+     * received into refcounted buffers and queued to the subscribers of the channel without copying.
+     * @param enabled Enable or disable relay mode
+     */
+    void SetMediaRelay(bool enabled);
+
+    /**
+     * Forward the media messages received in a channel to another connection.
+     * NOTE: The subscriber must be removed before it's destroyed.
+     * @param channelId The channel of this connection
+     * @param subscriber The connection to forward to
+     * @param subscriberChannelId The channel of the subscriber's connection
+     * @return Return false if the channel does not exist
+     */
+    bool AddMediaSubscriber(Uint16 channelId, PhotonProtocol* subscriber, Uint16 subscriberChannelId);
+
+    void RemoveMediaSubscriber(Uint16 channelId, PhotonProtocol* subscriber);
+
+    /**
+     * Move a subscriber's channel to a channel of this connection from the others, e.g. to another simulcast layer
+     * of the same source. The subscriber keeps getting the messages of the current channel until a key frame
+     * arrives in the new one, so its decoder never starts in the middle of a group of pictures.
+     * A pending switch of the subscriber's channel is replaced.
+     * @param channelId The channel to switch to
+     * @param subscriberChannelId The channel of the subscriber's connection
+     * @return Return false if the channel does not exist
+     */
+    bool SwitchMediaSubscriber(Uint16 channelId, PhotonProtocol* subscriber, Uint16 subscriberChannelId);
+
+    /**
+     * In relay mode, cache the latest group of pictures received in a channel, from the last key frame on, and
+     * forward it to every new subscriber before the live messages, so the subscriber can start decoding at once.
+     * @param channelId The media channel id
+     * @param maxBytes The limit of the cached payloads, 0 to disable the cache. See GopCache.
+     * @return Return false if the channel does not exist
+     */
+    bool EnableGopCache(Uint16 channelId, Uint32 maxBytes);
+
+    /**
+     * Queue a message whose payload may be shared with other connections.
+     * The OutBoundDataReady callback is invoked, so that the owner of this connection can flush it.
+     * @param channelId The channel to send the message
+     * @param header The message header, the message id and length will be rewritten
+     * @param payload The message payload
+     * @return Return false if the channel does not exist or the payload is empty
+     */
+    bool ForwardMessage(Uint16 channelId, const MessageHeader& header, const BufferSlice& payload);
+
+    // Invoked when messages are queued outside of OnInBoundData, OnOutBoundData should be called then
+    void SetOutBoundDataReadyCallback(std::function<void()>&& callback);
+
 private:
     class IProtocolState;
     class Impl;
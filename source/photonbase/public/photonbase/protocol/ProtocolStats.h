@@ -0,0 +1,74 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "photonbase/core/Types.h"
+#include "photonbase/protocol/MessageHeader.h"
+#include <map>
+
+namespace pht {
+
+static const Uint32 kMessageTypeCount = 5; // See MessageHeader::Type
+
+// Durations in milliseconds, bucket 0 counts 0ms, bucket i counts [2^(i-1), 2^i), the last bucket is unbounded.
+// A protocol is only used by the thread of its loop, so the histogram is updated without any synchronization.
+struct LatencyHistogram {
+    static const Uint32 kBucketCount = 16;
+
+    Uint64 buckets[kBucketCount] {};
+    Uint64 count { 0 };
+    Uint64 sum { 0 };
+    Uint32 max { 0 };
+
+    void Add(Uint32 milliseconds);
+
+    void Merge(const LatencyHistogram& other);
+
+    /**
+     * @param percentile In (0, 100]
+     * @return The upper bound of the bucket the percentile falls into, at most the max value. 0 if it's empty
+     */
+    Uint32 GetPercentile(double percentile) const;
+};
+
+struct ChannelStats {
+    // Chunk data, the chunk headers are not counted
+    Uint64 bytesIn { 0 };
+    Uint64 chunksIn { 0 };
+    Uint64 messagesIn { 0 };
+    Uint64 bytesOut { 0 };
+    Uint64 chunksOut { 0 };
+    Uint64 messagesOut { 0 };
+    // Expired video/audio messages discarded before sending
+    Uint64 droppedMessages { 0 };
+    Uint64 droppedBytes { 0 };
+    // The send queue, including the message being sent
+    Uint32 queuedMessages { 0 };
+    Uint64 queuedBytes { 0 };
+    // From the arrival of the first chunk of a message to its last
+    LatencyHistogram reassemblyLatency {};
+
+    void Merge(const ChannelStats& other);
+};
+
+// A snapshot of the counters of a connection. Rates are computed from two snapshots taken at different times.
+struct ProtocolStats {
+    Uint32 timestamp { 0 }; // When the snapshot was taken, in milliseconds since the connection's Base Time
+    Uint64 parseErrors { 0 }; // Inbound data rejected as malformed or violating the protocol
+    Uint64 messagesInByType[kMessageTypeCount] {};
+    Uint64 messagesOutByType[kMessageTypeCount] {};
+    ChannelStats total {}; // All the channels
+    std::map<Uint16, ChannelStats> channels {};
+
+    /**
+     * @param earlier A snapshot of the same connection taken before this one
+     * @param type The message type
+     * @param inbound Received messages or sent messages
+     * @return Messages per second between the snapshots, 0 if no time elapsed
+     */
+    double GetMessageRate(const ProtocolStats& earlier, MessageHeader::Type type, bool inbound) const;
+};
+
+}
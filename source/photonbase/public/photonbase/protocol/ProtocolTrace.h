@@ -0,0 +1,82 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "photonbase/core/Types.h"
+#include <chrono>
+#include <fstream>
+#include <string>
+
+namespace pht {
+
+/*
+A trace file records the raw inbound byte stream of a connection, read by read.
+
+| Field | Encoding | Note |
+| --- | --- | --- |
+| Magic | 7 bytes | "PHTRACE" |
+| Version | 1 byte | 1 |
+| Records | - | Until the end of the file |
+
+Each record:
+| Field | Encoding | Note |
+| --- | --- | --- |
+| Time delta | DUI[4] | Microseconds since the previous record, clamped to the DUI[4] range |
+| Length | DUI[4] | Bytes |
+| Data | raw | |
+ */
+class ProtocolTraceWriter {
+public:
+    ProtocolTraceWriter() = default;
+    ~ProtocolTraceWriter();
+
+    bool Open(const std::string& path);
+
+    bool IsOpen() const
+    {
+        return file_.is_open();
+    }
+
+    // Record a read that arrives now
+    bool Write(const void* data, Uint32 length);
+
+    void Close();
+
+private:
+    std::ofstream file_;
+    bool hasLastTime_ { false };
+    std::chrono::steady_clock::time_point lastTime_ {};
+};
+
+class ProtocolTraceReader {
+public:
+    struct Record {
+        Uint64 time { 0 }; // Microseconds since the first record
+        ByteArray data {};
+    };
+
+    bool Open(const std::string& path);
+
+    /**
+     * @param record Receives the next record
+     * @return Return false at the end of the trace or if the trace is corrupted
+     */
+    bool Next(Record& record);
+
+    bool IsCorrupted() const
+    {
+        return corrupted_;
+    }
+
+private:
+    bool ReadDUI(Uint32& value);
+
+    std::ifstream file_;
+    Uint64 time_ { 0 };
+    Uint8 byte_ { 0 };
+    bool corrupted_ { false };
+};
+
+}
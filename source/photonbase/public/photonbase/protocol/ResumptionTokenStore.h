@@ -0,0 +1,87 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "photonbase/core/Types.h"
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <random>
+#include <vector>
+
+namespace pht {
+
+// The server side state of a connection that a reconnecting client can resume, see photon.control.Resume
+struct SessionSnapshot {
+    struct Channel {
+        Uint16 channelId { 0 };
+        bool flowControlled { true };
+        Uint32 maxMessageSize { 0 };
+        Uint32 latencyBudget { 0 };
+        bool jitterBuffer { false };
+        Uint32 jitterMinDelay { 0 };
+        Uint32 jitterMaxDelay { 0 };
+    };
+
+    String appName {};
+    Uint16 protocolVersion { 0 };
+    std::vector<Channel> channels {};
+};
+
+// Keeps the snapshots of the connections of a server, indexed by random tokens.
+// A token can be redeemed once, and expires `lifetime` after it was issued. It may be shared by the connections
+// of different threads.
+class ResumptionTokenStore {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static const Uint32 kTokenSize = 16;
+
+    /**
+     * @param lifetime How long a token is valid, in milliseconds
+     * @param capacity The maximum tokens kept, the oldest ones are dropped beyond this
+     */
+    explicit ResumptionTokenStore(Uint32 lifetime = 5 * 60 * 1000, Uint32 capacity = 100000);
+
+    /**
+     * @return The token of the snapshot
+     */
+    ByteArray Issue(SessionSnapshot&& snapshot, Clock::time_point now = Clock::now());
+
+    /**
+     * Take the snapshot of a token, the token is no longer valid then
+     * @return Return false if the token is unknown or expired
+     */
+    bool Redeem(const ByteArray& token, SessionSnapshot& snapshot, Clock::time_point now = Clock::now());
+
+    /**
+     * Look up the application of a token without redeeming it, e.g. to decide which thread serves the resumed session
+     * @return Return false if the token is unknown or expired
+     */
+    bool GetApplicationName(const ByteArray& token, String& appName, Clock::time_point now = Clock::now()) const;
+
+    size_t Size() const;
+
+private:
+    struct Entry {
+        SessionSnapshot snapshot;
+        Clock::time_point expiry;
+    };
+
+    using Key = std::vector<Uint8>;
+
+    void Erase(std::map<Key, Entry>::iterator it);
+
+    void DropExpired(Clock::time_point now);
+
+    Uint32 lifetime_;
+    Uint32 capacity_;
+    mutable std::mutex mutex_ {};
+    std::random_device random_ {}; // Tokens must not be predictable
+    std::map<Key, Entry> entries_ {};
+    std::multimap<Clock::time_point, Key> expiries_ {};
+};
+
+}
@@ -0,0 +1,129 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "photonbase/core/Types.h"
+#include <deque>
+#include <vector>
+
+namespace pht {
+
+enum class BandwidthUsage : Uint8 {
+    kNormal = 0,
+    kOverusing = 1, // The queuing delay is growing
+    kUnderusing = 2, // The queuing delay is shrinking
+};
+
+// Estimates the bitrate the path can carry from the arrival times the receiver reports, in the style of Google
+// Congestion Control: a growing queuing delay means the sender is faster than the bottleneck.
+// - Packets sent within 5 milliseconds form a group, the delay variation between groups is smoothed and the
+//   trend of the last 20 groups is fitted with a linear regression.
+// - The trend is compared with an adaptive threshold to detect over-use and under-use.
+// - The target bitrate decreases to 85% of the received bitrate on over-use, holds on under-use and increases
+//   by 8% per second otherwise. A loss rate over 10% decreases it too.
+class BandwidthEstimator {
+public:
+    struct PacketResult {
+        Uint32 sendTime { 0 }; // Sender clock, in milliseconds
+        Uint32 arrivalTime { 0 }; // Receiver clock, in milliseconds, ignored if lost
+        Uint32 size { 0 }; // Bytes
+        bool received { false };
+    };
+
+    // In bits per second
+    static const Uint32 kDefaultMinBitrate = 100 * 1000;
+    static const Uint32 kDefaultStartBitrate = 1000 * 1000;
+    static const Uint32 kDefaultMaxBitrate = 50 * 1000 * 1000;
+
+    BandwidthEstimator();
+
+    void SetBitrateLimits(Uint32 minBitrate, Uint32 startBitrate, Uint32 maxBitrate);
+
+    /**
+     * @param packets The results of one feedback, in sending order
+     * @param now Sender clock, in milliseconds
+     * @param rtt The round trip time, 0 if unknown
+     */
+    void OnFeedback(const std::vector<PacketResult>& packets, Uint32 now, Uint32 rtt);
+
+    // In bits per second
+    Uint32 GetTargetBitrate() const
+    {
+        return targetBitrate_;
+    }
+
+    // The bitrate the receiver got recently, 0 if unknown
+    Uint32 GetAckedBitrate() const
+    {
+        return ackedBitrate_;
+    }
+
+    BandwidthUsage GetUsage() const
+    {
+        return usage_;
+    }
+
+    // The slope of the queuing delay, positive if it grows
+    double GetDelayTrend() const
+    {
+        return trend_;
+    }
+
+    double GetLossRate() const
+    {
+        return lossRate_;
+    }
+
+private:
+    struct PacketGroup {
+        Uint32 firstSendTime { 0 };
+        Uint32 lastSendTime { 0 };
+        Uint32 lastArrivalTime { 0 };
+    };
+
+    void OnPacket(const PacketResult& packet);
+
+    void OnGroupDelta(Int32 delayVariation, Uint32 arrivalTime);
+
+    void UpdateAckedBitrate(const PacketResult& packet);
+
+    void UpdateTarget(Uint32 now, Uint32 rtt);
+
+    Uint32 minBitrate_ { kDefaultMinBitrate };
+    Uint32 maxBitrate_ { kDefaultMaxBitrate };
+    Uint32 targetBitrate_ { kDefaultStartBitrate };
+    Uint32 ackedBitrate_ { 0 };
+
+    bool hasGroup_ { false };
+    bool hasPreviousGroup_ { false };
+    PacketGroup group_ {};
+    PacketGroup previousGroup_ {};
+
+    // Trendline
+    bool hasFirstArrival_ { false };
+    Uint32 firstArrivalTime_ { 0 };
+    double accumulatedDelay_ { 0 };
+    double smoothedDelay_ { 0 };
+    std::deque<std::pair<double, double>> delayHistory_ {}; // (arrival time, smoothed delay)
+    Uint32 deltaCount_ { 0 };
+    double trend_ { 0 };
+
+    // Over-use detector
+    double threshold_ { 12.5 };
+    Uint32 lastThresholdUpdate_ { 0 };
+    Uint32 overuseCount_ { 0 };
+    BandwidthUsage usage_ { BandwidthUsage::kNormal };
+
+    std::deque<std::pair<Uint32, Uint32>> ackedPackets_ {}; // (arrival time, size)
+    Uint32 ackedBytes_ { 0 };
+
+    double lossRate_ { 0 };
+    bool hasUpdate_ { false };
+    Uint32 lastUpdateTime_ { 0 };
+    bool hasDecrease_ { false };
+    Uint32 lastDecreaseTime_ { 0 };
+};
+
+}
@@ -0,0 +1,293 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "photonbase/core/Types.h"
+#include "photonbase/transport/BandwidthEstimator.h"
+#include <deque>
+#include <functional>
+#include <map>
+#include <set>
+#include <vector>
+
+namespace pht {
+
+enum class ReliabilityMode : Uint8 {
+    kReliableOrdered = 0, // Like TCP, the default
+    kReliableUnordered = 1, // Retransmitted, delivered as soon as complete
+    kUnreliable = 2, // Never retransmitted, late payloads are dropped so the delivery order is kept
+};
+
+static const Uint32 kMaxDatagramSize = 1200; // Safe for most paths without IP fragmentation
+
+// Carries the payloads of many channels over datagrams, see "Datagram transport" in doc/Communication_longterm.md.
+// A payload (usually one chunk) is split into fragments, each fragment has a sequence number of its channel.
+// Fragments of reliable channels are acknowledged by the peer and retransmitted on timeout. Unreliable channels may be
+// protected by forward error correction instead, the receiver rebuilds lost fragments from parity fragments, or by
+// NACKs, the receiver asks for lost fragments while they can still be played out in time.
+// The receiver reports the arrival time of each datagram, from which the sender estimates the available bandwidth.
+// The session does no IO, the owner feeds it with received datagrams and sends the datagrams it emits.
+class DatagramSession {
+public:
+    struct Stats {
+        Uint64 sentDatagrams { 0 };
+        Uint64 receivedDatagrams { 0 };
+        Uint64 retransmissions { 0 };
+        Uint64 droppedFragments { 0 }; // Fragments of unreliable channels lost or given up
+        Uint64 recoveredFragments { 0 }; // Fragments rebuilt by FEC
+        Uint64 nackedFragments { 0 }; // Requested by NACKs, including the repeated requests
+        Uint64 suppressedNacks { 0 }; // Missing fragments not requested since they would be too late
+        Uint32 rtt { 0 }; // Smoothed round trip time, in milliseconds
+        Uint32 targetBitrate { 0 }; // Bits per second the path is estimated to carry
+        Uint32 ackedBitrate { 0 }; // Bits per second the peer received recently
+        BandwidthUsage bandwidthUsage { BandwidthUsage::kNormal };
+    };
+
+    using DatagramCallback = std::function<void(const Uint8* data, Uint32 size)>;
+
+    DatagramSession();
+
+    /**
+     * The mode of a channel must be set before its first payload is sent. The mode of channel 0 can not be changed.
+     * The receiver learns the mode from the fragments.
+     * @return Return false if the channel has sent data or is channel 0
+     */
+    bool SetChannelMode(Uint16 channelId, ReliabilityMode mode);
+
+    /**
+     * Protect an unreliable channel with parity fragments, can be changed at any time.
+     * Every dataShards fragments are followed by parityShards parity fragments, any dataShards of them rebuild the
+     * group. One parity fragment is a plain XOR, more are Reed-Solomon.
+     * @param channelId An unreliable channel
+     * @param dataShards Fragments per group
+     * @param parityShards Parity fragments per group, 0 disables FEC. The maximum if adaptive
+     * @param adaptive Adjust the parity fragments per group to the loss rate reported by the peer
+     * @return Return false if the channel is not unreliable or the parameters are invalid
+     */
+    bool SetChannelFec(Uint16 channelId, Uint32 dataShards, Uint32 parityShards, bool adaptive = false);
+
+    /**
+     * Ask the peer to resend the lost fragments of an unreliable channel. The sender keeps the recent fragments of
+     * unreliable channels for this.
+     * @param channelId An unreliable channel of the peer
+     * @param playoutDelay In milliseconds. A lost fragment is not requested if it can't arrive within this since the
+     *        loss is detected, 0 disables NACKs
+     * @return Return false if the channel is reliable
+     */
+    bool SetChannelNack(Uint16 channelId, Uint32 playoutDelay);
+
+    /**
+     * @param lossRate Receives the loss rate of an unreliable channel reported by the peer, in [0, 1]
+     * @return Return false if the peer has not reported yet
+     */
+    bool GetChannelLossRate(Uint16 channelId, double& lossRate) const;
+
+    /**
+     * @param mode Receives the mode of a channel the peer sends, as learned from its fragments
+     * @return Return false if nothing was received from the channel
+     */
+    bool GetPeerChannelMode(Uint16 channelId, ReliabilityMode& mode) const;
+
+    /**
+     * Limit the estimated bandwidth, in bits per second
+     */
+    void SetBitrateLimits(Uint32 minBitrate, Uint32 startBitrate, Uint32 maxBitrate);
+
+    /**
+     * @return The bitrate the path is estimated to carry, in bits per second. Media producers and the outbound
+     *         scheduler should not send faster than this
+     */
+    Uint32 GetTargetBitrate() const
+    {
+        return estimator_.GetTargetBitrate();
+    }
+
+    /**
+     * Queue a payload, it will be sent by Poll
+     * @return Return false if the payload is empty
+     */
+    bool Send(Uint16 channelId, const Uint8* data, Uint32 size);
+
+    /**
+     * Handle a datagram from the peer
+     * @return Return false if the datagram is malformed
+     */
+    bool OnDatagram(const Uint8* data, Uint32 size, Uint32 now);
+
+    /**
+     * Take a received payload
+     * @return Return false if no payload is ready
+     */
+    bool Receive(Uint16& channelId, ByteArray& payload);
+
+    /**
+     * Emit acknowledgements, retransmissions and new fragments
+     * @param now Current time, in milliseconds
+     * @param send Called for each datagram
+     * @return Return false if a fragment is not acknowledged after the maximum retries, i.e. the peer is gone
+     */
+    bool Poll(Uint32 now, const DatagramCallback& send);
+
+    bool HasPendingData() const;
+
+    const Stats& GetStats() const
+    {
+        return stats_;
+    }
+
+private:
+    // Compare sequence numbers that may wrap around
+    struct SequenceLess {
+        bool operator()(Uint32 a, Uint32 b) const
+        {
+            return Int32(a - b) < 0;
+        }
+    };
+
+    struct Fragment {
+        Uint32 sequence { 0 };
+        bool first { false };
+        bool last { false };
+        std::vector<Uint8> data {};
+    };
+
+    struct InFlightFragment {
+        Fragment fragment {};
+        Uint32 firstSentTime { 0 };
+        Uint32 lastSentTime { 0 };
+        Uint32 retries { 0 };
+    };
+
+    struct FecEncoder {
+        Uint32 dataShards { 0 };
+        Uint32 parityShards { 0 }; // 0 means FEC is disabled
+        bool adaptive { false };
+        Uint32 groupBase { 0 };
+        Uint32 groupStartTime { 0 };
+        std::vector<std::vector<Uint8>> shards {};
+    };
+
+    struct CachedFragment {
+        Fragment fragment {};
+        Uint8 flags { 0 };
+        Uint32 sentTime { 0 };
+    };
+
+    struct SendChannel {
+        ReliabilityMode mode { ReliabilityMode::kReliableOrdered };
+        Uint32 nextSequence { 0 };
+        std::deque<Fragment> queue {};
+        std::map<Uint32, InFlightFragment, SequenceLess> inFlight {};
+        // Sent fragments of unreliable channels, for NACKs
+        std::map<Uint32, CachedFragment, SequenceLess> retransmitCache {};
+        Uint32 retransmitCacheBytes { 0 };
+        std::vector<Uint32> nacked {};
+        FecEncoder fec {};
+        bool hasLossRate { false };
+        double lossRate { 0 };
+    };
+
+    struct FecGroup {
+        Uint32 dataCount { 0 };
+        Uint32 parityCount { 0 };
+        std::map<Uint32, std::vector<Uint8>> parity {};
+    };
+
+    struct MissingFragment {
+        Uint32 detectedTime { 0 };
+        Uint32 lastNackTime { 0 };
+        Uint32 nacks { 0 };
+    };
+
+    struct ReceiveChannel {
+        ReliabilityMode mode { ReliabilityMode::kReliableOrdered };
+        Uint32 base { 0 }; // All fragments before this are delivered or given up
+        std::map<Uint32, Fragment, SequenceLess> pending {};
+        std::set<Uint32, SequenceLess> delivered {}; // Delivered fragments after base, unordered mode only
+        std::vector<Uint32> acks {};
+
+        // Unreliable mode only
+        bool hasGap { false }; // A later payload is complete while the one at base is not
+        Uint32 gapTime { 0 };
+        bool fec { false };
+        std::map<Uint32, std::vector<Uint8>, SequenceLess> shards {}; // FEC protected fragments
+        std::map<Uint32, FecGroup, SequenceLess> groups {}; // Keyed by the sequence of the first fragment
+        bool hasHighestSequence { false };
+        Uint32 highestSequence { 0 };
+        Uint32 reportBase { 0 }; // The first sequence of the current loss report interval
+        Uint32 receivedInInterval { 0 };
+        Uint32 lastReportTime { 0 };
+        Uint32 playoutDelay { 0 }; // 0 means NACK is disabled
+        std::map<Uint32, MissingFragment, SequenceLess> missing {};
+    };
+
+    struct SentDatagram {
+        Uint32 sendTime { 0 };
+        Uint32 size { 0 };
+    };
+
+    using FrameCallback = std::function<void()>;
+
+    bool OnDataFrame(const Uint8*& p, const Uint8* end, Uint32 now);
+
+    bool OnAckFrame(const Uint8*& p, const Uint8* end, Uint32 now);
+
+    bool OnLossReportFrame(const Uint8*& p, const Uint8* end);
+
+    bool OnParityFrame(const Uint8*& p, const Uint8* end, Uint32 now);
+
+    bool OnNackFrame(const Uint8*& p, const Uint8* end);
+
+    bool OnFeedbackFrame(const Uint8*& p, const Uint8* end, Uint32 now);
+
+    // Report the arrival times of the datagrams received since the last report
+    void WriteFeedback(std::vector<Uint8>& frame, const FrameCallback& append);
+
+    // Request the missing fragments of a channel, or give them up if they would be too late
+    void WriteNacks(Uint16 channelId, ReceiveChannel& channel, Uint32 now, std::vector<Uint8>& frame, const FrameCallback& append);
+
+    // Dispatch a received or rebuilt fragment
+    void OnFragment(Uint16 channelId, ReceiveChannel& channel, Fragment&& fragment, Uint32 now);
+
+    // Find the payload the fragment belongs to, return false if it is not complete
+    static bool FindPayload(const ReceiveChannel& channel, Uint32 sequence, Uint32& first, Uint32& last);
+
+    void Deliver(Uint16 channelId, ReceiveChannel& channel, Uint32 first, Uint32 last);
+
+    void DeliverOrdered(Uint16 channelId, ReceiveChannel& channel);
+
+    void DeliverUnordered(Uint16 channelId, ReceiveChannel& channel, Uint32 sequence);
+
+    // Deliver complete payloads in order, a missing one is given up once a later one is complete and FEC had time
+    // to rebuild it
+    void DeliverSequenced(Uint16 channelId, ReceiveChannel& channel, Uint32 now);
+
+    void TryRecover(Uint16 channelId, ReceiveChannel& channel, Uint32 groupBase, Uint32 now);
+
+    // Write the parity fragments of the current group
+    void WriteParity(Uint16 channelId, SendChannel& channel, std::vector<Uint8>& frame, const FrameCallback& append);
+
+    void OnRttSample(Uint32 rtt);
+
+    std::map<Uint16, SendChannel> sendChannels_;
+    std::map<Uint16, ReceiveChannel> receiveChannels_;
+    std::deque<std::pair<Uint16, ByteArray>> received_;
+    Stats stats_;
+    BandwidthEstimator estimator_ {};
+
+    // Datagrams carrying data or parity have a transport wide sequence number for feedback
+    Uint32 nextDatagramSequence_ { 0 };
+    std::map<Uint32, SentDatagram, SequenceLess> sentDatagrams_ {};
+    bool hasFeedbackBase_ { false };
+    Uint32 feedbackBase_ { 0 };
+    std::map<Uint32, Uint32, SequenceLess> arrivals_ {}; // Sequence to arrival time
+    Uint32 lastFeedbackTime_ { 0 };
+
+    bool hasRtt_ { false };
+    Uint32 rttVariance_ { 0 };
+    Uint32 rto_;
+};
+
+}
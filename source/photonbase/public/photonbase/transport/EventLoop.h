@@ -0,0 +1,94 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "photonbase/core/Types.h"
+#include <functional>
+#include <memory>
+
+namespace pht {
+
+class TcpSocket;
+
+// A timer of an EventLoop, created by EventLoop::CreateTimer. The loop owns it, it is released after Close.
+class LoopTimer {
+public:
+    using Callback = std::function<void()>;
+
+    LoopTimer(const LoopTimer&) = delete;
+    LoopTimer& operator=(const LoopTimer&) = delete;
+    ~LoopTimer();
+
+    /**
+     * @param timeout Milliseconds to the first call
+     * @param repeat Milliseconds between the following calls, 0 to call once
+     * @return Return false if the timer is closed
+     */
+    bool Start(Uint64 timeout, Uint64 repeat, Callback callback);
+
+    void Stop();
+
+    void Close();
+
+private:
+    friend class EventLoop;
+    struct Impl;
+
+    LoopTimer();
+
+    std::unique_ptr<Impl> impl_;
+};
+
+// An event loop backed by libuv. The loop and everything created by it must only be used on the thread running the
+// loop, except Post and Stop.
+class EventLoop {
+public:
+    using Task = std::function<void()>;
+
+    EventLoop();
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // Closes the sockets and timers still open
+    ~EventLoop();
+
+    /**
+     * Must be called before anything else
+     * @return Return false on failure
+     */
+    bool Init();
+
+    // Returns when the loop is stopped, or has nothing to wait for
+    void Run();
+
+    // Make Run return, thread safe
+    void Stop();
+
+    /**
+     * Run a task on the loop thread, thread safe. The tasks run in the order they are posted, the ones still pending
+     * when the loop is destroyed are dropped, so the loop must outlive the threads posting to it.
+     * @return Return false if the loop is not initialized
+     */
+    bool Post(Task task);
+
+    /**
+     * @return The socket, nullptr on failure. The loop owns it, it is released after its Close completes.
+     */
+    TcpSocket* CreateTcpSocket();
+
+    /**
+     * @return The timer, nullptr on failure. The loop owns it, it is released after its Close.
+     */
+    LoopTimer* CreateTimer();
+
+private:
+    friend class TcpSocket;
+    friend class LoopTimer;
+    struct Impl;
+
+    std::unique_ptr<Impl> impl_;
+};
+
+}
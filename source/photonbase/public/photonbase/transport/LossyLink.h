@@ -0,0 +1,48 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "photonbase/core/Types.h"
+#include <functional>
+#include <map>
+#include <random>
+#include <vector>
+
+namespace pht {
+
+// Simulates a bad network path: drops and delays datagrams. Datagrams with different delays are reordered.
+// It is deterministic for a given seed and sequence of calls, so a failing test can be reproduced.
+class LossyLink {
+public:
+    struct Options {
+        double lossRate { 0 }; // [0, 1]
+        Uint32 delay { 0 }; // Milliseconds
+        Uint32 jitter { 0 }; // Milliseconds, the delay of each datagram is in [delay, delay + jitter]
+        Uint32 seed { 1 };
+    };
+
+    using DatagramCallback = std::function<void(const Uint8* data, Uint32 size)>;
+
+    explicit LossyLink(const Options& options);
+
+    void Send(const Uint8* data, Uint32 size, Uint32 now);
+
+    // Deliver the datagrams whose time has come
+    void Poll(Uint32 now, const DatagramCallback& deliver);
+
+    Uint64 GetDroppedDatagrams() const
+    {
+        return droppedDatagrams_;
+    }
+
+private:
+    Options options_;
+    std::mt19937 random_;
+    // Keyed by delivery time, datagrams of the same time are delivered in sending order
+    std::multimap<Uint32, std::vector<Uint8>> inFlight_;
+    Uint64 droppedDatagrams_ { 0 };
+};
+
+}
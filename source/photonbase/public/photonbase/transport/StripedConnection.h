@@ -0,0 +1,107 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "photonbase/core/Types.h"
+#include <SSBase/Buffer.h>
+#include <map>
+#include <memory>
+#include <set>
+#include <vector>
+
+namespace pht {
+
+class IProtocol;
+
+// Runs a protocol, usually a PhotonProtocol, over several stream connections that form one Generic Connection,
+// e.g. several TCP connections, so that one congested connection doesn't cap the throughput.
+// Each chunk the protocol writes is sent on one path:
+// - The chunks of a channel stay on the path the channel was first sent on, the Control Channel uses path 0.
+// - The chunks of a striped channel go to the path with the least data waiting to be written.
+// The receiving side puts the chunks of each channel back in order by their chunk ids before passing them to the
+// protocol, so the order of each channel is preserved while different paths may be arbitrarily late.
+// A path can't be removed: the chunks queued on it would be lost, so the whole connection should be closed
+// when any of its paths is broken.
+class StripedConnection {
+public:
+    explicit StripedConnection(IProtocol* protocol);
+
+    /**
+     * Add a path, the first path added is path 0
+     * @return The path index
+     */
+    Uint32 AddPath();
+
+    Uint32 GetPathCount() const
+    {
+        return Uint32(paths_.size());
+    }
+
+    /**
+     * Spread the chunks of a channel over all the paths, usually for bulk transfers
+     * @return Return false if the channel is the Control Channel
+     */
+    bool SetChannelStriped(Uint16 channelId, bool striped);
+
+    /**
+     * Handle the data received on a path, the chunks that are in order are passed to the protocol
+     * @return Return false if the data is malformed or the protocol fails
+     */
+    bool OnData(Uint32 path, const Uint8* data, Uint32 size);
+
+    /**
+     * Collect the chunks the protocol has queued and distribute them to the paths
+     * @return Return false if the protocol fails
+     */
+    bool Poll();
+
+    /**
+     * The data to write to a path. The caller writes it to the connection and skips what was written, the data
+     * left in it makes the path less preferred by striped channels.
+     */
+    ss::DynamicBuffer& GetOutputBuffer(Uint32 path)
+    {
+        return paths_[path]->outputBuffer;
+    }
+
+    // Bytes of out of order chunks waiting for an earlier chunk of their channel
+    Uint32 GetReorderedBytes() const
+    {
+        return reorderedBytes_;
+    }
+
+private:
+    struct Path {
+        ss::DynamicBuffer inputBuffer {};
+        ss::DynamicBuffer outputBuffer {};
+    };
+
+    struct InboundChannel {
+        Uint32 nextChunkId { 0 };
+        std::map<Uint32, std::vector<Uint8>> reordered {}; // chunk id -> chunk, including the header
+    };
+
+    // Pass the complete chunks of a path to the reorder buffers
+    bool ReadChunks(Path& path);
+
+    bool OnChunk(Uint16 channelId, Uint32 chunkId, const Uint8* chunk, Uint32 size);
+
+    // Move the complete chunks of outputBuffer_ to the paths
+    bool SendChunks();
+
+    Uint32 SelectPath(Uint16 channelId);
+
+    IProtocol* protocol_;
+    std::vector<std::unique_ptr<Path>> paths_ {};
+    std::map<Uint16, InboundChannel> inboundChannels_ {};
+    std::map<Uint16, Uint32> channelPaths_ {};
+    std::set<Uint16> stripedChannels_ {};
+    Uint32 nextStripePath_ { 0 };
+    Uint32 reorderedBytes_ { 0 };
+    ss::DynamicBuffer inputBuffer_ {};
+    ss::DynamicBuffer outputBuffer_ {};
+};
+
+}
@@ -0,0 +1,131 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "photonbase/core/Types.h"
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace pht {
+
+class EventLoop;
+
+// A buffer of TcpSocket::Send, not owned
+struct ConstBuffer {
+    const void* data { nullptr };
+    size_t size { 0 };
+};
+
+// A TCP socket of an EventLoop, created by EventLoop::CreateTcpSocket or Accept. The loop owns it, it is released
+// after its Close completes, together with its callbacks. The status of the callbacks is 0 or a negative libuv
+// error code.
+class TcpSocket {
+public:
+    using ConnectionCallback = std::function<void(TcpSocket* server, int status)>;
+    using ConnectCallback = std::function<void(int status)>;
+    // Provides the buffer of the next read, which must stay valid until the ReceiveCallback returns
+    using AllocCallback = std::function<void(size_t suggestedSize, char** base, size_t* len)>;
+    // nread is negative on error or end of stream
+    using ReceiveCallback = std::function<void(Int64 nread, const char* data)>;
+    using SendCallback = std::function<void(int status)>;
+    using CloseCallback = std::function<void()>;
+
+    TcpSocket(const TcpSocket&) = delete;
+    TcpSocket& operator=(const TcpSocket&) = delete;
+    ~TcpSocket();
+
+    /**
+     * @param port 0 to pick a free port
+     * @return Return false on failure
+     */
+    bool Bind(const std::string& ip, Uint16 port);
+
+    /**
+     * Take over a socket created elsewhere, e.g. bound with options the loop doesn't set. The socket owns the fd
+     * from now on.
+     * @return Return false on failure
+     */
+    bool Open(int fd);
+
+    /**
+     * Send small writes at once instead of coalescing them, i.e. TCP_NODELAY
+     * @return Return false on failure
+     */
+    bool SetNoDelay(bool enable);
+
+    /**
+     * @param callback Called when a connection is ready to Accept
+     * @return Return false on failure
+     */
+    bool Listen(int backlog, ConnectionCallback callback);
+
+    /**
+     * @return The connection, nullptr on failure
+     */
+    TcpSocket* Accept();
+
+    /**
+     * @return Return false if the connect can't be started, the callback is not called then
+     */
+    bool Connect(const std::string& ip, Uint16 port, ConnectCallback callback);
+
+    /**
+     * Receive into a buffer of the socket
+     * @return Return false on failure
+     */
+    bool StartReceive(ReceiveCallback callback);
+
+    /**
+     * Receive into the buffers of the AllocCallback, e.g. one buffer shared by all the sockets of a loop
+     * @return Return false on failure
+     */
+    bool StartReceive(AllocCallback alloc, ReceiveCallback callback);
+
+    // The bytes not received yet stay in the socket, e.g. for whoever takes the fd over
+    void StopReceive();
+
+    /**
+     * The data is copied, the callback is called when it is written
+     * @return Return false if the write can't be started, the callback is not called then
+     */
+    bool Send(const void* data, Uint32 size, SendCallback callback);
+
+    /**
+     * Write several buffers at once. They are not copied, they must stay valid until the callback is called, the
+     * array itself may be reused right away.
+     * @return Return false if the write can't be started, the callback is not called then
+     */
+    bool Send(const ConstBuffer* buffers, Uint32 count, SendCallback callback);
+
+    // Pending sends complete with an error before the socket is released, closing again does nothing
+    void Close(CloseCallback callback);
+
+    /**
+     * @return Return false if the socket is not connected
+     */
+    bool GetPeer(std::string& ip, Uint16& port) const;
+
+    /**
+     * @return The fd of the socket, still owned by the socket. -1 if the socket is not open, or on Windows
+     */
+    int GetFd() const;
+
+    // 0 if the socket is not bound
+    Uint16 GetLocalPort() const;
+
+private:
+    friend class EventLoop;
+    struct Impl;
+
+    explicit TcpSocket(EventLoop* loop);
+
+    bool Init();
+
+    std::unique_ptr<Impl> impl_;
+};
+
+}
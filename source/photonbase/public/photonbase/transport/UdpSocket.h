@@ -0,0 +1,48 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "photonbase/core/Types.h"
+#include <cstdint>
+#include <string>
+
+namespace pht {
+
+// A non-blocking IPv4 UDP socket connected to one peer, the owner polls it.
+class UdpSocket {
+public:
+    UdpSocket() = default;
+    UdpSocket(const UdpSocket&) = delete;
+    UdpSocket& operator=(const UdpSocket&) = delete;
+    ~UdpSocket();
+
+    /**
+     * @param port 0 to pick a free port
+     * @return Return false on failure
+     */
+    bool Bind(const std::string& ip, Uint16 port);
+
+    Uint16 GetLocalPort() const;
+
+    // Only datagrams from the peer are received after connected
+    bool Connect(const std::string& ip, Uint16 port);
+
+    /**
+     * @return Return false on error. A datagram the system has no room for is silently dropped like on the network
+     */
+    bool Send(const Uint8* data, Uint32 size);
+
+    /**
+     * @return The size of the received datagram, or -1 if there is none
+     */
+    int Receive(Uint8* buffer, Uint32 capacity);
+
+    void Close();
+
+private:
+    std::intptr_t socket_ { -1 };
+};
+
+}
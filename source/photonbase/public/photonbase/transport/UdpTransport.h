@@ -0,0 +1,82 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "photonbase/transport/DatagramSession.h"
+#include <SSBase/Buffer.h>
+#include <functional>
+#include <set>
+
+namespace pht {
+
+class IProtocol;
+class UdpSocket;
+
+// Runs a protocol, usually a PhotonProtocol, over datagrams instead of a TCP stream.
+// Each chunk the protocol writes is sent as one payload of its channel, so a channel's mode decides whether its
+// chunks may be lost or reordered. The protocol reassembles a channel's messages from its chunks, so an unordered
+// or unreliable channel should use a chunk size no smaller than its messages.
+// Set the modes through the transport rather than the session: the unreliable channels of both endpoints are exempt
+// from the flow control of a PhotonProtocol, as their lost chunks would never be credited back.
+class UdpTransport {
+public:
+    using TargetBitrateCallback = std::function<void(Uint32 bitsPerSecond)>;
+
+    explicit UdpTransport(IProtocol* protocol);
+
+    DatagramSession& GetSession()
+    {
+        return session_;
+    }
+
+    /**
+     * @param callback Called from Poll when the session's target bitrate changes, e.g. to update the pacing rate
+     * of the protocol and the bitrate of the encoders
+     */
+    void SetTargetBitrateCallback(TargetBitrateCallback callback);
+
+    /**
+     * Set the mode of a channel on the session, see DatagramSession::SetChannelMode. An unreliable channel must be set
+     * before the protocol creates it, so that the exemption from flow control is sent along.
+     * @return Return false if the session refuses the mode, or the channel is already flow controlled
+     */
+    bool SetChannelMode(Uint16 channelId, ReliabilityMode mode);
+
+    /**
+     * Handle a datagram from the peer, the complete chunks are passed to the protocol
+     * @return Return false if the datagram is malformed, the protocol fails, or an unreliable channel of the peer is
+     * flow controlled
+     */
+    bool OnDatagram(const Uint8* data, Uint32 size, Uint32 now);
+
+    /**
+     * Collect the chunks the protocol has queued and emit datagrams
+     * @return Return false if the protocol fails or the peer is gone
+     */
+    bool Poll(Uint32 now, const DatagramSession::DatagramCallback& send);
+
+    /**
+     * Receive all the datagrams available on the socket, then Poll
+     * @return Return false on failure
+     */
+    bool PollSocket(UdpSocket& socket, Uint32 now);
+
+private:
+    // Move the complete chunks of outputBuffer_ to the session
+    bool SendChunks();
+
+    // Exempt an unreliable channel from the flow control of the protocol, once
+    bool ExemptChannel(Uint16 channelId);
+
+    IProtocol* protocol_;
+    DatagramSession session_ {};
+    ss::DynamicBuffer inputBuffer_ {};
+    ss::DynamicBuffer outputBuffer_ {};
+    TargetBitrateCallback targetBitrateCallback_ {};
+    Uint32 targetBitrate_ { 0 };
+    std::set<Uint16> unreliableChannels_ {};
+};
+
+}
@@ -0,0 +1,36 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "photonbase/application/ApplicationManager.h"
+#include <map>
+
+namespace pht {
+
+static std::map<String, IApplication*>& GetApplications()
+{
+    static std::map<String, IApplication*> applications;
+    return applications;
+}
+
+bool ApplicationManager::RegisterApplication(const String& appName, IApplication* application)
+{
+    if (application == nullptr) {
+        return false;
+    }
+    return GetApplications().emplace(appName, application).second;
+}
+
+void ApplicationManager::UnregisterApplication(const String& appName)
+{
+    GetApplications().erase(appName);
+}
+
+IApplication* ApplicationManager::GetApplication(const String& appName)
+{
+    auto& applications = GetApplications();
+    auto it = applications.find(appName);
+    return it == applications.end() ? nullptr : it->second;
+}
+
+}
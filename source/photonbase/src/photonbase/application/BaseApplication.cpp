@@ -6,4 +6,19 @@
 
 namespace pht {
 
+const std::set<IProtocol*>& BaseApplication::GetClients() const
+{
+    return clients_;
+}
+
+void BaseApplication::OnClientAttached(IProtocol* client)
+{
+    clients_.insert(client);
+}
+
+void BaseApplication::OnClientDetached(IProtocol* client)
+{
+    clients_.erase(client);
+}
+
 }
@@ -0,0 +1,62 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "photonbase/application/BenchApplication.h"
+#include "photonbase/protocol/PhotonProtocol.h"
+#include "photonbase/protocol/RemoteMethodInfo.h"
+
+namespace pht {
+
+bool BenchApplication::OnRemoteMethodInvoke(IProtocol* client, const RemoteMethodInfo& method)
+{
+    auto* protocol = dynamic_cast<PhotonProtocol*>(client);
+    if (protocol == nullptr) {
+        return false;
+    }
+    RemoteMethodInfo rmi = method;
+    auto& params = rmi.GetParameters();
+    // void bench.Echo(Uint16 channelId, Uint64 value)
+    if (rmi.MatchPrototype(Variant::Type::Void, "bench.Echo", { Variant::Type::Uint16, Variant::Type::Uint64 })) {
+        return protocol->InvokeRemoteMethod(params[0]->Get<Uint16>(), rmi);
+    }
+    // void bench.Reflect(Uint16 channelId)
+    if (rmi.MatchPrototype(Variant::Type::Void, "bench.Reflect", { Variant::Type::Uint16 })) {
+        return Reflect(protocol, params[0]->Get<Uint16>());
+    }
+    return false; // Unknown method
+}
+
+bool BenchApplication::OnMediaMessage(IProtocol* client, Uint16 channelId, const MessageHeader& header, const ByteArray& payload)
+{
+    return true;
+}
+
+void BenchApplication::OnClientDetached(IProtocol* client)
+{
+    auto* protocol = dynamic_cast<PhotonProtocol*>(client);
+    auto it = reflected_.find(protocol);
+    if (it != reflected_.end()) {
+        for (auto channelId : it->second) {
+            protocol->RemoveMediaSubscriber(channelId, protocol);
+        }
+        reflected_.erase(it);
+    }
+    BaseApplication::OnClientDetached(client);
+}
+
+bool BenchApplication::Reflect(PhotonProtocol* client, Uint16 channelId)
+{
+    if (reflected_[client].count(channelId) > 0) {
+        return true;
+    }
+    // The connection subscribes to itself, the payloads are sent back without copying
+    client->SetMediaRelay(true);
+    if (!client->AddMediaSubscriber(channelId, client, channelId)) {
+        return false;
+    }
+    reflected_[client].insert(channelId);
+    return true;
+}
+
+}
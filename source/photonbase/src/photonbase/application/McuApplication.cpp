@@ -0,0 +1,215 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "photonbase/application/McuApplication.h"
+#include "photonbase/protocol/MessageHeader.h"
+#include "photonbase/protocol/PhotonProtocol.h"
+#include "photonbase/protocol/RemoteMethodInfo.h"
+#include <algorithm>
+#include <cstring>
+
+namespace pht {
+
+McuApplication::McuApplication(Uint16 width, Uint16 height, Uint32 frameInterval, Uint32 threadCount, Uint32 latencyBudget)
+    : frameInterval_(frameInterval)
+    , latencyBudget_(latencyBudget)
+    , compositor_(width, height, threadCount)
+{
+}
+
+bool McuApplication::OnRemoteMethodInvoke(IProtocol* client, const RemoteMethodInfo& method)
+{
+    auto* protocol = dynamic_cast<PhotonProtocol*>(client);
+    if (protocol == nullptr) {
+        return false;
+    }
+    RemoteMethodInfo rmi = method;
+    auto& params = rmi.GetParameters();
+    // void mcu.Join(String room)
+    if (rmi.MatchPrototype(Variant::Type::Void, "mcu.Join", { Variant::Type::String })) {
+        return Join(protocol, params[0]->Get<String>());
+    }
+    // void mcu.Leave()
+    if (rmi.MatchPrototype(Variant::Type::Void, "mcu.Leave", {})) {
+        Leave(protocol);
+        return true;
+    }
+    // void mcu.Publish(Uint16 channelId)
+    if (rmi.MatchPrototype(Variant::Type::Void, "mcu.Publish", { Variant::Type::Uint16 })) {
+        return Publish(protocol, params[0]->Get<Uint16>());
+    }
+    // void mcu.Unpublish()
+    if (rmi.MatchPrototype(Variant::Type::Void, "mcu.Unpublish", {})) {
+        return Unpublish(protocol);
+    }
+    // void mcu.Subscribe(Uint16 channelId)
+    if (rmi.MatchPrototype(Variant::Type::Void, "mcu.Subscribe", { Variant::Type::Uint16 })) {
+        return Subscribe(protocol, params[0]->Get<Uint16>());
+    }
+    // void mcu.Unsubscribe()
+    if (rmi.MatchPrototype(Variant::Type::Void, "mcu.Unsubscribe", {})) {
+        return Unsubscribe(protocol);
+    }
+    return false; // Unknown method
+}
+
+bool McuApplication::OnMediaMessage(IProtocol* client, Uint16 channelId, const MessageHeader& header, const ByteArray& payload)
+{
+    auto member = members_.find(dynamic_cast<PhotonProtocol*>(client));
+    if (member == members_.end() || member->second.publishedChannelId != channelId
+        || header.messageType != MessageHeader::Type::kVideo) {
+        return true;
+    }
+    BufferSlice bytes(payload.Size());
+    if (payload.Size() > 0) {
+        memcpy(bytes.MutableData(), payload.Data(), payload.Size());
+    }
+    // A newer frame replaces the one not composed yet
+    if (!I420Frame::Parse(bytes, member->second.frame)) {
+        return false;
+    }
+    rooms_[member->second.room].changed = true;
+    return true;
+}
+
+void McuApplication::OnClientDetached(IProtocol* client)
+{
+    auto* protocol = dynamic_cast<PhotonProtocol*>(client);
+    if (protocol != nullptr) {
+        Leave(protocol);
+    }
+    BaseApplication::OnClientDetached(client);
+}
+
+void McuApplication::Update()
+{
+    for (auto& [roomName, room] : rooms_) {
+        if (room.subscriberCount == 0) {
+            continue; // Composed when someone watches
+        }
+        if (room.changed) {
+            Compose(room);
+        }
+        if (room.composite.Empty()) {
+            continue;
+        }
+        // Stamped on the output cadence, whenever the frames arrived
+        room.timestamp += frameInterval_;
+        for (auto* member : room.members) {
+            if (members_[member].subscribedChannelId != 0) {
+                Send(room, member);
+            }
+        }
+    }
+}
+
+bool McuApplication::Join(PhotonProtocol* client, const String& roomName)
+{
+    if (!members_.emplace(client, Member { roomName }).second) {
+        return false; // One room per connection, leave it first
+    }
+    rooms_[roomName].members.push_back(client);
+    return true;
+}
+
+void McuApplication::Leave(PhotonProtocol* client)
+{
+    auto member = members_.find(client);
+    if (member == members_.end()) {
+        return;
+    }
+    Unpublish(client);
+    Unsubscribe(client);
+    auto roomIt = rooms_.find(member->second.room);
+    auto& members = roomIt->second.members;
+    members.erase(std::find(members.begin(), members.end(), client));
+    if (members.empty()) {
+        rooms_.erase(roomIt);
+    }
+    members_.erase(member);
+}
+
+bool McuApplication::Publish(PhotonProtocol* client, Uint16 channelId)
+{
+    auto member = members_.find(client);
+    if (member == members_.end() || member->second.publishedChannelId != 0 || channelId == 0 || !client->HasChannel(channelId)) {
+        return false;
+    }
+    // Raw frames are much larger than the messages a channel accepts by default
+    if (!client->SetChannelMaxMessageSize(channelId, I420Frame::GetPayloadSize(kMaxPublishedWidth, kMaxPublishedHeight))) {
+        return false;
+    }
+    member->second.publishedChannelId = channelId;
+    return true;
+}
+
+bool McuApplication::Unpublish(PhotonProtocol* client)
+{
+    auto member = members_.find(client);
+    if (member == members_.end() || member->second.publishedChannelId == 0) {
+        return false;
+    }
+    member->second.publishedChannelId = 0;
+    if (!member->second.frame.Empty()) {
+        // Its tile is removed
+        member->second.frame = I420Frame();
+        rooms_[member->second.room].changed = true;
+    }
+    return true;
+}
+
+bool McuApplication::Subscribe(PhotonProtocol* client, Uint16 channelId)
+{
+    auto member = members_.find(client);
+    if (member == members_.end() || member->second.subscribedChannelId != 0 || channelId == 0 || !client->HasChannel(channelId)) {
+        return false;
+    }
+    if (latencyBudget_ > 0) {
+        client->SetChannelLatencyBudget(channelId, latencyBudget_);
+    }
+    member->second.subscribedChannelId = channelId;
+    auto& room = rooms_[member->second.room];
+    ++room.subscriberCount;
+    // Every composite is a key frame, the subscriber shows the latest one until the next is due
+    if (!room.changed && !room.composite.Empty()) {
+        Send(room, client);
+    }
+    return true;
+}
+
+bool McuApplication::Unsubscribe(PhotonProtocol* client)
+{
+    auto member = members_.find(client);
+    if (member == members_.end() || member->second.subscribedChannelId == 0) {
+        return false;
+    }
+    member->second.subscribedChannelId = 0;
+    --rooms_[member->second.room].subscriberCount;
+    return true;
+}
+
+void McuApplication::Compose(Room& room)
+{
+    std::vector<I420Frame> frames;
+    for (auto* member : room.members) {
+        auto& frame = members_[member].frame;
+        if (!frame.Empty()) {
+            frames.push_back(frame);
+        }
+    }
+    room.composite = frames.empty() ? I420Frame() : compositor_.Compose(frames);
+    room.changed = false;
+}
+
+void McuApplication::Send(const Room& room, PhotonProtocol* subscriber)
+{
+    MessageHeader header;
+    header.messageType = MessageHeader::Type::kVideo;
+    header.timestamp = room.timestamp;
+    header.reserved = MessageHeader::kKeyFrame;
+    // All the subscribers share the composite
+    subscriber->ForwardMessage(members_[subscriber].subscribedChannelId, header, room.composite.GetPayload());
+}
+
+}
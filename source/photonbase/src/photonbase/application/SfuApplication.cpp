@@ -0,0 +1,402 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "photonbase/application/SfuApplication.h"
+#include "photonbase/protocol/PhotonProtocol.h"
+#include "photonbase/protocol/RemoteMethodInfo.h"
+#include <algorithm>
+
+namespace pht {
+
+SfuApplication::SfuApplication(Uint32 latencyBudget, Uint32 gopCacheSize)
+    : latencyBudget_(latencyBudget)
+    , gopCacheSize_(gopCacheSize)
+{
+}
+
+bool SfuApplication::OnRemoteMethodInvoke(IProtocol* client, const RemoteMethodInfo& method)
+{
+    auto* protocol = dynamic_cast<PhotonProtocol*>(client);
+    if (protocol == nullptr) {
+        return false;
+    }
+    RemoteMethodInfo rmi = method;
+    auto& params = rmi.GetParameters();
+    // void sfu.Join(String room)
+    if (rmi.MatchPrototype(Variant::Type::Void, "sfu.Join", { Variant::Type::String })) {
+        return Join(protocol, params[0]->Get<String>());
+    }
+    // void sfu.Leave()
+    if (rmi.MatchPrototype(Variant::Type::Void, "sfu.Leave", {})) {
+        Leave(protocol);
+        return true;
+    }
+    // void sfu.Publish(String stream, Uint16 channelId)
+    if (rmi.MatchPrototype(Variant::Type::Void, "sfu.Publish", { Variant::Type::String, Variant::Type::Uint16 })) {
+        return Publish(protocol, params[0]->Get<String>(), Layer { params[1]->Get<Uint16>() });
+    }
+    // void sfu.PublishLayer(String stream, Uint16 channelId, Uint32 bitrate, Uint16 width, Uint16 height)
+    if (rmi.MatchPrototype(Variant::Type::Void, "sfu.PublishLayer",
+            { Variant::Type::String, Variant::Type::Uint16, Variant::Type::Uint32, Variant::Type::Uint16, Variant::Type::Uint16 })) {
+        Layer layer { params[1]->Get<Uint16>(), params[2]->Get<Uint32>(), params[3]->Get<Uint16>(), params[4]->Get<Uint16>() };
+        return Publish(protocol, params[0]->Get<String>(), layer);
+    }
+    // void sfu.Unpublish(String stream)
+    if (rmi.MatchPrototype(Variant::Type::Void, "sfu.Unpublish", { Variant::Type::String })) {
+        return Unpublish(protocol, params[0]->Get<String>());
+    }
+    // void sfu.Subscribe(String stream, Uint16 channelId)
+    if (rmi.MatchPrototype(Variant::Type::Void, "sfu.Subscribe", { Variant::Type::String, Variant::Type::Uint16 })) {
+        return Subscribe(protocol, params[0]->Get<String>(), params[1]->Get<Uint16>());
+    }
+    // void sfu.Unsubscribe(String stream)
+    if (rmi.MatchPrototype(Variant::Type::Void, "sfu.Unsubscribe", { Variant::Type::String })) {
+        return Unsubscribe(protocol, params[0]->Get<String>());
+    }
+    // void sfu.SetViewport(String stream, Uint16 width, Uint16 height)
+    if (rmi.MatchPrototype(Variant::Type::Void, "sfu.SetViewport", { Variant::Type::String, Variant::Type::Uint16, Variant::Type::Uint16 })) {
+        return SetViewport(protocol, params[0]->Get<String>(), params[1]->Get<Uint16>(), params[2]->Get<Uint16>());
+    }
+    // void sfu.SetBandwidth(Uint32 bitsPerSecond)
+    if (rmi.MatchPrototype(Variant::Type::Void, "sfu.SetBandwidth", { Variant::Type::Uint32 })) {
+        return SetBandwidth(protocol, params[0]->Get<Uint32>());
+    }
+    return false; // Unknown method
+}
+
+bool SfuApplication::OnMediaMessage(IProtocol* client, Uint16 channelId, const MessageHeader& header, const ByteArray& payload)
+{
+    return true;
+}
+
+void SfuApplication::OnClientDetached(IProtocol* client)
+{
+    auto* protocol = dynamic_cast<PhotonProtocol*>(client);
+    if (protocol != nullptr) {
+        Leave(protocol);
+    }
+    BaseApplication::OnClientDetached(client);
+}
+
+void SfuApplication::Update()
+{
+    for (auto& [roomName, room] : rooms_) {
+        for (auto& [streamName, subscriptions] : room.subscriptions) {
+            auto stream = room.streams.find(streamName);
+            if (stream == room.streams.end()) {
+                continue;
+            }
+            auto& layers = stream->second.layers;
+            for (auto& subscription : subscriptions) {
+                PhotonProtocol::DropStats stats;
+                if (!subscription.subscriber->GetChannelDropStats(subscription.channelId, stats)) {
+                    continue;
+                }
+                auto current = std::find_if(layers.begin(), layers.end(), [&subscription](const Layer& layer) {
+                    return layer.channelId == subscription.layerChannelId;
+                });
+                if (stats.droppedMessages > subscription.droppedMessages) {
+                    // The subscriber can't keep up with this layer, take the one below
+                    if (current != layers.end()) {
+                        subscription.bitrateCap = current == layers.begin() ? current->bitrate : std::prev(current)->bitrate;
+                    }
+                    subscription.stableUpdates = 0;
+                } else if (subscription.bitrateCap > 0 && ++subscription.stableUpdates >= kProbeUpdates) {
+                    // Try the layer above, the cap is lifted at the top
+                    if (current != layers.end()) {
+                        auto next = std::next(current);
+                        subscription.bitrateCap = next == layers.end() ? 0 : next->bitrate;
+                    }
+                    subscription.stableUpdates = 0;
+                }
+                subscription.droppedMessages = stats.droppedMessages;
+                ApplyLayer(stream->second, subscription);
+            }
+        }
+    }
+}
+
+bool SfuApplication::Join(PhotonProtocol* client, const String& roomName)
+{
+    if (!members_.emplace(client, Member { roomName }).second) {
+        return false; // One room per connection, leave it first
+    }
+    ++rooms_[roomName].memberCount;
+    // Relayed payloads are received into buffers of their own, which the subscribers share
+    client->SetMediaRelay(true);
+    return true;
+}
+
+void SfuApplication::Leave(PhotonProtocol* client)
+{
+    auto member = members_.find(client);
+    if (member == members_.end()) {
+        return;
+    }
+    auto roomIt = rooms_.find(member->second.room);
+    auto& room = roomIt->second;
+    for (auto it = room.streams.begin(); it != room.streams.end();) {
+        auto next = std::next(it);
+        if (it->second.publisher == client) {
+            Unpublish(client, it->first);
+        }
+        it = next;
+    }
+    for (auto it = room.subscriptions.begin(); it != room.subscriptions.end();) {
+        auto next = std::next(it);
+        Unsubscribe(client, it->first);
+        it = next;
+    }
+    if (--room.memberCount == 0) {
+        rooms_.erase(roomIt);
+    }
+    members_.erase(member);
+}
+
+bool SfuApplication::Publish(PhotonProtocol* client, const String& streamName, const Layer& layer)
+{
+    auto* room = GetRoom(client);
+    if (room == nullptr || layer.channelId == 0 || !client->HasChannel(layer.channelId)) {
+        return false;
+    }
+    if (IsChannelBound(*room, client, layer.channelId)) {
+        return false;
+    }
+    auto it = room->streams.emplace(streamName, Stream { client }).first;
+    auto& stream = it->second;
+    if (stream.publisher != client) {
+        return false; // Published by someone
+    }
+    auto position = std::upper_bound(stream.layers.begin(), stream.layers.end(), layer, [](const Layer& a, const Layer& b) {
+        return a.bitrate < b.bitrate;
+    });
+    stream.layers.insert(position, layer);
+    client->EnableGopCache(layer.channelId, gopCacheSize_);
+    auto subscriptions = room->subscriptions.find(streamName);
+    if (subscriptions == room->subscriptions.end()) {
+        return true;
+    }
+    // The new layer may suit some subscribers better
+    for (auto& subscription : subscriptions->second) {
+        ApplyLayer(stream, subscription);
+    }
+    return true;
+}
+
+bool SfuApplication::IsChannelBound(const Room& room, PhotonProtocol* client, Uint16 channelId)
+{
+    for (auto& [name, stream] : room.streams) {
+        if (stream.publisher != client) {
+            continue;
+        }
+        for (auto& layer : stream.layers) {
+            if (layer.channelId == channelId) {
+                return true;
+            }
+        }
+    }
+    for (auto& [name, subscriptions] : room.subscriptions) {
+        for (auto& subscription : subscriptions) {
+            if (subscription.subscriber == client && subscription.channelId == channelId) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool SfuApplication::Unpublish(PhotonProtocol* client, const String& streamName)
+{
+    auto* room = GetRoom(client);
+    if (room == nullptr) {
+        return false;
+    }
+    auto stream = room->streams.find(streamName);
+    if (stream == room->streams.end() || stream->second.publisher != client) {
+        return false;
+    }
+    // The subscriptions wait for the stream to be published again
+    auto it = room->subscriptions.find(streamName);
+    if (it != room->subscriptions.end()) {
+        for (auto& subscription : it->second) {
+            Unlink(stream->second, subscription);
+        }
+    }
+    for (auto& layer : stream->second.layers) {
+        client->EnableGopCache(layer.channelId, 0);
+    }
+    room->streams.erase(stream);
+    return true;
+}
+
+bool SfuApplication::Subscribe(PhotonProtocol* client, const String& streamName, Uint16 channelId)
+{
+    auto* room = GetRoom(client);
+    if (room == nullptr || channelId == 0 || !client->HasChannel(channelId)
+        || IsChannelBound(*room, client, channelId)) {
+        return false;
+    }
+    auto& subscriptions = room->subscriptions[streamName];
+    for (auto& subscription : subscriptions) {
+        if (subscription.subscriber == client) {
+            return false; // Subscribed
+        }
+    }
+    if (latencyBudget_ > 0) {
+        client->SetChannelLatencyBudget(channelId, latencyBudget_);
+    }
+    Subscription subscription;
+    subscription.subscriber = client;
+    subscription.channelId = channelId;
+    subscriptions.push_back(subscription);
+    ++members_[client].subscriptionCount;
+    // The bandwidth share of the others shrinks, and the new one is linked if the stream is published
+    ApplyLayers(client);
+    return true;
+}
+
+bool SfuApplication::Unsubscribe(PhotonProtocol* client, const String& streamName)
+{
+    auto* room = GetRoom(client);
+    if (room == nullptr) {
+        return false;
+    }
+    auto it = room->subscriptions.find(streamName);
+    if (it == room->subscriptions.end()) {
+        return false;
+    }
+    auto& subscriptions = it->second;
+    auto subscription = std::find_if(subscriptions.begin(), subscriptions.end(), [client](const Subscription& s) {
+        return s.subscriber == client;
+    });
+    if (subscription == subscriptions.end()) {
+        return false;
+    }
+    auto stream = room->streams.find(streamName);
+    if (stream != room->streams.end()) {
+        Unlink(stream->second, *subscription);
+    }
+    subscriptions.erase(subscription);
+    if (subscriptions.empty()) {
+        room->subscriptions.erase(it);
+    }
+    --members_[client].subscriptionCount;
+    ApplyLayers(client);
+    return true;
+}
+
+bool SfuApplication::SetViewport(PhotonProtocol* client, const String& streamName, Uint16 width, Uint16 height)
+{
+    auto* room = GetRoom(client);
+    if (room == nullptr) {
+        return false;
+    }
+    auto it = room->subscriptions.find(streamName);
+    if (it == room->subscriptions.end()) {
+        return false;
+    }
+    for (auto& subscription : it->second) {
+        if (subscription.subscriber != client) {
+            continue;
+        }
+        subscription.width = width;
+        subscription.height = height;
+        auto stream = room->streams.find(streamName);
+        if (stream != room->streams.end()) {
+            ApplyLayer(stream->second, subscription);
+        }
+        return true;
+    }
+    return false; // Not subscribed
+}
+
+bool SfuApplication::SetBandwidth(PhotonProtocol* client, Uint32 bitsPerSecond)
+{
+    auto member = members_.find(client);
+    if (member == members_.end()) {
+        return false;
+    }
+    member->second.bandwidth = bitsPerSecond;
+    ApplyLayers(client);
+    return true;
+}
+
+SfuApplication::Room* SfuApplication::GetRoom(PhotonProtocol* client)
+{
+    auto member = members_.find(client);
+    if (member == members_.end()) {
+        return nullptr;
+    }
+    return &rooms_[member->second.room];
+}
+
+const SfuApplication::Layer& SfuApplication::SelectLayer(const Stream& stream, const Subscription& subscription) const
+{
+    auto& layers = stream.layers;
+    // The smallest layer that covers the viewport, the larger ones are scaled down by the subscriber anyway
+    size_t selected = layers.size() - 1;
+    if (subscription.width > 0 && subscription.height > 0) {
+        for (size_t i = 0; i < layers.size(); ++i) {
+            if (layers[i].width >= subscription.width && layers[i].height >= subscription.height) {
+                selected = i;
+                break;
+            }
+        }
+    }
+    Uint32 limit = subscription.bitrateCap;
+    auto member = members_.find(subscription.subscriber);
+    if (member != members_.end() && member->second.bandwidth > 0) {
+        Uint32 share = member->second.bandwidth / std::max(member->second.subscriptionCount, 1u);
+        limit = limit == 0 ? share : std::min(limit, share);
+    }
+    // The lowest layer is forwarded even if it doesn't fit, it's the best we have
+    while (selected > 0 && limit > 0 && layers[selected].bitrate > limit) {
+        --selected;
+    }
+    return layers[selected];
+}
+
+void SfuApplication::ApplyLayer(const Stream& stream, Subscription& subscription)
+{
+    auto& layer = SelectLayer(stream, subscription);
+    if (layer.channelId == subscription.layerChannelId) {
+        return;
+    }
+    if (subscription.layerChannelId == 0) {
+        // Starts with the cached group of pictures
+        stream.publisher->AddMediaSubscriber(layer.channelId, subscription.subscriber, subscription.channelId);
+    } else {
+        stream.publisher->SwitchMediaSubscriber(layer.channelId, subscription.subscriber, subscription.channelId);
+    }
+    subscription.layerChannelId = layer.channelId;
+}
+
+void SfuApplication::Unlink(const Stream& stream, Subscription& subscription)
+{
+    for (auto& layer : stream.layers) {
+        stream.publisher->RemoveMediaSubscriber(layer.channelId, subscription.subscriber);
+    }
+    subscription.layerChannelId = 0;
+}
+
+void SfuApplication::ApplyLayers(PhotonProtocol* client)
+{
+    auto* room = GetRoom(client);
+    if (room == nullptr) {
+        return;
+    }
+    for (auto& [streamName, subscriptions] : room->subscriptions) {
+        auto stream = room->streams.find(streamName);
+        if (stream == room->streams.end()) {
+            continue;
+        }
+        for (auto& subscription : subscriptions) {
+            if (subscription.subscriber == client) {
+                ApplyLayer(stream->second, subscription);
+            }
+        }
+    }
+}
+
+}
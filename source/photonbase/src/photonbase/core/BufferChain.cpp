@@ -0,0 +1,160 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "photonbase/core/BufferChain.h"
+#include "photonbase/core/BufferPool.h"
+#include <algorithm>
+#include <cstring>
+
+namespace pht {
+
+static const Uint32 kScratchBlockSize = 4096;
+
+BufferChain::BufferChain(const BufferSlice& slice)
+{
+    Append(slice);
+}
+
+void BufferChain::Append(const BufferSlice& slice)
+{
+    if (slice.Empty()) {
+        return;
+    }
+    slices_.push_back(slice);
+    size_ += slice.Size();
+    lastIsScratch_ = false;
+}
+
+void BufferChain::Append(BufferChain&& chain)
+{
+    for (auto& slice : chain.slices_) {
+        Append(slice);
+    }
+    chain.Clear();
+}
+
+void BufferChain::AppendBytes(const void* data, Uint32 size)
+{
+    if (size == 0) {
+        return;
+    }
+    if (scratch_ == nullptr || scratchUsed_ + size > scratch_->Size()) {
+        if (pool_ != nullptr && size <= pool_->GetBlockSize()) {
+            scratch_ = pool_->Acquire();
+        } else {
+            scratch_ = std::make_shared<ByteArray>(std::max(size, kScratchBlockSize));
+        }
+        scratchUsed_ = 0;
+        lastIsScratch_ = false;
+    }
+    memcpy(scratch_->Data() + scratchUsed_, data, size);
+    if (lastIsScratch_) {
+        // Extend the last slice, it ends where the bytes were written
+        auto& last = slices_.back();
+        last = BufferSlice(scratch_, scratchUsed_ - last.Size(), last.Size() + size);
+    } else {
+        slices_.emplace_back(scratch_, scratchUsed_, size);
+        lastIsScratch_ = true;
+    }
+    scratchUsed_ += size;
+    size_ += size;
+}
+
+void BufferChain::Prepend(const BufferSlice& slice)
+{
+    if (slice.Empty()) {
+        return;
+    }
+    if (slices_.empty()) {
+        lastIsScratch_ = false;
+    }
+    slices_.push_front(slice);
+    size_ += slice.Size();
+}
+
+void BufferChain::Skip(Uint32 size)
+{
+    size = std::min(size, size_);
+    size_ -= size;
+    while (size > 0) {
+        auto& front = slices_.front();
+        if (front.Size() > size) {
+            front = front.Slice(size, front.Size() - size);
+            return;
+        }
+        size -= front.Size();
+        slices_.pop_front();
+    }
+    if (slices_.empty()) {
+        lastIsScratch_ = false;
+    }
+}
+
+BufferChain BufferChain::Split(Uint32 size)
+{
+    BufferChain head;
+    size = std::min(size, size_);
+    while (size > 0) {
+        auto& front = slices_.front();
+        Uint32 n = std::min(size, front.Size());
+        head.Append(front.Slice(0, n));
+        Skip(n);
+        size -= n;
+    }
+    return head;
+}
+
+bool BufferChain::CopyTo(Uint32 offset, void* data, Uint32 size) const
+{
+    if (Uint64(offset) + size > size_) {
+        return false;
+    }
+    auto* dst = static_cast<Uint8*>(data);
+    for (auto& slice : slices_) {
+        if (size == 0) {
+            break;
+        }
+        if (offset >= slice.Size()) {
+            offset -= slice.Size();
+            continue;
+        }
+        Uint32 n = std::min(size, slice.Size() - offset);
+        memcpy(dst, slice.Data() + offset, n);
+        dst += n;
+        size -= n;
+        offset = 0;
+    }
+    return true;
+}
+
+void BufferChain::CopyTo(ss::DynamicBuffer& buffer) const
+{
+    for (auto& slice : slices_) {
+        buffer.PushData(slice.Data(), slice.Size());
+    }
+}
+
+BufferSlice BufferChain::Coalesce(Uint32 size)
+{
+    if (size > size_ || size == 0) {
+        return BufferSlice();
+    }
+    if (slices_.front().Size() >= size) {
+        return slices_.front().Slice(0, size);
+    }
+    BufferSlice merged(size);
+    CopyTo(0, merged.MutableData(), size);
+    Skip(size);
+    Prepend(merged);
+    return merged;
+}
+
+void BufferChain::Clear()
+{
+    slices_.clear();
+    size_ = 0;
+    lastIsScratch_ = false;
+}
+
+}
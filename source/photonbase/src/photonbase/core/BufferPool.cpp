@@ -0,0 +1,35 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "photonbase/core/BufferPool.h"
+
+namespace pht {
+
+BufferPool::BufferPool(Uint32 blockSize, Uint32 maxFreeBlocks)
+    : blockSize_(blockSize)
+    , freeList_(std::make_shared<FreeList>())
+{
+    freeList_->maxBlocks = maxFreeBlocks;
+}
+
+std::shared_ptr<ByteArray> BufferPool::Acquire()
+{
+    std::unique_ptr<ByteArray> block;
+    if (freeList_->blocks.empty()) {
+        block = std::make_unique<ByteArray>(blockSize_);
+    } else {
+        block = std::move(freeList_->blocks.back());
+        freeList_->blocks.pop_back();
+    }
+    std::weak_ptr<FreeList> weakFreeList = freeList_;
+    return std::shared_ptr<ByteArray>(block.release(), [weakFreeList](ByteArray* released) {
+        std::unique_ptr<ByteArray> owned(released);
+        auto freeList = weakFreeList.lock();
+        if (freeList != nullptr && freeList->blocks.size() < freeList->maxBlocks) {
+            freeList->blocks.push_back(std::move(owned));
+        }
+    });
+}
+
+}
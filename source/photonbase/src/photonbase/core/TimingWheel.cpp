@@ -0,0 +1,148 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "photonbase/core/TimingWheel.h"
+#include <algorithm>
+
+namespace pht {
+
+TimingWheel::Timer::Timer(std::function<void()>&& callback)
+    : callback_(std::move(callback))
+{
+}
+
+TimingWheel::Timer::~Timer()
+{
+    if (wheel_ != nullptr) {
+        wheel_->Cancel(*this);
+    }
+}
+
+TimingWheel::TimingWheel(Uint32 tickMilliseconds, Uint64 now)
+    : tickMilliseconds_(std::max(tickMilliseconds, 1u))
+    , startTime_(now)
+{
+}
+
+TimingWheel::~TimingWheel()
+{
+    for (auto& level : slots_) {
+        for (auto& head : level) {
+            while (head != nullptr) {
+                Cancel(*head);
+            }
+        }
+    }
+}
+
+void TimingWheel::Arm(Timer& timer, Uint32 delay)
+{
+    if (timer.wheel_ != nullptr) {
+        timer.wheel_->Cancel(timer);
+    }
+    // The first tick at or after the deadline
+    Uint64 deadline = elapsed_ + delay;
+    timer.expiry_ = std::max((deadline + tickMilliseconds_ - 1) / tickMilliseconds_, currentTick_ + 1);
+    timer.wheel_ = this;
+    ++timerCount_;
+    Insert(timer);
+}
+
+void TimingWheel::Cancel(Timer& timer)
+{
+    if (timer.wheel_ != this) {
+        return;
+    }
+    Unlink(timer);
+    timer.wheel_ = nullptr;
+    --timerCount_;
+}
+
+Uint32 TimingWheel::Advance(Uint64 now)
+{
+    Uint64 targetTick = now > startTime_ ? (now - startTime_) / tickMilliseconds_ : 0;
+    Uint32 fired = 0;
+    while (currentTick_ < targetTick) {
+        ++currentTick_;
+        elapsed_ = currentTick_ * tickMilliseconds_; // The callbacks arm from the time of their tick
+        // A higher level slot is due when the lower bits wrap around
+        for (Uint32 level = 1; level < kLevelCount; ++level) {
+            Uint32 shift = kLevelBits * level;
+            if ((currentTick_ & ((Uint64(1) << shift) - 1)) != 0) {
+                break;
+            }
+            Cascade(level, Uint32(currentTick_ >> shift) & (kSlotCount - 1));
+        }
+
+        // Detach the due timers first, so that the callbacks may arm them again, or cancel the others
+        Timer* due = nullptr;
+        auto& head = slots_[0][currentTick_ & (kSlotCount - 1)];
+        while (head != nullptr) {
+            auto& timer = *head;
+            Unlink(timer);
+            Link(due, timer);
+        }
+        while (due != nullptr) {
+            auto& timer = *due;
+            Unlink(timer);
+            if (timer.expiry_ > currentTick_) {
+                Insert(timer); // Parked beyond the range of the wheel
+                continue;
+            }
+            timer.wheel_ = nullptr;
+            --timerCount_;
+            ++fired;
+            timer.callback_();
+        }
+    }
+    elapsed_ = std::max(elapsed_, now > startTime_ ? now - startTime_ : 0);
+    return fired;
+}
+
+void TimingWheel::Insert(Timer& timer)
+{
+    Uint64 delta = timer.expiry_ - currentTick_;
+    Uint32 level = 0;
+    while (level + 1 < kLevelCount && delta >= (Uint64(1) << (kLevelBits * (level + 1)))) {
+        ++level;
+    }
+    Uint64 expiry = timer.expiry_;
+    if (delta >= (Uint64(1) << (kLevelBits * kLevelCount))) {
+        // Park it in the farthest slot, it is inserted again when that slot is due
+        expiry = currentTick_ + (Uint64(1) << (kLevelBits * kLevelCount)) - 1;
+    }
+    Link(slots_[level][Uint32(expiry >> (kLevelBits * level)) & (kSlotCount - 1)], timer);
+}
+
+void TimingWheel::Link(Timer*& head, Timer& timer)
+{
+    timer.next_ = head;
+    if (head != nullptr) {
+        head->link_ = &timer.next_;
+    }
+    head = &timer;
+    timer.link_ = &head;
+}
+
+void TimingWheel::Unlink(Timer& timer)
+{
+    *timer.link_ = timer.next_;
+    if (timer.next_ != nullptr) {
+        timer.next_->link_ = timer.link_;
+    }
+    timer.link_ = nullptr;
+    timer.next_ = nullptr;
+}
+
+void TimingWheel::Cascade(Uint32 level, Uint32 slot)
+{
+    auto& head = slots_[level][slot];
+    while (head != nullptr) {
+        auto& timer = *head;
+        Unlink(timer);
+        Insert(timer);
+    }
+}
+
+}
@@ -0,0 +1,188 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "photonbase/media/VideoCompositor.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <libyuv/scale.h>
+
+namespace pht {
+
+static const Uint8 kBlackLuma = 16;
+static const Uint8 kBlackChroma = 128;
+
+I420Frame::I420Frame(Uint16 width, Uint16 height)
+    : width_(width)
+    , height_(height)
+    , payload_(GetPayloadSize(width, height))
+{
+    auto* header = payload_.MutableData();
+    header[0] = Uint8(width >> 8u);
+    header[1] = Uint8(width);
+    header[2] = Uint8(height >> 8u);
+    header[3] = Uint8(height);
+}
+
+bool I420Frame::Parse(const BufferSlice& payload, I420Frame& frame)
+{
+    if (payload.Size() < kHeaderSize) {
+        return false;
+    }
+    auto* header = payload.Data();
+    Uint16 width = Uint16(Uint32(header[0]) << 8u | header[1]);
+    Uint16 height = Uint16(Uint32(header[2]) << 8u | header[3]);
+    if (width == 0 || height == 0 || payload.Size() != GetPayloadSize(width, height)) {
+        return false;
+    }
+    frame.width_ = width;
+    frame.height_ = height;
+    frame.payload_ = payload;
+    return true;
+}
+
+Uint32 I420Frame::GetPayloadSize(Uint16 width, Uint16 height)
+{
+    Uint32 chroma = Uint32((width + 1) / 2) * Uint32((height + 1) / 2);
+    return kHeaderSize + Uint32(width) * height + chroma * 2;
+}
+
+VideoCompositor::VideoCompositor(Uint16 width, Uint16 height, Uint32 threadCount)
+    : width_(Uint16(width & ~1u))
+    , height_(Uint16(height & ~1u))
+{
+    for (Uint32 i = 1; i < threadCount; ++i) {
+        workers_.emplace_back([this]() {
+            RunWorker();
+        });
+    }
+}
+
+VideoCompositor::~VideoCompositor()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    jobReady_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+I420Frame VideoCompositor::Compose(const std::vector<I420Frame>& frames)
+{
+    I420Frame output(width_, height_);
+    Uint32 lumaSize = Uint32(width_) * height_;
+    memset(output.MutableY(), kBlackLuma, lumaSize);
+    memset(output.MutableU(), kBlackChroma, lumaSize / 2);
+    if (frames.empty() || lumaSize == 0) {
+        return output;
+    }
+
+    frames_ = &frames;
+    output_ = &output;
+    nextTile_ = 0;
+    if (workers_.empty() || frames.size() == 1) {
+        ScaleTiles();
+    } else {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            runningWorkers_ = Uint32(workers_.size());
+            ++jobGeneration_;
+        }
+        jobReady_.notify_all();
+        ScaleTiles();
+        // The tiles are all taken, wait for the workers to finish theirs
+        std::unique_lock<std::mutex> lock(mutex_);
+        jobDone_.wait(lock, [this]() {
+            return runningWorkers_ == 0;
+        });
+    }
+    frames_ = nullptr;
+    output_ = nullptr;
+    return output;
+}
+
+VideoCompositor::Rect VideoCompositor::GetTileRect(Uint32 count, Uint32 index, Uint16 frameWidth, Uint16 frameHeight) const
+{
+    Rect rect;
+    if (count == 0 || index >= count || frameWidth == 0 || frameHeight == 0) {
+        return rect;
+    }
+    auto columns = Uint32(std::ceil(std::sqrt(double(count))));
+    Uint32 rows = (count + columns - 1) / columns;
+    Uint32 column = index % columns;
+    Uint32 row = index / columns;
+    Uint32 left = (width_ * column / columns) & ~1u;
+    Uint32 right = (width_ * (column + 1) / columns) & ~1u;
+    Uint32 top = (height_ * row / rows) & ~1u;
+    Uint32 bottom = (height_ * (row + 1) / rows) & ~1u;
+    Uint32 tileWidth = right - left;
+    Uint32 tileHeight = bottom - top;
+
+    // Fit the frame into the tile
+    Uint32 width = tileWidth;
+    Uint32 height = Uint32(Uint64(frameHeight) * tileWidth / frameWidth);
+    if (height > tileHeight) {
+        height = tileHeight;
+        width = Uint32(Uint64(frameWidth) * tileHeight / frameHeight);
+    }
+    width &= ~1u;
+    height &= ~1u;
+    rect.x = Uint16(left + ((tileWidth - width) / 2 & ~1u));
+    rect.y = Uint16(top + ((tileHeight - height) / 2 & ~1u));
+    rect.width = Uint16(width);
+    rect.height = Uint16(height);
+    return rect;
+}
+
+void VideoCompositor::RunWorker()
+{
+    Uint64 generation = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            jobReady_.wait(lock, [this, generation]() {
+                return stopping_ || jobGeneration_ != generation;
+            });
+            if (stopping_) {
+                return;
+            }
+            generation = jobGeneration_;
+        }
+        ScaleTiles();
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--runningWorkers_ == 0) {
+            jobDone_.notify_one();
+        }
+    }
+}
+
+void VideoCompositor::ScaleTiles()
+{
+    auto& frames = *frames_;
+    auto& output = *output_;
+    auto count = Uint32(frames.size());
+    Uint32 chromaStride = output.GetChromaWidth();
+    for (Uint32 i = nextTile_++; i < count; i = nextTile_++) {
+        auto& frame = frames[i];
+        if (frame.Empty()) {
+            continue;
+        }
+        Rect rect = GetTileRect(count, i, frame.GetWidth(), frame.GetHeight());
+        if (rect.width == 0 || rect.height == 0) {
+            continue;
+        }
+        // The tiles never overlap, the threads write to disjoint areas
+        Uint32 lumaOffset = Uint32(rect.y) * width_ + rect.x;
+        Uint32 chromaOffset = Uint32(rect.y / 2) * chromaStride + rect.x / 2;
+        libyuv::I420Scale(frame.Y(), frame.GetWidth(), frame.U(), frame.GetChromaWidth(), frame.V(), frame.GetChromaWidth(),
+            frame.GetWidth(), frame.GetHeight(),
+            output.MutableY() + lumaOffset, width_, output.MutableU() + chromaOffset, int(chromaStride),
+            output.MutableV() + chromaOffset, int(chromaStride), rect.width, rect.height, libyuv::kFilterBox);
+    }
+}
+
+}
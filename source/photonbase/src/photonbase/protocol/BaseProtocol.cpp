@@ -3,6 +3,8 @@
 //
 
 #include "photonbase/protocol/BaseProtocol.h"
+#include "photonbase/application/IApplication.h"
+#include "photonbase/core/BufferChain.h"
 
 namespace pht {
 
@@ -16,6 +18,35 @@ bool BaseProtocol::OnOutBoundData(ss::DynamicBuffer& inputBuffer, ss::DynamicBuf
     return false; // NYI
 }
 
+bool BaseProtocol::OnInBoundChain(BufferChain& input, BufferChain& output)
+{
+    ss::DynamicBuffer inputBuffer;
+    ss::DynamicBuffer outputBuffer;
+    input.CopyTo(inputBuffer);
+    Uint32 size = inputBuffer.Size();
+    bool ok = OnInBoundData(inputBuffer, outputBuffer);
+    input.Skip(size - inputBuffer.Size());
+    output.AppendBytes(outputBuffer.GetData<Uint8>(), outputBuffer.Size());
+    return ok;
+}
+
+bool BaseProtocol::OnOutBoundChain(BufferChain& input, BufferChain& output)
+{
+    ss::DynamicBuffer inputBuffer;
+    ss::DynamicBuffer outputBuffer;
+    input.CopyTo(inputBuffer);
+    Uint32 size = inputBuffer.Size();
+    bool ok = OnOutBoundData(inputBuffer, outputBuffer);
+    input.Skip(size - inputBuffer.Size());
+    output.AppendBytes(outputBuffer.GetData<Uint8>(), outputBuffer.Size());
+    return ok;
+}
+
+bool BaseProtocol::GetStats(ProtocolStats& stats) const
+{
+    return false;
+}
+
 void BaseProtocol::SetHighLevelProtocol(IProtocol* protocol)
 {
     highLevelProtocol_ = protocol;
@@ -28,7 +59,16 @@ void BaseProtocol::SetLowLevelProtocol(IProtocol* protocol)
 
 void BaseProtocol::SetApplication(IApplication* application)
 {
+    if (application_ == application) {
+        return;
+    }
+    if (application_ != nullptr) {
+        application_->OnClientDetached(this);
+    }
     application_ = application;
+    if (application_ != nullptr) {
+        application_->OnClientAttached(this);
+    }
 }
 
 IProtocol* BaseProtocol::GetHighLevelProtocol() const
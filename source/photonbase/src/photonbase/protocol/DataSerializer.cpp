@@ -4,6 +4,8 @@
 
 #include "photonbase/protocol/DataSerializer.h"
 #include "photonbase/core/Variant.h"
+#include "photonbase/protocol/ChunkHeader.h"
+#include "photonbase/protocol/MessageHeader.h"
 #include "photonbase/protocol/RemoteMethodInfo.h"
 
 namespace pht {
@@ -164,4 +166,18 @@ bool DataSerializer::Serialize(const Array& arr, const WriteCallback& write)
     return true;
 }
 
+bool DataSerializer::Serialize(const ChunkHeader& ch, const WriteCallback& write)
+{
+    return SerializeToDUI<2>(ch.channelId, write) && SerializeToDUI<4>(ch.chunkId, write) && SerializeToDUI<3>(ch.chunkSize, write);
+}
+
+bool DataSerializer::Serialize(const MessageHeader& mh, const WriteCallback& write)
+{
+    if (!SerializeToDUI<2>(mh.messageId, write) || !SerializeToDUI<4>(mh.timestamp, write)) {
+        return false;
+    }
+    write(Uint8(Uint8(mh.reserved << 5u) | (Uint8(mh.messageType) & 0x1Fu)));
+    return SerializeToDUI<4>(mh.messageLength, write);
+}
+
 }
@@ -0,0 +1,36 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "photonbase/protocol/GopCache.h"
+
+namespace pht {
+
+GopCache::GopCache(Uint32 maxBytes)
+    : maxBytes_(maxBytes)
+{
+}
+
+void GopCache::Push(const MessageHeader& header, const BufferSlice& payload)
+{
+    bool keyFrame = header.messageType == MessageHeader::Type::kVideo && (header.reserved & MessageHeader::kKeyFrame) != 0;
+    if (keyFrame) {
+        Clear();
+    } else if (messages_.empty()) {
+        return; // Useless without the key frame
+    }
+    if (Uint64(size_) + payload.Size() > maxBytes_) {
+        Clear(); // Too large, a part of it can't be decoded
+        return;
+    }
+    messages_.push_back({ header, payload });
+    size_ += payload.Size();
+}
+
+void GopCache::Clear()
+{
+    messages_.clear();
+    size_ = 0;
+}
+
+}
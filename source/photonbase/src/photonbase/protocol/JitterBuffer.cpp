@@ -0,0 +1,92 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "photonbase/protocol/JitterBuffer.h"
+#include <algorithm>
+#include <cmath>
+
+namespace pht {
+
+// The target delay covers this many times of the estimated jitter
+static const double kJitterMultiplier = 3.0;
+
+JitterBuffer::JitterBuffer(Uint32 minDelay, Uint32 maxDelay)
+    : minDelay_(minDelay)
+    , maxDelay_(std::max(minDelay, maxDelay))
+    , currentDelay_(minDelay)
+{
+}
+
+bool JitterBuffer::Push(const MessageHeader& header, ByteArray&& payload, Uint32 arrivalTime)
+{
+    Int64 timestamp = timestampUnwrapper_.Unwrap(header.timestamp);
+    Int64 arrival = clockUnwrapper_.Unwrap(arrivalTime);
+
+    UpdateDelay(timestamp, arrival);
+
+    // Messages with the same timestamp (e.g. the NALUs of a frame) are still welcome
+    if (hasReleased_ && timestamp < lastReleased_) {
+        ++lateMessages_;
+        return false;
+    }
+    messages_.emplace(timestamp, Entry { header, std::move(payload) });
+    return true;
+}
+
+bool JitterBuffer::Pop(Uint32 now, MessageHeader& header, ByteArray& payload)
+{
+    if (messages_.empty()) {
+        return false;
+    }
+    auto it = messages_.begin();
+    if (clockUnwrapper_.Unwrap(now) < GetPlayoutTime(it->first)) {
+        return false;
+    }
+    header = it->second.header;
+    payload = std::move(it->second.payload);
+    hasReleased_ = true;
+    lastReleased_ = it->first;
+    messages_.erase(it);
+
+    // Shrink the delay slowly when the link gets better, jumping back would skip a bunch of messages at once
+    Uint32 target = std::clamp(Uint32(jitter_ * kJitterMultiplier), minDelay_, maxDelay_);
+    if (currentDelay_ > target) {
+        --currentDelay_;
+    }
+    return true;
+}
+
+Int32 JitterBuffer::GetTimeToNextPlayout(Uint32 now) const
+{
+    if (messages_.empty()) {
+        return -1;
+    }
+    Int64 wait = GetPlayoutTime(messages_.begin()->first) - clockUnwrapper_.Peek(now);
+    return wait > 0 ? Int32(wait) : 0;
+}
+
+void JitterBuffer::UpdateDelay(Int64 timestamp, Int64 arrivalTime)
+{
+    Int64 transit = arrivalTime - timestamp;
+    if (!hasPrevArrival_) {
+        baseTransit_ = transit;
+    } else {
+        // RFC 3550 interarrival jitter: J += (|D| - J) / 16
+        double d = double((arrivalTime - prevArrivalTime_) - (timestamp - prevTimestamp_));
+        jitter_ += (std::fabs(d) - jitter_) / 16.0;
+        // The fastest message tells the real transit time, the others are delayed by the jitter
+        baseTransit_ = std::min(baseTransit_, transit);
+    }
+    hasPrevArrival_ = true;
+    prevTimestamp_ = timestamp;
+    prevArrivalTime_ = arrivalTime;
+
+    // Grow the delay at once to stop the stuttering
+    Uint32 target = std::clamp(Uint32(jitter_ * kJitterMultiplier), minDelay_, maxDelay_);
+    if (target > currentDelay_) {
+        currentDelay_ = target;
+    }
+}
+
+}
@@ -0,0 +1,57 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "photonbase/protocol/KeepAlive.h"
+#include "photonbase/protocol/PhotonProtocol.h"
+
+namespace pht {
+
+KeepAlive::KeepAlive(PhotonProtocol* protocol, HeartbeatCallback&& heartbeatCallback, ExpiredCallback&& expiredCallback)
+    : protocol_(protocol)
+    , heartbeatCallback_(std::move(heartbeatCallback))
+    , expiredCallback_(std::move(expiredCallback))
+{
+}
+
+void KeepAlive::Start(TimingWheel* wheel)
+{
+    wheel_ = wheel;
+    wheel_->Arm(handshakeTimer_, kHandshakeTimeout);
+    wheel_->Arm(idleTimer_, kIdleTimeout);
+    wheel_->Arm(heartbeatTimer_, kHeartbeatInterval);
+}
+
+void KeepAlive::OnReceived()
+{
+    if (wheel_ == nullptr) {
+        return;
+    }
+    wheel_->Arm(idleTimer_, kIdleTimeout);
+    wheel_->Arm(heartbeatTimer_, kHeartbeatInterval);
+    if (handshakeTimer_.IsArmed() && protocol_->IsEstablished()) {
+        wheel_->Cancel(handshakeTimer_);
+    }
+}
+
+void KeepAlive::Stop()
+{
+    if (wheel_ == nullptr) {
+        return;
+    }
+    wheel_->Cancel(handshakeTimer_);
+    wheel_->Cancel(idleTimer_);
+    wheel_->Cancel(heartbeatTimer_);
+    wheel_ = nullptr;
+}
+
+void KeepAlive::OnHeartbeatTimer()
+{
+    // Probe again until the peer answers or the idle deadline passes
+    wheel_->Arm(heartbeatTimer_, kHeartbeatInterval);
+    if (protocol_->SendHeartbeat()) {
+        heartbeatCallback_();
+    }
+}
+
+}
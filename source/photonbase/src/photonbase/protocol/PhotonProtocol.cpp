@@ -10,7 +10,9 @@
 #include "photonbase/protocol/DataSerializer.h"
 #include "photonbase/protocol/MessageHeader.h"
 #include "photonbase/protocol/RemoteMethodInfo.h"
+#include "photonbase/protocol/ResumptionTokenStore.h"
 #include <set>
+#include <vector>
 
 namespace pht {
 
@@ -35,18 +37,246 @@ PhotonProtocol::PhotonProtocol(Role role)
 
 PhotonProtocol::~PhotonProtocol()
 {
+    // Detach while the connection is still usable, the application may unlink it from the others
+    SetApplication(nullptr);
     delete impl_;
 }
 
 bool PhotonProtocol::OnInBoundData(ss::DynamicBuffer& inputBuffer, ss::DynamicBuffer& outputBuffer)
 {
-    // return impl_->OnInBoundData(inputBuffer, outputBuffer);
-    if (memcmp(inputBuffer.GetData<void>(), "bye", 3) == 0) {
-        return false;
+    return impl_->OnInBoundData(inputBuffer, outputBuffer);
+}
+
+bool PhotonProtocol::Connect(const String& appName, const std::vector<Uint16>& channelIds)
+{
+    return impl_->Connect(appName, channelIds);
+}
+
+bool PhotonProtocol::CreateChannel(Uint16 channelId)
+{
+    return impl_->CreateChannel(channelId);
+}
+
+void PhotonProtocol::SetResumptionTokenStore(ResumptionTokenStore* store)
+{
+    impl_->SetResumptionTokenStore(store);
+}
+
+bool PhotonProtocol::Resume(const PhotonProtocol& previous)
+{
+    return impl_->Resume(*previous.impl_);
+}
+
+PhotonProtocol::PeekResult PhotonProtocol::PeekApplicationName(const Uint8* data, Uint32 size, String& appName, const ResumptionTokenStore* store)
+{
+    // A hello is small, don't wait for more than this
+    static const Uint32 kMaxHelloSize = 4096;
+
+    // The hello may be split into chunks of the Control Channel, reassemble it
+    std::vector<Uint8> message;
+    MessageHeader header {};
+    bool headerRead = false;
+    Uint32 offset = 0;
+    while (true) {
+        ChunkHeader chunkHeader {};
+        DataDeserializer chunkDeserializer(const_cast<Uint8*>(data) + offset, size - offset);
+        if (!chunkDeserializer.Deserialize(chunkHeader)) {
+            if (chunkDeserializer.IsNotEnoughData()) {
+                break;
+            }
+            return PeekResult::kNotHello;
+        }
+        if (chunkHeader.channelId != 0) {
+            return PeekResult::kNotHello;
+        }
+        offset += chunkDeserializer.DataConsumed();
+        if (size - offset < chunkHeader.chunkSize) {
+            break;
+        }
+        message.insert(message.end(), data + offset, data + offset + chunkHeader.chunkSize);
+        offset += chunkHeader.chunkSize;
+
+        if (!headerRead) {
+            DataDeserializer deserializer(message.data(), Uint32(message.size()));
+            if (!deserializer.Deserialize(header)) {
+                if (deserializer.IsNotEnoughData()) {
+                    continue;
+                }
+                return PeekResult::kNotHello;
+            }
+            if (header.messageType != MessageHeader::Type::kControl || header.messageLength > kMaxHelloSize) {
+                return PeekResult::kNotHello;
+            }
+            headerRead = true;
+            message.erase(message.begin(), message.begin() + deserializer.DataConsumed());
+        }
+        if (message.size() < header.messageLength) {
+            continue;
+        }
+        RemoteMethodInfo method;
+        DataDeserializer deserializer(message.data(), header.messageLength);
+        if (!deserializer.Deserialize(method)) {
+            return PeekResult::kNotHello;
+        }
+        // Uint16 photon.control.Resume(ByteArray token)
+        if (store != nullptr && method.MatchPrototype(Variant::Type::Uint16, "photon.control.Resume", { Variant::Type::ByteArray })) {
+            return store->GetApplicationName(method.GetParameters()[0]->Get<ByteArray>(), appName) ? PeekResult::kFound : PeekResult::kNotHello;
+        }
+        if (!method.MatchPrototype(Variant::Type::String, "photon.control.hello", { Variant::Type::String, Variant::Type::String })) {
+            return PeekResult::kNotHello;
+        }
+        appName = method.GetParameters()[1]->Get<String>();
+        return PeekResult::kFound;
     }
-    inputBuffer.ReadData(outputBuffer, inputBuffer.Size());
-    inputBuffer.Reset();
-    return true;
+    if (size > kMaxHelloSize * 2) {
+        return PeekResult::kNotHello; // Too many tiny chunks
+    }
+    return PeekResult::kNotEnoughData;
+}
+
+bool PhotonProtocol::IsEstablished() const
+{
+    return impl_->IsEstablished();
+}
+
+bool PhotonProtocol::HasChannel(Uint16 channelId) const
+{
+    return impl_->HasChannel(channelId);
+}
+
+Uint16 PhotonProtocol::GetProtocolVersion() const
+{
+    return impl_->GetProtocolVersion();
+}
+
+bool PhotonProtocol::OnOutBoundData(ss::DynamicBuffer& inputBuffer, ss::DynamicBuffer& outputBuffer)
+{
+    return impl_->OnOutBoundData(inputBuffer, outputBuffer);
+}
+
+bool PhotonProtocol::EnableCompression(Uint16 channelId, Uint32 threshold)
+{
+    return impl_->EnableCompression(channelId, threshold);
+}
+
+bool PhotonProtocol::SendHeartbeat()
+{
+    return impl_->SendHeartbeat();
+}
+
+bool PhotonProtocol::OnInBoundBytes(const Uint8* data, Uint32 size, ss::DynamicBuffer& outputBuffer)
+{
+    return impl_->OnInBoundBytes(data, size, outputBuffer);
+}
+
+bool PhotonProtocol::OnInBoundBytes(const Uint8* data, Uint32 size, BufferChain& output)
+{
+    return impl_->OnInBoundBytes(data, size, output);
+}
+
+bool PhotonProtocol::OnInBoundChain(BufferChain& input, BufferChain& output)
+{
+    return impl_->OnInBoundChain(input, output);
+}
+
+bool PhotonProtocol::OnOutBoundChain(BufferChain& input, BufferChain& output)
+{
+    return impl_->OnOutBoundChain(input, output);
+}
+
+bool PhotonProtocol::SendMessage(Uint16 channelId, MessageHeader::Type type, Uint32 timestamp, ByteArray&& payload)
+{
+    return impl_->SendMessage(channelId, type, timestamp, std::move(payload));
+}
+
+bool PhotonProtocol::SendMessage(Uint16 channelId, const MessageHeader& header, ByteArray&& payload)
+{
+    return impl_->SendMessage(channelId, header, std::move(payload));
+}
+
+bool PhotonProtocol::InvokeRemoteMethod(Uint16 channelId, const RemoteMethodInfo& method)
+{
+    return impl_->InvokeRemoteMethod(channelId, method);
+}
+
+Uint32 PhotonProtocol::GetTimestamp() const
+{
+    return impl_->GetTimestamp();
+}
+
+bool PhotonProtocol::SetChannelLatencyBudget(Uint16 channelId, Uint32 latencyBudget)
+{
+    return impl_->SetChannelLatencyBudget(channelId, latencyBudget);
+}
+
+bool PhotonProtocol::DisableChannelFlowControl(Uint16 channelId)
+{
+    return impl_->DisableChannelFlowControl(channelId);
+}
+
+bool PhotonProtocol::SetChannelMaxMessageSize(Uint16 channelId, Uint32 maxMessageSize)
+{
+    return impl_->SetChannelMaxMessageSize(channelId, maxMessageSize);
+}
+
+bool PhotonProtocol::GetChannelDropStats(Uint16 channelId, DropStats& stats) const
+{
+    return impl_->GetChannelDropStats(channelId, stats);
+}
+
+bool PhotonProtocol::GetStats(ProtocolStats& stats) const
+{
+    return impl_->GetStats(stats);
+}
+
+void PhotonProtocol::SetPacingRate(Uint32 bitsPerSecond)
+{
+    impl_->SetPacingRate(bitsPerSecond);
+}
+
+bool PhotonProtocol::EnableJitterBuffer(Uint16 channelId, Uint32 minDelay, Uint32 maxDelay)
+{
+    return impl_->EnableJitterBuffer(channelId, minDelay, maxDelay);
+}
+
+Int32 PhotonProtocol::PollMediaMessages()
+{
+    return impl_->PollMediaMessages();
+}
+
+void PhotonProtocol::SetMediaRelay(bool enabled)
+{
+    impl_->SetMediaRelay(enabled);
+}
+
+bool PhotonProtocol::AddMediaSubscriber(Uint16 channelId, PhotonProtocol* subscriber, Uint16 subscriberChannelId)
+{
+    return impl_->AddMediaSubscriber(channelId, subscriber, subscriberChannelId);
+}
+
+void PhotonProtocol::RemoveMediaSubscriber(Uint16 channelId, PhotonProtocol* subscriber)
+{
+    impl_->RemoveMediaSubscriber(channelId, subscriber);
+}
+
+bool PhotonProtocol::SwitchMediaSubscriber(Uint16 channelId, PhotonProtocol* subscriber, Uint16 subscriberChannelId)
+{
+    return impl_->SwitchMediaSubscriber(channelId, subscriber, subscriberChannelId);
+}
+
+bool PhotonProtocol::EnableGopCache(Uint16 channelId, Uint32 maxBytes)
+{
+    return impl_->EnableGopCache(channelId, maxBytes);
+}
+
+bool PhotonProtocol::ForwardMessage(Uint16 channelId, const MessageHeader& header, const BufferSlice& payload)
+{
+    return impl_->ForwardMessage(channelId, header, payload);
+}
+
+void PhotonProtocol::SetOutBoundDataReadyCallback(std::function<void()>&& callback)
+{
+    impl_->SetOutBoundDataReadyCallback(std::move(callback));
 }
 
 }
\ No newline at end of file
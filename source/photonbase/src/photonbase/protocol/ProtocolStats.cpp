@@ -0,0 +1,77 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "photonbase/protocol/ProtocolStats.h"
+#include <algorithm>
+#include <cmath>
+
+namespace pht {
+
+void LatencyHistogram::Add(Uint32 milliseconds)
+{
+    Uint32 bucket = 0;
+    while (bucket + 1 < kBucketCount && milliseconds >= (1u << bucket)) {
+        ++bucket;
+    }
+    ++buckets[bucket];
+    ++count;
+    sum += milliseconds;
+    max = std::max(max, milliseconds);
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram& other)
+{
+    for (Uint32 i = 0; i < kBucketCount; ++i) {
+        buckets[i] += other.buckets[i];
+    }
+    count += other.count;
+    sum += other.sum;
+    max = std::max(max, other.max);
+}
+
+Uint32 LatencyHistogram::GetPercentile(double percentile) const
+{
+    if (count == 0) {
+        return 0;
+    }
+    auto rank = Uint64(std::ceil(double(count) * std::min(percentile, 100.0) / 100));
+    Uint64 seen = 0;
+    for (Uint32 i = 0; i + 1 < kBucketCount; ++i) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            // The largest value of bucket i
+            return std::min(i == 0 ? 0 : (1u << i) - 1, max);
+        }
+    }
+    return max;
+}
+
+void ChannelStats::Merge(const ChannelStats& other)
+{
+    bytesIn += other.bytesIn;
+    chunksIn += other.chunksIn;
+    messagesIn += other.messagesIn;
+    bytesOut += other.bytesOut;
+    chunksOut += other.chunksOut;
+    messagesOut += other.messagesOut;
+    droppedMessages += other.droppedMessages;
+    droppedBytes += other.droppedBytes;
+    queuedMessages += other.queuedMessages;
+    queuedBytes += other.queuedBytes;
+    reassemblyLatency.Merge(other.reassemblyLatency);
+}
+
+double ProtocolStats::GetMessageRate(const ProtocolStats& earlier, MessageHeader::Type type, bool inbound) const
+{
+    auto index = Uint32(type);
+    Uint32 elapsed = timestamp - earlier.timestamp;
+    if (index >= kMessageTypeCount || elapsed == 0) {
+        return 0;
+    }
+    const Uint64* now = inbound ? messagesInByType : messagesOutByType;
+    const Uint64* before = inbound ? earlier.messagesInByType : earlier.messagesOutByType;
+    return double(now[index] - before[index]) * 1000 / elapsed;
+}
+
+}
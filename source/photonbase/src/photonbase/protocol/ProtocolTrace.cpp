@@ -0,0 +1,123 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "photonbase/protocol/ProtocolTrace.h"
+#include "photonbase/protocol/DataDeserializer.h"
+#include "photonbase/protocol/DataSerializer.h"
+#include <algorithm>
+#include <cstring>
+
+namespace pht {
+
+static const char kTraceMagic[] = "PHTRACE";
+static const Uint8 kTraceVersion = 1;
+static const Uint32 kMaxTimeDelta = 536870911; // DUI[4]
+
+ProtocolTraceWriter::~ProtocolTraceWriter()
+{
+    Close();
+}
+
+bool ProtocolTraceWriter::Open(const std::string& path)
+{
+    Close();
+    file_.open(path, std::ios::binary | std::ios::trunc);
+    if (!file_.is_open()) {
+        return false;
+    }
+    file_.write(kTraceMagic, sizeof(kTraceMagic) - 1);
+    file_.put(char(kTraceVersion));
+    hasLastTime_ = false;
+    return file_.good();
+}
+
+bool ProtocolTraceWriter::Write(const void* data, Uint32 length)
+{
+    if (!file_.is_open()) {
+        return false;
+    }
+    auto now = std::chrono::steady_clock::now();
+    Uint64 delta = 0;
+    if (hasLastTime_) {
+        delta = Uint64(std::chrono::duration_cast<std::chrono::microseconds>(now - lastTime_).count());
+    }
+    hasLastTime_ = true;
+    lastTime_ = now;
+
+    Uint8 header[8];
+    Uint32 headerSize = 0;
+    auto write = [&header, &headerSize](Uint8 b) { header[headerSize++] = b; };
+    DataSerializer::SerializeToDUI<4>(Uint32(std::min<Uint64>(delta, kMaxTimeDelta)), write);
+    if (!DataSerializer::SerializeToDUI<4>(length, write)) {
+        return false;
+    }
+    file_.write(reinterpret_cast<const char*>(header), headerSize);
+    file_.write(reinterpret_cast<const char*>(data), length);
+    return file_.good();
+}
+
+void ProtocolTraceWriter::Close()
+{
+    if (file_.is_open()) {
+        file_.close();
+    }
+}
+
+bool ProtocolTraceReader::Open(const std::string& path)
+{
+    file_.open(path, std::ios::binary);
+    if (!file_.is_open()) {
+        return false;
+    }
+    char magic[sizeof(kTraceMagic)] = { 0 };
+    file_.read(magic, sizeof(kTraceMagic) - 1);
+    int version = file_.get();
+    if (!file_.good() || memcmp(magic, kTraceMagic, sizeof(kTraceMagic) - 1) != 0 || version != kTraceVersion) {
+        corrupted_ = true;
+        return false;
+    }
+    time_ = 0;
+    return true;
+}
+
+bool ProtocolTraceReader::ReadDUI(Uint32& value)
+{
+    return DataDeserializer::DeserializeFromDUI<4>(value, [this](const Uint8** ptr, Uint32 len) {
+        int c = file_.get();
+        if (c == std::char_traits<char>::eof()) {
+            *ptr = nullptr;
+            return;
+        }
+        byte_ = Uint8(c);
+        *ptr = &byte_;
+    });
+}
+
+bool ProtocolTraceReader::Next(Record& record)
+{
+    if (!file_.is_open() || corrupted_) {
+        return false;
+    }
+    if (file_.peek() == std::char_traits<char>::eof()) {
+        return false; // The end of the trace
+    }
+    Uint32 delta;
+    Uint32 length;
+    if (!ReadDUI(delta) || !ReadDUI(length)) {
+        corrupted_ = true;
+        return false;
+    }
+    ByteArray data(length);
+    file_.read(reinterpret_cast<char*>(data.Data()), length);
+    if (Uint32(file_.gcount()) != length) {
+        corrupted_ = true;
+        return false;
+    }
+    time_ += delta;
+    record.time = time_;
+    record.data = std::move(data);
+    return true;
+}
+
+}
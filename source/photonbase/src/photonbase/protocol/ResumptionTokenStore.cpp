@@ -0,0 +1,94 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "photonbase/protocol/ResumptionTokenStore.h"
+#include <cstring>
+
+namespace pht {
+
+ResumptionTokenStore::ResumptionTokenStore(Uint32 lifetime, Uint32 capacity)
+    : lifetime_(lifetime)
+    , capacity_(capacity)
+{
+}
+
+ByteArray ResumptionTokenStore::Issue(SessionSnapshot&& snapshot, Clock::time_point now)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    DropExpired(now);
+    while (!entries_.empty() && entries_.size() >= capacity_) {
+        entries_.erase(expiries_.begin()->second);
+        expiries_.erase(expiries_.begin());
+    }
+
+    Key key(kTokenSize);
+    do {
+        for (Uint32 i = 0; i < kTokenSize; i += 4) {
+            auto value = Uint32(random_());
+            for (Uint32 j = 0; j < 4; ++j) {
+                key[i + j] = Uint8(value >> (8 * j));
+            }
+        }
+    } while (entries_.count(key) > 0);
+
+    auto expiry = now + std::chrono::milliseconds(lifetime_);
+    entries_[key] = Entry { std::move(snapshot), expiry };
+    expiries_.emplace(expiry, key);
+
+    ByteArray token(kTokenSize);
+    memcpy(token.Data(), key.data(), kTokenSize);
+    return token;
+}
+
+bool ResumptionTokenStore::Redeem(const ByteArray& token, SessionSnapshot& snapshot, Clock::time_point now)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    DropExpired(now);
+    auto it = entries_.find(Key(token.Data(), token.Data() + token.Size()));
+    if (it == entries_.end()) {
+        return false;
+    }
+    snapshot = std::move(it->second.snapshot);
+    Erase(it);
+    return true;
+}
+
+bool ResumptionTokenStore::GetApplicationName(const ByteArray& token, String& appName, Clock::time_point now) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(Key(token.Data(), token.Data() + token.Size()));
+    if (it == entries_.end() || it->second.expiry <= now) {
+        return false;
+    }
+    appName = it->second.snapshot.appName;
+    return true;
+}
+
+size_t ResumptionTokenStore::Size() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+}
+
+void ResumptionTokenStore::Erase(std::map<Key, Entry>::iterator it)
+{
+    auto range = expiries_.equal_range(it->second.expiry);
+    for (auto e = range.first; e != range.second; ++e) {
+        if (e->second == it->first) {
+            expiries_.erase(e);
+            break;
+        }
+    }
+    entries_.erase(it);
+}
+
+void ResumptionTokenStore::DropExpired(Clock::time_point now)
+{
+    while (!expiries_.empty() && expiries_.begin()->first <= now) {
+        entries_.erase(expiries_.begin()->second);
+        expiries_.erase(expiries_.begin());
+    }
+}
+
+}
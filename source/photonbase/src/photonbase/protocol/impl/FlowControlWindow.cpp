@@ -0,0 +1,51 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "FlowControlWindow.h"
+
+namespace pht {
+
+ReceiveWindow::ReceiveWindow(Uint32 windowSize)
+    : windowSize_(windowSize)
+    , available_(windowSize)
+    , consumed_(0)
+{
+}
+
+bool ReceiveWindow::OnDataReceived(Uint32 bytes)
+{
+    if (bytes > available_) {
+        return false;
+    }
+    available_ -= bytes;
+    return true;
+}
+
+Uint32 ReceiveWindow::Grow(Uint32 windowSize)
+{
+    if (windowSize <= windowSize_) {
+        return 0;
+    }
+    Uint32 increment = windowSize - windowSize_;
+    windowSize_ = windowSize;
+    available_ += increment;
+    return increment;
+}
+
+Uint32 ReceiveWindow::OnDataConsumed(Uint32 bytes)
+{
+    consumed_ += bytes;
+    SSASSERT(consumed_ + available_ <= windowSize_);
+    // Like HTTP/2 implementations, batch the credits until half of the window was consumed,
+    // so that we don't send a WindowUpdate for every single message.
+    if (consumed_ < windowSize_ / 2) {
+        return 0;
+    }
+    Uint32 credit = consumed_;
+    available_ += consumed_;
+    consumed_ = 0;
+    return credit;
+}
+
+}
@@ -0,0 +1,96 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "photonbase/core/Types.h"
+
+namespace pht {
+
+// Control channel (channel 0) is never flow controlled, otherwise a peer could
+// never send the credits that unblock it.
+static const Uint32 kDefaultChannelWindowSize = 1024 * 1024;
+static const Uint32 kDefaultConnectionWindowSize = 4 * 1024 * 1024;
+static const Uint32 kMaxWindowSize = 0x7FFFFFFF;
+
+// The receiver side of a flow control window.
+// The peer may send at most `Available()` bytes before we grant more credits.
+class ReceiveWindow {
+public:
+    explicit ReceiveWindow(Uint32 windowSize = kDefaultChannelWindowSize);
+
+    /**
+     * Account for bytes arrived from the peer.
+     * @param bytes The chunk payload size
+     * @return Return false if the peer exceeded the window (a protocol error)
+     */
+    bool OnDataReceived(Uint32 bytes);
+
+    /**
+     * Account for bytes the window no longer holds, e.g. a message handed over, which makes room in the window.
+     * @param bytes The consumed size
+     * @return The credit that should be announced to the peer, 0 if it's too small to worth a WindowUpdate
+     */
+    Uint32 OnDataConsumed(Uint32 bytes);
+
+    /**
+     * Enlarge the window, never shrinks it
+     * @param windowSize The new window size
+     * @return The credit that should be announced to the peer at once, 0 if the window is already large enough
+     */
+    Uint32 Grow(Uint32 windowSize);
+
+    Uint32 Available() const
+    {
+        return available_;
+    }
+
+    Uint32 GetWindowSize() const
+    {
+        return windowSize_;
+    }
+
+private:
+    Uint32 windowSize_;
+    Uint32 available_; // granted to the peer but not used yet
+    Uint32 consumed_; // consumed but not announced yet
+};
+
+// The sender side of a flow control window.
+class SendWindow {
+public:
+    explicit SendWindow(Uint32 windowSize = kDefaultChannelWindowSize)
+        : available_(windowSize)
+    {
+    }
+
+    Uint32 Available() const
+    {
+        return available_;
+    }
+
+    void Consume(Uint32 bytes)
+    {
+        SSASSERT(bytes <= available_);
+        available_ -= bytes;
+    }
+
+    /**
+     * @param increment The credit granted by the peer
+     * @return Return false if the window overflows (a protocol error)
+     */
+    bool Grant(Uint32 increment)
+    {
+        if (increment > kMaxWindowSize - available_) {
+            return false;
+        }
+        available_ += increment;
+        return true;
+    }
+
+private:
+    Uint32 available_;
+};
+
+}
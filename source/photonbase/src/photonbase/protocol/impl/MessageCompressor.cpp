@@ -0,0 +1,120 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "MessageCompressor.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace pht {
+
+static const int kWindowBits = -15; // Raw deflate, no zlib header
+static const int kMemoryLevel = 8;
+static const Uint8 kFlushTail[] = { 0x00, 0x00, 0xFF, 0xFF };
+static const Uint32 kStepSize = 4096;
+
+static void MoveToByteArray(const std::vector<Uint8>& bytes, Uint32 size, ByteArray& output)
+{
+    output = ByteArray(size);
+    memcpy(output.Data(), bytes.data(), size);
+}
+
+MessageDeflater::MessageDeflater()
+{
+    initialized_ = deflateInit2(&stream_, Z_DEFAULT_COMPRESSION, Z_DEFLATED, kWindowBits, kMemoryLevel, Z_DEFAULT_STRATEGY) == Z_OK;
+    valid_ = initialized_;
+}
+
+MessageDeflater::~MessageDeflater()
+{
+    // A failed Compress only invalidates the stream, its state is still allocated
+    if (initialized_) {
+        deflateEnd(&stream_);
+    }
+}
+
+bool MessageDeflater::Compress(const Uint8* data, Uint32 size, ByteArray& output)
+{
+    if (!valid_) {
+        return false;
+    }
+    std::vector<Uint8> bytes(deflateBound(&stream_, size) + sizeof(kFlushTail));
+    stream_.next_in = const_cast<Uint8*>(data);
+    stream_.avail_in = size;
+    Uint32 produced = 0;
+    do {
+        if (produced == bytes.size()) {
+            bytes.resize(bytes.size() + kStepSize);
+        }
+        stream_.next_out = bytes.data() + produced;
+        stream_.avail_out = uInt(bytes.size() - produced);
+        if (deflate(&stream_, Z_SYNC_FLUSH) != Z_OK) {
+            valid_ = false;
+            return false;
+        }
+        produced = Uint32(bytes.size() - stream_.avail_out);
+    } while (stream_.avail_out == 0);
+
+    // The peer appends the tail before inflating
+    if (produced < sizeof(kFlushTail) || memcmp(bytes.data() + produced - sizeof(kFlushTail), kFlushTail, sizeof(kFlushTail)) != 0) {
+        valid_ = false;
+        return false;
+    }
+    MoveToByteArray(bytes, produced - Uint32(sizeof(kFlushTail)), output);
+    return true;
+}
+
+MessageInflater::MessageInflater()
+{
+    initialized_ = inflateInit2(&stream_, kWindowBits) == Z_OK;
+    valid_ = initialized_;
+}
+
+MessageInflater::~MessageInflater()
+{
+    // A failed Decompress only invalidates the stream, its state is still allocated
+    if (initialized_) {
+        inflateEnd(&stream_);
+    }
+}
+
+bool MessageInflater::Decompress(const Uint8* data, Uint32 size, Uint32 maxSize, ByteArray& output)
+{
+    if (!valid_) {
+        return false;
+    }
+    std::vector<Uint8> bytes;
+    Uint32 produced = 0;
+    auto inflateAll = [&](const Uint8* input, Uint32 inputSize) {
+        stream_.next_in = const_cast<Uint8*>(input);
+        stream_.avail_in = inputSize;
+        while (true) {
+            if (produced == bytes.size()) {
+                if (bytes.size() > maxSize) {
+                    return false; // Too large, maybe a decompression bomb
+                }
+                bytes.resize(std::min<size_t>(bytes.size() + std::max(inputSize * 2, kStepSize), size_t(maxSize) + 1));
+            }
+            stream_.next_out = bytes.data() + produced;
+            stream_.avail_out = uInt(bytes.size() - produced);
+            int ret = inflate(&stream_, Z_SYNC_FLUSH);
+            produced = Uint32(bytes.size() - stream_.avail_out);
+            if (ret != Z_OK && ret != Z_BUF_ERROR) {
+                return false; // Corrupted, or the final block which our peer never sends
+            }
+            if (stream_.avail_out > 0) {
+                // Inflate stops only when the input is used up or the output is full
+                return stream_.avail_in == 0;
+            }
+        }
+    };
+    if (!inflateAll(data, size) || !inflateAll(kFlushTail, sizeof(kFlushTail)) || produced > maxSize) {
+        valid_ = false;
+        return false;
+    }
+    MoveToByteArray(bytes, produced, output);
+    return true;
+}
+
+}
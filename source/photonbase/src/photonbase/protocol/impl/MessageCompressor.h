@@ -0,0 +1,69 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "photonbase/core/Types.h"
+#include <zlib.h>
+
+namespace pht {
+
+// Compression methods of photon.control.EnableCompression
+enum class CompressionMethod : Uint8 {
+    kNone = 0,
+    kDeflate = 1,
+};
+
+// Raw deflate of the messages of a channel in one direction. The dictionary is kept across the messages, and every
+// message is sync-flushed so it can be inflated as soon as it arrives. The 00 00 FF FF tail of the flush is not sent.
+class MessageDeflater {
+public:
+    MessageDeflater();
+    ~MessageDeflater();
+    MessageDeflater(const MessageDeflater&) = delete;
+    MessageDeflater& operator=(const MessageDeflater&) = delete;
+
+    bool IsValid() const
+    {
+        return valid_;
+    }
+
+    /**
+     * @param output Receives the compressed message
+     * @return Return false if zlib fails, the stream can't be used any more then
+     */
+    bool Compress(const Uint8* data, Uint32 size, ByteArray& output);
+
+private:
+    z_stream stream_ {};
+    bool initialized_ { false };
+    bool valid_ { false };
+};
+
+class MessageInflater {
+public:
+    MessageInflater();
+    ~MessageInflater();
+    MessageInflater(const MessageInflater&) = delete;
+    MessageInflater& operator=(const MessageInflater&) = delete;
+
+    bool IsValid() const
+    {
+        return valid_;
+    }
+
+    /**
+     * @param maxSize The limit of the decompressed size
+     * @param output Receives the decompressed message
+     * @return Return false if the data is corrupted or decompresses to more than maxSize bytes
+     */
+    bool Decompress(const Uint8* data, Uint32 size, Uint32 maxSize, ByteArray& output);
+
+private:
+    z_stream stream_ {};
+    bool initialized_ { false };
+    bool valid_ { false };
+};
+
+}
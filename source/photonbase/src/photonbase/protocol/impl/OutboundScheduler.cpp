@@ -0,0 +1,349 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "OutboundScheduler.h"
+#include "photonbase/protocol/ChunkHeader.h"
+#include "photonbase/protocol/DataSerializer.h"
+#include <algorithm>
+
+namespace pht {
+
+static const Uint32 kMaxChunkSize = 4194303; // DUI[3]
+static const Uint32 kMaxChunkId = 536870911; // DUI[4]
+static const Uint32 kMaxMessageId = 32767; // DUI[2]
+static const Uint32 kMaxPacingBurst = 20; // ms
+static const Uint32 kMinPayloadSlice = 64; // Smaller pieces of payloads are copied into a chain
+
+static void WriteBytes(ss::DynamicBuffer& output, const Uint8* data, Uint32 size)
+{
+    output.PushData(data, size);
+}
+
+static void WriteBytes(BufferChain& output, const Uint8* data, Uint32 size)
+{
+    output.AppendBytes(data, size);
+}
+
+static void WritePayload(ss::DynamicBuffer& output, const BufferSlice& payload, Uint32 offset, Uint32 size)
+{
+    output.PushData(payload.Data() + offset, size);
+}
+
+static void WritePayload(BufferChain& output, const BufferSlice& payload, Uint32 offset, Uint32 size)
+{
+    if (size < kMinPayloadSlice) {
+        output.AppendBytes(payload.Data() + offset, size);
+    } else {
+        output.Append(payload.Slice(offset, size));
+    }
+}
+
+OutboundScheduler::OutboundScheduler()
+    : connectionWindow_(kDefaultConnectionWindowSize)
+{
+    AddChannel(0); // Control channel
+}
+
+bool OutboundScheduler::AddChannel(Uint16 channelId, Uint32 windowSize)
+{
+    auto& channel = channels_[channelId];
+    channel.sendWindow = SendWindow(windowSize);
+    return true;
+}
+
+void OutboundScheduler::RemoveChannel(Uint16 channelId)
+{
+    if (channelId == 0) {
+        return; // Control channel is never removed
+    }
+    channels_.erase(channelId);
+}
+
+bool OutboundScheduler::Enqueue(Uint16 channelId, MessageHeader header, ByteArray&& payload)
+{
+    Uint32 timestamp = header.timestamp;
+    return Enqueue(channelId, header, BufferSlice(std::move(payload)), timestamp);
+}
+
+bool OutboundScheduler::Enqueue(Uint16 channelId, MessageHeader header, const BufferSlice& payload, Uint32 deadlineBase)
+{
+    auto it = channels_.find(channelId);
+    if (it == channels_.end()) {
+        return false; // No such channel
+    }
+    if (payload.Size() == 0) {
+        return false; // The receiver treats a zero message length as "no message"
+    }
+    auto& channel = it->second;
+
+    header.messageId = channel.nextMessageId;
+    header.messageLength = payload.Size();
+    channel.nextMessageId = channel.nextMessageId == kMaxMessageId ? 0 : channel.nextMessageId + 1;
+
+    PendingMessage message;
+    if (channel.latencyBudget > 0
+        && (header.messageType == MessageHeader::Type::kVideo || header.messageType == MessageHeader::Type::kAudio)) {
+        message.hasDeadline = true;
+        message.deadline = deadlineBase + channel.latencyBudget;
+    }
+    if (!DataSerializer::Serialize(header, [&message](Uint8 b) { message.header.push_back(b); })) {
+        return false;
+    }
+    message.payload = payload;
+    message.type = header.messageType;
+    channel.queuedBytes += message.Size();
+    channel.messages.push_back(std::move(message));
+    return true;
+}
+
+bool OutboundScheduler::GetNextMessageId(Uint16 channelId, Uint32& messageId) const
+{
+    auto it = channels_.find(channelId);
+    if (it == channels_.end()) {
+        return false;
+    }
+    messageId = it->second.nextMessageId;
+    return true;
+}
+
+bool OutboundScheduler::OnWindowUpdate(Uint16 channelId, Uint32 increment)
+{
+    if (channelId == 0) {
+        return connectionWindow_.Grant(increment);
+    }
+    auto it = channels_.find(channelId);
+    if (it == channels_.end()) {
+        return true; // The channel may have been destroyed while the update was in flight
+    }
+    return it->second.sendWindow.Grant(increment);
+}
+
+bool OutboundScheduler::DisableFlowControl(Uint16 channelId)
+{
+    auto it = channels_.find(channelId);
+    if (it == channels_.end() || channelId == 0) {
+        return false;
+    }
+    it->second.flowControlled = false;
+    return true;
+}
+
+bool OutboundScheduler::SetChunkSize(Uint16 channelId, Uint32 chunkSize)
+{
+    auto it = channels_.find(channelId);
+    if (it == channels_.end() || chunkSize > kMaxChunkSize) {
+        return false;
+    }
+    // 0 means the remote endpoint doesn't care
+    it->second.chunkSize = chunkSize == 0 ? kDefaultChunkSize : chunkSize;
+    return true;
+}
+
+bool OutboundScheduler::SetLatencyBudget(Uint16 channelId, Uint32 latencyBudget)
+{
+    auto it = channels_.find(channelId);
+    if (it == channels_.end() || channelId == 0) {
+        return false; // Control messages never expire
+    }
+    it->second.latencyBudget = latencyBudget;
+    return true;
+}
+
+bool OutboundScheduler::GetLatencyBudget(Uint16 channelId, Uint32& latencyBudget) const
+{
+    auto it = channels_.find(channelId);
+    if (it == channels_.end()) {
+        return false;
+    }
+    latencyBudget = it->second.latencyBudget;
+    return true;
+}
+
+bool OutboundScheduler::GetDropStats(Uint16 channelId, DropStats& stats) const
+{
+    auto it = channels_.find(channelId);
+    if (it == channels_.end()) {
+        return false;
+    }
+    stats = it->second.dropStats;
+    return true;
+}
+
+void OutboundScheduler::GetStats(ProtocolStats& stats) const
+{
+    for (auto& [id, channel] : channels_) {
+        auto& channelStats = stats.channels[id];
+        channelStats.bytesOut = channel.sentBytes;
+        channelStats.chunksOut = channel.sentChunks;
+        channelStats.messagesOut = channel.sentMessages;
+        channelStats.droppedMessages = channel.dropStats.droppedMessages;
+        channelStats.droppedBytes = channel.dropStats.droppedBytes;
+        channelStats.queuedMessages = Uint32(channel.messages.size());
+        channelStats.queuedBytes = channel.queuedBytes;
+    }
+    for (Uint32 i = 0; i < kMessageTypeCount; ++i) {
+        stats.messagesOutByType[i] = sentMessagesByType_[i];
+    }
+}
+
+bool OutboundScheduler::HasPendingData() const
+{
+    for (auto& [id, channel] : channels_) {
+        if (!channel.messages.empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void OutboundScheduler::WriteChunks(ss::DynamicBuffer& outputBuffer, Uint32 now)
+{
+    WriteChunksTo(outputBuffer, now);
+}
+
+void OutboundScheduler::WriteChunks(BufferChain& output, Uint32 now)
+{
+    WriteChunksTo(output, now);
+}
+
+template <class Output>
+void OutboundScheduler::WriteChunksTo(Output& output, Uint32 now)
+{
+    auto& controlChannel = channels_[0];
+    while (WriteChunk(0, controlChannel, output)) {
+    }
+
+    for (auto& [id, channel] : channels_) {
+        if (channel.latencyBudget > 0) {
+            DropExpiredMessages(channel, now);
+        }
+    }
+
+    RefillPacingBudget(now);
+
+    // One chunk per channel per round, so that a large message won't block the other channels. A round resumes after
+    // the channel served last, otherwise a paced connection would spend its budget on the lowest channels only
+    bool progress = true;
+    while (progress) {
+        progress = false;
+        auto it = channels_.lower_bound(nextChannel_);
+        for (size_t i = 0; i < channels_.size(); ++i, ++it) {
+            if (it == channels_.end()) {
+                it = channels_.begin();
+            }
+            if (pacingRate_ > 0 && pacingBudget_ <= 0) {
+                return;
+            }
+            auto& [id, channel] = *it;
+            auto sizeBefore = output.Size();
+            if (id != 0 && WriteChunk(id, channel, output)) {
+                pacingBudget_ -= Int64(output.Size() - sizeBefore);
+                nextChannel_ = Uint16(id + 1);
+                progress = true;
+            }
+        }
+    }
+}
+
+void OutboundScheduler::SetPacingRate(Uint32 bytesPerSecond)
+{
+    pacingRate_ = bytesPerSecond;
+}
+
+void OutboundScheduler::RefillPacingBudget(Uint32 now)
+{
+    if (pacingRate_ == 0) {
+        hasPacingTime_ = false;
+        pacingBudget_ = 0;
+        return;
+    }
+    if (!hasPacingTime_) {
+        hasPacingTime_ = true;
+        lastPacingTime_ = now;
+        pacingBudget_ = kDefaultChunkSize;
+        return;
+    }
+    // Timestamps may wrap around
+    Uint32 elapsed = Int32(now - lastPacingTime_) > 0 ? now - lastPacingTime_ : 0;
+    lastPacingTime_ += elapsed;
+    // Only a short burst is allowed after idling, but always at least one chunk
+    Int64 maxBudget = std::max<Int64>(Int64(pacingRate_) * kMaxPacingBurst / 1000, kDefaultChunkSize);
+    pacingBudget_ = std::min(pacingBudget_ + Int64(pacingRate_) * elapsed / 1000, maxBudget);
+}
+
+void OutboundScheduler::DropExpiredMessages(OutboundChannel& channel, Uint32 now)
+{
+    auto& messages = channel.messages;
+    auto it = messages.begin();
+    // A partially sent message must be completed, or the receiver can't parse the rest of the channel
+    if (it != messages.end() && it->offset > 0) {
+        ++it;
+    }
+    while (it != messages.end()) {
+        // Timestamps may wrap around
+        if (it->hasDeadline && Int32(now - it->deadline) > 0) {
+            ++channel.dropStats.droppedMessages;
+            channel.dropStats.droppedBytes += it->Size();
+            channel.queuedBytes -= it->Size();
+            it = messages.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+template <class Output>
+bool OutboundScheduler::WriteChunk(Uint16 channelId, OutboundChannel& channel, Output& output)
+{
+    if (channel.messages.empty()) {
+        return false;
+    }
+    auto& message = channel.messages.front();
+    Uint32 size = std::min(channel.chunkSize, message.Size() - message.offset);
+    if (channelId != 0 && channel.flowControlled) {
+        size = std::min({ size, channel.sendWindow.Available(), connectionWindow_.Available() });
+        if (size == 0) {
+            return false; // Blocked by flow control
+        }
+    }
+
+    ChunkHeader chunkHeader { channelId, channel.nextChunkId, size };
+    channel.nextChunkId = channel.nextChunkId == kMaxChunkId ? 0 : channel.nextChunkId + 1;
+    Uint8 headerBytes[16];
+    Uint32 headerSize = 0;
+    DataSerializer::Serialize(chunkHeader, [&headerBytes, &headerSize](Uint8 b) { headerBytes[headerSize++] = b; });
+    WriteBytes(output, headerBytes, headerSize);
+
+    // The chunk may cover the tail of the message header and the head of the payload
+    Uint32 left = size;
+    Uint32 headerLength = Uint32(message.header.size());
+    if (message.offset < headerLength) {
+        Uint32 n = std::min(left, headerLength - message.offset);
+        WriteBytes(output, message.header.data() + message.offset, n);
+        message.offset += n;
+        left -= n;
+    }
+    if (left > 0) {
+        WritePayload(output, message.payload, message.offset - headerLength, left);
+        message.offset += left;
+    }
+
+    if (channelId != 0 && channel.flowControlled) {
+        channel.sendWindow.Consume(size);
+        connectionWindow_.Consume(size);
+    }
+    channel.queuedBytes -= size;
+    channel.sentBytes += size;
+    ++channel.sentChunks;
+    if (message.offset == message.Size()) {
+        ++channel.sentMessages;
+        if (Uint32(message.type) < kMessageTypeCount) {
+            ++sentMessagesByType_[Uint32(message.type)];
+        }
+        channel.messages.pop_front();
+    }
+    return true;
+}
+
+}
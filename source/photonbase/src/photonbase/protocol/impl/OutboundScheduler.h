@@ -0,0 +1,165 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "FlowControlWindow.h"
+#include "photonbase/core/BufferChain.h"
+#include "photonbase/core/BufferSlice.h"
+#include "photonbase/core/Types.h"
+#include "photonbase/protocol/MessageHeader.h"
+#include "photonbase/protocol/ProtocolStats.h"
+#include <SSBase/Buffer.h>
+#include <deque>
+#include <map>
+#include <vector>
+
+namespace pht {
+
+static const Uint32 kDefaultChunkSize = 4096;
+
+// Splits the queued messages of each channel into chunks, and interleaves the chunks of different channels.
+// Messages of the Control Channel are always sent first, messages of the other channels are sent in a
+// round-robin fashion as long as both the channel's and the connection's send window allow.
+// Media messages expire `latency budget` milliseconds after their timestamp, expired messages are dropped
+// unless they've been partially sent.
+// When a pacing rate is set, the chunks of the channels other than the Control Channel are also limited by a
+// token bucket, so that a congestion controller can make the connection follow its target bitrate.
+class OutboundScheduler {
+public:
+    struct DropStats {
+        Uint64 droppedMessages { 0 };
+        Uint64 droppedBytes { 0 };
+    };
+
+    OutboundScheduler();
+
+    bool AddChannel(Uint16 channelId, Uint32 windowSize = kDefaultChannelWindowSize);
+
+    void RemoveChannel(Uint16 channelId);
+
+    /**
+     * Queue a message. The message id and the message length will be filled.
+     * @param channelId The channel to send this message
+     * @param header The message header
+     * @param payload The message payload, should not be empty
+     * @return Return false if the channel does not exist or the message is invalid
+     */
+    bool Enqueue(Uint16 channelId, MessageHeader header, ByteArray&& payload);
+
+    /**
+     * Queue a message whose payload is shared with other queues, e.g. a relayed media message.
+     * @param channelId The channel to send this message
+     * @param header The message header, the message id and the message length will be filled.
+     * @param payload The message payload, should not be empty
+     * @param deadlineBase The local timestamp the latency budget is counted from
+     * @return Return false if the channel does not exist or the message is invalid
+     */
+    bool Enqueue(Uint16 channelId, MessageHeader header, const BufferSlice& payload, Uint32 deadlineBase);
+
+    /**
+     * @param channelId The channel id
+     * @param messageId The id the next message queued to the channel will get, e.g. to match its result
+     * @return Return false if the channel does not exist
+     */
+    bool GetNextMessageId(Uint16 channelId, Uint32& messageId) const;
+
+    /**
+     * Apply the credit granted by a WindowUpdate
+     * @param channelId The channel id, 0 means the connection level window
+     * @param increment The credit
+     * @return Return false on protocol error
+     */
+    bool OnWindowUpdate(Uint16 channelId, Uint32 increment);
+
+    /**
+     * Send the chunks of a channel regardless of the send windows, and without consuming them
+     * @return Return false if the channel does not exist or is the Control Channel
+     */
+    bool DisableFlowControl(Uint16 channelId);
+
+    bool SetChunkSize(Uint16 channelId, Uint32 chunkSize);
+
+    /**
+     * @param channelId The channel id
+     * @param latencyBudget In milliseconds. Video and audio messages older than this are dropped, 0 means never
+     * @return Return false if the channel does not exist
+     */
+    bool SetLatencyBudget(Uint16 channelId, Uint32 latencyBudget);
+
+    bool GetLatencyBudget(Uint16 channelId, Uint32& latencyBudget) const;
+
+    bool GetDropStats(Uint16 channelId, DropStats& stats) const;
+
+    // Fill the outbound counters and the send queues of the channels
+    void GetStats(ProtocolStats& stats) const;
+
+    /**
+     * @param bytesPerSecond The pacing rate of all the channels except the Control Channel, 0 means unlimited
+     */
+    void SetPacingRate(Uint32 bytesPerSecond);
+
+    bool HasPendingData() const;
+
+    /**
+     * Write as many chunks as the send windows allow
+     * @param outputBuffer The buffer to write chunks
+     * @param now Current timestamp of the connection, in milliseconds
+     */
+    void WriteChunks(ss::DynamicBuffer& outputBuffer, Uint32 now);
+
+    // Like above, the chunks refer to the payloads of the messages instead of copying them
+    void WriteChunks(BufferChain& output, Uint32 now);
+
+private:
+    struct PendingMessage {
+        std::vector<Uint8> header;
+        BufferSlice payload;
+        MessageHeader::Type type { MessageHeader::Type::kControl };
+        Uint32 offset { 0 }; // bytes of header + payload have been sent
+        bool hasDeadline { false };
+        Uint32 deadline { 0 };
+
+        Uint32 Size() const
+        {
+            return Uint32(header.size()) + payload.Size();
+        }
+    };
+
+    struct OutboundChannel {
+        Uint32 chunkSize { kDefaultChunkSize };
+        Uint32 nextChunkId { 0 };
+        Uint32 nextMessageId { 0 };
+        Uint32 latencyBudget { 0 };
+        SendWindow sendWindow {};
+        bool flowControlled { true };
+        DropStats dropStats {};
+        std::deque<PendingMessage> messages {};
+        Uint64 queuedBytes { 0 }; // Not sent yet
+        Uint64 sentBytes { 0 };
+        Uint64 sentChunks { 0 };
+        Uint64 sentMessages { 0 };
+    };
+
+    void DropExpiredMessages(OutboundChannel& channel, Uint32 now);
+
+    void RefillPacingBudget(Uint32 now);
+
+    template <class Output>
+    void WriteChunksTo(Output& output, Uint32 now);
+
+    template <class Output>
+    bool WriteChunk(Uint16 channelId, OutboundChannel& channel, Output& output);
+
+    std::map<Uint16, OutboundChannel> channels_;
+    SendWindow connectionWindow_;
+    Uint16 nextChannel_ { 0 }; // Where the next round-robin round starts
+    Uint32 pacingRate_ { 0 };
+    Int64 pacingBudget_ { 0 };
+    Uint32 lastPacingTime_ { 0 };
+    bool hasPacingTime_ { false };
+    Uint64 sentMessagesByType_[kMessageTypeCount] {};
+};
+
+}
@@ -3,34 +3,43 @@
 //
 
 #include "PhotonProtocolImpl.h"
+#include "photonbase/application/ApplicationManager.h"
 #include "photonbase/application/IApplication.h"
 #include "photonbase/protocol/DataDeserializer.h"
+#include "photonbase/protocol/DataSerializer.h"
 #include "photonbase/protocol/RemoteMethodBinding.h"
 #include "photonbase/protocol/RemoteMethodInfo.h"
+#include "photonbase/protocol/ResumptionTokenStore.h"
+#include <algorithm>
 #include <map>
 
 namespace pht {
 
+static const Uint16 kMaxChannelId = 32767; // DUI[2]
+static const Uint32 kMaxInflatedMessageSize = 16 * 1024 * 1024;
+static const Uint8 kChannelNotFlowControlled = 0x01; // Flag of photon.control.CreateChannel
+
 PhotonProtocol::Impl::Impl(PhotonProtocol* self, Role role)
+    : baseTime_(std::chrono::steady_clock::now())
 {
     self_ = self;
-    // TODO: construct a proper handler
-    if (role == Role::kServer) {
-        currentState_ = ProtocolState::kWaitingForHello;
-        protocolHandler_ = nullptr;
-    } else {
-        currentState_ = ProtocolState::kInitial;
-        protocolHandler_ = nullptr;
-    }
+    role_ = role;
+    SetState(role == Role::kServer ? ProtocolState::kWaitingForHello : ProtocolState::kInitial);
     channels_[0]; // Create channel 0 by default
 }
 
-bool PhotonProtocol::Impl::ReadChunks(std::set<ChannelContext*>& updatedChannels, ss::DynamicBuffer& inputBuffer, ss::DynamicBuffer& outputBuffer)
+class PhotonProtocol::Impl::IProtocolStateDelegate {
+public:
+    virtual bool ReadMessages(Impl* self, ChannelContext& channel) = 0;
+};
+
+template <class Input>
+bool PhotonProtocol::Impl::ReadChunks(std::set<ChannelContext*>& updatedChannels, Input& inputBuffer)
 {
     // unpack as more chunks as possible
     while (!inputBuffer.Empty()) {
         if (ReadingState::kExpectingChunkHeader == readingState_) {
-            DataDeserializer deserializer(inputBuffer.GetData<uint8_t>(), inputBuffer.Size());
+            DataDeserializer deserializer(const_cast<Uint8*>(inputBuffer.template GetData<Uint8>()), inputBuffer.Size());
             if (!deserializer.Deserialize(currentChunkHeader_)) {
                 if (deserializer.IsNotEnoughData()) {
                     break;
@@ -43,9 +52,17 @@ bool PhotonProtocol::Impl::ReadChunks(std::set<ChannelContext*>& updatedChannels
                 return false; // No such channel
             }
 
+            if (currentChunkHeader_.channelId != 0 && it->second.flowControlled_) {
+                // The peer must not send more than we granted
+                if (!it->second.receiveWindow_.OnDataReceived(currentChunkHeader_.chunkSize)
+                    || !connectionReceiveWindow_.OnDataReceived(currentChunkHeader_.chunkSize)) {
+                    return false;
+                }
+            }
+
             readingState_ = ReadingState::kExpectingChunkData;
             inputBuffer.Skip(deserializer.DataConsumed());
-        } else if (ReadingState::kExpectingChunkHeader == readingState_) {
+        } else if (ReadingState::kExpectingChunkData == readingState_) {
             if (inputBuffer.Size() < currentChunkHeader_.chunkSize) {
                 // Not enough data
                 break;
@@ -55,15 +72,115 @@ bool PhotonProtocol::Impl::ReadChunks(std::set<ChannelContext*>& updatedChannels
                 return false; // No such channel
             }
 
-            updatedChannels.insert(&it->second);
-            it->second.messageBuffer_.PushData(inputBuffer.GetData<Uint8>(), currentChunkHeader_.chunkSize);
+            auto& channel = it->second;
+            const Uint8* data = inputBuffer.template GetData<Uint8>();
+            Uint32 size = currentChunkHeader_.chunkSize;
+            bool receiving = !channel.messageBuffer_.Empty() || channel.currentMessageHeader_.messageLength > 0
+                || channel.relayReceived_ < channel.relayPayload_.Size();
+            if (!receiving) {
+                channel.messageStartTime_ = inboundTime_; // The first chunk of a message
+            }
+            channel.stats_.bytesIn += size;
+            ++channel.stats_.chunksIn;
+            if (channel.relayReceived_ < channel.relayPayload_.Size()) {
+                // A relayed payload is being received, fill it directly
+                Uint32 n = std::min(size, channel.relayPayload_.Size() - channel.relayReceived_);
+                memcpy(channel.relayPayload_.MutableData() + channel.relayReceived_, data, n);
+                channel.relayReceived_ += n;
+                data += n;
+                size -= n;
+            }
+            channel.messageBuffer_.PushData(data, size);
+            // The connection window is released as soon as the chunk is buffered, so that a channel waiting for the
+            // rest of a message never blocks the others. The channel window is released when the message is handed
+            // over, which bounds what a channel buffers for a slow consumer.
+            if (!ReleaseConnectionData(channel, currentChunkHeader_.chunkSize)) {
+                return false;
+            }
             inputBuffer.Skip(currentChunkHeader_.chunkSize);
+            readingState_ = ReadingState::kExpectingChunkHeader;
+
+            if (currentChunkHeader_.channelId == 0) {
+                // Control messages are handled at once, the following chunks may belong to a channel they create
+                if (!protocolHandler_->ReadMessages(this, channel)) {
+                    return false;
+                }
+            } else {
+                updatedChannels.insert(&channel);
+            }
+        }
+    }
+    return true;
+}
+
+bool PhotonProtocol::Impl::OnRemoteControlMessage(const MessageHeader& header, RemoteMethodInfo& rmi)
+{
+    // void photon.control.CreateChannel(Uint16 channelId)
+    // void photon.control.CreateChannel(Uint16 channelId, Uint8 flags)
+    bool hasFlags = rmi.MatchPrototype(Variant::Type::Void, "photon.control.CreateChannel", { Variant::Type::Uint16, Variant::Type::Uint8 });
+    if (hasFlags || rmi.MatchPrototype(Variant::Type::Void, "photon.control.CreateChannel", { Variant::Type::Uint16 })) {
+        Uint16 channelId = rmi.GetParameters()[0]->Get<Uint16>();
+        bool flowControlled = !hasFlags || (rmi.GetParameters()[1]->Get<Uint8>() & kChannelNotFlowControlled) == 0;
+        if (flowControlled && flowControlExemptChannels_.count(channelId) > 0) {
+            return false; // We exempted it, the windows would leak or split its messages
+        }
+        if (!AddChannel(channelId, flowControlled)) {
+            return false; // Invalid or in use
+        }
+        tokenOutdated_ = true;
+        return SendResult(0, header.messageId, InvokeResult::kSucceeded, nullptr);
+    }
+    // void photon.control.EnableCompression(Uint16 channelId, Uint8 method)
+    if (rmi.MatchPrototype(Variant::Type::Void, "photon.control.EnableCompression", { Variant::Type::Uint16, Variant::Type::Uint8 })) {
+        auto it = channels_.find(rmi.GetParameters()[0]->Get<Uint16>());
+        if (it == channels_.end()) {
+            return false;
+        }
+        auto method = CompressionMethod(rmi.GetParameters()[1]->Get<Uint8>());
+        if (method != CompressionMethod::kDeflate || it->second.inflater_ != nullptr) {
+            // The peer sends the messages uncompressed then
+            return SendResult(0, header.messageId, InvokeResult::kException, nullptr);
+        }
+        it->second.inflater_ = std::make_unique<MessageInflater>();
+        bool ok = it->second.inflater_->IsValid();
+        return SendResult(0, header.messageId, ok ? InvokeResult::kSucceeded : InvokeResult::kException, nullptr);
+    }
+    // void photon.control.Heartbeat(), any data keeps the connection alive. The server probes a silent client with
+    // it, the client answers so that it stays connected even if it only receives. The server never answers.
+    if (rmi.MatchPrototype(Variant::Type::Void, "photon.control.Heartbeat", {})) {
+        return role_ != Role::kClient || SendHeartbeat();
+    }
+    // void photon.control.ResumptionToken(ByteArray token)
+    if (rmi.MatchPrototype(Variant::Type::Void, "photon.control.ResumptionToken", { Variant::Type::ByteArray })) {
+        if (role_ != Role::kClient) {
+            return false;
+        }
+        // The token covers the channels whose creation the server has answered, the results came before it
+        resumptionToken_ = rmi.GetParameters()[0]->Get<ByteArray>();
+        tokenChannels_.clear();
+        for (auto& [id, channel] : channels_) {
+            tokenChannels_.insert(Uint16(id));
         }
+        for (auto& [requestId, channelId] : pendingChannels_) {
+            tokenChannels_.erase(channelId);
+        }
+        tokenChannels_.erase(0);
+        return true;
+    }
+    // void photon.control.WindowUpdate(Uint16 channelId, Uint32 increment)
+    if (rmi.MatchPrototype(Variant::Type::Void, "photon.control.WindowUpdate", { Variant::Type::Uint16, Variant::Type::Uint32 })) {
+        auto channelId = rmi.GetParameters()[0]->Get<Uint16>();
+        auto increment = rmi.GetParameters()[1]->Get<Uint32>();
+        if (increment == 0 || !scheduler_.OnWindowUpdate(channelId, increment)) {
+            return false;
+        }
+        // Some blocked chunks may be sendable now, they are written after the input is read
+        return true;
     }
     return true;
 }
 
-bool PhotonProtocol::Impl::OnRemoteMethodInvoke(RemoteMethodInfo& rmi, ss::DynamicBuffer& inputBuffer, ss::DynamicBuffer& outputBuffer)
+bool PhotonProtocol::Impl::OnRemoteMethodInvoke(RemoteMethodInfo& rmi)
 {
     auto* app = self_->GetApplication();
     if (!app) {
@@ -72,11 +189,6 @@ bool PhotonProtocol::Impl::OnRemoteMethodInvoke(RemoteMethodInfo& rmi, ss::Dynam
     return app->OnRemoteMethodInvoke(self_, rmi);
 }
 
-class PhotonProtocol::Impl::IProtocolStateDelegate {
-public:
-    virtual bool ReadMessages(Impl* self, ChannelContext& channel, ss::DynamicBuffer& inputBuffer, ss::DynamicBuffer& outputBuffer) = 0;
-};
-
 class PhotonProtocolControlRMIs {
 public:
     static RemoteMethodReturnValue Invoke(const RemoteMethodInfo& rmi, void* context)
@@ -113,14 +225,11 @@ private:
     RMIMap rmis_;
 };
 
-class PhotonProtocol::Impl::ServerInitDelegate : public IProtocolStateDelegate {
+// Reads the whole messages of the Control Channel until the handshake completes, the rest of the messages are
+// handed to the delegate of the new state.
+class PhotonProtocol::Impl::HandshakeDelegate : public IProtocolStateDelegate {
 public:
-    bool AttachToApplication(Impl* self, const String& appName)
-    {
-        return false; // TODO: NYI, the connection is not initialized yet, we'd better attach to application later
-    }
-
-    bool ReadMessages(Impl* self, ChannelContext& channel, ss::DynamicBuffer& inputBuffer, ss::DynamicBuffer& outputBuffer) override
+    bool ReadMessages(Impl* self, ChannelContext& channel) override
     {
         auto& msgBuffer = channel.messageBuffer_;
         auto& msgHeader = channel.currentMessageHeader_;
@@ -129,137 +238,1058 @@ public:
             if (msgHeader.messageLength == 0) {
                 DataDeserializer deserializer(msgBuffer.GetData<Uint8>(), msgBuffer.Size());
                 if (!deserializer.Deserialize(msgHeader)) {
-                    if (deserializer.IsNotEnoughData()) {
-                        // Not enough data, process the next channel
-                        break;
-                    }
-                    return false;
+                    return deserializer.IsNotEnoughData();
                 }
                 msgBuffer.Skip(deserializer.DataConsumed());
+                if (msgHeader.messageLength == 0 || msgHeader.reserved != 0) {
+                    return false; // Empty messages are not allowed, nor compressed ones before the handshake completes
+                }
+                if (msgHeader.messageLength > channel.maxMessageSize_) {
+                    return false;
+                }
             }
-
-            if (msgHeader.messageType != MessageHeader::Type::kControl // We are expecting 'HELLO' RMI
-                || msgHeader.messageLength == 0 // 'hello' RMI's length > 0
-            ) {
-                return false;
+            if (channel.channelId != 0) {
+                return false; // No other channel before the handshake completes
             }
-
             if (msgBuffer.Size() < msgHeader.messageLength) {
                 return true; // Not enough data
             }
 
-            RemoteMethodInfo method;
-            DataDeserializer deserializer(msgBuffer.GetData<Uint8>(), msgBuffer.Size());
-            if (!deserializer.Deserialize(method)) {
-                return false; // We've got enough data, the deserialization ought to be success
+            MessageHeader header = msgHeader;
+            msgHeader = MessageHeader {}; // Expecting the next message
+            self->OnMessageReceived(channel, header);
+            bool ok = OnMessage(self, header, msgBuffer.GetData<Uint8>(), header.messageLength);
+            msgBuffer.Skip(header.messageLength);
+            if (!ok) {
+                return false;
+            }
+            if (self->protocolHandler_ != this) {
+                // Pipelined messages, e.g. CreateChannel, follow the handshake
+                return self->protocolHandler_->ReadMessages(self, channel);
             }
-            if (deserializer.DataConsumed() != msgHeader.messageLength) {
-                return false; // check consistence
+        }
+        return true;
+    }
+
+protected:
+    virtual bool OnMessage(Impl* self, const MessageHeader& header, const Uint8* data, Uint32 size) = 0;
+};
+
+class PhotonProtocol::Impl::ServerInitDelegate : public HandshakeDelegate {
+public:
+    static bool AttachToApplication(Impl* self, const String& appName)
+    {
+        auto* app = ApplicationManager::GetApplication(appName);
+        if (app != nullptr) {
+            self->self_->SetApplication(app);
+        }
+        // An application may also be set by the owner of the connection
+        return self->self_->GetApplication() != nullptr;
+    }
+
+protected:
+    bool OnMessage(Impl* self, const MessageHeader& header, const Uint8* data, Uint32 size) override
+    {
+        if (header.messageType != MessageHeader::Type::kControl) {
+            return false;
+        }
+        RemoteMethodInfo method;
+        DataDeserializer deserializer(const_cast<Uint8*>(data), size);
+        if (!deserializer.Deserialize(method) || deserializer.DataConsumed() != size) {
+            return false; // We've got enough data, the deserialization ought to be success
+        }
+
+        // Uint16 photon.control.Resume(ByteArray token)
+        if (self->currentState_ == ProtocolState::kWaitingForHello
+            && method.MatchPrototype(Variant::Type::Uint16, "photon.control.Resume", { Variant::Type::ByteArray })) {
+            if (!self->RestoreSession(method.GetParameters()[0]->Get<ByteArray>())) {
+                return false; // The client connects again with a full handshake
             }
-            msgBuffer.Skip(deserializer.DataConsumed());
+            Variant reply(self->protocolVersion_);
+            return self->SendResult(0, header.messageId, InvokeResult::kSucceeded, &reply);
+        }
 
+        if (self->currentState_ == ProtocolState::kWaitingForHello) {
             // String photon.control.hello(String, String)
-            if (!method.MatchPrototype(Variant::Type::String, // Return type
-                    "photon.control.hello", // Method name
-                    { Variant::Type::String, Variant::Type::String }) // Parameters
-            ) {
+            if (!method.MatchPrototype(Variant::Type::String, "photon.control.hello", { Variant::Type::String, Variant::Type::String })) {
                 return false;
             }
             if (method.GetParameters()[0]->Get<String>() != "HELLO") {
                 return false;
             }
-            auto& appName = method.GetParameters()[1]->Get<String>();
+            self->appName_ = method.GetParameters()[1]->Get<String>();
+            if (!AttachToApplication(self, self->appName_)) {
+                return false;
+            }
+            Variant reply(String("HELLO"));
+            self->SetState(ProtocolState::kWaitingForVersionList);
+            return self->SendResult(0, header.messageId, InvokeResult::kSucceeded, &reply);
+        }
+
+        // Uint16 photon.control.Hello1(Uint16[] supportedVersions)
+        if (!method.MatchPrototype(Variant::Type::Uint16, "photon.control.Hello1", { Variant::Type::Array })) {
+            return false;
+        }
+        auto& versions = method.GetParameters()[0]->Get<Array>();
+        bool supported = false;
+        for (Uint32 i = 0; i < versions.Size(); ++i) {
+            if (versions[i] != nullptr && versions[i]->Is<Uint16>() && versions[i]->Get<Uint16>() == kProtocolVersion1) {
+                supported = true;
+            }
+        }
+        if (!supported) {
+            return false;
+        }
+        self->protocolVersion_ = kProtocolVersion1;
+        Variant reply(kProtocolVersion1);
+        self->SetState(ProtocolState::kEstablished);
+        self->tokenOutdated_ = true;
+        return self->SendResult(0, header.messageId, InvokeResult::kSucceeded, &reply);
+    }
+};
+
+class PhotonProtocol::Impl::ClientInitDelegate : public HandshakeDelegate {
+protected:
+    bool OnMessage(Impl* self, const MessageHeader& header, const Uint8* data, Uint32 size) override
+    {
+        if (header.messageType != MessageHeader::Type::kRemoteMethodResult) {
+            return false;
+        }
+        Uint32 requestId;
+        InvokeResult result;
+        Variant value;
+        if (!ParseResult(data, size, requestId, result, value) || result != InvokeResult::kSucceeded) {
+            return false;
+        }
 
-            if (!AttachToApplication(self, appName)) {
+        if (self->currentState_ == ProtocolState::kWaitingForHelloReply) {
+            if (requestId != self->helloRequestId_ || !value.Is<String>() || value.Get<String>() != "HELLO") {
+                return false;
+            }
+            self->SetState(ProtocolState::kWaitingForVersionSelected);
+            return true;
+        }
+        if (self->currentState_ == ProtocolState::kWaitingForVersionSelected) {
+            if (requestId != self->hello1RequestId_ || !value.Is<Uint16>() || value.Get<Uint16>() != kProtocolVersion1) {
                 return false;
             }
+            self->protocolVersion_ = value.Get<Uint16>();
+            self->SetState(ProtocolState::kEstablished);
+            return true;
+        }
+        if (self->currentState_ == ProtocolState::kWaitingForResumeReply) {
+            if (requestId != self->resumeRequestId_ || !value.Is<Uint16>() || value.Get<Uint16>() != kProtocolVersion1) {
+                return false;
+            }
+            self->protocolVersion_ = value.Get<Uint16>();
+            self->SetState(ProtocolState::kEstablished);
+            return true;
+        }
+        return false; // Connect was not called
+    }
+};
 
-            // TODO: change connetion state and it's state handle delegate
+// Processes the messages of an initialized connection
+class PhotonProtocol::Impl::EstablishedDelegate : public IProtocolStateDelegate {
+public:
+    bool ReadMessages(Impl* self, ChannelContext& channel) override
+    {
+        auto& msgBuffer = channel.messageBuffer_;
+        auto& msgHeader = channel.currentMessageHeader_;
+        while (true) {
+            // Update current message header if necessary.
+            if (msgHeader.messageLength == 0) {
+                if (msgBuffer.Empty()) {
+                    break;
+                }
+                DataDeserializer deserializer(msgBuffer.GetData<Uint8>(), msgBuffer.Size());
+                if (!deserializer.Deserialize(msgHeader)) {
+                    if (deserializer.IsNotEnoughData()) {
+                        // Not enough data, process the next channel
+                        break;
+                    }
+                    return false;
+                }
+                msgBuffer.Skip(deserializer.DataConsumed());
+                if (msgHeader.messageLength == 0) {
+                    return false; // Empty messages are not allowed
+                }
+                if (msgHeader.messageLength > channel.maxMessageSize_) {
+                    return false; // It would never fit in the channel window
+                }
+                channel.currentMessageHeaderSize_ = deserializer.DataConsumed();
+            }
 
             // process the message
-            if (0 && msgHeader.messageLength > 0) { // messageLength > 0 means we are processing message payloads
-                // process the message
-                switch (msgHeader.messageType) {
-                case MessageHeader::Type::kRemoteMethodInvoke:
-                case MessageHeader::Type::kControl: {
-                    // ensure the whole message is read, then process the message
-                    if (msgBuffer.Size() < msgHeader.messageLength) {
-                        return true; // Not enough data
-                    }
-                    RemoteMethodInfo method;
-                    DataDeserializer deserializer(msgBuffer.GetData<Uint8>(), msgBuffer.Size());
-                    if (!deserializer.Deserialize(method)) {
-                        return false; // We've got enough data, the deserialization ought to be success
-                    }
-                    if (deserializer.DataConsumed() != msgHeader.messageLength) {
-                        return false; // check consistence
+            switch (msgHeader.messageType) {
+            case MessageHeader::Type::kRemoteMethodInvoke:
+            case MessageHeader::Type::kControl: {
+                // ensure the whole message is read, then process the message
+                if (msgBuffer.Size() < msgHeader.messageLength) {
+                    return true; // Not enough data
+                }
+                const Uint8* data = msgBuffer.GetData<Uint8>();
+                Uint32 size = msgHeader.messageLength;
+                ByteArray inflated;
+                if (!self->InflateMessage(channel, msgHeader, data, size, inflated)) {
+                    return false;
+                }
+                RemoteMethodInfo method;
+                DataDeserializer deserializer(const_cast<Uint8*>(data), size);
+                if (!deserializer.Deserialize(method)) {
+                    return false; // We've got enough data, the deserialization ought to be success
+                }
+                if (deserializer.DataConsumed() != size) {
+                    return false; // check consistence
+                }
+                msgBuffer.Skip(msgHeader.messageLength);
+
+                if (msgHeader.messageType == MessageHeader::Type::kControl) {
+                    if (!self->OnRemoteControlMessage(msgHeader, method)) {
+                        return false;
                     }
-                    msgBuffer.Skip(deserializer.DataConsumed());
-
-                    if (msgHeader.messageType == MessageHeader::Type::kControl) {
-                        if (!self->OnRemoteControlMessage(method, inputBuffer, outputBuffer)) {
-                            return false;
-                        }
-                    } else {
-                        if (!self->OnRemoteMethodInvoke(method, inputBuffer, outputBuffer)) {
-                            return false;
-                        }
+                } else {
+                    if (!self->OnRemoteMethodInvoke(method)) {
+                        return false;
                     }
-                    break;
                 }
-                case MessageHeader::Type::kVideo: {
-                    // just forward the whole message payload
-                    SSASSERT2(false, "NYI");
-                    break;
+                break;
+            }
+            case MessageHeader::Type::kRemoteMethodResult: {
+                if (msgBuffer.Size() < msgHeader.messageLength) {
+                    return true; // Not enough data
                 }
-                case MessageHeader::Type::kAudio: {
+                const Uint8* data = msgBuffer.GetData<Uint8>();
+                Uint32 size = msgHeader.messageLength;
+                ByteArray inflated;
+                bool ok = self->InflateMessage(channel, msgHeader, data, size, inflated)
+                    && self->OnRemoteMethodResult(channel, data, size);
+                msgBuffer.Skip(msgHeader.messageLength);
+                if (!ok) {
+                    return false;
+                }
+                break;
+            }
+            case MessageHeader::Type::kVideo:
+            case MessageHeader::Type::kAudio: {
+                Uint8 allowedFlags = msgHeader.messageType == MessageHeader::Type::kVideo ? MessageHeader::kKeyFrame : 0;
+                if ((msgHeader.reserved & ~allowedFlags) != 0) {
+                    return false; // Media messages are never compressed
+                }
+                if (self->mediaRelay_) {
                     // just forward the whole message payload
-                    SSASSERT2(false, "NYI");
+                    if (!ReadRelayedPayload(channel)) {
+                        return true; // Not enough data
+                    }
+                    BufferSlice payload = std::move(channel.relayPayload_);
+                    channel.relayPayload_ = BufferSlice();
+                    channel.relayReceived_ = 0;
+                    self->ForwardMediaMessage(channel, msgHeader, payload);
                     break;
                 }
-                default:
-                    SSASSERT2(false, "Not Yet Implemented");
+                if (msgBuffer.Size() < msgHeader.messageLength) {
+                    return true; // Not enough data
                 }
+                ByteArray payload(msgHeader.messageLength);
+                memcpy(payload.Data(), msgBuffer.GetData<Uint8>(), msgHeader.messageLength);
+                msgBuffer.Skip(msgHeader.messageLength);
+                if (!self->OnMediaMessage(channel, msgHeader, std::move(payload))) {
+                    return false;
+                }
+                break;
+            }
+            default:
+                return false; // Unknown message type
             }
+            if (!self->ReleaseChannelData(channel, channel.currentMessageHeaderSize_ + msgHeader.messageLength)) {
+                return false;
+            }
+            self->OnMessageReceived(channel, msgHeader);
+            msgHeader = MessageHeader {}; // Expecting the next message
         }
         return true;
     }
+
+private:
+    // The payload is never parsed, ReadChunks copies the chunk data into the relay buffer directly.
+    // Returns true if the whole payload is received.
+    static bool ReadRelayedPayload(ChannelContext& channel)
+    {
+        auto& msgBuffer = channel.messageBuffer_;
+        auto& msgHeader = channel.currentMessageHeader_;
+        if (channel.relayPayload_.Empty()) {
+            // The message header was just parsed, the rest of the buffered chunk data belongs to the payload
+            channel.relayPayload_ = BufferSlice(msgHeader.messageLength);
+            Uint32 n = std::min(msgBuffer.Size(), msgHeader.messageLength);
+            memcpy(channel.relayPayload_.MutableData(), msgBuffer.GetData<Uint8>(), n);
+            msgBuffer.Skip(n);
+            channel.relayReceived_ = n;
+        }
+        return channel.relayReceived_ == channel.relayPayload_.Size();
+    }
 };
 
+void PhotonProtocol::Impl::ForwardMediaMessage(ChannelContext& channel, const MessageHeader& header, const BufferSlice& payload)
+{
+    if (channel.gopCache_ != nullptr) {
+        channel.gopCache_->Push(header, payload);
+    }
+    bool keyFrame = header.messageType == MessageHeader::Type::kVideo && (header.reserved & MessageHeader::kKeyFrame) != 0;
+    for (auto& subscriber : channel.subscribers_) {
+        if (subscriber.waitingForKeyFrame) {
+            if (!keyFrame) {
+                continue;
+            }
+            // The switch completes
+            subscriber.waitingForKeyFrame = false;
+            RemoveMediaSubscriberExcept(channel.channelId, subscriber.protocol, subscriber.channelId, false);
+        }
+        // A slow subscriber drops its own expired messages, it never blocks the others
+        subscriber.protocol->ForwardMessage(subscriber.channelId, header, payload);
+    }
+}
+
+void PhotonProtocol::Impl::SetMediaRelay(bool enabled)
+{
+    mediaRelay_ = enabled;
+}
+
+bool PhotonProtocol::Impl::AddMediaSubscriber(Uint16 channelId, PhotonProtocol* subscriber, Uint16 subscriberChannelId)
+{
+    auto it = channels_.find(channelId);
+    if (it == channels_.end() || channelId == 0 || subscriber == nullptr) {
+        return false;
+    }
+    it->second.subscribers_.push_back({ subscriber, subscriberChannelId });
+    if (it->second.gopCache_ != nullptr) {
+        // The subscriber can decode at once, then the live messages follow in order
+        for (auto& message : it->second.gopCache_->GetMessages()) {
+            subscriber->ForwardMessage(subscriberChannelId, message.header, message.payload);
+        }
+    }
+    return true;
+}
+
+bool PhotonProtocol::Impl::SwitchMediaSubscriber(Uint16 channelId, PhotonProtocol* subscriber, Uint16 subscriberChannelId)
+{
+    auto it = channels_.find(channelId);
+    if (it == channels_.end() || channelId == 0 || subscriber == nullptr) {
+        return false;
+    }
+    // Cancel the pending switch, if any
+    RemoveMediaSubscriberExcept(0, subscriber, subscriberChannelId, true);
+    auto& subscribers = it->second.subscribers_;
+    for (auto& s : subscribers) {
+        if (s.protocol == subscriber && s.channelId == subscriberChannelId) {
+            return true; // Switched back before the key frame
+        }
+    }
+    subscribers.push_back({ subscriber, subscriberChannelId, true });
+    return true;
+}
+
+void PhotonProtocol::Impl::RemoveMediaSubscriberExcept(Uint32 channelId, PhotonProtocol* subscriber, Uint16 subscriberChannelId, bool waitingOnly)
+{
+    for (auto& [id, channel] : channels_) {
+        if (id == channelId) {
+            continue;
+        }
+        auto& subscribers = channel.subscribers_;
+        subscribers.erase(std::remove_if(subscribers.begin(), subscribers.end(), [&](const MediaSubscriber& s) {
+            return s.protocol == subscriber && s.channelId == subscriberChannelId && (s.waitingForKeyFrame || !waitingOnly);
+        }),
+            subscribers.end());
+    }
+}
+
+bool PhotonProtocol::Impl::EnableGopCache(Uint16 channelId, Uint32 maxBytes)
+{
+    auto it = channels_.find(channelId);
+    if (it == channels_.end() || channelId == 0) {
+        return false;
+    }
+    it->second.gopCache_ = maxBytes > 0 ? std::make_unique<GopCache>(maxBytes) : nullptr;
+    return true;
+}
+
+void PhotonProtocol::Impl::RemoveMediaSubscriber(Uint16 channelId, PhotonProtocol* subscriber)
+{
+    auto it = channels_.find(channelId);
+    if (it == channels_.end()) {
+        return;
+    }
+    auto& subscribers = it->second.subscribers_;
+    subscribers.erase(std::remove_if(subscribers.begin(), subscribers.end(), [subscriber](const MediaSubscriber& s) {
+        return s.protocol == subscriber;
+    }),
+        subscribers.end());
+}
+
+bool PhotonProtocol::Impl::ForwardMessage(Uint16 channelId, const MessageHeader& header, const BufferSlice& payload)
+{
+    // The timestamp is in the publisher's Base Time, so the latency budget is counted from now on
+    if (!scheduler_.Enqueue(channelId, header, payload, GetTimestamp())) {
+        return false;
+    }
+    if (outBoundDataReadyCallback_) {
+        outBoundDataReadyCallback_();
+    }
+    return true;
+}
+
+void PhotonProtocol::Impl::SetOutBoundDataReadyCallback(std::function<void()>&& callback)
+{
+    outBoundDataReadyCallback_ = std::move(callback);
+}
+
+bool PhotonProtocol::Impl::OnMediaMessage(ChannelContext& channel, const MessageHeader& header, ByteArray&& payload)
+{
+    if (channel.jitterBuffer_ != nullptr) {
+        // Late messages are dropped by the jitter buffer, that's not an error
+        channel.jitterBuffer_->Push(header, std::move(payload), GetTimestamp());
+        return true;
+    }
+    auto* app = self_->GetApplication();
+    if (!app) {
+        return false;
+    }
+    return app->OnMediaMessage(self_, Uint16(channel.channelId), header, payload);
+}
+
+bool PhotonProtocol::Impl::EnableJitterBuffer(Uint16 channelId, Uint32 minDelay, Uint32 maxDelay)
+{
+    auto it = channels_.find(channelId);
+    if (it == channels_.end() || channelId == 0) {
+        return false;
+    }
+    it->second.jitterBuffer_ = std::make_unique<JitterBuffer>(minDelay, maxDelay);
+    tokenOutdated_ = true;
+    return true;
+}
+
+Int32 PhotonProtocol::Impl::PollMediaMessages()
+{
+    auto* app = self_->GetApplication();
+    Uint32 now = GetTimestamp();
+    Int32 timeToNext = -1;
+    MessageHeader header;
+    ByteArray payload;
+    for (auto& [id, channel] : channels_) {
+        if (channel.jitterBuffer_ == nullptr) {
+            continue;
+        }
+        while (channel.jitterBuffer_->Pop(now, header, payload)) {
+            if (app != nullptr) {
+                app->OnMediaMessage(self_, Uint16(id), header, payload);
+            }
+        }
+        Int32 wait = channel.jitterBuffer_->GetTimeToNextPlayout(now);
+        if (wait >= 0 && (timeToNext < 0 || wait < timeToNext)) {
+            timeToNext = wait;
+        }
+    }
+    return timeToNext;
+}
+
+bool PhotonProtocol::Impl::OnOutBoundData(ss::DynamicBuffer& inputBuffer, ss::DynamicBuffer& outputBuffer)
+{
+    return WriteOutBoundData(outputBuffer);
+}
+
+bool PhotonProtocol::Impl::OnOutBoundChain(BufferChain& input, BufferChain& output)
+{
+    return WriteOutBoundData(output);
+}
+
+bool PhotonProtocol::Impl::WriteOutBoundData(ss::DynamicBuffer& outputBuffer)
+{
+    if (!UpdateResumptionToken()) {
+        return false;
+    }
+    scheduler_.WriteChunks(outputBuffer, GetTimestamp());
+    return true;
+}
+
+bool PhotonProtocol::Impl::WriteOutBoundData(BufferChain& output)
+{
+    if (!UpdateResumptionToken()) {
+        return false;
+    }
+    scheduler_.WriteChunks(output, GetTimestamp());
+    return true;
+}
+
+bool PhotonProtocol::Impl::SendMessage(Uint16 channelId, MessageHeader::Type type, Uint32 timestamp, ByteArray&& payload)
+{
+    MessageHeader header;
+    header.timestamp = timestamp;
+    header.messageType = type;
+    return SendMessage(channelId, header, std::move(payload));
+}
+
+bool PhotonProtocol::Impl::SendMessage(Uint16 channelId, MessageHeader header, ByteArray&& payload)
+{
+    auto type = header.messageType;
+    if (header.reserved != 0 && (header.reserved != MessageHeader::kKeyFrame || type != MessageHeader::Type::kVideo)) {
+        return false; // The other flags are set by the protocol
+    }
+    auto it = channels_.find(channelId);
+    if (it != channels_.end() && it->second.deflater_ != nullptr && payload.Size() >= it->second.compressionThreshold_
+        && type != MessageHeader::Type::kVideo && type != MessageHeader::Type::kAudio) {
+        // The dictionary has taken the message, so it must be sent compressed even if it grew
+        ByteArray compressed;
+        if (!it->second.deflater_->Compress(payload.Data(), payload.Size(), compressed)) {
+            return false;
+        }
+        header.reserved |= MessageHeader::kCompressed;
+        return scheduler_.Enqueue(channelId, header, std::move(compressed));
+    }
+    return scheduler_.Enqueue(channelId, header, std::move(payload));
+}
+
+bool PhotonProtocol::Impl::InvokeRemoteMethod(Uint16 channelId, const RemoteMethodInfo& method)
+{
+    if (channelId == 0) {
+        return false; // Control messages are sent by the protocol
+    }
+    std::vector<Uint8> bytes;
+    if (!DataSerializer::Serialize(method, [&bytes](Uint8 b) { bytes.push_back(b); })) {
+        return false;
+    }
+    ByteArray payload(Uint32(bytes.size()));
+    memcpy(payload.Data(), bytes.data(), bytes.size());
+    return SendMessage(channelId, MessageHeader::Type::kRemoteMethodInvoke, 0, std::move(payload));
+}
+
+bool PhotonProtocol::Impl::EnableCompression(Uint16 channelId, Uint32 threshold)
+{
+    if (currentState_ == ProtocolState::kInitial || currentState_ == ProtocolState::kWaitingForHello
+        || currentState_ == ProtocolState::kWaitingForVersionList) {
+        return false;
+    }
+    auto it = channels_.find(channelId);
+    if (it == channels_.end() || it->second.deflater_ != nullptr) {
+        return false;
+    }
+    for (auto& [requestId, pending] : pendingCompression_) {
+        if (pending.first == channelId) {
+            return false; // Requested
+        }
+    }
+    // void photon.control.EnableCompression(Uint16 channelId, Uint8 method)
+    Array params({
+        std::make_shared<Variant>(channelId),
+        std::make_shared<Variant>(Uint8(CompressionMethod::kDeflate)),
+    });
+    Uint32 requestId;
+    if (!SendControlMessage(RemoteMethodInfo(Variant::Type::Void, "photon.control.EnableCompression", std::move(params)), &requestId)) {
+        return false;
+    }
+    pendingCompression_[requestId] = { channelId, threshold };
+    return true;
+}
+
+bool PhotonProtocol::Impl::SendHeartbeat()
+{
+    if (!IsEstablished()) {
+        return false;
+    }
+    // void photon.control.Heartbeat()
+    return SendControlMessage(RemoteMethodInfo(Variant::Type::Void, "photon.control.Heartbeat", Array()));
+}
+
+bool PhotonProtocol::Impl::InflateMessage(ChannelContext& channel, const MessageHeader& header, const Uint8*& data, Uint32& size, ByteArray& inflated)
+{
+    if (header.reserved == 0) {
+        return true;
+    }
+    if (header.reserved != MessageHeader::kCompressed || channel.inflater_ == nullptr) {
+        return false; // Unknown flags, or compression was not enabled
+    }
+    if (!channel.inflater_->Decompress(data, size, kMaxInflatedMessageSize, inflated)) {
+        return false;
+    }
+    data = inflated.Data();
+    size = inflated.Size();
+    return true;
+}
+
+Uint32 PhotonProtocol::Impl::GetTimestamp() const
+{
+    auto elapsed = std::chrono::steady_clock::now() - baseTime_;
+    return Uint32(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
+}
+
+bool PhotonProtocol::Impl::SetChannelLatencyBudget(Uint16 channelId, Uint32 latencyBudget)
+{
+    if (!scheduler_.SetLatencyBudget(channelId, latencyBudget)) {
+        return false;
+    }
+    tokenOutdated_ = true;
+    return true;
+}
+
+bool PhotonProtocol::Impl::SetChannelMaxMessageSize(Uint16 channelId, Uint32 maxMessageSize)
+{
+    static const Uint32 kMaxMessageHeaderSize = 16;
+    auto it = channels_.find(channelId);
+    if (it == channels_.end()) {
+        return false;
+    }
+    auto& channel = it->second;
+    if (channel.flowControlled_ && channelId != 0) {
+        // A message must fit in half of the window, the credits are only announced once half of it was consumed
+        Uint64 windowSize = (Uint64(maxMessageSize) + kMaxMessageHeaderSize) * 2;
+        if (windowSize > kMaxWindowSize) {
+            return false;
+        }
+        Uint32 increment = channel.receiveWindow_.Grow(Uint32(windowSize));
+        if (increment > 0 && !SendWindowUpdate(channelId, increment)) {
+            return false;
+        }
+    }
+    channel.maxMessageSize_ = maxMessageSize;
+    tokenOutdated_ = true;
+    return true;
+}
+
+bool PhotonProtocol::Impl::GetChannelDropStats(Uint16 channelId, DropStats& stats) const
+{
+    OutboundScheduler::DropStats schedulerStats;
+    if (!scheduler_.GetDropStats(channelId, schedulerStats)) {
+        return false;
+    }
+    stats.droppedMessages = schedulerStats.droppedMessages;
+    stats.droppedBytes = schedulerStats.droppedBytes;
+    return true;
+}
+
+void PhotonProtocol::Impl::SetPacingRate(Uint32 bitsPerSecond)
+{
+    scheduler_.SetPacingRate(bitsPerSecond / 8);
+}
+
+bool PhotonProtocol::Impl::SendControlMessage(const RemoteMethodInfo& rmi, Uint32* messageId)
+{
+    std::vector<Uint8> bytes;
+    if (!DataSerializer::Serialize(rmi, [&bytes](Uint8 b) { bytes.push_back(b); })) {
+        return false;
+    }
+    ByteArray payload(Uint32(bytes.size()));
+    memcpy(payload.Data(), bytes.data(), bytes.size());
+    if (messageId != nullptr && !scheduler_.GetNextMessageId(0, *messageId)) {
+        return false;
+    }
+    return SendMessage(0, MessageHeader::Type::kControl, 0, std::move(payload));
+}
+
+bool PhotonProtocol::Impl::SendResult(Uint16 channelId, Uint32 requestId, InvokeResult result, const Variant* value)
+{
+    // | The MessageID of Request | DUI[3] | Invoke Result | 1 byte | Return value | Object |
+    std::vector<Uint8> bytes;
+    auto write = [&bytes](Uint8 b) { bytes.push_back(b); };
+    if (!DataSerializer::SerializeToDUI<3>(requestId, write)) {
+        return false;
+    }
+    bytes.push_back(Uint8(result));
+    if (value != nullptr && !DataSerializer::Serialize(*value, write)) {
+        return false;
+    }
+    ByteArray payload(Uint32(bytes.size()));
+    memcpy(payload.Data(), bytes.data(), bytes.size());
+    return SendMessage(channelId, MessageHeader::Type::kRemoteMethodResult, 0, std::move(payload));
+}
+
+bool PhotonProtocol::Impl::ParseResult(const Uint8* data, Uint32 size, Uint32& requestId, InvokeResult& result, Variant& value)
+{
+    DataDeserializer deserializer(const_cast<Uint8*>(data), size);
+    if (!deserializer.DeserializeFromDUI<3>(requestId) || deserializer.DataConsumed() >= size) {
+        return false;
+    }
+    Uint32 offset = deserializer.DataConsumed();
+    if (data[offset] > Uint8(InvokeResult::kException)) {
+        return false;
+    }
+    result = InvokeResult(data[offset++]);
+    value = Variant();
+    if (offset == size) {
+        return true; // Void
+    }
+    DataDeserializer valueDeserializer(const_cast<Uint8*>(data + offset), size - offset);
+    return valueDeserializer.Deserialize(value) && valueDeserializer.DataConsumed() == size - offset;
+}
+
+bool PhotonProtocol::Impl::OnRemoteMethodResult(ChannelContext& channel, const Uint8* data, Uint32 size)
+{
+    Uint32 requestId;
+    InvokeResult result;
+    Variant value;
+    if (channel.channelId != 0 || !ParseResult(data, size, requestId, result, value)) {
+        return false; // The results of application RMIs are not supported yet
+    }
+    auto compression = pendingCompression_.find(requestId);
+    if (compression != pendingCompression_.end()) {
+        auto [channelId, threshold] = compression->second;
+        pendingCompression_.erase(compression);
+        auto channel = channels_.find(channelId);
+        if (result != InvokeResult::kSucceeded || channel == channels_.end()) {
+            return true; // Not supported by the peer, keep sending uncompressed messages
+        }
+        channel->second.deflater_ = std::make_unique<MessageDeflater>();
+        channel->second.compressionThreshold_ = threshold;
+        return channel->second.deflater_->IsValid();
+    }
+    auto it = pendingChannels_.find(requestId);
+    if (it == pendingChannels_.end()) {
+        return false; // Not requested
+    }
+    pendingChannels_.erase(it);
+    // The channel has been used since it was requested, the connection is useless if the peer refused it
+    return result == InvokeResult::kSucceeded;
+}
+
+bool PhotonProtocol::Impl::Connect(const String& appName, const std::vector<Uint16>& channelIds)
+{
+    if (currentState_ != ProtocolState::kInitial) {
+        return false;
+    }
+    // String photon.control.hello(String hello, String applicationName)
+    Array helloParams({
+        std::make_shared<Variant>(String("HELLO")),
+        std::make_shared<Variant>(appName),
+    });
+    RemoteMethodInfo hello(Variant::Type::String, "photon.control.hello", std::move(helloParams));
+    // Uint16 photon.control.Hello1(Uint16[] supportedVersions)
+    Array versions({ std::make_shared<Variant>(kProtocolVersion1) });
+    Array hello1Params({ std::make_shared<Variant>(std::move(versions)) });
+    RemoteMethodInfo hello1(Variant::Type::Uint16, "photon.control.Hello1", std::move(hello1Params));
+    if (!SendControlMessage(hello, &helloRequestId_) || !SendControlMessage(hello1, &hello1RequestId_)) {
+        return false;
+    }
+    // The replies are not waited for, the server processes the flight in order
+    SetState(ProtocolState::kWaitingForHelloReply);
+    for (auto channelId : channelIds) {
+        if (!CreateChannel(channelId)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool PhotonProtocol::Impl::CreateChannel(Uint16 channelId)
+{
+    if (currentState_ == ProtocolState::kInitial || currentState_ == ProtocolState::kWaitingForHello
+        || currentState_ == ProtocolState::kWaitingForVersionList) {
+        return false;
+    }
+    bool flowControlled = flowControlExemptChannels_.count(channelId) == 0;
+    if (!AddChannel(channelId, flowControlled)) {
+        return false;
+    }
+    // void photon.control.CreateChannel(Uint16 channelId), or with flags if the channel is exempt from flow control
+    Array params = flowControlled
+        ? Array({ std::make_shared<Variant>(channelId) })
+        : Array({ std::make_shared<Variant>(channelId), std::make_shared<Variant>(kChannelNotFlowControlled) });
+    Uint32 requestId;
+    if (!SendControlMessage(RemoteMethodInfo(Variant::Type::Void, "photon.control.CreateChannel", std::move(params)), &requestId)) {
+        return false;
+    }
+    pendingChannels_[requestId] = channelId;
+    tokenOutdated_ = true;
+    return true;
+}
+
+bool PhotonProtocol::Impl::AddChannel(Uint16 channelId, bool flowControlled)
+{
+    if (channelId == 0 || channelId > kMaxChannelId || channels_.count(channelId) > 0) {
+        return false;
+    }
+    auto& channel = channels_[channelId];
+    channel.channelId = channelId;
+    if (!scheduler_.AddChannel(channelId)) {
+        return false;
+    }
+    if (!flowControlled) {
+        channel.flowControlled_ = false;
+        scheduler_.DisableFlowControl(channelId);
+    }
+    return true;
+}
+
+bool PhotonProtocol::Impl::DisableChannelFlowControl(Uint16 channelId)
+{
+    if (channelId == 0 || channelId > kMaxChannelId) {
+        return false;
+    }
+    auto it = channels_.find(channelId);
+    if (it != channels_.end()) {
+        // The exemption was agreed on when the channel was created
+        return !it->second.flowControlled_;
+    }
+    flowControlExemptChannels_.insert(channelId);
+    return true;
+}
+
+void PhotonProtocol::Impl::SetState(ProtocolState state)
+{
+    static ServerInitDelegate serverInitDelegate;
+    static ClientInitDelegate clientInitDelegate;
+    static EstablishedDelegate establishedDelegate;
+    currentState_ = state;
+    switch (state) {
+    case ProtocolState::kWaitingForHello:
+    case ProtocolState::kWaitingForVersionList:
+        protocolHandler_ = &serverInitDelegate;
+        break;
+    case ProtocolState::kEstablished:
+        protocolHandler_ = &establishedDelegate;
+        break;
+    default:
+        protocolHandler_ = &clientInitDelegate;
+        break;
+    }
+}
+
+bool PhotonProtocol::Impl::ReleaseConnectionData(const ChannelContext& channel, Uint32 bytes)
+{
+    if (channel.channelId == 0 || !channel.flowControlled_ || bytes == 0) {
+        return true; // Control channel and exempt channels are not flow controlled
+    }
+    Uint32 credit = connectionReceiveWindow_.OnDataConsumed(bytes);
+    return credit == 0 || SendWindowUpdate(0, credit);
+}
+
+bool PhotonProtocol::Impl::ReleaseChannelData(ChannelContext& channel, Uint32 bytes)
+{
+    if (channel.channelId == 0 || !channel.flowControlled_ || bytes == 0) {
+        return true; // Control channel and exempt channels are not flow controlled
+    }
+    Uint32 credit = channel.receiveWindow_.OnDataConsumed(bytes);
+    return credit == 0 || SendWindowUpdate(Uint16(channel.channelId), credit);
+}
+
+bool PhotonProtocol::Impl::SendWindowUpdate(Uint16 channelId, Uint32 increment)
+{
+    // void photon.control.WindowUpdate(Uint16 channelId, Uint32 increment)
+    Array params({
+        std::make_shared<Variant>(channelId),
+        std::make_shared<Variant>(increment),
+    });
+    return SendControlMessage(RemoteMethodInfo(Variant::Type::Void, "photon.control.WindowUpdate", std::move(params)));
+}
+
+void PhotonProtocol::Impl::OnMessageReceived(ChannelContext& channel, const MessageHeader& header)
+{
+    ++channel.stats_.messagesIn;
+    channel.stats_.reassemblyLatency.Add(inboundTime_ - channel.messageStartTime_);
+    // The rest of the buffered data belongs to the next message
+    channel.messageStartTime_ = inboundTime_;
+    if (Uint32(header.messageType) < kMessageTypeCount) {
+        ++receivedMessagesByType_[Uint32(header.messageType)];
+    }
+}
+
+bool PhotonProtocol::Impl::GetStats(ProtocolStats& stats) const
+{
+    stats = ProtocolStats {};
+    stats.timestamp = GetTimestamp();
+    stats.parseErrors = parseErrors_;
+    for (Uint32 i = 0; i < kMessageTypeCount; ++i) {
+        stats.messagesInByType[i] = receivedMessagesByType_[i];
+    }
+    scheduler_.GetStats(stats);
+    for (auto& [id, channel] : channels_) {
+        auto& channelStats = stats.channels[Uint16(id)];
+        channelStats.bytesIn = channel.stats_.bytesIn;
+        channelStats.chunksIn = channel.stats_.chunksIn;
+        channelStats.messagesIn = channel.stats_.messagesIn;
+        channelStats.reassemblyLatency = channel.stats_.reassemblyLatency;
+    }
+    for (auto& [id, channelStats] : stats.channels) {
+        stats.total.Merge(channelStats);
+    }
+    return true;
+}
+
 bool PhotonProtocol::Impl::OnInBoundData(ss::DynamicBuffer& inputBuffer, ss::DynamicBuffer& outputBuffer)
 {
+    // Flush replies and WindowUpdates
+    return ReadInBoundData(inputBuffer) && WriteOutBoundData(outputBuffer);
+}
+
+bool PhotonProtocol::Impl::OnInBoundChain(BufferChain& input, BufferChain& output)
+{
+    // The chunks are parsed from contiguous memory, the incomplete ones are kept until the rest arrives
+    input.CopyTo(chainInput_);
+    input.Clear();
+    return ReadInBoundData(chainInput_) && WriteOutBoundData(output);
+}
+
+bool PhotonProtocol::Impl::OnInBoundBytes(const Uint8* data, Uint32 size, ss::DynamicBuffer& outputBuffer)
+{
+    return ReadInBoundBytes(data, size) && WriteOutBoundData(outputBuffer);
+}
+
+bool PhotonProtocol::Impl::OnInBoundBytes(const Uint8* data, Uint32 size, BufferChain& output)
+{
+    return ReadInBoundBytes(data, size) && WriteOutBoundData(output);
+}
+
+bool PhotonProtocol::Impl::ReadInBoundBytes(const Uint8* data, Uint32 size)
+{
+    // Complete the chunk left by the last read with as few bytes as needed
+    while (!pendingInput_.Empty() && size > 0) {
+        Uint32 n = std::min(size, GetBytesToCompleteChunk());
+        pendingInput_.PushData(data, n);
+        data += n;
+        size -= n;
+        if (!ReadInBoundData(pendingInput_)) {
+            return false;
+        }
+    }
+    // Then the rest are parsed in place, and an incomplete chunk at the end is kept
+    InputSpan input { data, size };
+    if (!ReadInBoundData(input)) {
+        return false;
+    }
+    pendingInput_.PushData(input.data, input.size);
+    return true;
+}
+
+Uint32 PhotonProtocol::Impl::GetBytesToCompleteChunk() const
+{
+    // Large enough for any chunk header, the bytes following the header are chunk data
+    static const Uint32 kMaxChunkHeaderSize = 16;
+    if (readingState_ == ReadingState::kExpectingChunkData) {
+        return std::max(currentChunkHeader_.chunkSize, pendingInput_.Size() + 1) - pendingInput_.Size();
+    }
+    return std::max(kMaxChunkHeaderSize, pendingInput_.Size() + 1) - pendingInput_.Size();
+}
+
+template <class Input>
+bool PhotonProtocol::Impl::ReadInBoundData(Input& inputBuffer)
+{
+    inboundTime_ = GetTimestamp();
     std::set<ChannelContext*> updatedChannels;
-    if (!ReadChunks(updatedChannels, inputBuffer, outputBuffer)) {
+    if (!ReadChunks(updatedChannels, inputBuffer)) {
+        ++parseErrors_;
         return false;
     }
 
     for (auto* channel : updatedChannels) {
-        if (!protocolHandler_->ReadMessages(this, *channel, inputBuffer, outputBuffer)) {
+        if (!protocolHandler_->ReadMessages(this, *channel)) {
+            ++parseErrors_;
             return false;
         }
     }
 
+    // Media messages that are already due needn't wait for the caller's playout timer
+    PollMediaMessages();
     return true;
-    if (currentState_ == ProtocolState::kWaitingForHello) {
-
-        //
-        DataDeserializer deserializer(inputBuffer.GetData<uint8_t>(), inputBuffer.Size());
-        RemoteMethodInfo hello;
-        if (!deserializer.Deserialize(hello)) {
-            // returns true if caused by `not enough data`.
-            // else returns false (protocol error)
-            return deserializer.IsNotEnoughData();
-        }
-        if (!hello.MatchPrototype(Variant::Type::Void, "photon.control.hello", {})) {
-            // protocol error
+}
+
+void PhotonProtocol::Impl::SetResumptionTokenStore(ResumptionTokenStore* store)
+{
+    tokenStore_ = store;
+    tokenOutdated_ = true;
+}
+
+bool PhotonProtocol::Impl::UpdateResumptionToken()
+{
+    if (!tokenOutdated_ || tokenStore_ == nullptr || role_ != Role::kServer || !IsEstablished()) {
+        return true;
+    }
+    tokenOutdated_ = false;
+
+    SessionSnapshot snapshot;
+    snapshot.appName = appName_;
+    snapshot.protocolVersion = protocolVersion_;
+    for (auto& [id, channel] : channels_) {
+        if (id == 0) {
+            continue;
+        }
+        SessionSnapshot::Channel config;
+        config.channelId = Uint16(id);
+        config.flowControlled = channel.flowControlled_;
+        config.maxMessageSize = channel.maxMessageSize_;
+        scheduler_.GetLatencyBudget(Uint16(id), config.latencyBudget);
+        if (channel.jitterBuffer_ != nullptr) {
+            config.jitterBuffer = true;
+            config.jitterMinDelay = channel.jitterBuffer_->GetMinDelay();
+            config.jitterMaxDelay = channel.jitterBuffer_->GetMaxDelay();
+        }
+        snapshot.channels.push_back(config);
+    }
+    // The older tokens stay valid until they expire: the connection may break before the new one arrives, and
+    // the client knows which channels the token it has covers
+    resumptionToken_ = tokenStore_->Issue(std::move(snapshot));
+
+    // void photon.control.ResumptionToken(ByteArray token)
+    Array params({ std::make_shared<Variant>(resumptionToken_) });
+    return SendControlMessage(RemoteMethodInfo(Variant::Type::Void, "photon.control.ResumptionToken", std::move(params)));
+}
+
+bool PhotonProtocol::Impl::RestoreSession(const ByteArray& token)
+{
+    SessionSnapshot snapshot;
+    if (tokenStore_ == nullptr || !tokenStore_->Redeem(token, snapshot)) {
+        return false;
+    }
+    if (!ServerInitDelegate::AttachToApplication(this, snapshot.appName)) {
+        return false;
+    }
+    appName_ = snapshot.appName;
+    protocolVersion_ = snapshot.protocolVersion;
+    for (auto& config : snapshot.channels) {
+        if (!AddChannel(config.channelId, config.flowControlled)) {
+            return false;
+        }
+        scheduler_.SetLatencyBudget(config.channelId, config.latencyBudget);
+        if (!SetChannelMaxMessageSize(config.channelId, config.maxMessageSize)) {
             return false;
         }
+        if (config.jitterBuffer) {
+            EnableJitterBuffer(config.channelId, config.jitterMinDelay, config.jitterMaxDelay);
+        }
+    }
+    SetState(ProtocolState::kEstablished);
+    tokenOutdated_ = true;
+    return true;
+}
+
+bool PhotonProtocol::Impl::Resume(const Impl& previous)
+{
+    if (currentState_ != ProtocolState::kInitial || previous.resumptionToken_.Size() == 0) {
+        return false;
+    }
+    // Uint16 photon.control.Resume(ByteArray token)
+    Array params({ std::make_shared<Variant>(previous.resumptionToken_) });
+    if (!SendControlMessage(RemoteMethodInfo(Variant::Type::Uint16, "photon.control.Resume", std::move(params)), &resumeRequestId_)) {
+        return false;
+    }
+    SetState(ProtocolState::kWaitingForResumeReply);
 
-        inputBuffer.Skip(deserializer.DataConsumed());
-        outputBuffer.EnsureSpace(32);
-        auto* buffer = outputBuffer.GetEndPtr<Uint8>();
-        //            buffer[0] =
+    flowControlExemptChannels_ = previous.flowControlExemptChannels_;
+    for (auto& [id, channel] : previous.channels_) {
+        if (id == 0) {
+            continue;
+        }
+        // The channels the token covers are restored by the server, the creation of the others is replayed
+        bool restored = previous.tokenChannels_.count(Uint16(id)) > 0;
+        if (restored ? !AddChannel(Uint16(id), channel.flowControlled_) : !CreateChannel(Uint16(id))) {
+            return false;
+        }
+        Uint32 latencyBudget = 0;
+        previous.scheduler_.GetLatencyBudget(Uint16(id), latencyBudget);
+        scheduler_.SetLatencyBudget(Uint16(id), latencyBudget);
+        if (!SetChannelMaxMessageSize(Uint16(id), channel.maxMessageSize_)) {
+            return false;
+        }
+        if (channel.jitterBuffer_ != nullptr) {
+            EnableJitterBuffer(Uint16(id), channel.jitterBuffer_->GetMinDelay(), channel.jitterBuffer_->GetMaxDelay());
+        }
     }
+    return true;
 }
 
 }
@@ -4,29 +4,100 @@
 
 #pragma once
 
+#include "FlowControlWindow.h"
+#include "MessageCompressor.h"
+#include "OutboundScheduler.h"
 #include "photonbase/core/Types.h"
 #include "photonbase/protocol/ChunkHeader.h"
+#include "photonbase/protocol/GopCache.h"
+#include "photonbase/protocol/JitterBuffer.h"
 #include "photonbase/protocol/MessageHeader.h"
 #include "photonbase/protocol/PhotonProtocol.h"
+#include "photonbase/protocol/ProtocolStats.h"
+#include <chrono>
+#include <functional>
+#include <map>
 #include <set>
 #include <unordered_map>
+#include <vector>
 
 namespace pht {
 
 class RemoteMethodInfo;
 class IApplication;
+class Variant;
+class ResumptionTokenStore;
+
+// Bytes parsed in place by ReadChunks, the same interface as ss::DynamicBuffer
+struct InputSpan {
+    const Uint8* data;
+    Uint32 size;
+
+    template <class T>
+    const T* GetData() const
+    {
+        return reinterpret_cast<const T*>(data);
+    }
+
+    Uint32 Size() const
+    {
+        return size;
+    }
+
+    bool Empty() const
+    {
+        return size == 0;
+    }
+
+    void Skip(Uint32 n)
+    {
+        data += n;
+        size -= n;
+    }
+};
+
+// 0x0100 means v1.0, see photon.control.Hello1
+static const Uint16 kProtocolVersion1 = 0x0100;
+
+struct MediaSubscriber {
+    PhotonProtocol* protocol { nullptr };
+    Uint16 channelId { 0 }; // The channel in the subscriber's connection
+    // Switching from another channel of this connection: nothing is forwarded until a key frame arrives, then the
+    // subscriber leaves the other channels
+    bool waitingForKeyFrame { false };
+};
 
 struct ChannelContext {
     Uint32 channelId { 0 };
     MessageHeader currentMessageHeader_ {};
+    Uint32 currentMessageHeaderSize_ { 0 }; // On the wire, the window is credited with it too
     ss::DynamicBuffer messageBuffer_ {};
+    ReceiveWindow receiveWindow_ {};
+    bool flowControlled_ { true }; // See PhotonProtocol::DisableChannelFlowControl
+    Uint32 maxMessageSize_ { PhotonProtocol::kDefaultMaxMessageSize };
+    std::unique_ptr<JitterBuffer> jitterBuffer_ { nullptr }; // only for media channels that need smooth playback
+    // Relay mode: the payload of the media message being received, chunk data is copied into it directly
+    BufferSlice relayPayload_ {};
+    Uint32 relayReceived_ { 0 };
+    std::vector<MediaSubscriber> subscribers_ {};
+    std::unique_ptr<GopCache> gopCache_ { nullptr }; // Relay mode: replayed to the new subscribers
+    // The inbound counters, the outbound ones are kept by the scheduler
+    ChannelStats stats_ {};
+    Uint32 messageStartTime_ { 0 }; // When the first chunk of the message being received arrived
+    // Compression of the control/RMI messages, the deflater is created when the peer agreed
+    std::unique_ptr<MessageInflater> inflater_ { nullptr };
+    std::unique_ptr<MessageDeflater> deflater_ { nullptr };
+    Uint32 compressionThreshold_ { 0 };
 };
 
 
 class PhotonProtocol::Impl {
 public:
     class IProtocolStateDelegate;
+    class HandshakeDelegate;
     class ServerInitDelegate;
+    class ClientInitDelegate;
+    class EstablishedDelegate;
 
     enum class ProtocolState {
         kInvalid,
@@ -35,6 +106,15 @@ public:
         kWaitingForVersionList, // server
         kWaitingForHelloReply, // client
         kWaitingForVersionSelected, // client
+        kWaitingForResumeReply, // client
+        kEstablished,
+    };
+    // See RMI response format
+    enum class InvokeResult : Uint8 {
+        kSucceeded = 0,
+        kReturnTypeMismatch = 1,
+        kParameterMismatch = 2,
+        kException = 3,
     };
     enum class ReadingState {
         kExpectingChunkHeader,
@@ -43,24 +123,201 @@ public:
 
     explicit Impl(PhotonProtocol* self, Role role);
 
-    bool ReadChunks(std::set<ChannelContext*>& updatedChannels, ss::DynamicBuffer& inputBuffer, ss::DynamicBuffer& outputBuffer);
+    // Input is a ss::DynamicBuffer or an InputSpan
+    template <class Input>
+    bool ReadChunks(std::set<ChannelContext*>& updatedChannels, Input& inputBuffer);
+
+    bool OnRemoteControlMessage(const MessageHeader& header, RemoteMethodInfo& rmi);
 
-    bool OnRemoteControlMessage(RemoteMethodInfo& rmi, ss::DynamicBuffer& inputBuffer, ss::DynamicBuffer& outputBuffer)
+    bool OnRemoteMethodResult(ChannelContext& channel, const Uint8* data, Uint32 size);
+
+    bool Connect(const String& appName, const std::vector<Uint16>& channelIds);
+
+    bool CreateChannel(Uint16 channelId);
+
+    bool EnableCompression(Uint16 channelId, Uint32 threshold);
+
+    bool SendHeartbeat();
+
+    /**
+     * Decompress a received message if it is compressed
+     * @param data In: the payload received. Out: the message, it points to `inflated` if decompressed
+     * @return Return false if the message is corrupted or should not be compressed
+     */
+    bool InflateMessage(ChannelContext& channel, const MessageHeader& header, const Uint8*& data, Uint32& size, ByteArray& inflated);
+
+    void SetResumptionTokenStore(ResumptionTokenStore* store);
+
+    bool Resume(const Impl& previous);
+
+    bool IsEstablished() const
     {
-        return true;
+        return currentState_ == ProtocolState::kEstablished;
     }
 
-    bool OnRemoteMethodInvoke(RemoteMethodInfo& rmi, ss::DynamicBuffer& inputBuffer, ss::DynamicBuffer& outputBuffer);
+    Uint16 GetProtocolVersion() const
+    {
+        return protocolVersion_;
+    }
+
+    bool HasChannel(Uint16 channelId) const
+    {
+        return channels_.find(channelId) != channels_.end();
+    }
+
+    bool OnRemoteMethodInvoke(RemoteMethodInfo& rmi);
+
+    bool OnMediaMessage(ChannelContext& channel, const MessageHeader& header, ByteArray&& payload);
+
+    bool EnableJitterBuffer(Uint16 channelId, Uint32 minDelay, Uint32 maxDelay);
+
+    Int32 PollMediaMessages();
+
+    void ForwardMediaMessage(ChannelContext& channel, const MessageHeader& header, const BufferSlice& payload);
+
+    void SetMediaRelay(bool enabled);
+
+    bool AddMediaSubscriber(Uint16 channelId, PhotonProtocol* subscriber, Uint16 subscriberChannelId);
+
+    void RemoveMediaSubscriber(Uint16 channelId, PhotonProtocol* subscriber);
+
+    bool SwitchMediaSubscriber(Uint16 channelId, PhotonProtocol* subscriber, Uint16 subscriberChannelId);
+
+    // Remove the subscriber's channel from the channels of this connection, except `channelId`
+    void RemoveMediaSubscriberExcept(Uint32 channelId, PhotonProtocol* subscriber, Uint16 subscriberChannelId, bool waitingOnly);
+
+    bool EnableGopCache(Uint16 channelId, Uint32 maxBytes);
+
+    bool ForwardMessage(Uint16 channelId, const MessageHeader& header, const BufferSlice& payload);
+
+    void SetOutBoundDataReadyCallback(std::function<void()>&& callback);
 
     bool OnInBoundData(ss::DynamicBuffer& inputBuffer, ss::DynamicBuffer& outputBuffer);
 
+    bool OnInBoundBytes(const Uint8* data, Uint32 size, ss::DynamicBuffer& outputBuffer);
+
+    bool OnInBoundBytes(const Uint8* data, Uint32 size, BufferChain& output);
+
+    bool OnOutBoundData(ss::DynamicBuffer& inputBuffer, ss::DynamicBuffer& outputBuffer);
+
+    bool OnInBoundChain(BufferChain& input, BufferChain& output);
+
+    bool OnOutBoundChain(BufferChain& input, BufferChain& output);
+
+    bool SendMessage(Uint16 channelId, MessageHeader::Type type, Uint32 timestamp, ByteArray&& payload);
+
+    bool SendMessage(Uint16 channelId, MessageHeader header, ByteArray&& payload);
+
+    bool InvokeRemoteMethod(Uint16 channelId, const RemoteMethodInfo& method);
+
+    /**
+     * @param rmi The control message
+     * @param messageId Receives the message id, to match the result of the control message
+     * @return Return false if the message can't be serialized
+     */
+    bool SendControlMessage(const RemoteMethodInfo& rmi, Uint32* messageId = nullptr);
+
+    /**
+     * Send the result of a request received in a channel
+     * @param value The return value, nullptr if the method returns void or failed
+     */
+    bool SendResult(Uint16 channelId, Uint32 requestId, InvokeResult result, const Variant* value);
+
+    /**
+     * @param data The payload of a Remote Method Result message
+     * @param value Receives the return value, Null if there is none
+     * @return Return false if the payload is malformed
+     */
+    static bool ParseResult(const Uint8* data, Uint32 size, Uint32& requestId, InvokeResult& result, Variant& value);
+
+    // Milliseconds since the connection's Base Time
+    Uint32 GetTimestamp() const;
+
+    bool SetChannelLatencyBudget(Uint16 channelId, Uint32 latencyBudget);
+
+    bool DisableChannelFlowControl(Uint16 channelId);
+
+    bool SetChannelMaxMessageSize(Uint16 channelId, Uint32 maxMessageSize);
+
+    bool GetChannelDropStats(Uint16 channelId, DropStats& stats) const;
+
+    void SetPacingRate(Uint32 bitsPerSecond);
+
+    // Called when the chunk data of a channel was buffered, a WindowUpdate of the connection is sent if necessary
+    bool ReleaseConnectionData(const ChannelContext& channel, Uint32 bytes);
+
+    // Called when a message of a channel was handed over, e.g. to the application or the jitter buffer, a
+    // WindowUpdate of the channel is sent if necessary
+    bool ReleaseChannelData(ChannelContext& channel, Uint32 bytes);
+
+    // void photon.control.WindowUpdate(Uint16 channelId, Uint32 increment)
+    bool SendWindowUpdate(Uint16 channelId, Uint32 increment);
+
+    // Count a message whose last chunk was read
+    void OnMessageReceived(ChannelContext& channel, const MessageHeader& header);
+
+    bool GetStats(ProtocolStats& stats) const;
+
 private:
+    // Create the local end of a channel, for both sending and receiving
+    bool AddChannel(Uint16 channelId, bool flowControlled);
+
+    void SetState(ProtocolState state);
+
+    // Parse the chunks and handle the complete messages, the replies are queued to be written by WriteOutBoundData
+    template <class Input>
+    bool ReadInBoundData(Input& inputBuffer);
+
+    // Parse bytes in the caller's memory, keep an incomplete chunk at the end
+    bool ReadInBoundBytes(const Uint8* data, Uint32 size);
+
+    // The bytes OnInBoundBytes should copy to complete the chunk being read in pendingInput_
+    Uint32 GetBytesToCompleteChunk() const;
+
+    // Write the queued messages as chunks
+    bool WriteOutBoundData(ss::DynamicBuffer& outputBuffer);
+
+    bool WriteOutBoundData(BufferChain& output);
+
+    // Server side, issue a new token if the state of the connection changed since the last one
+    bool UpdateResumptionToken();
+
+    // Server side, restore the state of the connection from a redeemed token
+    bool RestoreSession(const ByteArray& token);
+
     PhotonProtocol* self_ { nullptr };
+    Role role_;
+    std::chrono::steady_clock::time_point baseTime_;
     ProtocolState currentState_ { ProtocolState::kInvalid };
     IProtocolStateDelegate* protocolHandler_ { nullptr };
     ReadingState readingState_ { ReadingState::kExpectingChunkHeader };
+    ss::DynamicBuffer chainInput_ {}; // The incomplete chunks received by OnInBoundChain
+    ss::DynamicBuffer pendingInput_ {}; // The incomplete chunk received by OnInBoundBytes
     ChunkHeader currentChunkHeader_ {};
     std::unordered_map<Uint32, ChannelContext> channels_;
+    ReceiveWindow connectionReceiveWindow_ { kDefaultConnectionWindowSize };
+    std::set<Uint16> flowControlExemptChannels_ {}; // Including the ones not created yet
+    OutboundScheduler scheduler_ {};
+    bool mediaRelay_ { false };
+    std::function<void()> outBoundDataReadyCallback_ {};
+    Uint16 protocolVersion_ { 0 };
+    // Client side, the requests of the handshake
+    Uint32 helloRequestId_ { 0 };
+    Uint32 hello1RequestId_ { 0 };
+    std::map<Uint32, Uint16> pendingChannels_ {}; // CreateChannel request id -> channel id
+    std::map<Uint32, std::pair<Uint16, Uint32>> pendingCompression_ {}; // Request id -> channel id, threshold
+    Uint32 resumeRequestId_ { 0 };
+    // Session resumption. The server issues a new token whenever the state changes, the client keeps the
+    // latest one and the channels it covers.
+    String appName_ {};
+    ResumptionTokenStore* tokenStore_ { nullptr };
+    bool tokenOutdated_ { false };
+    ByteArray resumptionToken_ {};
+    std::set<Uint16> tokenChannels_ {};
+    // Statistics
+    Uint32 inboundTime_ { 0 }; // When the data being read arrived
+    Uint64 parseErrors_ { 0 };
+    Uint64 receivedMessagesByType_[kMessageTypeCount] {};
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,197 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "photonbase/transport/BandwidthEstimator.h"
+#include <algorithm>
+#include <cmath>
+
+namespace pht {
+
+static const Int32 kGroupLength = 5; // Milliseconds
+static const size_t kTrendWindow = 20; // Groups
+static const double kSmoothing = 0.9;
+static const double kTrendGain = 4.0;
+static const Uint32 kMaxDeltaCount = 60;
+static const double kMinThreshold = 6;
+static const double kMaxThreshold = 600;
+static const double kThresholdUp = 0.0087;
+static const double kThresholdDown = 0.039;
+static const Int32 kAckedWindow = 500; // Milliseconds
+static const double kDecreaseFactor = 0.85;
+static const double kIncreasePerSecond = 1.08;
+static const double kHighLoss = 0.1;
+
+BandwidthEstimator::BandwidthEstimator() = default;
+
+void BandwidthEstimator::SetBitrateLimits(Uint32 minBitrate, Uint32 startBitrate, Uint32 maxBitrate)
+{
+    minBitrate_ = minBitrate;
+    maxBitrate_ = std::max(minBitrate, maxBitrate);
+    targetBitrate_ = std::clamp(startBitrate, minBitrate_, maxBitrate_);
+}
+
+void BandwidthEstimator::OnFeedback(const std::vector<PacketResult>& packets, Uint32 now, Uint32 rtt)
+{
+    if (packets.empty()) {
+        return;
+    }
+    Uint32 lost = 0;
+    for (auto& packet : packets) {
+        if (!packet.received) {
+            ++lost;
+            continue;
+        }
+        UpdateAckedBitrate(packet);
+        OnPacket(packet);
+    }
+    lossRate_ = 0.5 * lossRate_ + 0.5 * double(lost) / double(packets.size());
+    UpdateTarget(now, rtt);
+}
+
+void BandwidthEstimator::OnPacket(const PacketResult& packet)
+{
+    if (!hasGroup_) {
+        group_ = { packet.sendTime, packet.sendTime, packet.arrivalTime };
+        hasGroup_ = true;
+        return;
+    }
+    Int32 sinceGroupStart = Int32(packet.sendTime - group_.firstSendTime);
+    if (sinceGroupStart < 0) {
+        return; // Reordered, its group is complete already
+    }
+    if (sinceGroupStart <= kGroupLength) {
+        if (Int32(packet.sendTime - group_.lastSendTime) > 0) {
+            group_.lastSendTime = packet.sendTime;
+        }
+        if (Int32(packet.arrivalTime - group_.lastArrivalTime) > 0) {
+            group_.lastArrivalTime = packet.arrivalTime;
+        }
+        return;
+    }
+
+    if (hasPreviousGroup_) {
+        Int32 sendDelta = Int32(group_.lastSendTime - previousGroup_.lastSendTime);
+        Int32 arrivalDelta = Int32(group_.lastArrivalTime - previousGroup_.lastArrivalTime);
+        OnGroupDelta(arrivalDelta - sendDelta, group_.lastArrivalTime);
+    }
+    previousGroup_ = group_;
+    hasPreviousGroup_ = true;
+    group_ = { packet.sendTime, packet.sendTime, packet.arrivalTime };
+}
+
+void BandwidthEstimator::OnGroupDelta(Int32 delayVariation, Uint32 arrivalTime)
+{
+    if (!hasFirstArrival_) {
+        hasFirstArrival_ = true;
+        firstArrivalTime_ = arrivalTime;
+        lastThresholdUpdate_ = arrivalTime;
+    }
+    deltaCount_ = std::min(deltaCount_ + 1, kMaxDeltaCount);
+    accumulatedDelay_ += delayVariation;
+    smoothedDelay_ = kSmoothing * smoothedDelay_ + (1 - kSmoothing) * accumulatedDelay_;
+    delayHistory_.emplace_back(double(arrivalTime - firstArrivalTime_), smoothedDelay_);
+    if (delayHistory_.size() > kTrendWindow) {
+        delayHistory_.pop_front();
+    }
+    if (delayHistory_.size() == kTrendWindow) {
+        // Least squares slope
+        double meanX = 0;
+        double meanY = 0;
+        for (auto& [x, y] : delayHistory_) {
+            meanX += x;
+            meanY += y;
+        }
+        meanX /= double(kTrendWindow);
+        meanY /= double(kTrendWindow);
+        double numerator = 0;
+        double denominator = 0;
+        for (auto& [x, y] : delayHistory_) {
+            numerator += (x - meanX) * (y - meanY);
+            denominator += (x - meanX) * (x - meanX);
+        }
+        if (denominator != 0) {
+            trend_ = numerator / denominator;
+        }
+    }
+
+    double modifiedTrend = double(deltaCount_) * trend_ * kTrendGain;
+    double magnitude = std::fabs(modifiedTrend);
+    // Adapt the threshold so that the detector is neither starved by TCP flows nor triggered by noise
+    if (magnitude <= threshold_ + 15) {
+        double k = magnitude < threshold_ ? kThresholdDown : kThresholdUp;
+        double elapsed = std::min(double(Int32(arrivalTime - lastThresholdUpdate_)), 100.0);
+        threshold_ = std::clamp(threshold_ + k * (magnitude - threshold_) * std::max(elapsed, 0.0), kMinThreshold, kMaxThreshold);
+    }
+    lastThresholdUpdate_ = arrivalTime;
+
+    if (modifiedTrend > threshold_) {
+        // Two in a row, a single spike is likely noise
+        if (++overuseCount_ >= 2) {
+            usage_ = BandwidthUsage::kOverusing;
+        }
+    } else if (modifiedTrend < -threshold_) {
+        overuseCount_ = 0;
+        usage_ = BandwidthUsage::kUnderusing;
+    } else {
+        overuseCount_ = 0;
+        usage_ = BandwidthUsage::kNormal;
+    }
+}
+
+void BandwidthEstimator::UpdateAckedBitrate(const PacketResult& packet)
+{
+    ackedPackets_.emplace_back(packet.arrivalTime, packet.size);
+    ackedBytes_ += packet.size;
+    while (Int32(packet.arrivalTime - ackedPackets_.front().first) > kAckedWindow) {
+        ackedBytes_ -= ackedPackets_.front().second;
+        ackedPackets_.pop_front();
+    }
+    Int32 span = std::max(Int32(packet.arrivalTime - ackedPackets_.front().first), 100);
+    ackedBitrate_ = Uint32(Uint64(ackedBytes_) * 8 * 1000 / Uint64(span));
+}
+
+void BandwidthEstimator::UpdateTarget(Uint32 now, Uint32 rtt)
+{
+    Uint32 elapsed = hasUpdate_ ? std::min(now - lastUpdateTime_, 1000u) : 0;
+    hasUpdate_ = true;
+    lastUpdateTime_ = now;
+
+    // Decrease at most once per round trip, the effect of a decrease takes that long to show
+    Uint32 decreaseInterval = std::max(rtt, 100u);
+    bool canDecrease = !hasDecrease_ || now - lastDecreaseTime_ >= decreaseInterval;
+    double target = targetBitrate_;
+
+    switch (usage_) {
+    case BandwidthUsage::kOverusing:
+        if (canDecrease) {
+            double base = ackedBitrate_ > 0 ? ackedBitrate_ : target;
+            target = std::min(target, kDecreaseFactor * base);
+            hasDecrease_ = true;
+            lastDecreaseTime_ = now;
+            canDecrease = false;
+        }
+        break;
+    case BandwidthUsage::kUnderusing:
+        break; // Let the queue drain
+    case BandwidthUsage::kNormal:
+        if (lossRate_ <= kHighLoss) {
+            double increased = target * std::pow(kIncreasePerSecond, double(elapsed) / 1000.0);
+            if (ackedBitrate_ > 0) {
+                // Don't run far ahead of what actually gets through
+                increased = std::min(increased, std::max(target, 1.5 * ackedBitrate_ + 10000));
+            }
+            target = increased;
+        }
+        break;
+    }
+
+    if (lossRate_ > kHighLoss && canDecrease) {
+        target *= 1 - 0.5 * lossRate_;
+        hasDecrease_ = true;
+        lastDecreaseTime_ = now;
+    }
+    targetBitrate_ = Uint32(std::clamp(target, double(minBitrate_), double(maxBitrate_)));
+}
+
+}
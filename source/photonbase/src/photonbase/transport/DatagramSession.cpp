@@ -0,0 +1,1010 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "photonbase/transport/DatagramSession.h"
+#include "impl/ErasureCode.h"
+#include "photonbase/protocol/DataDeserializer.h"
+#include "photonbase/protocol/DataSerializer.h"
+#include <algorithm>
+#include <cmath>
+
+namespace pht {
+
+static const Uint8 kDataFrame = 1;
+static const Uint8 kAckFrame = 2;
+static const Uint8 kLossReportFrame = 3;
+static const Uint8 kParityFrame = 4;
+static const Uint8 kNackFrame = 5;
+static const Uint8 kFeedbackFrame = 6;
+static const Uint8 kModeMask = 0x03;
+static const Uint8 kFirstFlag = 0x10;
+static const Uint8 kLastFlag = 0x20;
+static const Uint8 kFecFlag = 0x40;
+
+static const Uint16 kMaxChannelId = 32767; // DUI[2]
+// A datagram starts with its sequence number. A parity shard is a fragment with its length and flags, its frame has
+// type, channel id, group base, data count, parity index, parity count and length
+static const Uint32 kDatagramHeaderSize = 4;
+static const Uint32 kShardHeaderSize = 3;
+static const Uint32 kMaxFragmentSize = kMaxDatagramSize - kDatagramHeaderSize - (1 + 2 + 4 + 1 + 1 + 1 + 2) - kShardHeaderSize;
+static const Uint32 kMaxAcksPerFrame = (kMaxDatagramSize - kDatagramHeaderSize - (1 + 2 + 2)) / 4;
+// Each arrival takes 1 or 2 bytes
+static const Uint32 kMaxFeedbackCount = (kMaxDatagramSize - kDatagramHeaderSize - (1 + 4 + 4 + 2)) / 2;
+static const Uint32 kMaxInFlight = 256; // Fragments per channel
+static const Uint32 kReceiveWindow = 4096; // Fragments per channel
+static const Uint32 kInitialRto = 200;
+static const Uint32 kMinRto = 20;
+static const Uint32 kMaxRto = 2000;
+static const Uint32 kMaxRetries = 10;
+static const Uint32 kMaxFecGroupDelay = 10; // A partial group is closed after this
+static const Uint32 kFecRecoveryWait = 50; // How long a missing payload may wait for its parity
+static const Uint32 kLossReportInterval = 500;
+static const Uint32 kNackReorderDelay = 5; // A hole may be caused by reordering, don't request it at once
+static const Uint32 kMaxMissingFragments = 1024; // Per channel
+static const Uint32 kRetransmitCacheTime = 1000; // Per channel
+static const Uint32 kRetransmitCacheBytes = 1024 * 1024; // Per channel
+static const Uint32 kFeedbackInterval = 50;
+static const Uint32 kSentDatagramHistory = 2000; // Datagrams not reported within this are forgotten
+static const Int32 kMaxArrivalDelta = 16383; // So that the zigzag encoded delta + 1 fits DUI[2]
+
+static void WriteSequence(std::vector<Uint8>& out, Uint32 sequence)
+{
+    for (int i = 0; i < 4; ++i) {
+        out.push_back(Uint8(sequence >> (8 * i)));
+    }
+}
+
+static bool ReadSequence(const Uint8*& p, const Uint8* end, Uint32& sequence)
+{
+    if (end - p < 4) {
+        return false;
+    }
+    sequence = Uint32(p[0]) | Uint32(p[1]) << 8u | Uint32(p[2]) << 16u | Uint32(p[3]) << 24u;
+    p += 4;
+    return true;
+}
+
+template <int N, class T>
+static bool ReadDUI(const Uint8*& p, const Uint8* end, T& value)
+{
+    return DataDeserializer::DeserializeFromDUI<N>(value, [&p, end](const Uint8** ptr, Uint32 len) {
+        *ptr = p < end ? p++ : nullptr;
+    });
+}
+
+DatagramSession::DatagramSession()
+    : rto_(kInitialRto)
+{
+    stats_.targetBitrate = estimator_.GetTargetBitrate();
+}
+
+bool DatagramSession::SetChannelMode(Uint16 channelId, ReliabilityMode mode)
+{
+    if (channelId == 0 || channelId > kMaxChannelId) {
+        return false;
+    }
+    auto& channel = sendChannels_[channelId];
+    if (channel.nextSequence != 0) {
+        return false;
+    }
+    channel.mode = mode;
+    return true;
+}
+
+bool DatagramSession::SetChannelFec(Uint16 channelId, Uint32 dataShards, Uint32 parityShards, bool adaptive)
+{
+    auto it = sendChannels_.find(channelId);
+    if (it == sendChannels_.end() || it->second.mode != ReliabilityMode::kUnreliable) {
+        return false;
+    }
+    if (dataShards == 0 || dataShards + parityShards > 256) {
+        return false;
+    }
+    auto& fec = it->second.fec;
+    fec.dataShards = dataShards;
+    fec.parityShards = parityShards;
+    fec.adaptive = adaptive;
+    if (parityShards == 0) {
+        fec.shards.clear();
+    }
+    return true;
+}
+
+bool DatagramSession::SetChannelNack(Uint16 channelId, Uint32 playoutDelay)
+{
+    if (channelId == 0 || channelId > kMaxChannelId) {
+        return false;
+    }
+    auto it = receiveChannels_.find(channelId);
+    if (it == receiveChannels_.end()) {
+        it = receiveChannels_.emplace(channelId, ReceiveChannel {}).first;
+        it->second.mode = ReliabilityMode::kUnreliable;
+    } else if (it->second.mode != ReliabilityMode::kUnreliable) {
+        return false;
+    }
+    it->second.playoutDelay = playoutDelay;
+    if (playoutDelay == 0) {
+        it->second.missing.clear();
+    }
+    return true;
+}
+
+void DatagramSession::SetBitrateLimits(Uint32 minBitrate, Uint32 startBitrate, Uint32 maxBitrate)
+{
+    estimator_.SetBitrateLimits(minBitrate, startBitrate, maxBitrate);
+    stats_.targetBitrate = estimator_.GetTargetBitrate();
+}
+
+bool DatagramSession::GetChannelLossRate(Uint16 channelId, double& lossRate) const
+{
+    auto it = sendChannels_.find(channelId);
+    if (it == sendChannels_.end() || !it->second.hasLossRate) {
+        return false;
+    }
+    lossRate = it->second.lossRate;
+    return true;
+}
+
+bool DatagramSession::GetPeerChannelMode(Uint16 channelId, ReliabilityMode& mode) const
+{
+    auto it = receiveChannels_.find(channelId);
+    if (it == receiveChannels_.end()) {
+        return false;
+    }
+    mode = it->second.mode;
+    return true;
+}
+
+bool DatagramSession::Send(Uint16 channelId, const Uint8* data, Uint32 size)
+{
+    if (size == 0 || channelId > kMaxChannelId) {
+        return false;
+    }
+    auto& channel = sendChannels_[channelId];
+    for (Uint32 offset = 0; offset < size; offset += kMaxFragmentSize) {
+        Uint32 n = std::min(kMaxFragmentSize, size - offset);
+        Fragment fragment;
+        fragment.sequence = channel.nextSequence++;
+        fragment.first = offset == 0;
+        fragment.last = offset + n == size;
+        fragment.data.assign(data + offset, data + offset + n);
+        channel.queue.push_back(std::move(fragment));
+    }
+    return true;
+}
+
+bool DatagramSession::OnDatagram(const Uint8* data, Uint32 size, Uint32 now)
+{
+    ++stats_.receivedDatagrams;
+    const Uint8* p = data;
+    const Uint8* end = data + size;
+    Uint32 sequence;
+    if (!ReadSequence(p, end, sequence)) {
+        return false;
+    }
+    bool tracked = false;
+    while (p < end) {
+        Uint8 type = *p++;
+        bool ok = false;
+        tracked = tracked || type == kDataFrame || type == kParityFrame;
+        switch (type) {
+        case kDataFrame:
+            ok = OnDataFrame(p, end, now);
+            break;
+        case kAckFrame:
+            ok = OnAckFrame(p, end, now);
+            break;
+        case kLossReportFrame:
+            ok = OnLossReportFrame(p, end);
+            break;
+        case kParityFrame:
+            ok = OnParityFrame(p, end, now);
+            break;
+        case kNackFrame:
+            ok = OnNackFrame(p, end);
+            break;
+        case kFeedbackFrame:
+            ok = OnFeedbackFrame(p, end, now);
+            break;
+        default:
+            break;
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+
+    if (tracked) {
+        if (!hasFeedbackBase_) {
+            hasFeedbackBase_ = true;
+            feedbackBase_ = sequence;
+        }
+        // A datagram arriving after its report is counted as lost
+        if (Int32(sequence - feedbackBase_) >= 0) {
+            arrivals_.emplace(sequence, now);
+        }
+    }
+    return true;
+}
+
+static std::vector<Uint8> MakeShard(const std::vector<Uint8>& data, bool first, bool last)
+{
+    std::vector<Uint8> shard;
+    shard.reserve(kShardHeaderSize + data.size());
+    shard.push_back(Uint8(data.size()));
+    shard.push_back(Uint8(data.size() >> 8u));
+    shard.push_back(Uint8((first ? kFirstFlag : 0) | (last ? kLastFlag : 0)));
+    shard.insert(shard.end(), data.begin(), data.end());
+    return shard;
+}
+
+bool DatagramSession::OnDataFrame(const Uint8*& p, const Uint8* end, Uint32 now)
+{
+    Uint16 channelId;
+    Uint32 sequence;
+    Uint16 length;
+    if (!ReadDUI<2>(p, end, channelId) || p == end) {
+        return false;
+    }
+    Uint8 flags = *p++;
+    if (!ReadSequence(p, end, sequence) || !ReadDUI<2>(p, end, length) || end - p < length || length == 0) {
+        return false;
+    }
+    auto mode = ReliabilityMode(flags & kModeMask);
+    if (mode > ReliabilityMode::kUnreliable) {
+        return false;
+    }
+
+    Fragment fragment;
+    fragment.sequence = sequence;
+    fragment.first = (flags & kFirstFlag) != 0;
+    fragment.last = (flags & kLastFlag) != 0;
+    fragment.data.assign(p, p + length);
+    p += length;
+
+    auto it = receiveChannels_.find(channelId);
+    if (it == receiveChannels_.end()) {
+        it = receiveChannels_.emplace(channelId, ReceiveChannel {}).first;
+        it->second.mode = mode;
+    } else if (it->second.mode != mode) {
+        return false;
+    }
+    auto& channel = it->second;
+
+    if (mode == ReliabilityMode::kUnreliable) {
+        if (!channel.hasHighestSequence || Int32(sequence - channel.highestSequence) > 0) {
+            if (channel.playoutDelay > 0) {
+                // The fragments skipped are lost or reordered
+                Uint32 s = channel.hasHighestSequence ? channel.highestSequence + 1 : channel.base;
+                for (; s != sequence && channel.missing.size() < kMaxMissingFragments; ++s) {
+                    channel.missing.emplace(s, MissingFragment { now, 0, 0 });
+                }
+            }
+            channel.hasHighestSequence = true;
+            channel.highestSequence = sequence;
+        }
+        ++channel.receivedInInterval;
+
+        auto missingIt = channel.missing.find(sequence);
+        if (missingIt != channel.missing.end() && missingIt->second.nacks == 1) {
+            OnRttSample(now - missingIt->second.lastNackTime);
+        }
+    }
+
+    Int32 offset = Int32(sequence - channel.base);
+    if (offset >= Int32(kReceiveWindow)) {
+        if (mode != ReliabilityMode::kUnreliable) {
+            return true; // Not acknowledged, the peer will send it again
+        }
+        // Give up the oldest fragments to make room
+        Uint32 newBase = sequence - kReceiveWindow + 1;
+        channel.pending.erase(channel.pending.begin(), channel.pending.lower_bound(newBase));
+        stats_.droppedFragments += newBase - channel.base;
+        channel.base = newBase;
+        channel.hasGap = false;
+    }
+    if (mode != ReliabilityMode::kUnreliable) {
+        // Acknowledge duplicates too, the previous acknowledgement may be lost
+        channel.acks.push_back(sequence);
+    }
+    if (offset < 0 || channel.delivered.count(sequence) != 0 || channel.pending.count(sequence) != 0) {
+        return true; // Duplicated or too late
+    }
+
+    if ((flags & kFecFlag) != 0 && mode == ReliabilityMode::kUnreliable) {
+        channel.shards[sequence] = MakeShard(fragment.data, fragment.first, fragment.last);
+        OnFragment(channelId, channel, std::move(fragment), now);
+        // The fragment may complete a group whose parity has arrived
+        auto groupIt = channel.groups.upper_bound(sequence);
+        if (groupIt != channel.groups.begin()) {
+            --groupIt;
+            if (Uint32(sequence - groupIt->first) < groupIt->second.dataCount) {
+                TryRecover(channelId, channel, groupIt->first, now);
+            }
+        }
+        return true;
+    }
+    OnFragment(channelId, channel, std::move(fragment), now);
+    return true;
+}
+
+void DatagramSession::OnFragment(Uint16 channelId, ReceiveChannel& channel, Fragment&& fragment, Uint32 now)
+{
+    Uint32 sequence = fragment.sequence;
+    channel.missing.erase(sequence);
+    channel.pending.emplace(sequence, std::move(fragment));
+    switch (channel.mode) {
+    case ReliabilityMode::kReliableOrdered:
+        DeliverOrdered(channelId, channel);
+        break;
+    case ReliabilityMode::kReliableUnordered:
+        DeliverUnordered(channelId, channel, sequence);
+        break;
+    case ReliabilityMode::kUnreliable:
+        DeliverSequenced(channelId, channel, now);
+        break;
+    }
+}
+
+bool DatagramSession::OnAckFrame(const Uint8*& p, const Uint8* end, Uint32 now)
+{
+    Uint16 channelId;
+    Uint16 count;
+    if (!ReadDUI<2>(p, end, channelId) || !ReadDUI<2>(p, end, count)) {
+        return false;
+    }
+    auto it = sendChannels_.find(channelId);
+    for (Uint16 i = 0; i < count; ++i) {
+        Uint32 sequence;
+        if (!ReadSequence(p, end, sequence)) {
+            return false;
+        }
+        if (it == sendChannels_.end()) {
+            continue;
+        }
+        auto& inFlight = it->second.inFlight;
+        auto fragmentIt = inFlight.find(sequence);
+        if (fragmentIt == inFlight.end()) {
+            continue; // Acknowledged already
+        }
+        if (fragmentIt->second.retries == 0) {
+            // Karn's algorithm, the acknowledgement of a retransmitted fragment is ambiguous
+            OnRttSample(now - fragmentIt->second.firstSentTime);
+        }
+        inFlight.erase(fragmentIt);
+    }
+    return true;
+}
+
+bool DatagramSession::OnLossReportFrame(const Uint8*& p, const Uint8* end)
+{
+    Uint16 channelId;
+    Uint32 expected;
+    Uint32 received;
+    if (!ReadDUI<2>(p, end, channelId) || !ReadDUI<4>(p, end, expected) || !ReadDUI<4>(p, end, received)) {
+        return false;
+    }
+    auto it = sendChannels_.find(channelId);
+    if (it == sendChannels_.end() || expected == 0) {
+        return true;
+    }
+    // Reordered fragments may be counted in the next interval
+    double loss = 1.0 - double(std::min(received, expected)) / double(expected);
+    auto& channel = it->second;
+    channel.lossRate = channel.hasLossRate ? 0.75 * channel.lossRate + 0.25 * loss : loss;
+    channel.hasLossRate = true;
+    return true;
+}
+
+bool DatagramSession::OnNackFrame(const Uint8*& p, const Uint8* end)
+{
+    Uint16 channelId;
+    Uint16 count;
+    if (!ReadDUI<2>(p, end, channelId) || !ReadDUI<2>(p, end, count)) {
+        return false;
+    }
+    auto it = sendChannels_.find(channelId);
+    for (Uint16 i = 0; i < count; ++i) {
+        Uint32 sequence;
+        if (!ReadSequence(p, end, sequence)) {
+            return false;
+        }
+        if (it == sendChannels_.end() || it->second.retransmitCache.count(sequence) == 0) {
+            continue; // Evicted already
+        }
+        auto& nacked = it->second.nacked;
+        if (std::find(nacked.begin(), nacked.end(), sequence) == nacked.end()) {
+            nacked.push_back(sequence);
+        }
+    }
+    return true;
+}
+
+bool DatagramSession::OnFeedbackFrame(const Uint8*& p, const Uint8* end, Uint32 now)
+{
+    Uint32 base;
+    Uint32 referenceTime;
+    Uint16 count;
+    if (!ReadSequence(p, end, base) || !ReadSequence(p, end, referenceTime) || !ReadDUI<2>(p, end, count)) {
+        return false;
+    }
+    std::vector<BandwidthEstimator::PacketResult> results;
+    Uint32 arrivalTime = referenceTime;
+    for (Uint16 i = 0; i < count; ++i) {
+        Uint16 value;
+        if (!ReadDUI<2>(p, end, value)) {
+            return false;
+        }
+        bool received = value != 0;
+        if (received) {
+            // Zigzag encoded, reordered datagrams may arrive earlier than the previous one
+            Uint32 zigzag = value - 1u;
+            Int32 delta = Int32(zigzag >> 1u) ^ -Int32(zigzag & 1u);
+            arrivalTime += Uint32(delta);
+        }
+        auto it = sentDatagrams_.find(base + i);
+        if (it == sentDatagrams_.end()) {
+            continue;
+        }
+        results.push_back({ it->second.sendTime, arrivalTime, it->second.size, received });
+        sentDatagrams_.erase(it);
+    }
+    estimator_.OnFeedback(results, now, hasRtt_ ? stats_.rtt : 0);
+    stats_.targetBitrate = estimator_.GetTargetBitrate();
+    stats_.ackedBitrate = estimator_.GetAckedBitrate();
+    stats_.bandwidthUsage = estimator_.GetUsage();
+    return true;
+}
+
+void DatagramSession::WriteFeedback(std::vector<Uint8>& frame, const FrameCallback& append)
+{
+    auto write = [&frame](Uint8 b) { frame.push_back(b); };
+    Uint32 last = arrivals_.rbegin()->first;
+    while (Int32(last - feedbackBase_) >= 0) {
+        Uint32 count = std::min(last - feedbackBase_ + 1, kMaxFeedbackCount);
+        auto it = arrivals_.begin();
+        Uint32 previousTime = it->second;
+        frame.push_back(kFeedbackFrame);
+        WriteSequence(frame, feedbackBase_);
+        WriteSequence(frame, previousTime);
+        DataSerializer::SerializeToDUI<2>(Uint16(count), write);
+        for (Uint32 i = 0; i < count; ++i) {
+            Uint32 sequence = feedbackBase_ + i;
+            if (it == arrivals_.end() || it->first != sequence) {
+                frame.push_back(0); // Lost
+                continue;
+            }
+            Int32 delta = std::clamp(Int32(it->second - previousTime), -kMaxArrivalDelta, kMaxArrivalDelta);
+            previousTime += Uint32(delta);
+            Uint32 zigzag = (Uint32(delta) << 1u) ^ Uint32(delta >> 31);
+            DataSerializer::SerializeToDUI<2>(Uint16(zigzag + 1), write);
+            it = arrivals_.erase(it);
+        }
+        append();
+        feedbackBase_ += count;
+    }
+}
+
+bool DatagramSession::OnParityFrame(const Uint8*& p, const Uint8* end, Uint32 now)
+{
+    Uint16 channelId;
+    Uint32 groupBase;
+    Uint16 length;
+    if (!ReadDUI<2>(p, end, channelId) || !ReadSequence(p, end, groupBase) || end - p < 3) {
+        return false;
+    }
+    Uint32 dataCount = Uint32(p[0]) + 1;
+    Uint32 parityIndex = p[1];
+    Uint32 parityCount = Uint32(p[2]) + 1;
+    p += 3;
+    if (!ReadDUI<2>(p, end, length) || end - p < length || length < kShardHeaderSize) {
+        return false;
+    }
+    if (parityIndex >= parityCount || dataCount + parityCount > 256) {
+        return false;
+    }
+    std::vector<Uint8> parity(p, p + length);
+    p += length;
+
+    auto it = receiveChannels_.find(channelId);
+    if (it == receiveChannels_.end()) {
+        it = receiveChannels_.emplace(channelId, ReceiveChannel {}).first;
+        it->second.mode = ReliabilityMode::kUnreliable;
+    } else if (it->second.mode != ReliabilityMode::kUnreliable) {
+        return false;
+    }
+    auto& channel = it->second;
+    channel.fec = true;
+    if (Int32(groupBase + dataCount - channel.base) <= 0) {
+        return true; // Too late, all of its payloads are delivered or given up
+    }
+
+    auto groupIt = channel.groups.find(groupBase);
+    if (groupIt == channel.groups.end()) {
+        groupIt = channel.groups.emplace(groupBase, FecGroup {}).first;
+        groupIt->second.dataCount = dataCount;
+        groupIt->second.parityCount = parityCount;
+    }
+    auto& group = groupIt->second;
+    if (group.dataCount != dataCount || group.parityCount != parityCount
+        || (!group.parity.empty() && group.parity.begin()->second.size() != parity.size())) {
+        return true; // Inconsistent, ignore it
+    }
+    group.parity[parityIndex] = std::move(parity);
+    TryRecover(channelId, channel, groupBase, now);
+    return true;
+}
+
+void DatagramSession::TryRecover(Uint16 channelId, ReceiveChannel& channel, Uint32 groupBase, Uint32 now)
+{
+    auto groupIt = channel.groups.find(groupBase);
+    if (groupIt == channel.groups.end() || groupIt->second.parity.empty()) {
+        return;
+    }
+    auto& group = groupIt->second;
+    Uint32 present = 0;
+    for (Uint32 j = 0; j < group.dataCount; ++j) {
+        present += Uint32(channel.shards.count(groupBase + j));
+    }
+    if (present == group.dataCount) {
+        channel.groups.erase(groupIt); // Nothing is lost
+        return;
+    }
+    if (present + group.parity.size() < group.dataCount) {
+        return; // Wait for more
+    }
+
+    auto size = Uint32(group.parity.begin()->second.size());
+    std::vector<std::vector<Uint8>> padded(group.dataCount);
+    std::vector<const Uint8*> data(group.dataCount, nullptr);
+    std::vector<const Uint8*> parity(group.parityCount, nullptr);
+    for (Uint32 j = 0; j < group.dataCount; ++j) {
+        auto shardIt = channel.shards.find(groupBase + j);
+        if (shardIt != channel.shards.end()) {
+            padded[j] = shardIt->second;
+            padded[j].resize(std::max<size_t>(size, padded[j].size()), 0);
+            data[j] = padded[j].data();
+        }
+    }
+    for (auto& [index, shard] : group.parity) {
+        parity[index] = shard.data();
+    }
+    std::map<Uint32, std::vector<Uint8>> recovered;
+    bool ok = ErasureCode::Decode(data, parity, size, recovered);
+    channel.groups.erase(groupIt);
+    if (!ok) {
+        return;
+    }
+
+    for (auto& [index, shard] : recovered) {
+        Uint32 length = Uint32(shard[0]) | Uint32(shard[1]) << 8u;
+        if (length == 0 || kShardHeaderSize + length > size) {
+            continue; // Corrupted
+        }
+        Fragment fragment;
+        fragment.sequence = groupBase + index;
+        fragment.first = (shard[2] & kFirstFlag) != 0;
+        fragment.last = (shard[2] & kLastFlag) != 0;
+        fragment.data.assign(shard.begin() + kShardHeaderSize, shard.begin() + kShardHeaderSize + length);
+        if (Int32(fragment.sequence - channel.base) < 0 || channel.pending.count(fragment.sequence) != 0) {
+            continue;
+        }
+        ++stats_.recoveredFragments;
+        channel.shards[fragment.sequence] = std::move(shard);
+        OnFragment(channelId, channel, std::move(fragment), now);
+    }
+}
+
+bool DatagramSession::FindPayload(const ReceiveChannel& channel, Uint32 sequence, Uint32& first, Uint32& last)
+{
+    auto& pending = channel.pending;
+    auto it = pending.find(sequence);
+    if (it == pending.end()) {
+        return false;
+    }
+    first = sequence;
+    while (!it->second.first) {
+        it = pending.find(first - 1);
+        if (it == pending.end()) {
+            return false;
+        }
+        --first;
+    }
+    last = sequence;
+    it = pending.find(last);
+    while (!it->second.last) {
+        it = pending.find(last + 1);
+        if (it == pending.end()) {
+            return false;
+        }
+        ++last;
+    }
+    return true;
+}
+
+void DatagramSession::Deliver(Uint16 channelId, ReceiveChannel& channel, Uint32 first, Uint32 last)
+{
+    auto& pending = channel.pending;
+    Uint32 size = 0;
+    for (Uint32 s = first; s != last + 1; ++s) {
+        size += Uint32(pending.at(s).data.size());
+    }
+    ByteArray payload(size);
+    Uint32 offset = 0;
+    for (Uint32 s = first; s != last + 1; ++s) {
+        auto it = pending.find(s);
+        std::copy(it->second.data.begin(), it->second.data.end(), payload.Data() + offset);
+        offset += Uint32(it->second.data.size());
+        pending.erase(it);
+    }
+    received_.emplace_back(channelId, std::move(payload));
+}
+
+void DatagramSession::DeliverOrdered(Uint16 channelId, ReceiveChannel& channel)
+{
+    Uint32 first;
+    Uint32 last;
+    while (FindPayload(channel, channel.base, first, last) && first == channel.base) {
+        Deliver(channelId, channel, first, last);
+        channel.base = last + 1;
+    }
+}
+
+void DatagramSession::DeliverUnordered(Uint16 channelId, ReceiveChannel& channel, Uint32 sequence)
+{
+    Uint32 first;
+    Uint32 last;
+    if (!FindPayload(channel, sequence, first, last)) {
+        return;
+    }
+    Deliver(channelId, channel, first, last);
+    for (Uint32 s = first; s != last + 1; ++s) {
+        channel.delivered.insert(s);
+    }
+    while (channel.delivered.erase(channel.base) != 0) {
+        ++channel.base;
+    }
+}
+
+void DatagramSession::DeliverSequenced(Uint16 channelId, ReceiveChannel& channel, Uint32 now)
+{
+    Uint32 first;
+    Uint32 last;
+    while (true) {
+        if (FindPayload(channel, channel.base, first, last) && first == channel.base) {
+            Deliver(channelId, channel, first, last);
+            channel.base = last + 1;
+            channel.hasGap = false;
+            continue;
+        }
+        // Look for a complete payload after the gap
+        bool found = false;
+        for (auto& [sequence, fragment] : channel.pending) {
+            if (fragment.first && FindPayload(channel, sequence, first, last)) {
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            break;
+        }
+        if (!channel.hasGap) {
+            channel.hasGap = true;
+            channel.gapTime = now;
+        }
+        Uint32 wait = std::max(channel.fec ? kFecRecoveryWait : 0, channel.playoutDelay);
+        if (now - channel.gapTime < wait) {
+            break; // The parity or a retransmission may fill the gap
+        }
+        channel.pending.erase(channel.pending.begin(), channel.pending.lower_bound(first));
+        stats_.droppedFragments += first - channel.base;
+        channel.base = first;
+        channel.hasGap = false;
+    }
+
+    // Forget FEC state no longer useful, a group has at most 255 data fragments
+    auto& groups = channel.groups;
+    while (!groups.empty() && Int32(groups.begin()->first + groups.begin()->second.dataCount - channel.base) <= 0) {
+        groups.erase(groups.begin());
+    }
+    channel.shards.erase(channel.shards.begin(), channel.shards.lower_bound(channel.base - 255));
+    channel.missing.erase(channel.missing.begin(), channel.missing.lower_bound(channel.base));
+}
+
+void DatagramSession::WriteNacks(Uint16 channelId, ReceiveChannel& channel, Uint32 now, std::vector<Uint8>& frame,
+    const FrameCallback& append)
+{
+    Uint32 rtt = hasRtt_ ? stats_.rtt : 0;
+    Uint32 retryInterval = std::max(rtt + rtt / 2, kMinRto);
+    std::vector<Uint32> requests;
+    for (auto it = channel.missing.begin(); it != channel.missing.end();) {
+        auto& missing = it->second;
+        if (now - missing.detectedTime + rtt > channel.playoutDelay) {
+            // It would be too late even if requested now
+            ++stats_.suppressedNacks;
+            it = channel.missing.erase(it);
+            continue;
+        }
+        bool due = missing.nacks == 0 ? now - missing.detectedTime >= kNackReorderDelay : now - missing.lastNackTime >= retryInterval;
+        if (due) {
+            requests.push_back(it->first);
+            ++missing.nacks;
+            missing.lastNackTime = now;
+        }
+        ++it;
+    }
+    stats_.nackedFragments += requests.size();
+
+    auto write = [&frame](Uint8 b) { frame.push_back(b); };
+    for (size_t i = 0; i < requests.size(); i += kMaxAcksPerFrame) {
+        auto count = Uint16(std::min<size_t>(kMaxAcksPerFrame, requests.size() - i));
+        frame.push_back(kNackFrame);
+        DataSerializer::SerializeToDUI<2>(channelId, write);
+        DataSerializer::SerializeToDUI<2>(count, write);
+        for (Uint16 k = 0; k < count; ++k) {
+            WriteSequence(frame, requests[i + k]);
+        }
+        append();
+    }
+}
+
+bool DatagramSession::Receive(Uint16& channelId, ByteArray& payload)
+{
+    if (received_.empty()) {
+        return false;
+    }
+    channelId = received_.front().first;
+    payload = std::move(received_.front().second);
+    received_.pop_front();
+    return true;
+}
+
+void DatagramSession::OnRttSample(Uint32 rtt)
+{
+    // RFC 6298
+    if (!hasRtt_) {
+        hasRtt_ = true;
+        stats_.rtt = rtt;
+        rttVariance_ = rtt / 2;
+    } else {
+        Uint32 delta = rtt > stats_.rtt ? rtt - stats_.rtt : stats_.rtt - rtt;
+        rttVariance_ = (3 * rttVariance_ + delta) / 4;
+        stats_.rtt = (7 * stats_.rtt + rtt) / 8;
+    }
+    rto_ = std::clamp(stats_.rtt + 4 * rttVariance_, kMinRto, kMaxRto);
+}
+
+static void WriteDataFrame(std::vector<Uint8>& out, Uint16 channelId, ReliabilityMode mode, const std::vector<Uint8>& data,
+    Uint32 sequence, Uint8 flags)
+{
+    auto write = [&out](Uint8 b) { out.push_back(b); };
+    out.push_back(kDataFrame);
+    DataSerializer::SerializeToDUI<2>(channelId, write);
+    out.push_back(Uint8(Uint8(mode) | flags));
+    WriteSequence(out, sequence);
+    DataSerializer::SerializeToDUI<2>(Uint16(data.size()), write);
+    out.insert(out.end(), data.begin(), data.end());
+}
+
+static Uint8 FragmentFlags(bool first, bool last)
+{
+    return Uint8((first ? kFirstFlag : 0) | (last ? kLastFlag : 0));
+}
+
+void DatagramSession::WriteParity(Uint16 channelId, SendChannel& channel, std::vector<Uint8>& frame, const FrameCallback& append)
+{
+    auto& fec = channel.fec;
+    auto dataCount = Uint32(fec.shards.size());
+    Uint32 parityCount = fec.parityShards;
+    if (fec.adaptive) {
+        // Twice the expected losses, so most groups are rebuilt
+        auto expected = channel.hasLossRate ? std::ceil(2 * channel.lossRate * dataCount) : double(parityCount);
+        parityCount = std::clamp(Uint32(expected), 1u, fec.parityShards);
+    }
+    parityCount = std::min(parityCount, 256 - dataCount);
+
+    size_t size = 0;
+    for (auto& shard : fec.shards) {
+        size = std::max(size, shard.size());
+    }
+    std::vector<const Uint8*> data;
+    for (auto& shard : fec.shards) {
+        shard.resize(size, 0);
+        data.push_back(shard.data());
+    }
+    std::vector<Uint8> parity(size);
+    auto write = [&frame](Uint8 b) { frame.push_back(b); };
+    for (Uint32 i = 0; i < parityCount; ++i) {
+        ErasureCode::Encode(data, Uint32(size), parityCount, i, parity.data());
+        frame.push_back(kParityFrame);
+        DataSerializer::SerializeToDUI<2>(channelId, write);
+        WriteSequence(frame, fec.groupBase);
+        frame.push_back(Uint8(dataCount - 1));
+        frame.push_back(Uint8(i));
+        frame.push_back(Uint8(parityCount - 1));
+        DataSerializer::SerializeToDUI<2>(Uint16(size), write);
+        frame.insert(frame.end(), parity.begin(), parity.end());
+        append();
+    }
+    fec.shards.clear();
+}
+
+bool DatagramSession::Poll(Uint32 now, const DatagramCallback& send)
+{
+    std::vector<Uint8> datagram;
+    std::vector<Uint8> frame;
+    bool tracked = false;
+    auto flush = [this, &datagram, &tracked, &send, now]() {
+        if (datagram.empty()) {
+            return;
+        }
+        Uint32 sequence = nextDatagramSequence_++;
+        for (Uint32 i = 0; i < kDatagramHeaderSize; ++i) {
+            datagram[i] = Uint8(sequence >> (8 * i));
+        }
+        if (tracked) {
+            sentDatagrams_[sequence] = SentDatagram { now, Uint32(datagram.size()) };
+        }
+        send(datagram.data(), Uint32(datagram.size()));
+        ++stats_.sentDatagrams;
+        datagram.clear();
+        tracked = false;
+    };
+    auto append = [&datagram, &frame, &tracked, &flush]() {
+        if (datagram.size() + frame.size() > kMaxDatagramSize) {
+            flush();
+        }
+        if (datagram.empty()) {
+            datagram.resize(kDatagramHeaderSize);
+        }
+        tracked = tracked || frame[0] == kDataFrame || frame[0] == kParityFrame;
+        datagram.insert(datagram.end(), frame.begin(), frame.end());
+        frame.clear();
+    };
+    auto write = [&frame](Uint8 b) { frame.push_back(b); };
+
+    if (!arrivals_.empty() && now - lastFeedbackTime_ >= kFeedbackInterval) {
+        WriteFeedback(frame, append);
+        lastFeedbackTime_ = now;
+    }
+    while (!sentDatagrams_.empty() && now - sentDatagrams_.begin()->second.sendTime > kSentDatagramHistory) {
+        sentDatagrams_.erase(sentDatagrams_.begin());
+    }
+
+    for (auto& [channelId, channel] : receiveChannels_) {
+        auto& acks = channel.acks;
+        for (size_t i = 0; i < acks.size(); i += kMaxAcksPerFrame) {
+            auto count = Uint16(std::min<size_t>(kMaxAcksPerFrame, acks.size() - i));
+            frame.push_back(kAckFrame);
+            DataSerializer::SerializeToDUI<2>(channelId, write);
+            DataSerializer::SerializeToDUI<2>(count, write);
+            for (Uint16 k = 0; k < count; ++k) {
+                WriteSequence(frame, acks[i + k]);
+            }
+            append();
+        }
+        acks.clear();
+
+        if (channel.mode != ReliabilityMode::kUnreliable) {
+            continue;
+        }
+        if (channel.hasGap) {
+            DeliverSequenced(channelId, channel, now);
+        }
+        if (channel.playoutDelay > 0) {
+            WriteNacks(channelId, channel, now, frame, append);
+        }
+        if (channel.hasHighestSequence && now - channel.lastReportTime >= kLossReportInterval) {
+            Uint32 expected = channel.highestSequence + 1 - channel.reportBase;
+            frame.push_back(kLossReportFrame);
+            DataSerializer::SerializeToDUI<2>(channelId, write);
+            DataSerializer::SerializeToDUI<4>(std::min(expected, 536870911u), write);
+            DataSerializer::SerializeToDUI<4>(std::min(channel.receivedInInterval, 536870911u), write);
+            append();
+            channel.reportBase = channel.highestSequence + 1;
+            channel.receivedInInterval = 0;
+            channel.lastReportTime = now;
+        }
+    }
+
+    for (auto& [channelId, channel] : sendChannels_) {
+        for (auto& [sequence, inFlight] : channel.inFlight) {
+            Uint32 timeout = std::min(rto_ << std::min(inFlight.retries, 16u), kMaxRto);
+            if (now - inFlight.lastSentTime < timeout) {
+                continue;
+            }
+            if (inFlight.retries >= kMaxRetries) {
+                flush();
+                return false;
+            }
+            ++inFlight.retries;
+            ++stats_.retransmissions;
+            inFlight.lastSentTime = now;
+            auto& fragment = inFlight.fragment;
+            WriteDataFrame(frame, channelId, channel.mode, fragment.data, sequence, FragmentFlags(fragment.first, fragment.last));
+            append();
+        }
+
+        for (auto sequence : channel.nacked) {
+            auto it = channel.retransmitCache.find(sequence);
+            if (it == channel.retransmitCache.end()) {
+                continue;
+            }
+            ++stats_.retransmissions;
+            auto& cached = it->second;
+            WriteDataFrame(frame, channelId, channel.mode, cached.fragment.data, sequence, cached.flags);
+            append();
+        }
+        channel.nacked.clear();
+    }
+
+    // One fragment per channel in turn, so a large payload does not delay the other channels
+    bool progress = true;
+    while (progress) {
+        progress = false;
+        for (auto& [channelId, channel] : sendChannels_) {
+            bool reliable = channel.mode != ReliabilityMode::kUnreliable;
+            if (channel.queue.empty() || (reliable && channel.inFlight.size() >= kMaxInFlight)) {
+                continue;
+            }
+            auto fragment = std::move(channel.queue.front());
+            channel.queue.pop_front();
+            auto& fec = channel.fec;
+            bool protect = !reliable && fec.parityShards > 0;
+            Uint8 flags = FragmentFlags(fragment.first, fragment.last) | (protect ? kFecFlag : 0);
+            WriteDataFrame(frame, channelId, channel.mode, fragment.data, fragment.sequence, flags);
+            append();
+            if (protect) {
+                if (fec.shards.empty()) {
+                    fec.groupBase = fragment.sequence;
+                    fec.groupStartTime = now;
+                }
+                fec.shards.push_back(MakeShard(fragment.data, fragment.first, fragment.last));
+                if (fec.shards.size() >= fec.dataShards) {
+                    WriteParity(channelId, channel, frame, append);
+                }
+            }
+            Uint32 sequence = fragment.sequence;
+            if (reliable) {
+                channel.inFlight.emplace(sequence, InFlightFragment { std::move(fragment), now, now, 0 });
+            } else {
+                channel.retransmitCacheBytes += Uint32(fragment.data.size());
+                channel.retransmitCache.emplace(sequence, CachedFragment { std::move(fragment), flags, now });
+            }
+            progress = true;
+        }
+    }
+
+    for (auto& [channelId, channel] : sendChannels_) {
+        auto& fec = channel.fec;
+        if (!fec.shards.empty() && now - fec.groupStartTime >= kMaxFecGroupDelay) {
+            WriteParity(channelId, channel, frame, append);
+        }
+        auto& cache = channel.retransmitCache;
+        while (!cache.empty()
+            && (now - cache.begin()->second.sentTime > kRetransmitCacheTime || channel.retransmitCacheBytes > kRetransmitCacheBytes)) {
+            channel.retransmitCacheBytes -= Uint32(cache.begin()->second.fragment.data.size());
+            cache.erase(cache.begin());
+        }
+    }
+    flush();
+    return true;
+}
+
+bool DatagramSession::HasPendingData() const
+{
+    for (auto& [channelId, channel] : sendChannels_) {
+        if (!channel.queue.empty() || !channel.inFlight.empty() || !channel.fec.shards.empty() || !channel.nacked.empty()) {
+            return true;
+        }
+    }
+    for (auto& [channelId, channel] : receiveChannels_) {
+        if (!channel.acks.empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+}
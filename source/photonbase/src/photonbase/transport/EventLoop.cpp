@@ -0,0 +1,181 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "photonbase/transport/EventLoop.h"
+#include "photonbase/transport/TcpSocket.h"
+#include "photonbase/transport/impl/EventLoopImpl.h"
+
+namespace pht {
+
+struct LoopTimer::Impl : public LoopHandle {
+    void Close() override
+    {
+        owner->Close();
+    }
+
+    LoopTimer* owner { nullptr };
+    uv_timer_t timer {};
+    Callback callback {};
+    bool closing { false };
+};
+
+LoopTimer::LoopTimer()
+    : impl_(std::make_unique<Impl>())
+{
+    impl_->owner = this;
+}
+
+LoopTimer::~LoopTimer() = default;
+
+bool LoopTimer::Start(Uint64 timeout, Uint64 repeat, Callback callback)
+{
+    if (impl_->closing) {
+        return false;
+    }
+    impl_->callback = std::move(callback);
+    return uv_timer_start(&impl_->timer, [](uv_timer_t* timer) {
+        auto* impl = static_cast<Impl*>(static_cast<LoopHandle*>(timer->data));
+        // The callback may restart the timer with another callback
+        auto callback = impl->callback;
+        callback();
+    }, timeout, repeat) == 0;
+}
+
+void LoopTimer::Stop()
+{
+    if (!impl_->closing) {
+        uv_timer_stop(&impl_->timer);
+    }
+}
+
+void LoopTimer::Close()
+{
+    if (impl_->closing) {
+        return;
+    }
+    impl_->closing = true;
+    uv_close(reinterpret_cast<uv_handle_t*>(&impl_->timer), [](uv_handle_t* handle) {
+        delete static_cast<Impl*>(static_cast<LoopHandle*>(handle->data))->owner;
+    });
+}
+
+EventLoop::EventLoop()
+    : impl_(std::make_unique<Impl>())
+{
+}
+
+EventLoop::~EventLoop()
+{
+    if (!impl_->initialized) {
+        return;
+    }
+    uv_close(reinterpret_cast<uv_handle_t*>(&impl_->wakeup), nullptr);
+    uv_walk(&impl_->loop, [](uv_handle_t* handle, void*) {
+        if (handle->data != nullptr && !uv_is_closing(handle)) {
+            static_cast<LoopHandle*>(handle->data)->Close();
+        }
+    }, nullptr);
+    // Complete the closes, the sockets and timers are released
+    uv_run(&impl_->loop, UV_RUN_DEFAULT);
+    uv_loop_close(&impl_->loop);
+}
+
+bool EventLoop::Init()
+{
+    if (impl_->initialized) {
+        return false;
+    }
+    if (uv_loop_init(&impl_->loop) != 0) {
+        return false;
+    }
+    int ret = uv_async_init(&impl_->loop, &impl_->wakeup, [](uv_async_t* wakeup) {
+        auto* impl = static_cast<Impl*>(wakeup->data);
+        std::vector<Task> tasks;
+        bool stopping;
+        {
+            std::lock_guard<std::mutex> lock(impl->mutex);
+            tasks.swap(impl->tasks);
+            stopping = impl->stopping;
+            impl->stopping = false;
+        }
+        for (auto& task : tasks) {
+            task();
+        }
+        if (stopping) {
+            uv_stop(&impl->loop);
+        }
+    });
+    if (ret != 0) {
+        uv_loop_close(&impl_->loop);
+        return false;
+    }
+    // Not a LoopHandle, it is closed separately
+    impl_->wakeup.data = impl_.get();
+    // Posting doesn't keep the loop running
+    uv_unref(reinterpret_cast<uv_handle_t*>(&impl_->wakeup));
+    impl_->initialized = true;
+    return true;
+}
+
+void EventLoop::Run()
+{
+    if (impl_->initialized) {
+        uv_run(&impl_->loop, UV_RUN_DEFAULT);
+    }
+}
+
+void EventLoop::Stop()
+{
+    if (!impl_->initialized) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(impl_->mutex);
+        impl_->stopping = true;
+    }
+    uv_async_send(&impl_->wakeup);
+}
+
+bool EventLoop::Post(Task task)
+{
+    if (!impl_->initialized) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(impl_->mutex);
+        impl_->tasks.push_back(std::move(task));
+    }
+    // Several sends before the loop wakes up call the callback once
+    uv_async_send(&impl_->wakeup);
+    return true;
+}
+
+TcpSocket* EventLoop::CreateTcpSocket()
+{
+    if (!impl_->initialized) {
+        return nullptr;
+    }
+    auto* socket = new TcpSocket(this);
+    if (!socket->Init()) {
+        delete socket;
+        return nullptr;
+    }
+    return socket;
+}
+
+LoopTimer* EventLoop::CreateTimer()
+{
+    if (!impl_->initialized) {
+        return nullptr;
+    }
+    auto* timer = new LoopTimer();
+    if (uv_timer_init(&impl_->loop, &timer->impl_->timer) != 0) {
+        delete timer;
+        return nullptr;
+    }
+    timer->impl_->timer.data = static_cast<LoopHandle*>(timer->impl_.get());
+    return timer;
+}
+
+}
@@ -0,0 +1,38 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "photonbase/transport/LossyLink.h"
+
+namespace pht {
+
+LossyLink::LossyLink(const Options& options)
+    : options_(options)
+    , random_(options.seed)
+{
+}
+
+void LossyLink::Send(const Uint8* data, Uint32 size, Uint32 now)
+{
+    // Don't use std::*_distribution, their results differ between standard libraries
+    if (double(random_()) / double(std::mt19937::max()) < options_.lossRate) {
+        ++droppedDatagrams_;
+        return;
+    }
+    Uint32 delay = options_.delay;
+    if (options_.jitter > 0) {
+        delay += random_() % (options_.jitter + 1);
+    }
+    inFlight_.emplace(now + delay, std::vector<Uint8>(data, data + size));
+}
+
+void LossyLink::Poll(Uint32 now, const DatagramCallback& deliver)
+{
+    while (!inFlight_.empty() && Int32(inFlight_.begin()->first - now) <= 0) {
+        auto datagram = std::move(inFlight_.begin()->second);
+        inFlight_.erase(inFlight_.begin());
+        deliver(datagram.data(), Uint32(datagram.size()));
+    }
+}
+
+}
@@ -0,0 +1,166 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "photonbase/transport/StripedConnection.h"
+#include "photonbase/protocol/ChunkHeader.h"
+#include "photonbase/protocol/DataDeserializer.h"
+#include "photonbase/protocol/IProtocol.h"
+
+namespace pht {
+
+static const Uint32 kChunkIdCount = 536870912; // DUI[4]
+// How far a chunk may be ahead of the next expected one of its channel
+static const Uint32 kMaxReorderDistance = 65536;
+static const Uint32 kMaxReorderedBytes = 16 * 1024 * 1024;
+
+StripedConnection::StripedConnection(IProtocol* protocol)
+    : protocol_(protocol)
+{
+}
+
+Uint32 StripedConnection::AddPath()
+{
+    paths_.push_back(std::make_unique<Path>());
+    return Uint32(paths_.size() - 1);
+}
+
+bool StripedConnection::SetChannelStriped(Uint16 channelId, bool striped)
+{
+    if (channelId == 0) {
+        return false;
+    }
+    if (striped) {
+        stripedChannels_.insert(channelId);
+    } else {
+        stripedChannels_.erase(channelId);
+    }
+    return true;
+}
+
+bool StripedConnection::OnData(Uint32 path, const Uint8* data, Uint32 size)
+{
+    if (path >= paths_.size()) {
+        return false;
+    }
+    paths_[path]->inputBuffer.PushData(data, size);
+    if (!ReadChunks(*paths_[path])) {
+        return false;
+    }
+    if (inputBuffer_.Empty()) {
+        return true;
+    }
+    if (!protocol_->OnInBoundData(inputBuffer_, outputBuffer_)) {
+        return false;
+    }
+    return SendChunks();
+}
+
+bool StripedConnection::Poll()
+{
+    ss::DynamicBuffer unused;
+    return protocol_->OnOutBoundData(unused, outputBuffer_) && SendChunks();
+}
+
+bool StripedConnection::ReadChunks(Path& path)
+{
+    auto& buffer = path.inputBuffer;
+    while (!buffer.Empty()) {
+        ChunkHeader header;
+        DataDeserializer deserializer(buffer.GetData<Uint8>(), buffer.Size());
+        if (!deserializer.Deserialize(header)) {
+            return deserializer.IsNotEnoughData();
+        }
+        Uint32 size = deserializer.DataConsumed() + header.chunkSize;
+        if (buffer.Size() < size) {
+            break;
+        }
+        if (!OnChunk(header.channelId, header.chunkId, buffer.GetData<Uint8>(), size)) {
+            return false;
+        }
+        buffer.Skip(size);
+    }
+    return true;
+}
+
+bool StripedConnection::OnChunk(Uint16 channelId, Uint32 chunkId, const Uint8* chunk, Uint32 size)
+{
+    auto& channel = inboundChannels_[channelId];
+    if (chunkId != channel.nextChunkId) {
+        Uint32 distance = (chunkId + kChunkIdCount - channel.nextChunkId) % kChunkIdCount;
+        if (chunkId == 0 && channel.reordered.empty()) {
+            // The channel was destroyed and created again, its chunk ids restart
+            channel.nextChunkId = 0;
+        } else if (distance < kMaxReorderDistance) {
+            if (reorderedBytes_ + size > kMaxReorderedBytes || channel.reordered.count(chunkId) > 0) {
+                return false;
+            }
+            channel.reordered.emplace(chunkId, std::vector<Uint8>(chunk, chunk + size));
+            reorderedBytes_ += size;
+            return true;
+        } else {
+            return false; // Duplicated or too far ahead
+        }
+    }
+
+    inputBuffer_.PushData(chunk, size);
+    channel.nextChunkId = (channel.nextChunkId + 1) % kChunkIdCount;
+    // The chunks that were waiting for this one
+    for (auto it = channel.reordered.find(channel.nextChunkId); it != channel.reordered.end();
+         it = channel.reordered.find(channel.nextChunkId)) {
+        inputBuffer_.PushData(it->second.data(), Uint32(it->second.size()));
+        reorderedBytes_ -= Uint32(it->second.size());
+        channel.reordered.erase(it);
+        channel.nextChunkId = (channel.nextChunkId + 1) % kChunkIdCount;
+    }
+    return true;
+}
+
+bool StripedConnection::SendChunks()
+{
+    if (paths_.empty()) {
+        return true;
+    }
+    while (!outputBuffer_.Empty()) {
+        ChunkHeader header;
+        DataDeserializer deserializer(outputBuffer_.GetData<Uint8>(), outputBuffer_.Size());
+        if (!deserializer.Deserialize(header)) {
+            return deserializer.IsNotEnoughData();
+        }
+        Uint32 size = deserializer.DataConsumed() + header.chunkSize;
+        if (outputBuffer_.Size() < size) {
+            break;
+        }
+        paths_[SelectPath(header.channelId)]->outputBuffer.PushData(outputBuffer_.GetData<Uint8>(), size);
+        outputBuffer_.Skip(size);
+    }
+    return true;
+}
+
+Uint32 StripedConnection::SelectPath(Uint16 channelId)
+{
+    if (channelId == 0) {
+        return 0;
+    }
+    if (stripedChannels_.count(channelId) == 0) {
+        auto it = channelPaths_.find(channelId);
+        if (it == channelPaths_.end()) {
+            it = channelPaths_.emplace(channelId, channelId % paths_.size()).first;
+        }
+        return it->second;
+    }
+
+    // The least loaded path, ties are broken in a round-robin fashion
+    Uint32 count = Uint32(paths_.size());
+    Uint32 selected = nextStripePath_ % count;
+    for (Uint32 i = 1; i < count; ++i) {
+        Uint32 path = (nextStripePath_ + i) % count;
+        if (paths_[path]->outputBuffer.Size() < paths_[selected]->outputBuffer.Size()) {
+            selected = path;
+        }
+    }
+    nextStripePath_ = selected + 1;
+    return selected;
+}
+
+}
@@ -0,0 +1,319 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "photonbase/transport/TcpSocket.h"
+#include "photonbase/transport/impl/EventLoopImpl.h"
+#include <vector>
+
+namespace pht {
+
+static const size_t kReceiveBufferSize = 64 * 1024;
+
+struct TcpSocket::Impl : public LoopHandle {
+    // The data of the handle
+    static Impl* From(void* data)
+    {
+        return static_cast<Impl*>(static_cast<LoopHandle*>(data));
+    }
+
+    void Close() override
+    {
+        owner->Close(nullptr);
+    }
+
+    uv_stream_t* Stream()
+    {
+        return reinterpret_cast<uv_stream_t*>(&tcp);
+    }
+
+    TcpSocket* owner { nullptr };
+    EventLoop* loop { nullptr };
+    uv_tcp_t tcp {};
+    bool closing { false };
+    ConnectionCallback connectionCallback {};
+    AllocCallback allocCallback {};
+    ReceiveCallback receiveCallback {};
+    CloseCallback closeCallback {};
+    std::vector<char> receiveBuffer {}; // Allocated by the first read without an AllocCallback
+};
+
+struct WriteRequest {
+    uv_write_t request {};
+    std::vector<char> data {}; // Empty if the buffers are not copied
+    TcpSocket::SendCallback callback {};
+};
+
+struct ConnectRequest {
+    uv_connect_t request {};
+    TcpSocket::ConnectCallback callback {};
+};
+
+static bool MakeAddress(const std::string& ip, Uint16 port, sockaddr_storage& address)
+{
+    if (uv_ip4_addr(ip.c_str(), port, reinterpret_cast<sockaddr_in*>(&address)) == 0) {
+        return true;
+    }
+    return uv_ip6_addr(ip.c_str(), port, reinterpret_cast<sockaddr_in6*>(&address)) == 0;
+}
+
+static bool ParseAddress(const sockaddr_storage& address, std::string& ip, Uint16& port)
+{
+    char name[64] {};
+    if (address.ss_family == AF_INET) {
+        auto* v4 = reinterpret_cast<const sockaddr_in*>(&address);
+        if (uv_ip4_name(v4, name, sizeof(name)) != 0) {
+            return false;
+        }
+        port = ntohs(v4->sin_port);
+    } else if (address.ss_family == AF_INET6) {
+        auto* v6 = reinterpret_cast<const sockaddr_in6*>(&address);
+        if (uv_ip6_name(v6, name, sizeof(name)) != 0) {
+            return false;
+        }
+        port = ntohs(v6->sin6_port);
+    } else {
+        return false;
+    }
+    ip = name;
+    return true;
+}
+
+static void OnWritten(uv_write_t* handle, int status)
+{
+    auto* request = static_cast<WriteRequest*>(handle->data);
+    if (request->callback) {
+        request->callback(status);
+    }
+    delete request;
+}
+
+TcpSocket::TcpSocket(EventLoop* loop)
+    : impl_(std::make_unique<Impl>())
+{
+    impl_->owner = this;
+    impl_->loop = loop;
+}
+
+TcpSocket::~TcpSocket() = default;
+
+bool TcpSocket::Init()
+{
+    if (uv_tcp_init(&impl_->loop->impl_->loop, &impl_->tcp) != 0) {
+        return false;
+    }
+    impl_->tcp.data = static_cast<LoopHandle*>(impl_.get());
+    return true;
+}
+
+bool TcpSocket::Bind(const std::string& ip, Uint16 port)
+{
+    sockaddr_storage address {};
+    if (impl_->closing || !MakeAddress(ip, port, address)) {
+        return false;
+    }
+    return uv_tcp_bind(&impl_->tcp, reinterpret_cast<const sockaddr*>(&address), 0) == 0;
+}
+
+bool TcpSocket::Open(int fd)
+{
+    if (impl_->closing) {
+        return false;
+    }
+    return uv_tcp_open(&impl_->tcp, uv_os_sock_t(fd)) == 0;
+}
+
+bool TcpSocket::SetNoDelay(bool enable)
+{
+    if (impl_->closing) {
+        return false;
+    }
+    return uv_tcp_nodelay(&impl_->tcp, enable ? 1 : 0) == 0;
+}
+
+bool TcpSocket::Listen(int backlog, ConnectionCallback callback)
+{
+    if (impl_->closing) {
+        return false;
+    }
+    impl_->connectionCallback = std::move(callback);
+    return uv_listen(impl_->Stream(), backlog, [](uv_stream_t* server, int status) {
+        auto* impl = Impl::From(server->data);
+        impl->connectionCallback(impl->owner, status);
+    }) == 0;
+}
+
+TcpSocket* TcpSocket::Accept()
+{
+    if (impl_->closing) {
+        return nullptr;
+    }
+    auto* client = impl_->loop->CreateTcpSocket();
+    if (client == nullptr) {
+        return nullptr;
+    }
+    if (uv_accept(impl_->Stream(), client->impl_->Stream()) != 0) {
+        client->Close(nullptr);
+        return nullptr;
+    }
+    return client;
+}
+
+bool TcpSocket::Connect(const std::string& ip, Uint16 port, ConnectCallback callback)
+{
+    sockaddr_storage address {};
+    if (impl_->closing || !MakeAddress(ip, port, address)) {
+        return false;
+    }
+    auto* request = new ConnectRequest;
+    request->request.data = request;
+    request->callback = std::move(callback);
+    int ret = uv_tcp_connect(&request->request, &impl_->tcp, reinterpret_cast<const sockaddr*>(&address),
+        [](uv_connect_t* handle, int status) {
+            auto* request = static_cast<ConnectRequest*>(handle->data);
+            auto callback = std::move(request->callback);
+            delete request;
+            if (callback) {
+                callback(status);
+            }
+        });
+    if (ret != 0) {
+        delete request;
+        return false;
+    }
+    return true;
+}
+
+bool TcpSocket::StartReceive(ReceiveCallback callback)
+{
+    return StartReceive(nullptr, std::move(callback));
+}
+
+bool TcpSocket::StartReceive(AllocCallback alloc, ReceiveCallback callback)
+{
+    if (impl_->closing) {
+        return false;
+    }
+    impl_->allocCallback = std::move(alloc);
+    impl_->receiveCallback = std::move(callback);
+    auto allocBuffer = [](uv_handle_t* handle, size_t suggestedSize, uv_buf_t* buffer) {
+        auto* impl = Impl::From(handle->data);
+        if (impl->allocCallback) {
+            char* base = nullptr;
+            size_t len = 0;
+            impl->allocCallback(suggestedSize, &base, &len);
+            *buffer = uv_buf_init(base, static_cast<unsigned int>(len));
+            return;
+        }
+        if (impl->receiveBuffer.empty()) {
+            impl->receiveBuffer.resize(kReceiveBufferSize);
+        }
+        *buffer = uv_buf_init(impl->receiveBuffer.data(), static_cast<unsigned int>(impl->receiveBuffer.size()));
+    };
+    return uv_read_start(impl_->Stream(), allocBuffer, [](uv_stream_t* stream, ssize_t nread, const uv_buf_t* buffer) {
+        if (nread != 0) { // 0 means nothing to read for now
+            Impl::From(stream->data)->receiveCallback(Int64(nread), buffer->base);
+        }
+    }) == 0;
+}
+
+void TcpSocket::StopReceive()
+{
+    if (!impl_->closing) {
+        uv_read_stop(impl_->Stream());
+    }
+}
+
+bool TcpSocket::Send(const void* data, Uint32 size, SendCallback callback)
+{
+    if (impl_->closing) {
+        return false;
+    }
+    auto* request = new WriteRequest;
+    request->request.data = request;
+    request->data.assign(static_cast<const char*>(data), static_cast<const char*>(data) + size);
+    request->callback = std::move(callback);
+    auto buffer = uv_buf_init(request->data.data(), size);
+    if (uv_write(&request->request, impl_->Stream(), &buffer, 1, OnWritten) != 0) {
+        delete request;
+        return false;
+    }
+    return true;
+}
+
+bool TcpSocket::Send(const ConstBuffer* buffers, Uint32 count, SendCallback callback)
+{
+    if (impl_->closing || count == 0) {
+        return false;
+    }
+    // libuv copies the array, not the data
+    std::vector<uv_buf_t> uvBuffers;
+    uvBuffers.reserve(count);
+    for (Uint32 i = 0; i < count; ++i) {
+        auto* base = const_cast<char*>(static_cast<const char*>(buffers[i].data));
+        uvBuffers.push_back(uv_buf_init(base, static_cast<unsigned int>(buffers[i].size)));
+    }
+    auto* request = new WriteRequest;
+    request->request.data = request;
+    request->callback = std::move(callback);
+    if (uv_write(&request->request, impl_->Stream(), uvBuffers.data(), count, OnWritten) != 0) {
+        delete request;
+        return false;
+    }
+    return true;
+}
+
+void TcpSocket::Close(CloseCallback callback)
+{
+    if (impl_->closing) {
+        return;
+    }
+    impl_->closing = true;
+    impl_->closeCallback = std::move(callback);
+    uv_close(reinterpret_cast<uv_handle_t*>(&impl_->tcp), [](uv_handle_t* handle) {
+        auto* impl = Impl::From(handle->data);
+        auto callback = std::move(impl->closeCallback);
+        delete impl->owner;
+        if (callback) {
+            callback();
+        }
+    });
+}
+
+bool TcpSocket::GetPeer(std::string& ip, Uint16& port) const
+{
+    sockaddr_storage address {};
+    int length = sizeof(address);
+    if (uv_tcp_getpeername(&impl_->tcp, reinterpret_cast<sockaddr*>(&address), &length) != 0) {
+        return false;
+    }
+    return ParseAddress(address, ip, port);
+}
+
+int TcpSocket::GetFd() const
+{
+#ifdef _WIN32
+    return -1;
+#else
+    uv_os_fd_t fd;
+    if (impl_->closing || uv_fileno(reinterpret_cast<const uv_handle_t*>(&impl_->tcp), &fd) != 0) {
+        return -1;
+    }
+    return fd;
+#endif
+}
+
+Uint16 TcpSocket::GetLocalPort() const
+{
+    sockaddr_storage address {};
+    int length = sizeof(address);
+    std::string ip;
+    Uint16 port = 0;
+    if (uv_tcp_getsockname(&impl_->tcp, reinterpret_cast<sockaddr*>(&address), &length) != 0
+        || !ParseAddress(address, ip, port)) {
+        return 0;
+    }
+    return port;
+}
+
+}
@@ -0,0 +1,133 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "photonbase/transport/UdpSocket.h"
+#include <cstring>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+using SocketLength = int;
+#else
+#include <arpa/inet.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+using SocketLength = socklen_t;
+#endif
+
+namespace pht {
+
+static bool MakeAddress(const std::string& ip, Uint16 port, sockaddr_in& address)
+{
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    return inet_pton(AF_INET, ip.c_str(), &address.sin_addr) == 1;
+}
+
+static bool IsWouldBlock()
+{
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
+UdpSocket::~UdpSocket()
+{
+    Close();
+}
+
+bool UdpSocket::Bind(const std::string& ip, Uint16 port)
+{
+#ifdef _WIN32
+    static const bool wsaStarted = []() {
+        WSADATA data;
+        return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+    }();
+    if (!wsaStarted) {
+        return false;
+    }
+#endif
+    Close();
+    sockaddr_in address;
+    if (!MakeAddress(ip, port, address)) {
+        return false;
+    }
+    auto s = socket(AF_INET, SOCK_DGRAM, 0);
+#ifdef _WIN32
+    if (s == INVALID_SOCKET) {
+        return false;
+    }
+    u_long nonBlocking = 1;
+    bool ok = ioctlsocket(s, FIONBIO, &nonBlocking) == 0;
+#else
+    if (s < 0) {
+        return false;
+    }
+    bool ok = fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK) == 0;
+#endif
+    socket_ = std::intptr_t(s);
+    if (!ok || bind(s, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+Uint16 UdpSocket::GetLocalPort() const
+{
+    sockaddr_in address;
+    SocketLength length = sizeof(address);
+    if (socket_ == -1 || getsockname(socket_, reinterpret_cast<sockaddr*>(&address), &length) != 0) {
+        return 0;
+    }
+    return ntohs(address.sin_port);
+}
+
+bool UdpSocket::Connect(const std::string& ip, Uint16 port)
+{
+    sockaddr_in address;
+    if (socket_ == -1 || !MakeAddress(ip, port, address)) {
+        return false;
+    }
+    return connect(socket_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+}
+
+bool UdpSocket::Send(const Uint8* data, Uint32 size)
+{
+    if (socket_ == -1) {
+        return false;
+    }
+    auto ret = send(socket_, reinterpret_cast<const char*>(data), size, 0);
+    return ret >= 0 || IsWouldBlock();
+}
+
+int UdpSocket::Receive(Uint8* buffer, Uint32 capacity)
+{
+    if (socket_ == -1) {
+        return -1;
+    }
+    auto ret = recv(socket_, reinterpret_cast<char*>(buffer), capacity, 0);
+    return ret < 0 ? -1 : int(ret);
+}
+
+void UdpSocket::Close()
+{
+    if (socket_ == -1) {
+        return;
+    }
+#ifdef _WIN32
+    closesocket(SOCKET(socket_));
+#else
+    close(int(socket_));
+#endif
+    socket_ = -1;
+}
+
+}
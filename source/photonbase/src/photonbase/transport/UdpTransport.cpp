@@ -0,0 +1,126 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "photonbase/transport/UdpTransport.h"
+#include "photonbase/protocol/ChunkHeader.h"
+#include "photonbase/protocol/DataDeserializer.h"
+#include "photonbase/protocol/IProtocol.h"
+#include "photonbase/protocol/PhotonProtocol.h"
+#include "photonbase/transport/UdpSocket.h"
+
+namespace pht {
+
+UdpTransport::UdpTransport(IProtocol* protocol)
+    : protocol_(protocol)
+{
+}
+
+void UdpTransport::SetTargetBitrateCallback(TargetBitrateCallback callback)
+{
+    targetBitrateCallback_ = std::move(callback);
+    targetBitrate_ = 0; // Report the current target on the next Poll
+}
+
+bool UdpTransport::SetChannelMode(Uint16 channelId, ReliabilityMode mode)
+{
+    if (mode == ReliabilityMode::kUnreliable && !ExemptChannel(channelId)) {
+        return false;
+    }
+    return session_.SetChannelMode(channelId, mode);
+}
+
+bool UdpTransport::OnDatagram(const Uint8* data, Uint32 size, Uint32 now)
+{
+    if (!session_.OnDatagram(data, size, now)) {
+        return false;
+    }
+    Uint16 channelId;
+    ByteArray chunk;
+    bool received = false;
+    while (session_.Receive(channelId, chunk)) {
+        ReliabilityMode mode;
+        if (session_.GetPeerChannelMode(channelId, mode) && mode == ReliabilityMode::kUnreliable && !ExemptChannel(channelId)) {
+            return false; // The peer sends a flow controlled channel unreliably
+        }
+        inputBuffer_.PushData(chunk.Data(), chunk.Size());
+        received = true;
+    }
+    if (!received) {
+        return true;
+    }
+    if (!protocol_->OnInBoundData(inputBuffer_, outputBuffer_)) {
+        return false;
+    }
+    return SendChunks();
+}
+
+bool UdpTransport::Poll(Uint32 now, const DatagramSession::DatagramCallback& send)
+{
+    ss::DynamicBuffer unused;
+    if (!protocol_->OnOutBoundData(unused, outputBuffer_) || !SendChunks()) {
+        return false;
+    }
+    if (!session_.Poll(now, send)) {
+        return false;
+    }
+    Uint32 targetBitrate = session_.GetTargetBitrate();
+    if (targetBitrate != targetBitrate_) {
+        targetBitrate_ = targetBitrate;
+        if (targetBitrateCallback_) {
+            targetBitrateCallback_(targetBitrate);
+        }
+    }
+    return true;
+}
+
+bool UdpTransport::PollSocket(UdpSocket& socket, Uint32 now)
+{
+    Uint8 datagram[kMaxDatagramSize];
+    int size;
+    while ((size = socket.Receive(datagram, sizeof(datagram))) >= 0) {
+        if (!OnDatagram(datagram, Uint32(size), now)) {
+            return false;
+        }
+    }
+    bool sendFailed = false;
+    bool ok = Poll(now, [&socket, &sendFailed](const Uint8* data, Uint32 size) {
+        sendFailed = sendFailed || !socket.Send(data, size);
+    });
+    return ok && !sendFailed;
+}
+
+bool UdpTransport::SendChunks()
+{
+    while (!outputBuffer_.Empty()) {
+        ChunkHeader header;
+        DataDeserializer deserializer(outputBuffer_.GetData<Uint8>(), outputBuffer_.Size());
+        if (!deserializer.Deserialize(header)) {
+            return deserializer.IsNotEnoughData();
+        }
+        Uint32 size = deserializer.DataConsumed() + header.chunkSize;
+        if (outputBuffer_.Size() < size) {
+            break;
+        }
+        if (!session_.Send(header.channelId, outputBuffer_.GetData<Uint8>(), size)) {
+            return false;
+        }
+        outputBuffer_.Skip(size);
+    }
+    return true;
+}
+
+bool UdpTransport::ExemptChannel(Uint16 channelId)
+{
+    if (unreliableChannels_.count(channelId) > 0) {
+        return true;
+    }
+    auto photonProtocol = dynamic_cast<PhotonProtocol*>(protocol_);
+    if (photonProtocol && !photonProtocol->DisableChannelFlowControl(channelId)) {
+        return false;
+    }
+    unreliableChannels_.insert(channelId);
+    return true;
+}
+
+}
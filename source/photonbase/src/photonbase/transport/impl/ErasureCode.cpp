@@ -0,0 +1,110 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "ErasureCode.h"
+#include "GaloisField.h"
+#include <SSBase/Assert.h>
+#include <cstring>
+
+namespace pht {
+
+Uint8 ErasureCode::Coefficient(Uint32 dataCount, Uint32 parityCount, Uint32 parityIndex, Uint32 dataIndex)
+{
+    if (parityCount == 1) {
+        return 1;
+    }
+    // Cauchy matrix 1 / (x_i + y_j) with x_i = dataCount + i and y_j = j, every square sub-matrix is invertible
+    return GaloisField::Inverse(Uint8((dataCount + parityIndex) ^ dataIndex));
+}
+
+void ErasureCode::Encode(const std::vector<const Uint8*>& data, Uint32 size, Uint32 parityCount, Uint32 parityIndex, Uint8* parity)
+{
+    auto dataCount = Uint32(data.size());
+    memset(parity, 0, size);
+    for (Uint32 j = 0; j < dataCount; ++j) {
+        GaloisField::MultiplyAdd(parity, data[j], Coefficient(dataCount, parityCount, parityIndex, j), size);
+    }
+}
+
+bool ErasureCode::Decode(const std::vector<const Uint8*>& data, const std::vector<const Uint8*>& parity, Uint32 size,
+    std::map<Uint32, std::vector<Uint8>>& recovered)
+{
+    auto dataCount = Uint32(data.size());
+    auto parityCount = Uint32(parity.size());
+    std::vector<Uint32> missing;
+    std::vector<Uint32> used;
+    for (Uint32 j = 0; j < dataCount; ++j) {
+        if (data[j] == nullptr) {
+            missing.push_back(j);
+        }
+    }
+    for (Uint32 i = 0; i < parityCount && used.size() < missing.size(); ++i) {
+        if (parity[i] != nullptr) {
+            used.push_back(i);
+        }
+    }
+    if (used.size() < missing.size()) {
+        return false;
+    }
+    auto n = Uint32(missing.size());
+    if (n == 0) {
+        return true;
+    }
+
+    // Subtract the known data from each used parity shard, leaving a combination of the missing ones
+    std::vector<std::vector<Uint8>> syndromes(n);
+    for (Uint32 k = 0; k < n; ++k) {
+        syndromes[k].assign(parity[used[k]], parity[used[k]] + size);
+        for (Uint32 j = 0; j < dataCount; ++j) {
+            if (data[j] != nullptr) {
+                GaloisField::MultiplyAdd(syndromes[k].data(), data[j], Coefficient(dataCount, parityCount, used[k], j), size);
+            }
+        }
+    }
+
+    // Invert the n x n matrix of the coefficients of the missing shards with Gauss-Jordan elimination
+    std::vector<std::vector<Uint8>> a(n, std::vector<Uint8>(n));
+    std::vector<std::vector<Uint8>> inverse(n, std::vector<Uint8>(n, 0));
+    for (Uint32 k = 0; k < n; ++k) {
+        for (Uint32 l = 0; l < n; ++l) {
+            a[k][l] = Coefficient(dataCount, parityCount, used[k], missing[l]);
+        }
+        inverse[k][k] = 1;
+    }
+    for (Uint32 col = 0; col < n; ++col) {
+        Uint32 pivot = col;
+        while (pivot < n && a[pivot][col] == 0) {
+            ++pivot;
+        }
+        SSASSERT2(pivot < n, "Cauchy matrix is singular");
+        std::swap(a[col], a[pivot]);
+        std::swap(inverse[col], inverse[pivot]);
+        Uint8 scale = GaloisField::Inverse(a[col][col]);
+        for (Uint32 l = 0; l < n; ++l) {
+            a[col][l] = GaloisField::Multiply(a[col][l], scale);
+            inverse[col][l] = GaloisField::Multiply(inverse[col][l], scale);
+        }
+        for (Uint32 row = 0; row < n; ++row) {
+            Uint8 factor = a[row][col];
+            if (row == col || factor == 0) {
+                continue;
+            }
+            for (Uint32 l = 0; l < n; ++l) {
+                a[row][l] ^= GaloisField::Multiply(factor, a[col][l]);
+                inverse[row][l] ^= GaloisField::Multiply(factor, inverse[col][l]);
+            }
+        }
+    }
+
+    for (Uint32 l = 0; l < n; ++l) {
+        std::vector<Uint8> shard(size, 0);
+        for (Uint32 k = 0; k < n; ++k) {
+            GaloisField::MultiplyAdd(shard.data(), syndromes[k].data(), inverse[l][k], size);
+        }
+        recovered[missing[l]] = std::move(shard);
+    }
+    return true;
+}
+
+}
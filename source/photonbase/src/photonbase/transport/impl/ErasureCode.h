@@ -0,0 +1,41 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "photonbase/core/Types.h"
+#include <map>
+#include <vector>
+
+namespace pht {
+
+// A systematic erasure code over GF(2^8): dataCount data shards are protected by parityCount parity shards of the
+// same size, any dataCount of them rebuild the data. One parity shard is the XOR of the data shards, more are
+// Reed-Solomon with a Cauchy matrix. dataCount + parityCount should not exceed 256.
+class ErasureCode {
+public:
+    static Uint8 Coefficient(Uint32 dataCount, Uint32 parityCount, Uint32 parityIndex, Uint32 dataIndex);
+
+    /**
+     * @param data The data shards
+     * @param size The size of each shard
+     * @param parityCount The number of parity shards of this group
+     * @param parityIndex Which parity shard to compute
+     * @param parity Receives the parity shard, size bytes
+     */
+    static void Encode(const std::vector<const Uint8*>& data, Uint32 size, Uint32 parityCount, Uint32 parityIndex, Uint8* parity);
+
+    /**
+     * Rebuild the missing data shards
+     * @param data The data shards, nullptr for the missing ones
+     * @param parity The parity shards, nullptr for the missing ones
+     * @param size The size of each shard
+     * @param recovered Receives the rebuilt shards, keyed by data index
+     * @return Return false if too many shards are missing
+     */
+    static bool Decode(const std::vector<const Uint8*>& data, const std::vector<const Uint8*>& parity, Uint32 size,
+        std::map<Uint32, std::vector<Uint8>>& recovered);
+};
+
+}
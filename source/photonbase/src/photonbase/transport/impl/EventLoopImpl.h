@@ -0,0 +1,31 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "photonbase/transport/EventLoop.h"
+#include <mutex>
+#include <uv.h>
+#include <vector>
+
+namespace pht {
+
+// Owns a libuv handle of a loop, the loop closes the handles left open when it is destroyed
+class LoopHandle {
+public:
+    virtual ~LoopHandle() = default;
+
+    virtual void Close() = 0;
+};
+
+struct EventLoop::Impl {
+    uv_loop_t loop {};
+    bool initialized { false };
+    uv_async_t wakeup {}; // Wakes the loop up for the tasks and Stop of other threads
+    std::mutex mutex {};
+    std::vector<Task> tasks {}; // Guarded by mutex
+    bool stopping { false }; // Guarded by mutex
+};
+
+}
@@ -0,0 +1,171 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "GaloisField.h"
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+#define PHT_GF_NEON 1
+#include <arm_neon.h>
+#elif defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define PHT_GF_SSSE3 1
+#include <tmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define PHT_TARGET_SSSE3
+#else
+#define PHT_TARGET_SSSE3 __attribute__((target("ssse3")))
+#endif
+#endif
+
+namespace pht {
+
+struct GaloisTables {
+    Uint8 exp[512];
+    Uint8 log[256];
+
+    GaloisTables()
+    {
+        Uint32 x = 1;
+        for (Uint32 i = 0; i < 255; ++i) {
+            exp[i] = Uint8(x);
+            log[x] = Uint8(i);
+            x <<= 1u;
+            if (x & 0x100u) {
+                x ^= 0x11Du;
+            }
+        }
+        // So that exp[log[a] + log[b]] needs no modulo
+        for (Uint32 i = 255; i < 512; ++i) {
+            exp[i] = exp[i - 255];
+        }
+        log[0] = 0;
+    }
+};
+
+static const GaloisTables& Tables()
+{
+    static const GaloisTables tables;
+    return tables;
+}
+
+Uint8 GaloisField::Multiply(Uint8 a, Uint8 b)
+{
+    if (a == 0 || b == 0) {
+        return 0;
+    }
+    auto& t = Tables();
+    return t.exp[t.log[a] + t.log[b]];
+}
+
+Uint8 GaloisField::Inverse(Uint8 a)
+{
+    auto& t = Tables();
+    return t.exp[255 - t.log[a]];
+}
+
+void GaloisField::MultiplyAddScalar(Uint8* dst, const Uint8* src, Uint8 c, Uint32 size)
+{
+    if (c == 0) {
+        return;
+    }
+    if (c == 1) {
+        for (Uint32 i = 0; i < size; ++i) {
+            dst[i] ^= src[i];
+        }
+        return;
+    }
+    if (size < 256) {
+        for (Uint32 i = 0; i < size; ++i) {
+            dst[i] ^= Multiply(c, src[i]);
+        }
+        return;
+    }
+    Uint8 row[256];
+    for (Uint32 x = 0; x < 256; ++x) {
+        row[x] = Multiply(c, Uint8(x));
+    }
+    for (Uint32 i = 0; i < size; ++i) {
+        dst[i] ^= row[src[i]];
+    }
+}
+
+// c * x = c * (x & 0x0F) ^ c * (x & 0xF0), both halves are looked up with a 16 entry table shuffle
+#if PHT_GF_SSSE3
+static bool HasSsse3()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 9)) != 0;
+#else
+    return __builtin_cpu_supports("ssse3");
+#endif
+}
+
+PHT_TARGET_SSSE3 static Uint32 MultiplyAddSimd(Uint8* dst, const Uint8* src, Uint8 c, Uint32 size)
+{
+    alignas(16) Uint8 low[16];
+    alignas(16) Uint8 high[16];
+    for (Uint32 x = 0; x < 16; ++x) {
+        low[x] = GaloisField::Multiply(c, Uint8(x));
+        high[x] = GaloisField::Multiply(c, Uint8(x << 4u));
+    }
+    const __m128i lowTable = _mm_load_si128(reinterpret_cast<const __m128i*>(low));
+    const __m128i highTable = _mm_load_si128(reinterpret_cast<const __m128i*>(high));
+    const __m128i mask = _mm_set1_epi8(0x0F);
+    Uint32 i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i l = _mm_shuffle_epi8(lowTable, _mm_and_si128(s, mask));
+        __m128i h = _mm_shuffle_epi8(highTable, _mm_and_si128(_mm_srli_epi64(s, 4), mask));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(d, _mm_xor_si128(l, h)));
+    }
+    return i;
+}
+#elif PHT_GF_NEON
+static Uint32 MultiplyAddSimd(Uint8* dst, const Uint8* src, Uint8 c, Uint32 size)
+{
+    Uint8 low[16];
+    Uint8 high[16];
+    for (Uint32 x = 0; x < 16; ++x) {
+        low[x] = GaloisField::Multiply(c, Uint8(x));
+        high[x] = GaloisField::Multiply(c, Uint8(x << 4u));
+    }
+    const uint8x16_t lowTable = vld1q_u8(low);
+    const uint8x16_t highTable = vld1q_u8(high);
+    const uint8x16_t mask = vdupq_n_u8(0x0F);
+    Uint32 i = 0;
+    for (; i + 16 <= size; i += 16) {
+        uint8x16_t s = vld1q_u8(src + i);
+        uint8x16_t l = vqtbl1q_u8(lowTable, vandq_u8(s, mask));
+        uint8x16_t h = vqtbl1q_u8(highTable, vshrq_n_u8(s, 4));
+        vst1q_u8(dst + i, veorq_u8(vld1q_u8(dst + i), veorq_u8(l, h)));
+    }
+    return i;
+}
+#endif
+
+void GaloisField::MultiplyAdd(Uint8* dst, const Uint8* src, Uint8 c, Uint32 size)
+{
+    if (c <= 1 || size < 64) {
+        MultiplyAddScalar(dst, src, c, size);
+        return;
+    }
+#if PHT_GF_SSSE3 || PHT_GF_NEON
+#if PHT_GF_SSSE3
+    static const bool simd = HasSsse3();
+#else
+    static const bool simd = true;
+#endif
+    if (simd) {
+        Uint32 done = MultiplyAddSimd(dst, src, c, size);
+        MultiplyAddScalar(dst + done, src + done, c, size - done);
+        return;
+    }
+#endif
+    MultiplyAddScalar(dst, src, c, size);
+}
+
+}
@@ -0,0 +1,28 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "photonbase/core/Types.h"
+
+namespace pht {
+
+// Arithmetic of GF(2^8) with the polynomial x^8 + x^4 + x^3 + x^2 + 1 (0x11D)
+class GaloisField {
+public:
+    static Uint8 Multiply(Uint8 a, Uint8 b);
+
+    // a should not be 0
+    static Uint8 Inverse(Uint8 a);
+
+    /**
+     * dst[i] ^= c * src[i], the hot loop of erasure coding. Uses SSSE3 or NEON when the CPU supports it.
+     */
+    static void MultiplyAdd(Uint8* dst, const Uint8* src, Uint8 c, Uint32 size);
+
+    // The portable implementation of MultiplyAdd, exposed for tests
+    static void MultiplyAddScalar(Uint8* dst, const Uint8* src, Uint8 c, Uint32 size);
+};
+
+}
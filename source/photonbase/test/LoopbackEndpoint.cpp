@@ -0,0 +1,59 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "LoopbackEndpoint.h"
+#include <SSBase/Assert.h>
+
+namespace pht {
+
+bool MediaSink::OnRemoteMethodInvoke(IProtocol* client, const RemoteMethodInfo& method)
+{
+    methods.push_back(method);
+    return true;
+}
+
+bool MediaSink::OnMediaMessage(IProtocol* client, Uint16 channelId, const MessageHeader& header, const ByteArray& payload)
+{
+    media.emplace_back(channelId, payload);
+    headers.push_back(header);
+    return true;
+}
+
+bool Deliver(PhotonProtocol& from, PhotonProtocol& to)
+{
+    ss::DynamicBuffer wire;
+    ss::DynamicBuffer reply;
+    ss::DynamicBuffer unused;
+    bool written = from.OnOutBoundData(unused, wire);
+    SSASSERT(written);
+    while (!wire.Empty()) {
+        if (!to.OnInBoundData(wire, reply)) {
+            return false;
+        }
+        bool answered = reply.Empty() || from.OnInBoundData(reply, wire);
+        SSASSERT(answered);
+    }
+    return true;
+}
+
+LoopbackEndpoint::LoopbackEndpoint(const String& applicationName, const std::vector<Uint16>& channelIds)
+{
+    client.SetApplication(&sink);
+    bool connected = client.Connect(applicationName, channelIds);
+    SSASSERT(connected);
+}
+
+void LoopbackEndpoint::Invoke(const String& methodName, Array&& params)
+{
+    bool invoked = client.InvokeRemoteMethod(1, RemoteMethodInfo(Variant::Type::Void, methodName, std::move(params)));
+    SSASSERT(invoked);
+}
+
+void LoopbackEndpoint::Receive()
+{
+    bool delivered = Deliver(*server, client);
+    SSASSERT(delivered);
+}
+
+}
@@ -0,0 +1,64 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "photonbase/application/IApplication.h"
+#include "photonbase/protocol/MessageHeader.h"
+#include "photonbase/protocol/PhotonProtocol.h"
+#include "photonbase/protocol/RemoteMethodInfo.h"
+#include <memory>
+#include <vector>
+
+namespace pht {
+
+// The application of a test client, records the RMIs and the media it receives
+class MediaSink : public IApplication {
+public:
+    bool OnRemoteMethodInvoke(IProtocol* client, const RemoteMethodInfo& method) override;
+
+    bool OnMediaMessage(IProtocol* client, Uint16 channelId, const MessageHeader& header, const ByteArray& payload) override;
+
+    void OnClientAttached(IProtocol* client) override
+    {
+    }
+
+    void OnClientDetached(IProtocol* client) override
+    {
+    }
+
+    std::vector<RemoteMethodInfo> methods {};
+    std::vector<std::pair<Uint16, ByteArray>> media {};
+    std::vector<MessageHeader> headers {}; // Of the media
+};
+
+/**
+ * Deliver what `from` has queued to `to` and the replies back, until nothing is left, e.g. the chunks unblocked by
+ * the WindowUpdates of `to`
+ * @return Return false if `to` rejects the data
+ */
+bool Deliver(PhotonProtocol& from, PhotonProtocol& to);
+
+// A client and its connection on the server, joined by memory. Channel 1 carries the RMIs.
+struct LoopbackEndpoint {
+    explicit LoopbackEndpoint(const String& applicationName, const std::vector<Uint16>& channelIds = { 1, 2, 3 });
+
+    // Queue an RMI of the client
+    void Invoke(const String& methodName, Array&& params);
+
+    // Deliver what the client has queued, returns false if the server closes the connection
+    bool Send()
+    {
+        return Deliver(client, *server);
+    }
+
+    // Deliver what the server has queued, e.g. the relayed messages
+    void Receive();
+
+    MediaSink sink {};
+    PhotonProtocol client { PhotonProtocol::Role::kClient };
+    std::unique_ptr<PhotonProtocol> server { std::make_unique<PhotonProtocol>(PhotonProtocol::Role::kServer) };
+};
+
+}
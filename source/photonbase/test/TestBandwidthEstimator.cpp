@@ -0,0 +1,118 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "TestBandwidthEstimator.h"
+#include "photonbase/transport/BandwidthEstimator.h"
+#include <SSBase/Assert.h>
+#include <deque>
+#include <iostream>
+
+namespace pht {
+
+// A sender following the target bitrate through a bottleneck with a FIFO queue
+class Bottleneck {
+public:
+    static const Uint32 kPacketSize = 1200;
+    static const Uint32 kPropagationDelay = 20; // ms, each way
+    static const Uint32 kMaxQueueDelay = 500; // ms, tail drop beyond this
+    static const Uint32 kFeedbackInterval = 50; // ms
+
+    // Run the link for `duration` milliseconds at `capacity` bits per second
+    // @return The maximum queuing delay in the last second
+    Uint32 Run(Uint32 capacity, Uint32 duration)
+    {
+        Uint32 maxQueueDelay = 0;
+        for (Uint32 end = now_ + duration; now_ < end; ++now_) {
+            budget_ += double(estimator_.GetTargetBitrate()) / 8 / 1000;
+            while (budget_ >= kPacketSize) {
+                budget_ -= kPacketSize;
+                BandwidthEstimator::PacketResult packet;
+                packet.sendTime = now_;
+                packet.size = kPacketSize;
+                double start = std::max(double(now_), linkFree_);
+                if (start - now_ <= kMaxQueueDelay) {
+                    linkFree_ = start + double(kPacketSize) * 8 * 1000 / capacity;
+                    packet.received = true;
+                    packet.arrivalTime = Uint32(linkFree_) + kPropagationDelay;
+                    if (now_ + 1000 >= end) {
+                        maxQueueDelay = std::max(maxQueueDelay, Uint32(start - now_));
+                    }
+                }
+                inFlight_.push_back(packet);
+            }
+            if (now_ % kFeedbackInterval == 0) {
+                // The feedback reports the packets the receiver has got, and takes another propagation delay
+                std::vector<BandwidthEstimator::PacketResult> packets;
+                while (!inFlight_.empty()) {
+                    auto& packet = inFlight_.front();
+                    Uint32 reportTime = packet.received ? packet.arrivalTime : packet.sendTime + kPropagationDelay;
+                    if (reportTime + kPropagationDelay > now_) {
+                        break;
+                    }
+                    packets.push_back(packet);
+                    inFlight_.pop_front();
+                }
+                estimator_.OnFeedback(packets, now_, 2 * kPropagationDelay);
+            }
+        }
+        return maxQueueDelay;
+    }
+
+    BandwidthEstimator estimator_ {};
+
+private:
+    Uint32 now_ { 1 };
+    double budget_ { 0 };
+    double linkFree_ { 0 };
+    std::deque<BandwidthEstimator::PacketResult> inFlight_ {};
+};
+
+static void TestFollowCapacity()
+{
+    Bottleneck bottleneck;
+    auto& estimator = bottleneck.estimator_;
+    SSASSERT(estimator.GetTargetBitrate() == BandwidthEstimator::kDefaultStartBitrate);
+
+    // Ramp up towards the capacity without building a standing queue
+    Uint32 queueDelay = bottleneck.Run(3000 * 1000, 40 * 1000);
+    SSASSERT(estimator.GetTargetBitrate() > 2000 * 1000);
+    SSASSERT(estimator.GetTargetBitrate() < 4500 * 1000);
+    SSASSERT(queueDelay < 200);
+
+    // The capacity drops, the growing queue must be detected quickly
+    queueDelay = bottleneck.Run(1000 * 1000, 10 * 1000);
+    SSASSERT(estimator.GetTargetBitrate() < 1500 * 1000);
+    SSASSERT(estimator.GetTargetBitrate() > 500 * 1000);
+    SSASSERT(queueDelay < 200);
+}
+
+static void TestLimits()
+{
+    BandwidthEstimator estimator;
+    estimator.SetBitrateLimits(200 * 1000, 300 * 1000, 400 * 1000);
+    SSASSERT(estimator.GetTargetBitrate() == 300 * 1000);
+
+    // Everything is lost, the target decreases to the minimum and stays there
+    Uint32 now = 0;
+    for (Uint32 i = 0; i < 200; ++i) {
+        std::vector<BandwidthEstimator::PacketResult> packets(10);
+        for (auto& packet : packets) {
+            packet.sendTime = now;
+            packet.size = 1000;
+        }
+        now += 50;
+        estimator.OnFeedback(packets, now, 40);
+    }
+    SSASSERT(estimator.GetLossRate() > 0.9);
+    SSASSERT(estimator.GetTargetBitrate() == 200 * 1000);
+}
+
+void TestBandwidthEstimator::test()
+{
+    TestFollowCapacity();
+    TestLimits();
+    std::cout << "Test bandwidth estimator pass" << std::endl;
+}
+
+}
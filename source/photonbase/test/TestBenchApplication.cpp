@@ -0,0 +1,82 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "TestBenchApplication.h"
+#include "LoopbackEndpoint.h"
+#include "photonbase/application/ApplicationManager.h"
+#include "photonbase/application/BenchApplication.h"
+#include "photonbase/protocol/MessageHeader.h"
+#include "photonbase/protocol/RemoteMethodInfo.h"
+#include <SSBase/Assert.h>
+#include <iostream>
+#include <vector>
+
+namespace pht {
+
+// The values of the echoes the client has received
+static std::vector<Uint64> Echoes(const MediaSink& sink)
+{
+    std::vector<Uint64> echoes;
+    for (auto rmi : sink.methods) {
+        bool matched = rmi.MatchPrototype(Variant::Type::Void, "bench.Echo", { Variant::Type::Uint16, Variant::Type::Uint64 });
+        SSASSERT(matched);
+        echoes.push_back(rmi.GetParameters()[1]->Get<Uint64>());
+    }
+    return echoes;
+}
+
+static RemoteMethodInfo Echo(Uint16 channelId, Uint64 value)
+{
+    return RemoteMethodInfo(Variant::Type::Void, "bench.Echo", Array({ std::make_shared<Variant>(channelId), std::make_shared<Variant>(value) }));
+}
+
+static void TestEchoAndReflect()
+{
+    BenchApplication bench;
+    bool registered = ApplicationManager::RegisterApplication("bench", &bench);
+    SSASSERT(registered);
+    {
+        LoopbackEndpoint endpoint("bench", { 1, 2 });
+        auto& client = endpoint.client;
+        bool invoked = client.InvokeRemoteMethod(0, Echo(1, 1));
+        SSASSERT(!invoked);
+        invoked = client.InvokeRemoteMethod(1, Echo(1, 0x123456789ABull));
+        SSASSERT(invoked);
+        invoked = client.InvokeRemoteMethod(1, Echo(2, 7));
+        SSASSERT(invoked);
+        bool sent = endpoint.Send();
+        SSASSERT(sent);
+        endpoint.Receive();
+        SSASSERT((Echoes(endpoint.sink) == std::vector<Uint64> { 0x123456789ABull, 7 }));
+
+        // Reflected without being handed to the application
+        endpoint.Invoke("bench.Reflect", Array({ std::make_shared<Variant>(Uint16(2)) }));
+        sent = client.SendMessage(2, MessageHeader::Type::kAudio, 0, ByteArray { 1, 2, 3 });
+        SSASSERT(sent);
+        sent = client.SendMessage(1, MessageHeader::Type::kAudio, 0, ByteArray { 4 });
+        SSASSERT(sent);
+        sent = endpoint.Send();
+        SSASSERT(sent);
+        endpoint.Receive();
+        auto& media = endpoint.sink.media;
+        SSASSERT(media.size() == 1 && media[0].first == 2 && media[0].second == (ByteArray { 1, 2, 3 }));
+        SSASSERT(bench.GetClients().size() == 1);
+
+        // No such channel
+        invoked = client.InvokeRemoteMethod(1, Echo(9, 0));
+        SSASSERT(invoked);
+        sent = endpoint.Send();
+        SSASSERT(!sent);
+    }
+    SSASSERT(bench.GetClients().empty());
+    ApplicationManager::UnregisterApplication("bench");
+}
+
+void TestBenchApplication::test()
+{
+    TestEchoAndReflect();
+    std::cout << "Test bench application pass" << std::endl;
+}
+
+}
@@ -0,0 +1,156 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "TestBufferChain.h"
+#include "photonbase/core/BufferChain.h"
+#include "photonbase/core/BufferPool.h"
+#include "photonbase/protocol/BaseProtocol.h"
+#include <SSBase/Assert.h>
+#include <iostream>
+#include <vector>
+
+namespace pht {
+
+static BufferSlice MakeSlice(Uint8 first, Uint32 size)
+{
+    BufferSlice slice(size);
+    for (Uint32 i = 0; i < size; ++i) {
+        slice.MutableData()[i] = Uint8(first + i);
+    }
+    return slice;
+}
+
+static std::vector<Uint8> ReadAll(const BufferChain& chain)
+{
+    std::vector<Uint8> bytes(chain.Size());
+    bool copied = chain.CopyTo(0, bytes.data(), chain.Size());
+    SSASSERT(copied);
+    return bytes;
+}
+
+static void TestSlices()
+{
+    auto payload = MakeSlice(10, 100);
+    BufferChain chain(payload);
+    Uint8 header[] = { 1, 2, 3 };
+    chain.Prepend(MakeSlice(1, 3));
+    chain.AppendBytes(header, sizeof(header));
+    chain.AppendBytes(header, sizeof(header)); // Merged into the same slice
+    SSASSERT(chain.Size() == 109 && chain.GetSlices().size() == 3);
+    SSASSERT(payload.UseCount() == 2); // Not copied
+
+    auto bytes = ReadAll(chain);
+    SSASSERT(bytes[0] == 1 && bytes[3] == 10 && bytes[102] == 109 && bytes[103] == 1 && bytes[108] == 3);
+    Uint8 middle[4];
+    bool copied = chain.CopyTo(1, middle, 4);
+    SSASSERT(copied && middle[0] == 2 && middle[2] == 10 && middle[3] == 11);
+    copied = chain.CopyTo(100, middle, 10);
+    SSASSERT(!copied);
+
+    // Split in the middle of the payload
+    auto head = chain.Split(53);
+    SSASSERT(head.Size() == 53 && chain.Size() == 56);
+    SSASSERT(ReadAll(head)[52] == 59 && ReadAll(chain)[0] == 60);
+    SSASSERT(payload.UseCount() == 3);
+
+    // Coalesce copies only if the bytes span several slices
+    auto first = chain.Coalesce(10);
+    SSASSERT(first.Size() == 10 && first.Data()[0] == 60 && payload.UseCount() == 4);
+    auto merged = chain.Coalesce(52);
+    SSASSERT(merged.Size() == 52 && merged.Data()[49] == 109 && merged.Data()[50] == 1);
+    SSASSERT(chain.Size() == 56 && ReadAll(chain)[50] == 1);
+
+    chain.Skip(54);
+    SSASSERT(chain.Size() == 2 && ReadAll(chain)[0] == 2);
+    chain.AppendBytes(header, 1); // The last slice is still the scratch block's
+    SSASSERT(ReadAll(chain) == std::vector<Uint8>({ 2, 3, 1 }));
+    chain.Skip(100);
+    SSASSERT(chain.Empty() && chain.GetSlices().empty());
+
+    head.Append(std::move(chain));
+    SSASSERT(head.Size() == 53);
+}
+
+// Only implements the DynamicBuffer interface, reverses every complete pair of bytes
+class SwapProtocol : public BaseProtocol {
+public:
+    bool OnInBoundData(ss::DynamicBuffer& inputBuffer, ss::DynamicBuffer& outputBuffer) override
+    {
+        while (inputBuffer.Size() >= 2) {
+            Uint8 pair[2] = { inputBuffer.GetData<Uint8>()[1], inputBuffer.GetData<Uint8>()[0] };
+            outputBuffer.PushData(pair, 2);
+            inputBuffer.Skip(2);
+        }
+        return true;
+    }
+};
+
+static void TestAdapter()
+{
+    SwapProtocol protocol;
+    Uint8 bytes[] = { 1, 2, 3, 4, 5 };
+    BufferChain input;
+    input.AppendBytes(bytes, 3);
+    input.Append(MakeSlice(4, 2));
+    BufferChain output;
+    bool handled = protocol.OnInBoundChain(input, output);
+    SSASSERT(handled);
+    SSASSERT(input.Size() == 1 && ReadAll(input)[0] == 5);
+    SSASSERT(ReadAll(output) == std::vector<Uint8>({ 2, 1, 4, 3 }));
+}
+
+static void TestPool()
+{
+    BufferPool pool(64, 2);
+    {
+        BufferChain chain;
+        chain.SetBlockPool(&pool);
+        Uint8 header[40] = { 7 };
+        chain.AppendBytes(header, sizeof(header));
+        chain.AppendBytes(header, sizeof(header)); // Doesn't fit, a second block
+        SSASSERT(chain.GetSlices().size() == 2 && pool.GetFreeCount() == 0);
+
+        // The bytes stay valid while a slice refers to them, e.g. during a write
+        auto sending = chain.GetSlices()[0];
+        chain.Clear();
+        SSASSERT(sending.Data()[0] == 7 && pool.GetFreeCount() == 0);
+    }
+    // Both blocks returned once the chain and the slice are gone
+    SSASSERT(pool.GetFreeCount() == 2);
+    auto block = pool.Acquire();
+    SSASSERT(block->Size() == 64 && pool.GetFreeCount() == 1);
+
+    // Larger than a block, not pooled
+    BufferChain chain;
+    chain.SetBlockPool(&pool);
+    std::vector<Uint8> large(100, 1);
+    chain.AppendBytes(large.data(), Uint32(large.size()));
+    SSASSERT(chain.Size() == 100 && pool.GetFreeCount() == 1);
+
+    // Beyond the limit, released blocks are freed
+    {
+        auto a = pool.Acquire();
+        auto b = pool.Acquire();
+        auto c = pool.Acquire();
+    }
+    SSASSERT(pool.GetFreeCount() == 2);
+
+    // Released after the pool is gone
+    std::shared_ptr<ByteArray> orphan;
+    {
+        BufferPool shortLived(16);
+        orphan = shortLived.Acquire();
+    }
+    orphan = nullptr;
+}
+
+void TestBufferChain::test()
+{
+    TestSlices();
+    TestPool();
+    TestAdapter();
+    std::cout << "Test buffer chain pass" << std::endl;
+}
+
+}
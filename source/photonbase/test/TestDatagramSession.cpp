@@ -0,0 +1,439 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "TestDatagramSession.h"
+#include "photonbase/protocol/impl/FlowControlWindow.h"
+#include <SSBase/Assert.h>
+#include <chrono>
+#include <iostream>
+#include <photonbase/application/IApplication.h>
+#include <photonbase/protocol/MessageHeader.h>
+#include <photonbase/protocol/PhotonProtocol.h>
+#include <photonbase/transport/DatagramSession.h>
+#include <photonbase/transport/LossyLink.h>
+#include <photonbase/transport/UdpSocket.h>
+#include <photonbase/transport/UdpTransport.h>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace pht {
+
+static ByteArray MakePayload(Uint32 index, Uint32 size)
+{
+    ByteArray payload(size);
+    for (Uint32 i = 0; i < size; ++i) {
+        payload.Data()[i] = Uint8(index + i);
+    }
+    return payload;
+}
+
+// Payload i has size (i * 397) % 3000 + 1, so some of them span several datagrams
+static Uint32 PayloadSize(Uint32 index)
+{
+    return (index * 397) % 3000 + 1;
+}
+
+struct Peers {
+    DatagramSession sender;
+    DatagramSession receiver;
+    LossyLink forward;
+    LossyLink backward;
+
+    explicit Peers(const LossyLink::Options& options)
+        : forward(options)
+        , backward(LossyLink::Options { options.lossRate, options.delay, options.jitter, options.seed + 1 })
+    {
+    }
+
+    bool Step(Uint32 now)
+    {
+        bool ok = sender.Poll(now, [this, now](const Uint8* data, Uint32 size) { forward.Send(data, size, now); });
+        ok = receiver.Poll(now, [this, now](const Uint8* data, Uint32 size) { backward.Send(data, size, now); }) && ok;
+        forward.Poll(now, [this, now](const Uint8* data, Uint32 size) {
+            bool accepted = receiver.OnDatagram(data, size, now);
+            SSASSERT(accepted);
+        });
+        backward.Poll(now, [this, now](const Uint8* data, Uint32 size) {
+            bool accepted = sender.OnDatagram(data, size, now);
+            SSASSERT(accepted);
+        });
+        return ok;
+    }
+};
+
+static void TestReliableOrdered()
+{
+    Peers peers(LossyLink::Options { 0.2, 20, 30, 7 });
+    const Uint32 count = 200;
+    for (Uint32 i = 0; i < count; ++i) {
+        bool sent = peers.sender.Send(1, MakePayload(i, PayloadSize(i)).Data(), PayloadSize(i));
+        SSASSERT(sent);
+    }
+
+    Uint32 received = 0;
+    for (Uint32 now = 0; now < 60000 && received < count; ++now) {
+        bool stepped = peers.Step(now);
+        SSASSERT(stepped);
+        Uint16 channelId;
+        ByteArray payload;
+        while (peers.receiver.Receive(channelId, payload)) {
+            SSASSERT(channelId == 1);
+            SSASSERT(payload == MakePayload(received, PayloadSize(received)));
+            ++received;
+        }
+    }
+    SSASSERT(received == count);
+    SSASSERT(peers.sender.GetStats().retransmissions > 0);
+    SSASSERT(peers.sender.GetStats().rtt >= 20);
+    // The receiver's feedback reaches the bandwidth estimator
+    SSASSERT(peers.sender.GetStats().ackedBitrate > 0);
+    SSASSERT(peers.sender.GetStats().targetBitrate >= BandwidthEstimator::kDefaultMinBitrate);
+}
+
+static void TestReliableUnordered()
+{
+    Peers peers(LossyLink::Options { 0.2, 20, 30, 11 });
+    bool modeSet = peers.sender.SetChannelMode(2, ReliabilityMode::kReliableUnordered);
+    SSASSERT(modeSet);
+    const Uint32 count = 200;
+    for (Uint32 i = 0; i < count; ++i) {
+        // The first byte identifies the payload
+        bool sent = peers.sender.Send(2, MakePayload(i, PayloadSize(i)).Data(), PayloadSize(i));
+        SSASSERT(sent);
+    }
+
+    std::set<Uint32> received;
+    bool reordered = false;
+    for (Uint32 now = 0; now < 60000 && received.size() < count; ++now) {
+        bool stepped = peers.Step(now);
+        SSASSERT(stepped);
+        Uint16 channelId;
+        ByteArray payload;
+        while (peers.receiver.Receive(channelId, payload)) {
+            Uint32 index = 0;
+            while (index < count && !(payload.Size() == PayloadSize(index) && payload == MakePayload(index, PayloadSize(index)))) {
+                ++index;
+            }
+            SSASSERT(index < count);
+            bool inserted = received.insert(index).second;
+            SSASSERT(inserted);
+            reordered = reordered || index + 1 != received.size();
+        }
+    }
+    SSASSERT(received.size() == count);
+    SSASSERT(reordered);
+}
+
+// Send a media-like stream on an unreliable channel, return the number of payloads delivered
+static Uint32 RunUnreliable(Peers& peers, Uint32 count)
+{
+    Uint32 now = 0;
+    Uint32 received = 0;
+    Uint32 lastIndex = 0;
+    for (Uint32 i = 0; i < count + 20; ++i) {
+        // One payload per 5 milliseconds, and some idle time at the end
+        if (i < count) {
+            bool sent = peers.sender.Send(3, MakePayload(i, PayloadSize(i)).Data(), PayloadSize(i));
+            SSASSERT(sent);
+        }
+        for (Uint32 end = now + 5; now < end; ++now) {
+            bool stepped = peers.Step(now);
+            SSASSERT(stepped);
+            Uint16 channelId;
+            ByteArray payload;
+            while (peers.receiver.Receive(channelId, payload)) {
+                // Find which payload it is, it must be newer than the previous one
+                Uint32 index = received == 0 ? 0 : lastIndex + 1;
+                while (index < count && !(payload.Size() == PayloadSize(index) && payload == MakePayload(index, PayloadSize(index)))) {
+                    ++index;
+                }
+                SSASSERT(index < count);
+                lastIndex = index;
+                ++received;
+            }
+        }
+    }
+    SSASSERT(!peers.sender.HasPendingData());
+    return received;
+}
+
+static void TestUnreliable()
+{
+    Peers peers(LossyLink::Options { 0.2, 20, 0, 13 });
+    bool modeSet = peers.sender.SetChannelMode(3, ReliabilityMode::kUnreliable);
+    SSASSERT(modeSet);
+    modeSet = peers.sender.SetChannelMode(0, ReliabilityMode::kUnreliable);
+    SSASSERT(!modeSet);
+    const Uint32 count = 200;
+    Uint32 received = RunUnreliable(peers, count);
+    SSASSERT(received > count / 2 && received < count);
+    SSASSERT(peers.receiver.GetStats().droppedFragments > 0);
+    SSASSERT(peers.sender.GetStats().retransmissions == 0);
+
+    double lossRate = 0;
+    SSASSERT(peers.sender.GetChannelLossRate(3, lossRate));
+    SSASSERT(lossRate > 0.1 && lossRate < 0.3);
+}
+
+static void TestFec()
+{
+    const Uint32 count = 200;
+    const LossyLink::Options options { 0.1, 20, 10, 19 };
+    Peers plain(options);
+    bool modeSet = plain.sender.SetChannelMode(3, ReliabilityMode::kUnreliable);
+    SSASSERT(modeSet);
+    bool fecSet = plain.sender.SetChannelFec(1, 4, 1);
+    SSASSERT(!fecSet); // Reliable channels are retransmitted instead
+    Uint32 plainReceived = RunUnreliable(plain, count);
+
+    Peers xorParity(options);
+    modeSet = xorParity.sender.SetChannelMode(3, ReliabilityMode::kUnreliable);
+    SSASSERT(modeSet);
+    fecSet = xorParity.sender.SetChannelFec(3, 4, 1);
+    SSASSERT(fecSet);
+    Uint32 xorReceived = RunUnreliable(xorParity, count);
+    SSASSERT(xorParity.receiver.GetStats().recoveredFragments > 0);
+
+    Peers reedSolomon(options);
+    modeSet = reedSolomon.sender.SetChannelMode(3, ReliabilityMode::kUnreliable);
+    SSASSERT(modeSet);
+    fecSet = reedSolomon.sender.SetChannelFec(3, 8, 4, true);
+    SSASSERT(fecSet);
+    Uint32 reedSolomonReceived = RunUnreliable(reedSolomon, count);
+    SSASSERT(reedSolomon.receiver.GetStats().recoveredFragments > 0);
+
+    SSASSERT(plainReceived < xorReceived);
+    SSASSERT(plainReceived < reedSolomonReceived);
+    SSASSERT(reedSolomonReceived > count * 95 / 100);
+}
+
+static void TestNack()
+{
+    const Uint32 count = 200;
+    const LossyLink::Options options { 0.1, 20, 10, 23 };
+    Peers plain(options);
+    bool modeSet = plain.sender.SetChannelMode(3, ReliabilityMode::kUnreliable);
+    SSASSERT(modeSet);
+    Uint32 plainReceived = RunUnreliable(plain, count);
+
+    // The round trip is 40~60ms, a retransmission arrives in time
+    Peers nack(options);
+    modeSet = nack.sender.SetChannelMode(3, ReliabilityMode::kUnreliable);
+    SSASSERT(modeSet);
+    bool nackSet = nack.receiver.SetChannelNack(3, 200);
+    SSASSERT(nackSet);
+    Uint32 nackReceived = RunUnreliable(nack, count);
+    SSASSERT(nack.receiver.GetStats().nackedFragments > 0);
+    SSASSERT(nackReceived > plainReceived);
+    SSASSERT(nackReceived > count * 95 / 100);
+
+    // A retransmission would be too late, the receiver stops asking once it knows the round trip
+    Peers late(options);
+    modeSet = late.sender.SetChannelMode(3, ReliabilityMode::kUnreliable);
+    SSASSERT(modeSet);
+    nackSet = late.receiver.SetChannelNack(3, 30);
+    SSASSERT(nackSet);
+    RunUnreliable(late, count);
+    SSASSERT(late.receiver.GetStats().suppressedNacks > 0);
+    SSASSERT(late.receiver.GetStats().nackedFragments < nack.receiver.GetStats().nackedFragments);
+
+    nackSet = nack.receiver.SetChannelNack(0, 100);
+    SSASSERT(!nackSet); // Channel 0 is reliable
+}
+
+static void TestMalformed()
+{
+    DatagramSession session;
+    const Uint8 tooShort[] = { 0, 0, 0 };
+    bool accepted = session.OnDatagram(tooShort, sizeof(tooShort), 0);
+    SSASSERT(!accepted);
+    const Uint8 unknownFrame[] = { 0, 0, 0, 0, 9, 0 };
+    accepted = session.OnDatagram(unknownFrame, sizeof(unknownFrame), 0);
+    SSASSERT(!accepted);
+    // A data frame claims 5 bytes but only has 1
+    const Uint8 truncated[] = { 0, 0, 0, 0, 1, 1, 0, 0, 0, 0, 0, 5, 1 };
+    accepted = session.OnDatagram(truncated, sizeof(truncated), 0);
+    SSASSERT(!accepted);
+}
+
+static void TestPeerGone()
+{
+    DatagramSession session;
+    const Uint8 data[] = { 1, 2, 3 };
+    bool queued = session.Send(0, data, sizeof(data));
+    SSASSERT(queued);
+    Uint32 sent = 0;
+    bool alive = true;
+    for (Uint32 now = 0; now < 60000 && alive; now += 10) {
+        alive = session.Poll(now, [&sent](const Uint8*, Uint32) { ++sent; });
+    }
+    SSASSERT(!alive);
+    SSASSERT(sent == 11);
+}
+
+static Uint32 Now()
+{
+    static auto start = std::chrono::steady_clock::now();
+    return Uint32(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+// Two real sockets over loopback, with loss and delay injected before the sending socket
+static void TestLoopback()
+{
+    UdpSocket a;
+    UdpSocket b;
+    bool bound = a.Bind("127.0.0.1", 0) && b.Bind("127.0.0.1", 0);
+    SSASSERT(bound);
+    bool connected = a.Connect("127.0.0.1", b.GetLocalPort()) && b.Connect("127.0.0.1", a.GetLocalPort());
+    SSASSERT(connected);
+
+    DatagramSession sender;
+    DatagramSession receiver;
+    LossyLink link(LossyLink::Options { 0.3, 5, 5, 17 });
+    const Uint32 count = 50;
+    for (Uint32 i = 0; i < count; ++i) {
+        bool sent = sender.Send(1, MakePayload(i, PayloadSize(i)).Data(), PayloadSize(i));
+        SSASSERT(sent);
+    }
+
+    Uint8 datagram[kMaxDatagramSize];
+    Uint32 received = 0;
+    auto deadline = Now() + 10000;
+    while (received < count && Now() < deadline) {
+        Uint32 now = Now();
+        bool polled = sender.Poll(now, [&link, now](const Uint8* data, Uint32 size) { link.Send(data, size, now); });
+        SSASSERT(polled);
+        link.Poll(now, [&a](const Uint8* data, Uint32 size) {
+            bool sent = a.Send(data, size);
+            SSASSERT(sent);
+        });
+        polled = receiver.Poll(now, [&b](const Uint8* data, Uint32 size) {
+            bool sent = b.Send(data, size);
+            SSASSERT(sent);
+        });
+        SSASSERT(polled);
+        int size;
+        while ((size = b.Receive(datagram, sizeof(datagram))) >= 0) {
+            bool accepted = receiver.OnDatagram(datagram, Uint32(size), now);
+            SSASSERT(accepted);
+        }
+        while ((size = a.Receive(datagram, sizeof(datagram))) >= 0) {
+            bool accepted = sender.OnDatagram(datagram, Uint32(size), now);
+            SSASSERT(accepted);
+        }
+        Uint16 channelId;
+        ByteArray payload;
+        while (receiver.Receive(channelId, payload)) {
+            SSASSERT(payload == MakePayload(received, PayloadSize(received)));
+            ++received;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    SSASSERT(received == count);
+    SSASSERT(link.GetDroppedDatagrams() > 0);
+}
+
+// Checks the media messages it receives are whole: the first 2 bytes are the index, then byte k is index + k
+class MediaCheckApplication : public IApplication {
+public:
+    bool OnRemoteMethodInvoke(IProtocol* client, const RemoteMethodInfo& method) override
+    {
+        return true;
+    }
+
+    bool OnMediaMessage(IProtocol* client, Uint16 channelId, const MessageHeader& header, const ByteArray& payload) override
+    {
+        SSASSERT(payload.Size() == size);
+        Uint32 index = payload.Data()[0] | (payload.Data()[1] << 8);
+        for (Uint32 k = 2; k < payload.Size(); ++k) {
+            SSASSERT(payload.Data()[k] == Uint8(index + k));
+        }
+        SSASSERT(received == 0 || index > lastIndex);
+        lastIndex = index;
+        ++received;
+        return true;
+    }
+
+    void OnClientAttached(IProtocol* client) override
+    {
+    }
+
+    void OnClientDetached(IProtocol* client) override
+    {
+    }
+
+    Uint32 size { 0 };
+    Uint32 received { 0 };
+    Uint32 lastIndex { 0 };
+};
+
+// A PhotonProtocol over a lossy path, the lost chunks of an unreliable channel must not use up its windows
+static void TestUnreliableFlowControl()
+{
+    const Uint32 size = 3000; // 3 fragments, and a single chunk
+    const Uint32 count = kDefaultConnectionWindowSize / size * 2;
+    MediaCheckApplication serverApp;
+    serverApp.size = size;
+    PhotonProtocol server(PhotonProtocol::Role::kServer);
+    server.SetApplication(&serverApp);
+    PhotonProtocol client(PhotonProtocol::Role::kClient);
+    UdpTransport serverTransport(&server);
+    UdpTransport clientTransport(&client);
+    bool modeSet = clientTransport.SetChannelMode(1, ReliabilityMode::kUnreliable);
+    SSASSERT(modeSet);
+    bool connected = client.Connect("any", { 1, 2 });
+    SSASSERT(connected);
+    modeSet = clientTransport.SetChannelMode(2, ReliabilityMode::kUnreliable);
+    SSASSERT(!modeSet); // Already created flow controlled
+
+    // Half of the messages are lost
+    LossyLink forward(LossyLink::Options { 0.2, 10, 0, 29 });
+    LossyLink backward(LossyLink::Options { 0.2, 10, 0, 31 });
+    Uint32 sent = 0;
+    for (Uint32 now = 0; now < count + 2000; ++now) {
+        if (sent < count && client.IsEstablished()) {
+            ByteArray payload(size);
+            payload.Data()[0] = Uint8(sent);
+            payload.Data()[1] = Uint8(sent >> 8);
+            for (Uint32 k = 2; k < size; ++k) {
+                payload.Data()[k] = Uint8(sent + k);
+            }
+            bool queued = client.SendMessage(1, MessageHeader::Type::kVideo, 0, std::move(payload));
+            SSASSERT(queued);
+            ++sent;
+        }
+        bool ok = clientTransport.Poll(now, [&forward, now](const Uint8* data, Uint32 size) { forward.Send(data, size, now); })
+            && serverTransport.Poll(now, [&backward, now](const Uint8* data, Uint32 size) { backward.Send(data, size, now); });
+        SSASSERT(ok);
+        forward.Poll(now, [&serverTransport, now](const Uint8* data, Uint32 size) {
+            bool ok = serverTransport.OnDatagram(data, size, now);
+            SSASSERT(ok);
+        });
+        backward.Poll(now, [&clientTransport, now](const Uint8* data, Uint32 size) {
+            bool ok = clientTransport.OnDatagram(data, size, now);
+            SSASSERT(ok);
+        });
+    }
+    SSASSERT(sent == count);
+    // Much more than the windows got through, up to the end of the stream
+    SSASSERT(serverApp.received * size > kDefaultConnectionWindowSize);
+    SSASSERT(serverApp.received < count && serverApp.lastIndex + 20 > count);
+}
+
+void TestDatagramSession::test()
+{
+    TestReliableOrdered();
+    TestReliableUnordered();
+    TestUnreliable();
+    TestFec();
+    TestNack();
+    TestMalformed();
+    TestPeerGone();
+    TestLoopback();
+    TestUnreliableFlowControl();
+    std::cout << "Test datagram session pass" << std::endl;
+}
+
+}
@@ -0,0 +1,94 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "TestErasureCode.h"
+#include "photonbase/transport/impl/ErasureCode.h"
+#include "photonbase/transport/impl/GaloisField.h"
+#include <SSBase/Assert.h>
+#include <iostream>
+#include <random>
+
+namespace pht {
+
+static void TestGaloisField()
+{
+    for (Uint32 a = 1; a < 256; ++a) {
+        SSASSERT(GaloisField::Multiply(Uint8(a), GaloisField::Inverse(Uint8(a))) == 1);
+        SSASSERT(GaloisField::Multiply(Uint8(a), 1) == a);
+        SSASSERT(GaloisField::Multiply(Uint8(a), 0) == 0);
+    }
+    // x^8 = x^4 + x^3 + x^2 + 1
+    SSASSERT(GaloisField::Multiply(0x80, 2) == 0x1D);
+
+    // The SIMD path must match the portable one, including the tail
+    std::mt19937 random(3);
+    std::vector<Uint8> src(1000);
+    for (auto& b : src) {
+        b = Uint8(random());
+    }
+    for (Uint32 c : { 0u, 1u, 2u, 0x53u, 0xFFu }) {
+        std::vector<Uint8> expected(src.size(), 0x5A);
+        std::vector<Uint8> actual(src.size(), 0x5A);
+        GaloisField::MultiplyAddScalar(expected.data(), src.data(), Uint8(c), Uint32(src.size()));
+        GaloisField::MultiplyAdd(actual.data(), src.data(), Uint8(c), Uint32(src.size()));
+        SSASSERT(expected == actual);
+    }
+}
+
+// Erase every combination of up to parityCount shards of a group and rebuild the data
+static void TestRecover(Uint32 dataCount, Uint32 parityCount)
+{
+    const Uint32 size = 100;
+    std::mt19937 random(dataCount * 31 + parityCount);
+    std::vector<std::vector<Uint8>> data(dataCount, std::vector<Uint8>(size));
+    std::vector<const Uint8*> dataPointers;
+    for (auto& shard : data) {
+        for (auto& b : shard) {
+            b = Uint8(random());
+        }
+        dataPointers.push_back(shard.data());
+    }
+    std::vector<std::vector<Uint8>> parity(parityCount, std::vector<Uint8>(size));
+    for (Uint32 i = 0; i < parityCount; ++i) {
+        ErasureCode::Encode(dataPointers, size, parityCount, i, parity[i].data());
+    }
+
+    Uint32 total = dataCount + parityCount;
+    for (Uint32 mask = 0; mask < (1u << total); ++mask) {
+        Uint32 erased = 0;
+        std::vector<const Uint8*> receivedData(dataCount);
+        std::vector<const Uint8*> receivedParity(parityCount);
+        for (Uint32 i = 0; i < total; ++i) {
+            bool lost = (mask & (1u << i)) != 0;
+            erased += lost ? 1 : 0;
+            if (i < dataCount) {
+                receivedData[i] = lost ? nullptr : data[i].data();
+            } else {
+                receivedParity[i - dataCount] = lost ? nullptr : parity[i - dataCount].data();
+            }
+        }
+        std::map<Uint32, std::vector<Uint8>> recovered;
+        bool ok = ErasureCode::Decode(receivedData, receivedParity, size, recovered);
+        SSASSERT(ok == (erased <= parityCount));
+        if (erased > parityCount) {
+            continue;
+        }
+        for (Uint32 j = 0; j < dataCount; ++j) {
+            if (receivedData[j] == nullptr) {
+                SSASSERT(recovered.at(j) == data[j]);
+            }
+        }
+    }
+}
+
+void TestErasureCode::test()
+{
+    TestGaloisField();
+    TestRecover(5, 1); // XOR
+    TestRecover(6, 3);
+    TestRecover(1, 4);
+    std::cout << "Test erasure code pass" << std::endl;
+}
+
+}
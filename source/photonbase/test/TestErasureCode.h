@@ -0,0 +1,14 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+namespace pht {
+
+class TestErasureCode {
+public:
+    static void test();
+};
+
+}
@@ -0,0 +1,430 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "TestEventLoop.h"
+#include "photonbase/transport/EventLoop.h"
+#include "photonbase/transport/TcpSocket.h"
+#include <SSBase/Assert.h>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace pht {
+
+// Stops a loop that hangs, e.g. waiting for data that never arrives
+static LoopTimer* StartWatchdog(EventLoop& loop, bool& expired)
+{
+    auto* watchdog = loop.CreateTimer();
+    SSASSERT(watchdog != nullptr);
+    bool started = watchdog->Start(5000, 0, [&loop, &expired]() {
+        expired = true;
+        loop.Stop();
+    });
+    SSASSERT(started);
+    return watchdog;
+}
+
+static void TestTimers()
+{
+    EventLoop loop;
+    auto* uninitialized = loop.CreateTimer();
+    SSASSERT(uninitialized == nullptr);
+    bool initialized = loop.Init();
+    SSASSERT(initialized);
+
+    int once = 0;
+    int repeated = 0;
+    auto* onceTimer = loop.CreateTimer();
+    auto* repeatTimer = loop.CreateTimer();
+    SSASSERT(onceTimer != nullptr && repeatTimer != nullptr);
+    bool started = onceTimer->Start(5, 0, [&once, onceTimer]() {
+        ++once;
+        onceTimer->Close();
+    });
+    SSASSERT(started);
+    started = repeatTimer->Start(1, 2, [&repeated, repeatTimer]() {
+        if (++repeated == 5) {
+            repeatTimer->Close();
+        }
+    });
+    SSASSERT(started);
+    // Returns once both timers are closed
+    loop.Run();
+    SSASSERT(once == 1 && repeated == 5);
+
+    // Stop returns from Run with a timer still running, the loop closes it
+    auto* stopTimer = loop.CreateTimer();
+    started = stopTimer->Start(1, 1, [&loop]() {
+        loop.Stop();
+    });
+    SSASSERT(started);
+    loop.Run();
+}
+
+// A client sends to an echo server, on one loop
+static void RunEcho(EventLoop& loop, TcpSocket* server, Uint16 port)
+{
+    bool listening = server->Listen(16, [](TcpSocket* server, int status) {
+        SSASSERT(status == 0);
+        auto* connection = server->Accept();
+        SSASSERT(connection != nullptr);
+        std::string ip;
+        Uint16 peerPort = 0;
+        bool gotPeer = connection->GetPeer(ip, peerPort);
+        SSASSERT(gotPeer && ip == "127.0.0.1" && peerPort != 0);
+        bool receiving = connection->StartReceive([connection](Int64 nread, const char* data) {
+            if (nread < 0) {
+                connection->Close(nullptr);
+                return;
+            }
+            bool sent = connection->Send(data, Uint32(nread), nullptr);
+            SSASSERT(sent);
+        });
+        SSASSERT(receiving);
+    });
+    SSASSERT(listening);
+
+    bool expired = false;
+    auto* watchdog = StartWatchdog(loop, expired);
+    const std::string message = "hello photon";
+    std::string echoed;
+    bool closed = false;
+    auto* client = loop.CreateTcpSocket();
+    SSASSERT(client != nullptr);
+    bool connecting = client->Connect("127.0.0.1", port, [&](int status) {
+        SSASSERT(status == 0);
+        bool noDelay = client->SetNoDelay(true);
+        SSASSERT(noDelay);
+        bool receiving = client->StartReceive([&](Int64 nread, const char* data) {
+            SSASSERT(nread > 0);
+            echoed.append(data, size_t(nread));
+            if (echoed.size() == message.size()) {
+                client->Close([&closed, server, watchdog]() {
+                    closed = true;
+                    server->Close(nullptr);
+                    watchdog->Close();
+                });
+            }
+        });
+        SSASSERT(receiving);
+        bool sent = client->Send(message.data(), Uint32(message.size()), [](int status) {
+            SSASSERT(status == 0);
+        });
+        SSASSERT(sent);
+    });
+    SSASSERT(connecting);
+    // Returns once everything is closed
+    loop.Run();
+    SSASSERT(!expired && closed && echoed == message);
+}
+
+static void TestEcho()
+{
+    EventLoop loop;
+    bool initialized = loop.Init();
+    SSASSERT(initialized);
+    auto* server = loop.CreateTcpSocket();
+    SSASSERT(server != nullptr);
+    SSASSERT(server->GetLocalPort() == 0);
+    bool bound = server->Bind("127.0.0.1", 0);
+    SSASSERT(bound);
+    Uint16 port = server->GetLocalPort();
+    SSASSERT(port != 0);
+    RunEcho(loop, server, port);
+}
+
+// A listening socket bound outside the loop, like the SO_REUSEPORT ones of photonserver
+static void TestOpen()
+{
+#ifndef _WIN32
+    sockaddr_in address {};
+    address.sin_family = AF_INET;
+    address.sin_port = 0;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    SSASSERT(fd >= 0);
+    int ret = bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+    SSASSERT(ret == 0);
+
+    EventLoop loop;
+    bool initialized = loop.Init();
+    SSASSERT(initialized);
+    auto* server = loop.CreateTcpSocket();
+    SSASSERT(server != nullptr);
+    bool opened = server->Open(fd);
+    SSASSERT(opened);
+    Uint16 port = server->GetLocalPort();
+    SSASSERT(port != 0);
+    RunEcho(loop, server, port);
+#endif
+}
+
+// The connections of a loop read into one buffer, each read is handled before the next one
+static void TestSharedReceiveBuffer()
+{
+    EventLoop loop;
+    bool initialized = loop.Init();
+    SSASSERT(initialized);
+    auto* server = loop.CreateTcpSocket();
+    bool bound = server != nullptr && server->Bind("127.0.0.1", 0);
+    SSASSERT(bound);
+
+    std::vector<char> shared(64);
+    std::vector<TcpSocket*> connections;
+    std::string received;
+    bool expired = false;
+    auto* watchdog = StartWatchdog(loop, expired);
+    const std::string messages[] = { "alpha", "beta" };
+    bool listening = server->Listen(16, [&](TcpSocket* server, int status) {
+        SSASSERT(status == 0);
+        auto* connection = server->Accept();
+        SSASSERT(connection != nullptr);
+        connections.push_back(connection);
+        auto alloc = [&shared](size_t /* suggestedSize */, char** base, size_t* len) {
+            *base = shared.data();
+            *len = shared.size();
+        };
+        bool receiving = connection->StartReceive(alloc, [&, server](Int64 nread, const char* data) {
+            if (nread < 0) {
+                return; // The client closes after sending
+            }
+            SSASSERT(data == shared.data());
+            received.append(data, size_t(nread));
+            if (received.size() == messages[0].size() + messages[1].size()) {
+                for (auto* connection : connections) {
+                    connection->Close(nullptr);
+                }
+                server->Close(nullptr);
+                watchdog->Close();
+            }
+        });
+        SSASSERT(receiving);
+    });
+    SSASSERT(listening);
+
+    for (auto& message : messages) {
+        auto* client = loop.CreateTcpSocket();
+        bool connecting = client->Connect("127.0.0.1", server->GetLocalPort(), [client, &message](int status) {
+            SSASSERT(status == 0);
+            bool sent = client->Send(message.data(), Uint32(message.size()), [client](int status) {
+                SSASSERT(status == 0);
+                client->Close(nullptr);
+            });
+            SSASSERT(sent);
+        });
+        SSASSERT(connecting);
+    }
+    loop.Run();
+    SSASSERT(!expired);
+    SSASSERT(received == "alphabeta" || received == "betaalpha");
+}
+
+// Slices of separate blocks go out in one write, and stay with the write until it completes
+static void TestVectoredSend()
+{
+    EventLoop loop;
+    bool initialized = loop.Init();
+    SSASSERT(initialized);
+    auto* server = loop.CreateTcpSocket();
+    bool bound = server != nullptr && server->Bind("127.0.0.1", 0);
+    SSASSERT(bound);
+
+    auto slices = std::make_shared<std::vector<std::string>>();
+    std::string expected;
+    for (int i = 0; i < 10; ++i) {
+        slices->push_back(std::string(size_t(1000 * i + 1), char('a' + i)));
+        expected += slices->back();
+    }
+    std::string received;
+    bool written = false;
+    bool expired = false;
+    auto* watchdog = StartWatchdog(loop, expired);
+    bool listening = server->Listen(16, [&written, slices](TcpSocket* server, int status) {
+        SSASSERT(status == 0);
+        auto* connection = server->Accept();
+        SSASSERT(connection != nullptr);
+        std::vector<ConstBuffer> buffers;
+        for (auto& slice : *slices) {
+            buffers.push_back({ slice.data(), slice.size() });
+        }
+        // The write holds the slices, the array goes away now
+        bool sent = connection->Send(buffers.data(), Uint32(buffers.size()), [&written, slices, connection](int status) {
+            SSASSERT(status == 0);
+            written = true;
+            connection->Close(nullptr);
+        });
+        SSASSERT(sent);
+        server->Close(nullptr);
+    });
+    SSASSERT(listening);
+
+    auto* client = loop.CreateTcpSocket();
+    bool connecting = client->Connect("127.0.0.1", server->GetLocalPort(), [&](int status) {
+        SSASSERT(status == 0);
+        bool receiving = client->StartReceive([&](Int64 nread, const char* data) {
+            if (nread < 0) {
+                client->Close(nullptr);
+                watchdog->Close();
+                return;
+            }
+            received.append(data, size_t(nread));
+        });
+        SSASSERT(receiving);
+    });
+    SSASSERT(connecting);
+    slices = nullptr; // Held by the server until the write completes
+    loop.Run();
+    SSASSERT(!expired && written && received == expected);
+}
+
+// Tasks posted by several threads run one by one on the loop thread
+static void TestPost()
+{
+    EventLoop loop;
+    bool posted = loop.Post([]() {});
+    SSASSERT(!posted); // Not initialized
+    bool initialized = loop.Init();
+    SSASSERT(initialized);
+    // Keeps the loop running until it is stopped
+    auto* keepAlive = loop.CreateTimer();
+    bool started = keepAlive->Start(60000, 60000, []() {});
+    SSASSERT(started);
+    std::thread runner([&loop]() {
+        loop.Run();
+    });
+
+    const int threadCount = 4;
+    const int taskCount = 1000;
+    int counter = 0; // Only touched by the loop thread
+    std::vector<std::thread> posters;
+    for (int i = 0; i < threadCount; ++i) {
+        posters.emplace_back([&loop, &counter]() {
+            for (int k = 0; k < taskCount; ++k) {
+                bool posted = loop.Post([&counter]() {
+                    ++counter;
+                });
+                SSASSERT(posted);
+            }
+        });
+    }
+    for (auto& poster : posters) {
+        poster.join();
+    }
+    int total = 0;
+    posted = loop.Post([&counter, &total]() {
+        total = counter;
+    });
+    SSASSERT(posted);
+    loop.Stop();
+    runner.join();
+    SSASSERT(total == threadCount * taskCount);
+}
+
+// A connection accepted by one loop is served by another one on another thread, like the handoffs of photonserver
+static void TestHandoff()
+{
+#ifndef _WIN32
+    EventLoop owner;
+    bool initialized = owner.Init();
+    SSASSERT(initialized);
+    auto* keepAlive = owner.CreateTimer();
+    bool started = keepAlive->Start(60000, 60000, []() {});
+    SSASSERT(started);
+    std::thread ownerThread([&owner]() {
+        owner.Run();
+    });
+
+    EventLoop loop;
+    initialized = loop.Init();
+    SSASSERT(initialized);
+    auto* server = loop.CreateTcpSocket();
+    bool bound = server != nullptr && server->Bind("127.0.0.1", 0);
+    SSASSERT(bound);
+    bool listening = server->Listen(16, [&owner](TcpSocket* server, int status) {
+        SSASSERT(status == 0);
+        auto* connection = server->Accept();
+        SSASSERT(connection != nullptr);
+        bool receiving = connection->StartReceive([connection, &owner](Int64 nread, const char* data) {
+            SSASSERT(nread > 0);
+            // Hand off after the first read, what has been read goes along
+            int fd = dup(connection->GetFd());
+            SSASSERT(fd >= 0);
+            connection->StopReceive();
+            connection->Close(nullptr);
+            std::string received(data, size_t(nread));
+            bool posted = owner.Post([&owner, fd, received]() {
+                auto* adopted = owner.CreateTcpSocket();
+                bool opened = adopted != nullptr && adopted->Open(fd);
+                SSASSERT(opened);
+                bool sent = adopted->Send(received.data(), Uint32(received.size()), nullptr);
+                SSASSERT(sent);
+                bool receiving = adopted->StartReceive([adopted](Int64 nread, const char* data) {
+                    if (nread < 0) {
+                        adopted->Close(nullptr);
+                        return;
+                    }
+                    bool sent = adopted->Send(data, Uint32(nread), nullptr);
+                    SSASSERT(sent);
+                });
+                SSASSERT(receiving);
+            });
+            SSASSERT(posted);
+        });
+        SSASSERT(receiving);
+    });
+    SSASSERT(listening);
+
+    // The first message is answered by the owner with the bytes read before the handoff, the second one is read
+    // by the owner
+    bool expired = false;
+    auto* watchdog = StartWatchdog(loop, expired);
+    std::string echoed;
+    auto* client = loop.CreateTcpSocket();
+    bool connecting = client->Connect("127.0.0.1", server->GetLocalPort(), [&](int status) {
+        SSASSERT(status == 0);
+        bool receiving = client->StartReceive([&](Int64 nread, const char* data) {
+            SSASSERT(nread > 0);
+            echoed.append(data, size_t(nread));
+            if (echoed == "first") {
+                bool sent = client->Send("second", 6, nullptr);
+                SSASSERT(sent);
+            } else if (echoed == "firstsecond") {
+                client->Close(nullptr);
+                server->Close(nullptr);
+                watchdog->Close();
+            }
+        });
+        SSASSERT(receiving);
+        bool sent = client->Send("first", 5, nullptr);
+        SSASSERT(sent);
+    });
+    SSASSERT(connecting);
+    loop.Run();
+    owner.Stop();
+    ownerThread.join();
+    SSASSERT(!expired && echoed == "firstsecond");
+#endif
+}
+
+void TestEventLoop::test()
+{
+    TestTimers();
+    TestEcho();
+    TestOpen();
+    TestSharedReceiveBuffer();
+    TestVectoredSend();
+    TestPost();
+    TestHandoff();
+    std::cout << "Test event loop pass" << std::endl;
+}
+
+}
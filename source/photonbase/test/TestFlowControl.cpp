@@ -0,0 +1,140 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "TestFlowControl.h"
+#include "photonbase/protocol/ChunkHeader.h"
+#include "photonbase/protocol/DataDeserializer.h"
+#include "photonbase/protocol/MessageHeader.h"
+#include "photonbase/protocol/impl/FlowControlWindow.h"
+#include "photonbase/protocol/impl/OutboundScheduler.h"
+#include <SSBase/Assert.h>
+#include <map>
+
+namespace pht {
+
+static ByteArray MakePayload(Uint32 size, Uint8 value)
+{
+    ByteArray payload(size);
+    memset(payload.Data(), value, size);
+    return payload;
+}
+
+// Parse chunks in buffer, returns payload bytes received by each channel
+static std::map<Uint16, Uint32> ParseChunks(ss::DynamicBuffer& buffer, std::vector<Uint16>& order)
+{
+    std::map<Uint16, Uint32> received;
+    while (!buffer.Empty()) {
+        ChunkHeader ch {};
+        DataDeserializer deserializer(buffer.GetData<Uint8>(), buffer.Size());
+        bool deserialized = deserializer.Deserialize(ch);
+        SSASSERT(deserialized);
+        buffer.Skip(deserializer.DataConsumed());
+        SSASSERT(buffer.Size() >= ch.chunkSize);
+        buffer.Skip(ch.chunkSize);
+        received[ch.channelId] += ch.chunkSize;
+        order.push_back(ch.channelId);
+    }
+    return received;
+}
+
+static void TestReceiveWindow()
+{
+    ReceiveWindow window(100);
+    bool accepted = window.OnDataReceived(60);
+    SSASSERT(accepted);
+    accepted = window.OnDataReceived(41);
+    SSASSERT(!accepted); // exceeds the window
+    accepted = window.OnDataReceived(40);
+    SSASSERT(accepted);
+    SSASSERT(window.Available() == 0);
+
+    Uint32 announced = window.OnDataConsumed(30);
+    SSASSERT(announced == 0); // less than half of the window, not announced yet
+    announced = window.OnDataConsumed(30);
+    SSASSERT(announced == 60);
+    SSASSERT(window.Available() == 60);
+
+    Uint32 granted = window.Grow(300);
+    SSASSERT(granted == 200 && window.Available() == 260);
+    granted = window.Grow(100);
+    SSASSERT(granted == 0 && window.GetWindowSize() == 300); // Never shrinks
+}
+
+static void TestSchedulerFlowControl()
+{
+    OutboundScheduler scheduler;
+    bool added = scheduler.AddChannel(1, 10000);
+    SSASSERT(added);
+    added = scheduler.AddChannel(2, 10000);
+    SSASSERT(added);
+    bool chunkSizeSet = scheduler.SetChunkSize(1, 1000);
+    SSASSERT(chunkSizeSet);
+    chunkSizeSet = scheduler.SetChunkSize(2, 1000);
+    SSASSERT(chunkSizeSet);
+    bool queued = scheduler.Enqueue(3, MessageHeader {}, MakePayload(10, 1));
+    SSASSERT(!queued); // No such channel
+    queued = scheduler.Enqueue(1, MessageHeader {}, ByteArray());
+    SSASSERT(!queued); // Empty message
+
+    queued = scheduler.Enqueue(1, MessageHeader {}, MakePayload(20000, 1));
+    SSASSERT(queued);
+    queued = scheduler.Enqueue(2, MessageHeader {}, MakePayload(3000, 2));
+    SSASSERT(queued);
+    queued = scheduler.Enqueue(0, MessageHeader {}, MakePayload(100, 0));
+    SSASSERT(queued);
+
+    ss::DynamicBuffer buffer;
+    scheduler.WriteChunks(buffer, 0);
+    std::vector<Uint16> order;
+    auto received = ParseChunks(buffer, order);
+    SSASSERT(order[0] == 0); // control channel first
+    SSASSERT(order[1] == 1 && order[2] == 2); // interleaved
+    SSASSERT(received[1] == 10000); // blocked by the channel window
+    SSASSERT(received[2] > 3000); // the whole message with its header
+    SSASSERT(scheduler.HasPendingData());
+
+    // Channel 1 is unblocked by a WindowUpdate
+    bool updated = scheduler.OnWindowUpdate(1, 20000);
+    SSASSERT(updated);
+    scheduler.WriteChunks(buffer, 0);
+    order.clear();
+    received = ParseChunks(buffer, order);
+    SSASSERT(received[1] > 10000 - 1 && received[1] < 10010);
+    SSASSERT(!scheduler.HasPendingData());
+
+    updated = scheduler.OnWindowUpdate(1, kMaxWindowSize);
+    SSASSERT(!updated); // overflow
+}
+
+static void TestConnectionWindow()
+{
+    OutboundScheduler scheduler;
+    bool added = scheduler.AddChannel(1, kMaxWindowSize);
+    SSASSERT(added);
+    bool queued = scheduler.Enqueue(1, MessageHeader {}, MakePayload(kDefaultConnectionWindowSize + 100, 1));
+    SSASSERT(queued);
+
+    ss::DynamicBuffer buffer;
+    scheduler.WriteChunks(buffer, 0);
+    std::vector<Uint16> order;
+    auto received = ParseChunks(buffer, order);
+    SSASSERT(received[1] == kDefaultConnectionWindowSize);
+
+    bool updated = scheduler.OnWindowUpdate(0, 1000);
+    SSASSERT(updated);
+    scheduler.WriteChunks(buffer, 0);
+    received = ParseChunks(buffer, order);
+    SSASSERT(received[1] > 100);
+    SSASSERT(!scheduler.HasPendingData());
+}
+
+void TestFlowControl::test()
+{
+    TestReceiveWindow();
+    TestSchedulerFlowControl();
+    TestConnectionWindow();
+    std::cout << "Test flow control pass" << std::endl;
+}
+
+}
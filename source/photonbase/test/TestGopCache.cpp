@@ -0,0 +1,68 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "TestGopCache.h"
+#include "photonbase/protocol/GopCache.h"
+#include <SSBase/Assert.h>
+#include <iostream>
+
+namespace pht {
+
+static MessageHeader Header(Uint32 timestamp, bool keyFrame, MessageHeader::Type type = MessageHeader::Type::kVideo)
+{
+    MessageHeader header;
+    header.timestamp = timestamp;
+    header.messageType = type;
+    header.reserved = keyFrame ? MessageHeader::kKeyFrame : 0;
+    return header;
+}
+
+static void TestGroups()
+{
+    GopCache cache(100);
+    BufferSlice frame(30);
+
+    // Nothing to start decoding from
+    cache.Push(Header(0, false), frame);
+    SSASSERT(cache.GetMessages().empty());
+
+    cache.Push(Header(10, true), frame);
+    cache.Push(Header(20, false), frame);
+    cache.Push(Header(20, false, MessageHeader::Type::kAudio), BufferSlice(5));
+    SSASSERT(cache.GetMessages().size() == 3 && cache.GetSize() == 65);
+    SSASSERT(cache.GetMessages()[0].header.timestamp == 10);
+    // The payloads are shared, not copied
+    SSASSERT(cache.GetMessages()[0].payload.Data() == frame.Data());
+
+    // A key frame starts over
+    cache.Push(Header(30, true), frame);
+    SSASSERT(cache.GetMessages().size() == 1 && cache.GetSize() == 30);
+    SSASSERT(cache.GetMessages()[0].header.timestamp == 30);
+
+    // A group that grows beyond the limit is dropped until the next key frame
+    cache.Push(Header(40, false), frame);
+    cache.Push(Header(50, false), frame);
+    SSASSERT(cache.GetSize() == 90);
+    cache.Push(Header(60, false), frame);
+    SSASSERT(cache.GetMessages().empty() && cache.GetSize() == 0);
+    cache.Push(Header(70, false), frame);
+    SSASSERT(cache.GetMessages().empty());
+    cache.Push(Header(80, true), BufferSlice(101));
+    SSASSERT(cache.GetMessages().empty());
+    cache.Push(Header(90, true), frame);
+    SSASSERT(cache.GetMessages().size() == 1);
+
+    // The flag means nothing to audio
+    cache.Clear();
+    cache.Push(Header(100, true, MessageHeader::Type::kAudio), frame);
+    SSASSERT(cache.GetMessages().empty());
+}
+
+void TestGopCache::test()
+{
+    TestGroups();
+    std::cout << "Test gop cache pass" << std::endl;
+}
+
+}
@@ -0,0 +1,100 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "TestJitterBuffer.h"
+#include <SSBase/Assert.h>
+#include <iostream>
+#include <photonbase/protocol/JitterBuffer.h>
+
+namespace pht {
+
+static MessageHeader MakeHeader(Uint32 timestamp)
+{
+    MessageHeader header;
+    header.messageType = MessageHeader::Type::kAudio;
+    header.timestamp = timestamp;
+    return header;
+}
+
+static void TestReorder()
+{
+    JitterBuffer buffer(40, 200);
+    MessageHeader header;
+    ByteArray payload;
+
+    // Sender's clock is 1000ms ahead, message 20 overtakes message 0
+    bool pushed = buffer.Push(MakeHeader(1020), ByteArray(1), 10);
+    SSASSERT(pushed);
+    pushed = buffer.Push(MakeHeader(1000), ByteArray(2), 11);
+    SSASSERT(pushed);
+    pushed = buffer.Push(MakeHeader(1040), ByteArray(3), 30);
+    SSASSERT(pushed);
+    SSASSERT(buffer.Size() == 3);
+
+    bool popped = buffer.Pop(20, header, payload);
+    SSASSERT(!popped); // not due yet
+    SSASSERT(buffer.GetTimeToNextPlayout(20) > 0);
+
+    Uint32 now = 20 + Uint32(buffer.GetTimeToNextPlayout(20));
+    popped = buffer.Pop(now, header, payload);
+    SSASSERT(popped);
+    SSASSERT(header.timestamp == 1000 && payload.Size() == 2);
+    popped = buffer.Pop(now, header, payload);
+    SSASSERT(!popped);
+
+    popped = buffer.Pop(now + 100, header, payload);
+    SSASSERT(popped);
+    SSASSERT(header.timestamp == 1020);
+    popped = buffer.Pop(now + 100, header, payload);
+    SSASSERT(popped);
+    SSASSERT(header.timestamp == 1040);
+    SSASSERT(buffer.GetTimeToNextPlayout(now + 100) == -1);
+
+    // Too late, the later messages have been played
+    pushed = buffer.Push(MakeHeader(1030), ByteArray(1), now + 100);
+    SSASSERT(!pushed);
+    SSASSERT(buffer.GetLateMessages() == 1);
+}
+
+static void TestAdaptiveDelay()
+{
+    JitterBuffer smooth(0, 500);
+    JitterBuffer jittery(0, 500);
+    for (Uint32 i = 0; i < 100; ++i) {
+        Uint32 ts = i * 20;
+        smooth.Push(MakeHeader(ts), ByteArray(1), ts + 50);
+        jittery.Push(MakeHeader(ts), ByteArray(1), ts + 50 + (i % 2 == 0 ? 0 : 40));
+    }
+    SSASSERT(smooth.GetJitter() == 0);
+    SSASSERT(smooth.GetTargetDelay() == 0);
+    SSASSERT(jittery.GetJitter() > 30);
+    SSASSERT(jittery.GetTargetDelay() >= 90 && jittery.GetTargetDelay() <= 500);
+}
+
+static void TestTimestampWrapAround()
+{
+    JitterBuffer buffer(10, 100);
+    MessageHeader header;
+    ByteArray payload;
+    bool pushed = buffer.Push(MakeHeader(0xFFFFFFF0u), ByteArray(1), 0xFFFFFFF8u);
+    SSASSERT(pushed);
+    pushed = buffer.Push(MakeHeader(0x10), ByteArray(1), 0x18);
+    SSASSERT(pushed);
+    bool popped = buffer.Pop(0x100, header, payload);
+    SSASSERT(popped);
+    SSASSERT(header.timestamp == 0xFFFFFFF0u);
+    popped = buffer.Pop(0x100, header, payload);
+    SSASSERT(popped);
+    SSASSERT(header.timestamp == 0x10);
+}
+
+void TestJitterBuffer::test()
+{
+    TestReorder();
+    TestAdaptiveDelay();
+    TestTimestampWrapAround();
+    std::cout << "Test jitter buffer pass" << std::endl;
+}
+
+}
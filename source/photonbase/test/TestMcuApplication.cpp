@@ -0,0 +1,169 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "TestMcuApplication.h"
+#include "LoopbackEndpoint.h"
+#include "photonbase/application/ApplicationManager.h"
+#include "photonbase/application/McuApplication.h"
+#include "photonbase/protocol/MessageHeader.h"
+#include "photonbase/protocol/PhotonProtocol.h"
+#include "photonbase/protocol/impl/FlowControlWindow.h"
+#include <SSBase/Assert.h>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+namespace pht {
+
+// Publish a frame of one color
+static bool SendFrame(LoopbackEndpoint& publisher, Uint16 width, Uint16 height, Uint8 luma)
+{
+    I420Frame frame(width, height);
+    memset(frame.MutableY(), luma, Uint32(width) * height);
+    memset(frame.MutableU(), 128, Uint32(frame.GetChromaWidth()) * frame.GetChromaHeight() * 2);
+    ByteArray payload(frame.GetPayload().Size());
+    memcpy(payload.Data(), frame.GetPayload().Data(), payload.Size());
+    return publisher.client.SendMessage(2, MessageHeader::Type::kVideo, 0, std::move(payload)) && publisher.Send();
+}
+
+// The composites a viewer has received, in channel 3
+static std::vector<I420Frame> Composites(const LoopbackEndpoint& viewer)
+{
+    std::vector<I420Frame> frames;
+    for (size_t i = 0; i < viewer.sink.media.size(); ++i) {
+        auto& [channelId, payload] = viewer.sink.media[i];
+        SSASSERT(channelId == 3 && viewer.sink.headers[i].reserved == MessageHeader::kKeyFrame);
+        BufferSlice bytes(payload.Size());
+        memcpy(bytes.MutableData(), payload.Data(), payload.Size());
+        I420Frame frame;
+        bool parsed = I420Frame::Parse(bytes, frame);
+        SSASSERT(parsed);
+        frames.push_back(frame);
+    }
+    return frames;
+}
+
+static Array Params(const String& room)
+{
+    return Array({ std::make_shared<Variant>(room) });
+}
+
+static Array Params(Uint16 channelId)
+{
+    return Array({ std::make_shared<Variant>(channelId) });
+}
+
+// The scaling filters may round a solid color off by one
+static bool IsLuma(const I420Frame& frame, Uint16 x, Uint16 y, Uint8 luma)
+{
+    Uint8 value = frame.Y()[Uint32(y) * frame.GetWidth() + x];
+    return value + 1 >= luma && value <= luma + 1;
+}
+
+static void TestComposite()
+{
+    McuApplication mcu(64, 36, 10, 2, 0);
+    bool registered = ApplicationManager::RegisterApplication("mcu", &mcu);
+    SSASSERT(registered);
+    {
+        LoopbackEndpoint alice("mcu");
+        auto bob = std::make_unique<LoopbackEndpoint>("mcu");
+        LoopbackEndpoint viewer("mcu");
+        alice.Invoke("mcu.Join", Params("room"));
+        alice.Invoke("mcu.Publish", Params(2));
+        bool sent = alice.Send();
+        SSASSERT(sent);
+        bob->Invoke("mcu.Join", Params("room"));
+        bob->Invoke("mcu.Publish", Params(2));
+        sent = bob->Send();
+        SSASSERT(sent);
+        viewer.Invoke("mcu.Join", Params("room"));
+        viewer.Invoke("mcu.Subscribe", Params(3));
+        sent = viewer.Send();
+        SSASSERT(sent);
+        SSASSERT(mcu.GetRoomCount() == 1 && mcu.GetClients().size() == 3);
+
+        // Nothing to show yet
+        mcu.Update();
+        viewer.Receive();
+        SSASSERT(viewer.sink.media.empty());
+
+        // A burst is composed once, with the latest frame
+        sent = SendFrame(alice, 32, 18, 50);
+        SSASSERT(sent);
+        sent = SendFrame(alice, 32, 18, 100);
+        SSASSERT(sent);
+        mcu.Update();
+        viewer.Receive();
+        auto composites = Composites(viewer);
+        SSASSERT(composites.size() == 1);
+        auto& first = composites[0];
+        SSASSERT(first.GetWidth() == 64 && first.GetHeight() == 36 && IsLuma(first, 32, 18, 100));
+
+        // The cadence goes on without new frames
+        mcu.Update();
+        sent = SendFrame(*bob, 16, 9, 200);
+        SSASSERT(sent);
+        mcu.Update();
+        viewer.Receive();
+        composites = Composites(viewer);
+        SSASSERT(composites.size() == 3);
+        for (Uint32 i = 0; i < 3; ++i) {
+            SSASSERT(viewer.sink.headers[i].timestamp == (i + 1) * 10);
+        }
+        auto& second = composites[2];
+        SSASSERT(IsLuma(second, 16, 17, 100) && IsLuma(second, 48, 17, 200));
+
+        // A late viewer gets the latest composite at once
+        LoopbackEndpoint late("mcu");
+        late.Invoke("mcu.Join", Params("room"));
+        late.Invoke("mcu.Subscribe", Params(3));
+        sent = late.Send();
+        SSASSERT(sent);
+        late.Receive();
+        SSASSERT(Composites(late).size() == 1 && late.sink.headers[0].timestamp == 30);
+
+        // A publisher gone, its tile is removed
+        bob = nullptr;
+        mcu.Update();
+        viewer.Receive();
+        composites = Composites(viewer);
+        SSASSERT(composites.size() == 4 && IsLuma(composites[3], 32, 18, 100));
+
+        // A 720p frame is larger than the default channel window, the published channel accepts it
+        SSASSERT(I420Frame(1280, 720).GetPayload().Size() > kDefaultChannelWindowSize);
+        sent = SendFrame(alice, 1280, 720, 150);
+        SSASSERT(sent);
+        mcu.Update();
+        viewer.Receive();
+        composites = Composites(viewer);
+        SSASSERT(composites.size() == 5 && IsLuma(composites[4], 32, 18, 150));
+
+        // Misuse closes the connection
+        LoopbackEndpoint outsider("mcu");
+        outsider.Invoke("mcu.Publish", Params(2));
+        sent = outsider.Send();
+        SSASSERT(!sent); // Not in a room
+        LoopbackEndpoint clumsy("mcu");
+        clumsy.Invoke("mcu.Join", Params("room"));
+        clumsy.Invoke("mcu.Publish", Params(2));
+        sent = clumsy.Send();
+        SSASSERT(sent);
+        sent = clumsy.client.SendMessage(2, MessageHeader::Type::kVideo, 0, ByteArray { 0, 2, 0, 2, 1 });
+        SSASSERT(sent);
+        sent = clumsy.Send();
+        SSASSERT(!sent); // Not a frame
+    }
+    SSASSERT(mcu.GetRoomCount() == 0 && mcu.GetClients().empty());
+    ApplicationManager::UnregisterApplication("mcu");
+}
+
+void TestMcuApplication::test()
+{
+    TestComposite();
+    std::cout << "Test mcu application pass" << std::endl;
+}
+
+}
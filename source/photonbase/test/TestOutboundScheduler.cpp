@@ -0,0 +1,253 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "TestOutboundScheduler.h"
+#include "photonbase/protocol/ChunkHeader.h"
+#include "photonbase/protocol/DataDeserializer.h"
+#include "photonbase/protocol/MessageHeader.h"
+#include "photonbase/protocol/impl/OutboundScheduler.h"
+#include <SSBase/Assert.h>
+#include <iostream>
+#include <map>
+#include <vector>
+
+namespace pht {
+
+static MessageHeader MakeHeader(MessageHeader::Type type, Uint32 timestamp)
+{
+    MessageHeader header;
+    header.messageType = type;
+    header.timestamp = timestamp;
+    return header;
+}
+
+static ByteArray MakePayload(Uint32 size)
+{
+    ByteArray payload(size);
+    memset(payload.Data(), 0x5A, size);
+    return payload;
+}
+
+// Reassemble the channel stream and return the timestamps of the messages in it
+static std::vector<Uint32> ReadTimestamps(ss::DynamicBuffer& buffer, Uint16 channelId)
+{
+    ss::DynamicBuffer stream;
+    while (!buffer.Empty()) {
+        ChunkHeader ch {};
+        DataDeserializer deserializer(buffer.GetData<Uint8>(), buffer.Size());
+        bool deserialized = deserializer.Deserialize(ch);
+        SSASSERT(deserialized);
+        buffer.Skip(deserializer.DataConsumed());
+        if (ch.channelId == channelId) {
+            stream.PushData(buffer.GetData<Uint8>(), ch.chunkSize);
+        }
+        buffer.Skip(ch.chunkSize);
+    }
+    std::vector<Uint32> timestamps;
+    while (!stream.Empty()) {
+        MessageHeader mh {};
+        DataDeserializer deserializer(stream.GetData<Uint8>(), stream.Size());
+        bool deserialized = deserializer.Deserialize(mh);
+        SSASSERT(deserialized);
+        stream.Skip(deserializer.DataConsumed());
+        SSASSERT(stream.Size() >= mh.messageLength);
+        stream.Skip(mh.messageLength);
+        timestamps.push_back(mh.timestamp);
+    }
+    return timestamps;
+}
+
+static void TestDropExpiredMessages()
+{
+    OutboundScheduler scheduler;
+    bool added = scheduler.AddChannel(1, 3000);
+    SSASSERT(added);
+    bool chunkSizeSet = scheduler.SetChunkSize(1, 1000);
+    SSASSERT(chunkSizeSet);
+    bool budgetSet = scheduler.SetLatencyBudget(1, 500);
+    SSASSERT(budgetSet);
+    budgetSet = scheduler.SetLatencyBudget(0, 500);
+    SSASSERT(!budgetSet);
+
+    // The first frame is partially sent because of the flow control window
+    bool queued = scheduler.Enqueue(1, MakeHeader(MessageHeader::Type::kVideo, 100), MakePayload(5000));
+    SSASSERT(queued);
+    queued = scheduler.Enqueue(1, MakeHeader(MessageHeader::Type::kVideo, 133), MakePayload(100));
+    SSASSERT(queued);
+    queued = scheduler.Enqueue(1, MakeHeader(MessageHeader::Type::kRemoteMethodInvoke, 134), MakePayload(100));
+    SSASSERT(queued);
+    queued = scheduler.Enqueue(1, MakeHeader(MessageHeader::Type::kVideo, 900), MakePayload(100));
+    SSASSERT(queued);
+
+    ss::DynamicBuffer buffer;
+    scheduler.WriteChunks(buffer, 200);
+    SSASSERT(!buffer.Empty());
+
+    // At 700ms the first two frames are expired, but the first one was started
+    bool updated = scheduler.OnWindowUpdate(1, 100000);
+    SSASSERT(updated);
+    scheduler.WriteChunks(buffer, 700);
+    auto timestamps = ReadTimestamps(buffer, 1);
+    SSASSERT(timestamps.size() == 3);
+    SSASSERT(timestamps[0] == 100 && timestamps[1] == 134 && timestamps[2] == 900);
+
+    OutboundScheduler::DropStats stats;
+    SSASSERT(scheduler.GetDropStats(1, stats));
+    SSASSERT(stats.droppedMessages == 1);
+    SSASSERT(stats.droppedBytes > 100);
+}
+
+// Reassemble the payloads of a channel
+static std::vector<ByteArray> ReadPayloads(ss::DynamicBuffer& buffer, Uint16 channelId, Uint32& chunkCount)
+{
+    ss::DynamicBuffer stream;
+    chunkCount = 0;
+    while (!buffer.Empty()) {
+        ChunkHeader ch {};
+        DataDeserializer deserializer(buffer.GetData<Uint8>(), buffer.Size());
+        bool deserialized = deserializer.Deserialize(ch);
+        SSASSERT(deserialized);
+        buffer.Skip(deserializer.DataConsumed());
+        if (ch.channelId == channelId) {
+            stream.PushData(buffer.GetData<Uint8>(), ch.chunkSize);
+            ++chunkCount;
+        }
+        buffer.Skip(ch.chunkSize);
+    }
+    std::vector<ByteArray> payloads;
+    while (!stream.Empty()) {
+        MessageHeader mh {};
+        DataDeserializer deserializer(stream.GetData<Uint8>(), stream.Size());
+        bool deserialized = deserializer.Deserialize(mh);
+        SSASSERT(deserialized);
+        stream.Skip(deserializer.DataConsumed());
+        ByteArray payload(mh.messageLength);
+        memcpy(payload.Data(), stream.GetData<Uint8>(), mh.messageLength);
+        stream.Skip(mh.messageLength);
+        payloads.push_back(std::move(payload));
+    }
+    return payloads;
+}
+
+static void TestSharedPayload()
+{
+    ByteArray bytes(10000);
+    for (Uint32 i = 0; i < bytes.Size(); ++i) {
+        bytes[i] = Uint8(i);
+    }
+    BufferSlice payload(std::move(bytes));
+
+    // Two subscribers with different chunk sizes share one payload
+    OutboundScheduler subscriber1;
+    OutboundScheduler subscriber2;
+    bool added = subscriber1.AddChannel(3);
+    SSASSERT(added);
+    added = subscriber2.AddChannel(7);
+    SSASSERT(added);
+    bool chunkSizeSet = subscriber1.SetChunkSize(3, 4096);
+    SSASSERT(chunkSizeSet);
+    chunkSizeSet = subscriber2.SetChunkSize(7, 1000);
+    SSASSERT(chunkSizeSet);
+    bool queued = subscriber1.Enqueue(3, MakeHeader(MessageHeader::Type::kVideo, 1), payload, 0);
+    SSASSERT(queued);
+    queued = subscriber2.Enqueue(7, MakeHeader(MessageHeader::Type::kVideo, 1), payload, 0);
+    SSASSERT(queued);
+    SSASSERT(payload.UseCount() == 3);
+
+    ss::DynamicBuffer buffer1;
+    ss::DynamicBuffer buffer2;
+    subscriber1.WriteChunks(buffer1, 0);
+    subscriber2.WriteChunks(buffer2, 0);
+    SSASSERT(payload.UseCount() == 1); // released once sent
+
+    Uint32 chunks1;
+    Uint32 chunks2;
+    auto payloads1 = ReadPayloads(buffer1, 3, chunks1);
+    auto payloads2 = ReadPayloads(buffer2, 7, chunks2);
+    SSASSERT(chunks1 == 3 && chunks2 == 11);
+    SSASSERT(payloads1.size() == 1 && payloads2.size() == 1);
+    SSASSERT(payloads1[0].Size() == payload.Size() && memcmp(payloads1[0].Data(), payload.Data(), payload.Size()) == 0);
+    SSASSERT(payloads1[0] == payloads2[0]);
+}
+
+static void TestPacing()
+{
+    OutboundScheduler scheduler;
+    bool added = scheduler.AddChannel(1);
+    SSASSERT(added);
+    scheduler.SetPacingRate(100000);
+    for (Uint32 i = 0; i < 50; ++i) {
+        bool queued = scheduler.Enqueue(1, MakeHeader(MessageHeader::Type::kVideo, i), MakePayload(4000));
+        SSASSERT(queued);
+    }
+
+    // About one second worth of bytes is sent in one second, even though the windows allow more
+    ss::DynamicBuffer buffer;
+    for (Uint32 now = 1000; now <= 2000; ++now) {
+        scheduler.WriteChunks(buffer, now);
+    }
+    SSASSERT(buffer.Size() > 95000 && buffer.Size() < 110000);
+
+    // The Control Channel is not paced
+    auto size = buffer.Size();
+    bool queued = scheduler.Enqueue(0, MakeHeader(MessageHeader::Type::kRemoteMethodInvoke, 0), MakePayload(10000));
+    SSASSERT(queued);
+    scheduler.WriteChunks(buffer, 2000);
+    SSASSERT(buffer.Size() > size + 10000);
+
+    scheduler.SetPacingRate(0);
+    scheduler.WriteChunks(buffer, 2000);
+    SSASSERT(!scheduler.HasPendingData());
+    auto timestamps = ReadTimestamps(buffer, 1);
+    SSASSERT(timestamps.size() == 50);
+}
+
+// Count the chunks of each channel
+static std::map<Uint16, Uint32> CountChunks(ss::DynamicBuffer& buffer)
+{
+    std::map<Uint16, Uint32> chunkCounts;
+    while (!buffer.Empty()) {
+        ChunkHeader ch {};
+        DataDeserializer deserializer(buffer.GetData<Uint8>(), buffer.Size());
+        bool deserialized = deserializer.Deserialize(ch);
+        SSASSERT(deserialized);
+        buffer.Skip(deserializer.DataConsumed() + ch.chunkSize);
+        ++chunkCounts[ch.channelId];
+    }
+    return chunkCounts;
+}
+
+static void TestPacingFairness()
+{
+    OutboundScheduler scheduler;
+    for (Uint16 id : { 1, 2 }) {
+        bool added = scheduler.AddChannel(id);
+        SSASSERT(added);
+        for (Uint32 i = 0; i < 10; ++i) {
+            bool queued = scheduler.Enqueue(id, MakeHeader(MessageHeader::Type::kVideo, i), MakePayload(40000));
+            SSASSERT(queued);
+        }
+    }
+    // About one chunk per millisecond, each call can send a single chunk
+    scheduler.SetPacingRate(kDefaultChunkSize * 1000);
+
+    ss::DynamicBuffer buffer;
+    for (Uint32 now = 1000; now < 1100; ++now) {
+        scheduler.WriteChunks(buffer, now);
+    }
+    auto chunkCounts = CountChunks(buffer);
+    SSASSERT(chunkCounts[1] > 40 && chunkCounts[2] > 40);
+    SSASSERT(chunkCounts[1] + 1 >= chunkCounts[2] && chunkCounts[2] + 1 >= chunkCounts[1]);
+}
+
+void TestOutboundScheduler::test()
+{
+    TestDropExpiredMessages();
+    TestSharedPayload();
+    TestPacing();
+    TestPacingFairness();
+    std::cout << "Test outbound scheduler pass" << std::endl;
+}
+
+}
@@ -0,0 +1,935 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "TestPhotonProtocol.h"
+#include "LoopbackEndpoint.h"
+#include "photonbase/application/ApplicationManager.h"
+#include "photonbase/application/IApplication.h"
+#include "photonbase/core/BufferChain.h"
+#include "photonbase/core/TimingWheel.h"
+#include "photonbase/protocol/ChunkHeader.h"
+#include "photonbase/protocol/DataSerializer.h"
+#include "photonbase/protocol/KeepAlive.h"
+#include "photonbase/protocol/MessageHeader.h"
+#include "photonbase/protocol/PhotonProtocol.h"
+#include "photonbase/protocol/ProtocolStats.h"
+#include "photonbase/protocol/RemoteMethodInfo.h"
+#include "photonbase/protocol/ResumptionTokenStore.h"
+#include "photonbase/protocol/impl/FlowControlWindow.h"
+#include "photonbase/protocol/impl/MessageCompressor.h"
+#include <SSBase/Assert.h>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+namespace pht {
+
+// Records what it receives, and answers the first RMI with a video message
+class RecordingApplication : public IApplication {
+public:
+    bool OnRemoteMethodInvoke(IProtocol* client, const RemoteMethodInfo& method) override
+    {
+        methods.push_back(method.GetMethodName());
+        if (replyChannel != 0) {
+            auto* protocol = static_cast<PhotonProtocol*>(client);
+            bool sent = protocol->SendMessage(replyChannel, MessageHeader::Type::kVideo, 0, ByteArray { 4, 5, 6 });
+            SSASSERT(sent);
+            replyChannel = 0;
+        }
+        return true;
+    }
+
+    bool OnMediaMessage(IProtocol* client, Uint16 channelId, const MessageHeader& header, const ByteArray& payload) override
+    {
+        media.emplace_back(channelId, payload);
+        return true;
+    }
+
+    void OnClientAttached(IProtocol* client) override
+    {
+        ++attached;
+    }
+
+    void OnClientDetached(IProtocol* client) override
+    {
+        --attached;
+    }
+
+    std::vector<String> methods {};
+    std::vector<std::pair<Uint16, ByteArray>> media {};
+    Uint16 replyChannel { 0 };
+    Int32 attached { 0 };
+};
+
+static void TestPipelinedHandshake()
+{
+    RecordingApplication serverApp;
+    RecordingApplication clientApp;
+    serverApp.replyChannel = 1;
+    bool registered = ApplicationManager::RegisterApplication("test", &serverApp);
+    SSASSERT(registered);
+    registered = ApplicationManager::RegisterApplication("test", &serverApp);
+    SSASSERT(!registered);
+
+    PhotonProtocol server(PhotonProtocol::Role::kServer);
+    PhotonProtocol client(PhotonProtocol::Role::kClient);
+    client.SetApplication(&clientApp);
+    bool connected = server.Connect("test", { 1 });
+    SSASSERT(!connected);
+    bool created = client.CreateChannel(1);
+    SSASSERT(!created); // Before Connect
+
+    // The handshake, the channels and the first messages in one flight
+    connected = client.Connect("test", { 1, 2 });
+    SSASSERT(connected);
+    connected = client.Connect("test", {});
+    SSASSERT(!connected);
+    created = client.CreateChannel(2);
+    SSASSERT(!created); // Exists
+    created = client.CreateChannel(0);
+    SSASSERT(!created);
+    Array params({ std::make_shared<Variant>(Uint32(42)) });
+    std::vector<Uint8> rmi;
+    bool serialized = DataSerializer::Serialize(RemoteMethodInfo(Variant::Type::Void, "test.start", std::move(params)),
+        [&rmi](Uint8 b) { rmi.push_back(b); });
+    SSASSERT(serialized);
+    ByteArray rmiPayload(Uint32(rmi.size()));
+    memcpy(rmiPayload.Data(), rmi.data(), rmi.size());
+    bool sent = client.SendMessage(1, MessageHeader::Type::kRemoteMethodInvoke, 0, std::move(rmiPayload));
+    SSASSERT(sent);
+    sent = client.SendMessage(2, MessageHeader::Type::kAudio, 7, ByteArray { 1, 2, 3 });
+    SSASSERT(sent);
+    SSASSERT(!client.IsEstablished());
+
+    ss::DynamicBuffer clientFlight;
+    ss::DynamicBuffer unused;
+    bool written = client.OnOutBoundData(unused, clientFlight);
+    SSASSERT(written);
+    ss::DynamicBuffer serverFlight;
+    bool handled = server.OnInBoundData(clientFlight, serverFlight);
+    SSASSERT(handled);
+    SSASSERT(server.IsEstablished() && server.GetProtocolVersion() == 0x0100);
+    SSASSERT(server.GetApplication() == &serverApp);
+    SSASSERT(serverApp.attached == 1 && clientApp.attached == 1);
+    SSASSERT(serverApp.methods.size() == 1 && serverApp.methods[0] == "test.start");
+    SSASSERT(serverApp.media.size() == 1 && serverApp.media[0].first == 2);
+
+    // The replies and the server's first message come back together, i.e. after one round trip
+    handled = client.OnInBoundData(serverFlight, unused);
+    SSASSERT(handled);
+    SSASSERT(client.IsEstablished() && client.GetProtocolVersion() == 0x0100);
+    SSASSERT(clientApp.media.size() == 1 && clientApp.media[0].first == 1);
+    SSASSERT(clientApp.media[0].second == (ByteArray { 4, 5, 6 }));
+
+    // Channels created later take a round trip of their own, but may be used right away too
+    created = server.CreateChannel(3);
+    SSASSERT(created);
+    sent = server.SendMessage(3, MessageHeader::Type::kVideo, 0, ByteArray { 9 });
+    SSASSERT(sent);
+    bool delivered = Deliver(server, client);
+    SSASSERT(delivered);
+    SSASSERT(clientApp.media.size() == 2 && clientApp.media[1].first == 3);
+    ApplicationManager::UnregisterApplication("test");
+}
+
+static void TestRefused()
+{
+    ss::DynamicBuffer unused;
+
+    // No such application
+    PhotonProtocol server(PhotonProtocol::Role::kServer);
+    PhotonProtocol client(PhotonProtocol::Role::kClient);
+    bool connected = client.Connect("missing", { 1 });
+    SSASSERT(connected);
+    ss::DynamicBuffer wire;
+    bool written = client.OnOutBoundData(unused, wire);
+    SSASSERT(written);
+    bool handled = server.OnInBoundData(wire, unused);
+    SSASSERT(!handled);
+
+    // The application set by the owner of the connection is used if the name is unknown
+    RecordingApplication app;
+    PhotonProtocol server2(PhotonProtocol::Role::kServer);
+    server2.SetApplication(&app);
+    PhotonProtocol client2(PhotonProtocol::Role::kClient);
+    connected = client2.Connect("any", { 5 });
+    SSASSERT(connected);
+    ss::DynamicBuffer wire2;
+    written = client2.OnOutBoundData(unused, wire2);
+    SSASSERT(written);
+    ss::DynamicBuffer replies;
+    handled = server2.OnInBoundData(wire2, replies);
+    SSASSERT(handled);
+    SSASSERT(server2.IsEstablished());
+
+    // A client that never connected rejects the results
+    PhotonProtocol stranger(PhotonProtocol::Role::kClient);
+    handled = stranger.OnInBoundData(replies, unused);
+    SSASSERT(!handled);
+
+    // Data of a channel that was never created
+    PhotonProtocol server3(PhotonProtocol::Role::kServer);
+    server3.SetApplication(&app);
+    PhotonProtocol client3(PhotonProtocol::Role::kClient);
+    connected = client3.Connect("any", {});
+    SSASSERT(connected);
+    ss::DynamicBuffer wire3;
+    written = client3.OnOutBoundData(unused, wire3);
+    SSASSERT(written);
+    handled = server3.OnInBoundData(wire3, unused);
+    SSASSERT(handled);
+    ss::DynamicBuffer chunk;
+    bool serialized = DataSerializer::Serialize(ChunkHeader { 6, 0, 1 }, [&chunk](Uint8 b) { chunk.PushData(&b, 1); });
+    SSASSERT(serialized);
+    chunk.PushData("x", 1);
+    handled = server3.OnInBoundData(chunk, unused);
+    SSASSERT(!handled);
+}
+
+static void TestResumptionTokenStore()
+{
+    auto now = ResumptionTokenStore::Clock::now();
+    ResumptionTokenStore store(1000, 2);
+    SessionSnapshot snapshot;
+    snapshot.appName = "a";
+    auto token1 = store.Issue(SessionSnapshot(snapshot), now);
+    snapshot.appName = "b";
+    auto token2 = store.Issue(SessionSnapshot(snapshot), now);
+    SSASSERT(token1.Size() == ResumptionTokenStore::kTokenSize && !(token1 == token2));
+
+    // Redeemed once
+    SessionSnapshot redeemed;
+    bool found = store.Redeem(token2, redeemed, now);
+    SSASSERT(found && redeemed.appName == "b");
+    found = store.Redeem(token2, redeemed, now);
+    SSASSERT(!found);
+
+    // The oldest token is dropped beyond the capacity
+    auto token3 = store.Issue(SessionSnapshot(snapshot), now + std::chrono::milliseconds(10));
+    auto token4 = store.Issue(SessionSnapshot(snapshot), now + std::chrono::milliseconds(20));
+    SSASSERT(store.Size() == 2);
+    found = store.Redeem(token1, redeemed, now + std::chrono::milliseconds(20));
+    SSASSERT(!found);
+
+    // Expired
+    found = store.Redeem(token3, redeemed, now + std::chrono::milliseconds(1010));
+    SSASSERT(!found);
+    found = store.Redeem(token4, redeemed, now + std::chrono::milliseconds(1010));
+    SSASSERT(found);
+    SSASSERT(store.Size() == 0);
+}
+
+static void TestResume()
+{
+    RecordingApplication serverApp;
+    bool registered = ApplicationManager::RegisterApplication("resume", &serverApp);
+    SSASSERT(registered);
+    ResumptionTokenStore store;
+    ss::DynamicBuffer unused;
+
+    PhotonProtocol server1(PhotonProtocol::Role::kServer);
+    server1.SetResumptionTokenStore(&store);
+    PhotonProtocol client1(PhotonProtocol::Role::kClient);
+    bool connected = client1.Connect("resume", { 1, 2 });
+    SSASSERT(connected);
+    ss::DynamicBuffer wire;
+    bool written = client1.OnOutBoundData(unused, wire);
+    SSASSERT(written);
+    ss::DynamicBuffer replies;
+    bool handled = server1.OnInBoundData(wire, replies);
+    SSASSERT(handled);
+    bool enabled = server1.EnableJitterBuffer(2, 200, 500);
+    SSASSERT(enabled);
+    written = server1.OnOutBoundData(unused, replies);
+    SSASSERT(written); // A new token for the new configuration
+    handled = client1.OnInBoundData(replies, unused);
+    SSASSERT(handled);
+    SSASSERT(client1.IsEstablished());
+    SSASSERT(store.Size() == 2);
+
+    // Channel 3 is created, but the connection breaks before the answer and the new token arrive
+    bool created = client1.CreateChannel(3);
+    SSASSERT(created);
+    written = client1.OnOutBoundData(unused, wire);
+    SSASSERT(written);
+    handled = server1.OnInBoundData(wire, replies);
+    SSASSERT(handled);
+    replies.Skip(replies.Size());
+
+    // The new connection resumes and uses the channels in its first flight
+    PhotonProtocol server2(PhotonProtocol::Role::kServer);
+    server2.SetResumptionTokenStore(&store);
+    PhotonProtocol client2(PhotonProtocol::Role::kClient);
+    PhotonProtocol fresh(PhotonProtocol::Role::kClient);
+    bool resumed = client2.Resume(fresh);
+    SSASSERT(!resumed); // No token
+    resumed = client2.Resume(client1);
+    SSASSERT(resumed);
+    connected = client2.Connect("resume", {});
+    SSASSERT(!connected);
+    bool sent = client2.SendMessage(1, MessageHeader::Type::kVideo, 0, ByteArray { 1 });
+    SSASSERT(sent);
+    sent = client2.SendMessage(2, MessageHeader::Type::kAudio, 0, ByteArray { 2 });
+    SSASSERT(sent);
+    sent = client2.SendMessage(3, MessageHeader::Type::kVideo, 0, ByteArray { 3 });
+    SSASSERT(sent);
+    written = client2.OnOutBoundData(unused, wire);
+    SSASSERT(written);
+    // Routed to the application of the token, before the token is redeemed
+    String appName;
+    auto peeked = PhotonProtocol::PeekApplicationName(wire.GetData<Uint8>(), wire.Size(), appName);
+    SSASSERT(peeked == PhotonProtocol::PeekResult::kNotHello);
+    peeked = PhotonProtocol::PeekApplicationName(wire.GetData<Uint8>(), wire.Size(), appName, &store);
+    SSASSERT(peeked == PhotonProtocol::PeekResult::kFound);
+    SSASSERT(appName == "resume");
+    handled = server2.OnInBoundData(wire, replies);
+    SSASSERT(handled);
+    SSASSERT(server2.IsEstablished() && server2.GetProtocolVersion() == 0x0100);
+    SSASSERT(server2.GetApplication() == &serverApp);
+    // Channel 2 has its jitter buffer again, so its message is held
+    SSASSERT(serverApp.media.size() == 2);
+    SSASSERT(serverApp.media[0].first == 1 && serverApp.media[1].first == 3);
+    handled = client2.OnInBoundData(replies, unused);
+    SSASSERT(handled);
+    SSASSERT(client2.IsEstablished());
+
+    // A token can't be used twice
+    PhotonProtocol server3(PhotonProtocol::Role::kServer);
+    server3.SetResumptionTokenStore(&store);
+    PhotonProtocol client3(PhotonProtocol::Role::kClient);
+    resumed = client3.Resume(client1);
+    SSASSERT(resumed);
+    ss::DynamicBuffer wire3;
+    written = client3.OnOutBoundData(unused, wire3);
+    SSASSERT(written);
+    peeked = PhotonProtocol::PeekApplicationName(wire3.GetData<Uint8>(), wire3.Size(), appName, &store);
+    SSASSERT(peeked == PhotonProtocol::PeekResult::kNotHello);
+    handled = server3.OnInBoundData(wire3, unused);
+    SSASSERT(!handled);
+
+    // The resumed connection got a token of its own
+    PhotonProtocol server4(PhotonProtocol::Role::kServer);
+    server4.SetResumptionTokenStore(&store);
+    PhotonProtocol client4(PhotonProtocol::Role::kClient);
+    resumed = client4.Resume(client2);
+    SSASSERT(resumed);
+    ss::DynamicBuffer wire4;
+    written = client4.OnOutBoundData(unused, wire4);
+    SSASSERT(written);
+    handled = server4.OnInBoundData(wire4, unused);
+    SSASSERT(handled);
+    SSASSERT(server4.IsEstablished());
+    ApplicationManager::UnregisterApplication("resume");
+}
+
+static void TestLatencyHistogram()
+{
+    LatencyHistogram histogram;
+    SSASSERT(histogram.GetPercentile(50) == 0);
+    for (Uint32 i = 0; i < 90; ++i) {
+        histogram.Add(3); // [2, 4)
+    }
+    for (Uint32 i = 0; i < 10; ++i) {
+        histogram.Add(100); // [64, 128)
+    }
+    SSASSERT(histogram.count == 100 && histogram.sum == 1270 && histogram.max == 100);
+    SSASSERT(histogram.GetPercentile(50) == 3);
+    SSASSERT(histogram.GetPercentile(90) == 3);
+    SSASSERT(histogram.GetPercentile(99) == 100); // Capped by the max
+    histogram.Add(1000000);
+    SSASSERT(histogram.buckets[LatencyHistogram::kBucketCount - 1] == 1);
+    SSASSERT(histogram.GetPercentile(100) == 1000000);
+}
+
+static void TestStats()
+{
+    RecordingApplication serverApp;
+    bool registered = ApplicationManager::RegisterApplication("stats", &serverApp);
+    SSASSERT(registered);
+    PhotonProtocol server(PhotonProtocol::Role::kServer);
+    PhotonProtocol client(PhotonProtocol::Role::kClient);
+    ss::DynamicBuffer wire;
+    bool connected = client.Connect("stats", { 1 });
+    SSASSERT(connected);
+    bool delivered = Deliver(client, server);
+    SSASSERT(delivered);
+    SSASSERT(client.IsEstablished());
+
+    ProtocolStats before;
+    SSASSERT(server.GetStats(before));
+    SSASSERT(before.channels.size() == 2 && before.messagesInByType[Uint32(MessageHeader::Type::kControl)] == 3);
+    SSASSERT(before.total.messagesIn == 3 && before.total.messagesOut == 3 && before.parseErrors == 0);
+
+    // A 10000 bytes video message takes 3 chunks, the last one arrives later
+    bool sent = client.SendMessage(1, MessageHeader::Type::kVideo, 0, ByteArray(10000));
+    SSASSERT(sent);
+    ProtocolStats clientStats;
+    SSASSERT(client.GetStats(clientStats));
+    SSASSERT(clientStats.channels[1].queuedMessages == 1 && clientStats.channels[1].queuedBytes > 10000);
+    ss::DynamicBuffer unused;
+    bool written = client.OnOutBoundData(unused, wire);
+    SSASSERT(written);
+    SSASSERT(client.GetStats(clientStats));
+    SSASSERT(clientStats.channels[1].queuedMessages == 0 && clientStats.channels[1].queuedBytes == 0);
+    SSASSERT(clientStats.channels[1].chunksOut == 3 && clientStats.channels[1].messagesOut == 1);
+    SSASSERT(clientStats.messagesOutByType[Uint32(MessageHeader::Type::kVideo)] == 1);
+
+    ss::DynamicBuffer received;
+    received.PushData(wire.GetData<Uint8>(), wire.Size() - 100);
+    wire.Skip(wire.Size() - 100);
+    bool handled = server.OnInBoundData(received, unused);
+    SSASSERT(handled);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    received.PushData(wire.GetData<Uint8>(), wire.Size());
+    handled = server.OnInBoundData(received, unused);
+    SSASSERT(handled);
+    SSASSERT(serverApp.media.size() == 1);
+
+    ProtocolStats after;
+    SSASSERT(server.GetStats(after));
+    auto& channel = after.channels[1];
+    SSASSERT(channel.chunksIn == 3 && channel.messagesIn == 1 && channel.bytesIn == clientStats.channels[1].bytesOut);
+    SSASSERT(channel.reassemblyLatency.count == 1 && channel.reassemblyLatency.max >= 20);
+    SSASSERT(after.total.messagesIn == 4 && after.total.bytesIn > 10000);
+    SSASSERT(after.GetMessageRate(before, MessageHeader::Type::kVideo, true) > 0);
+    SSASSERT(after.GetMessageRate(before, MessageHeader::Type::kAudio, true) == 0);
+    SSASSERT(after.GetMessageRate(after, MessageHeader::Type::kVideo, true) == 0);
+
+    // Garbage
+    PhotonProtocol broken(PhotonProtocol::Role::kServer);
+    ss::DynamicBuffer garbage;
+    Uint8 bytes[] = { 0x05, 0x00, 0x01, 0xff };
+    garbage.PushData(bytes, sizeof(bytes));
+    handled = broken.OnInBoundData(garbage, unused);
+    SSASSERT(!handled);
+    SSASSERT(broken.GetStats(after) && after.parseErrors == 1);
+    ApplicationManager::UnregisterApplication("stats");
+}
+
+static void TestBufferChains()
+{
+    RecordingApplication serverApp;
+    bool registered = ApplicationManager::RegisterApplication("chain", &serverApp);
+    SSASSERT(registered);
+    PhotonProtocol server(PhotonProtocol::Role::kServer);
+    PhotonProtocol client(PhotonProtocol::Role::kClient);
+    bool connected = client.Connect("chain", { 1 });
+    SSASSERT(connected);
+    BufferChain unused;
+    BufferChain wire;
+    BufferChain replies;
+    bool written = client.OnOutBoundChain(unused, wire);
+    SSASSERT(written);
+    bool handled = server.OnInBoundChain(wire, replies);
+    SSASSERT(handled);
+    SSASSERT(wire.Empty());
+    handled = client.OnInBoundChain(replies, unused);
+    SSASSERT(handled);
+    SSASSERT(client.IsEstablished() && unused.Empty());
+
+    // The chunks refer to the payload
+    BufferSlice payload(10000);
+    memset(payload.MutableData(), 7, payload.Size());
+    MessageHeader header;
+    header.messageType = MessageHeader::Type::kVideo;
+    bool forwarded = client.ForwardMessage(1, header, payload);
+    SSASSERT(forwarded);
+    written = client.OnOutBoundChain(unused, wire);
+    SSASSERT(written);
+    SSASSERT(payload.UseCount() == 4); // One slice per chunk
+    SSASSERT(wire.Size() > 10000 && wire.Size() < 10100);
+
+    // Chunks split anywhere are kept until the rest arrives
+    auto head = wire.Split(5000);
+    handled = server.OnInBoundChain(head, replies);
+    SSASSERT(handled);
+    SSASSERT(serverApp.media.empty());
+    handled = server.OnInBoundChain(wire, replies);
+    SSASSERT(handled);
+    SSASSERT(serverApp.media.size() == 1 && serverApp.media[0].second.Size() == 10000);
+    SSASSERT(serverApp.media[0].second[9999] == 7);
+    SSASSERT(payload.UseCount() == 1);
+    ApplicationManager::UnregisterApplication("chain");
+}
+
+static ByteArray SerializeRmi(const RemoteMethodInfo& rmi)
+{
+    std::vector<Uint8> bytes;
+    bool serialized = DataSerializer::Serialize(rmi, [&bytes](Uint8 b) { bytes.push_back(b); });
+    SSASSERT(serialized);
+    ByteArray payload(Uint32(bytes.size()));
+    memcpy(payload.Data(), bytes.data(), bytes.size());
+    return payload;
+}
+
+static void TestMessageCompressor()
+{
+    MessageDeflater deflater;
+    MessageInflater inflater;
+    MessageInflater limited;
+    ByteArray zeros(100000);
+    memset(zeros.Data(), 0, zeros.Size());
+    ByteArray compressed;
+    ByteArray inflated;
+    bool compressedOk = deflater.Compress(zeros.Data(), zeros.Size(), compressed);
+    SSASSERT(compressedOk && compressed.Size() < 1000);
+    bool decompressed = inflater.Decompress(compressed.Data(), compressed.Size(), zeros.Size(), inflated);
+    SSASSERT(decompressed);
+    SSASSERT(inflated.Size() == zeros.Size() && inflated[99999] == 0);
+    decompressed = limited.Decompress(compressed.Data(), compressed.Size(), zeros.Size() - 1, inflated);
+    SSASSERT(!decompressed);
+    SSASSERT(!limited.IsValid());
+
+    // A corrupted stream
+    MessageInflater corrupted;
+    Uint8 garbage[] = { 0xFF, 0xFF, 0xFF, 0xFF };
+    decompressed = corrupted.Decompress(garbage, sizeof(garbage), 1000, inflated);
+    SSASSERT(!decompressed);
+}
+
+static void TestCompression()
+{
+    RecordingApplication serverApp;
+    bool registered = ApplicationManager::RegisterApplication("deflate", &serverApp);
+    SSASSERT(registered);
+    PhotonProtocol server(PhotonProtocol::Role::kServer);
+    PhotonProtocol client(PhotonProtocol::Role::kClient);
+    bool enabled = client.EnableCompression(1);
+    SSASSERT(!enabled); // Before Connect
+    bool connected = client.Connect("deflate", { 1 });
+    SSASSERT(connected);
+    enabled = client.EnableCompression(1, 16);
+    SSASSERT(enabled);
+    enabled = client.EnableCompression(1);
+    SSASSERT(!enabled); // Requested
+    enabled = client.EnableCompression(9);
+    SSASSERT(!enabled);
+    ss::DynamicBuffer wire;
+    bool delivered = Deliver(client, server);
+    SSASSERT(delivered);
+    SSASSERT(client.IsEstablished());
+    enabled = client.EnableCompression(1);
+    SSASSERT(!enabled); // Enabled
+
+    // Chatty RMIs shrink, and shrink further as the dictionary learns them
+    std::vector<Uint32> sizes;
+    ss::DynamicBuffer unused;
+    for (Uint32 i = 0; i < 3; ++i) {
+        Array params({
+            std::make_shared<Variant>(String("subscribe-to-the-video-stream-of-the-presenter")),
+            std::make_shared<Variant>(String("subscribe-to-the-audio-stream-of-the-presenter")),
+            std::make_shared<Variant>(i),
+        });
+        auto payload = SerializeRmi(RemoteMethodInfo(Variant::Type::Void, "room.member.UpdateSubscription", std::move(params)));
+        SSASSERT(payload.Size() > 120);
+        bool sent = client.SendMessage(1, MessageHeader::Type::kRemoteMethodInvoke, 0, std::move(payload));
+        SSASSERT(sent);
+        bool written = client.OnOutBoundData(unused, wire);
+        SSASSERT(written);
+        sizes.push_back(wire.Size());
+        bool handled = server.OnInBoundData(wire, unused);
+        SSASSERT(handled);
+    }
+    SSASSERT(sizes[0] < 120 && sizes[2] < sizes[0] && sizes[2] < 40);
+    SSASSERT(serverApp.methods.size() == 3 && serverApp.methods[2] == "room.member.UpdateSubscription");
+
+    // Small messages are sent as they are, media is never compressed
+    bool sent = client.SendMessage(1, MessageHeader::Type::kRemoteMethodInvoke, 0, SerializeRmi(RemoteMethodInfo(Variant::Type::Void, "a", Array())));
+    SSASSERT(sent);
+    sent = client.SendMessage(1, MessageHeader::Type::kVideo, 0, ByteArray(1000));
+    SSASSERT(sent);
+    bool written = client.OnOutBoundData(unused, wire);
+    SSASSERT(written);
+    SSASSERT(wire.Size() > 1000);
+    bool handled = server.OnInBoundData(wire, unused);
+    SSASSERT(handled);
+    SSASSERT(serverApp.methods.size() == 4 && serverApp.media.size() == 1);
+
+    // The other direction of the Control Channel, the results are compressed too
+    enabled = server.EnableCompression(0, 0);
+    SSASSERT(enabled);
+    delivered = Deliver(server, client);
+    SSASSERT(delivered);
+    bool created = client.CreateChannel(2);
+    SSASSERT(created);
+    delivered = Deliver(client, server);
+    SSASSERT(delivered);
+    sent = client.SendMessage(2, MessageHeader::Type::kAudio, 0, ByteArray { 1 });
+    SSASSERT(sent);
+    delivered = Deliver(client, server);
+    SSASSERT(delivered);
+    SSASSERT(serverApp.media.size() == 2);
+
+    // A compressed message without the agreement
+    PhotonProtocol server2(PhotonProtocol::Role::kServer);
+    PhotonProtocol client2(PhotonProtocol::Role::kClient);
+    connected = client2.Connect("deflate", {});
+    SSASSERT(connected);
+    delivered = Deliver(client2, server2);
+    SSASSERT(delivered);
+    MessageHeader header;
+    header.messageId = 5;
+    header.reserved = MessageHeader::kCompressed;
+    header.messageType = MessageHeader::Type::kControl;
+    header.messageLength = 1;
+    std::vector<Uint8> message;
+    bool serialized = DataSerializer::Serialize(header, [&message](Uint8 b) { message.push_back(b); });
+    SSASSERT(serialized);
+    message.push_back(0);
+    ss::DynamicBuffer chunk;
+    serialized = DataSerializer::Serialize(ChunkHeader { 0, 9, Uint32(message.size()) }, [&chunk](Uint8 b) { chunk.PushData(&b, 1); });
+    SSASSERT(serialized);
+    chunk.PushData(message.data(), Uint32(message.size()));
+    handled = server2.OnInBoundData(chunk, unused);
+    SSASSERT(!handled);
+    ApplicationManager::UnregisterApplication("deflate");
+}
+
+static void TestPeekApplicationName()
+{
+    ss::DynamicBuffer unused;
+    PhotonProtocol client(PhotonProtocol::Role::kClient);
+    bool connected = client.Connect("room", { 1 });
+    SSASSERT(connected);
+    bool sent = client.SendMessage(1, MessageHeader::Type::kAudio, 0, ByteArray { 1, 2, 3 });
+    SSASSERT(sent);
+    ss::DynamicBuffer wire;
+    bool written = client.OnOutBoundData(unused, wire);
+    SSASSERT(written);
+
+    // Nothing is found until the whole hello arrives, whatever follows it
+    String appName;
+    auto* data = wire.GetData<Uint8>();
+    auto peeked = PhotonProtocol::PeekApplicationName(data, 0, appName);
+    SSASSERT(peeked == PhotonProtocol::PeekResult::kNotEnoughData);
+    peeked = PhotonProtocol::PeekApplicationName(data, 8, appName);
+    SSASSERT(peeked == PhotonProtocol::PeekResult::kNotEnoughData);
+    peeked = PhotonProtocol::PeekApplicationName(data, wire.Size(), appName);
+    SSASSERT(peeked == PhotonProtocol::PeekResult::kFound);
+    SSASSERT(appName == "room");
+    Uint32 helloSize = 1;
+    while (PhotonProtocol::PeekApplicationName(data, helloSize, appName) != PhotonProtocol::PeekResult::kFound) {
+        ++helloSize;
+    }
+    SSASSERT(helloSize < wire.Size());
+
+    // The peeked bytes can still be handled by a server
+    RecordingApplication app;
+    bool registered = ApplicationManager::RegisterApplication("room", &app);
+    SSASSERT(registered);
+    PhotonProtocol server(PhotonProtocol::Role::kServer);
+    bool handled = server.OnInBoundData(wire, unused);
+    SSASSERT(handled);
+    SSASSERT(server.IsEstablished() && app.media.size() == 1);
+    ApplicationManager::UnregisterApplication("room");
+
+    // A resuming client or a stranger is not routed
+    ss::DynamicBuffer chunk;
+    bool serialized = DataSerializer::Serialize(ChunkHeader { 3, 0, 1 }, [&chunk](Uint8 b) { chunk.PushData(&b, 1); });
+    SSASSERT(serialized);
+    chunk.PushData("x", 1);
+    peeked = PhotonProtocol::PeekApplicationName(chunk.GetData<Uint8>(), chunk.Size(), appName);
+    SSASSERT(peeked == PhotonProtocol::PeekResult::kNotHello);
+    std::vector<Uint8> garbage(64 * 1024, 0);
+    peeked = PhotonProtocol::PeekApplicationName(garbage.data(), Uint32(garbage.size()), appName);
+    SSASSERT(peeked != PhotonProtocol::PeekResult::kFound);
+}
+
+static void TestInBoundBytes()
+{
+    RecordingApplication app;
+    bool registered = ApplicationManager::RegisterApplication("bytes", &app);
+    SSASSERT(registered);
+    for (Uint32 readSize : { 1u, 7u, 100u, 65536u }) {
+        PhotonProtocol client(PhotonProtocol::Role::kClient);
+        bool connected = client.Connect("bytes", { 1 });
+        SSASSERT(connected);
+        ByteArray large(Uint32(20000));
+        for (Uint32 i = 0; i < large.Size(); ++i) {
+            large.Data()[i] = Uint8(i * 7);
+        }
+        bool sent = client.SendMessage(1, MessageHeader::Type::kVideo, 0, ByteArray(large));
+        SSASSERT(sent);
+        sent = client.SendMessage(1, MessageHeader::Type::kAudio, 1, ByteArray { 1, 2 });
+        SSASSERT(sent);
+        ss::DynamicBuffer wire;
+        ss::DynamicBuffer unused;
+        bool written = client.OnOutBoundData(unused, wire);
+        SSASSERT(written);
+
+        // The receive buffer is overwritten after every read, nothing may refer to it
+        PhotonProtocol server(PhotonProtocol::Role::kServer);
+        std::vector<Uint8> receiveBuffer(readSize);
+        ss::DynamicBuffer replies;
+        app.media.clear();
+        while (!wire.Empty()) {
+            Uint32 n = std::min(readSize, wire.Size());
+            memcpy(receiveBuffer.data(), wire.GetData<Uint8>(), n);
+            wire.Skip(n);
+            bool handled = server.OnInBoundBytes(receiveBuffer.data(), n, replies);
+            SSASSERT(handled);
+            memset(receiveBuffer.data(), 0xCC, receiveBuffer.size());
+        }
+        SSASSERT(server.IsEstablished());
+        SSASSERT(app.media.size() == 2 && app.media[0].second == large && app.media[1].second == (ByteArray { 1, 2 }));
+        bool handled = client.OnInBoundData(replies, unused);
+        SSASSERT(handled && client.IsEstablished());
+    }
+    ApplicationManager::UnregisterApplication("bytes");
+}
+
+static void TestHeartbeat()
+{
+    RecordingApplication app;
+    PhotonProtocol server(PhotonProtocol::Role::kServer);
+    server.SetApplication(&app);
+    PhotonProtocol client(PhotonProtocol::Role::kClient);
+    bool sent = client.SendHeartbeat();
+    SSASSERT(!sent);
+    bool connected = client.Connect("any", {});
+    SSASSERT(connected);
+    bool delivered = Deliver(client, server);
+    SSASSERT(delivered);
+    SSASSERT(server.IsEstablished() && client.IsEstablished());
+
+    // Accepted by both sides, and never handed to the application
+    sent = server.SendHeartbeat() && client.SendHeartbeat();
+    SSASSERT(sent);
+    delivered = Deliver(server, client) && Deliver(client, server);
+    SSASSERT(delivered);
+    SSASSERT(app.methods.empty());
+}
+
+// The server streams to a client that sends nothing by itself for longer than the idle timeout. The client is
+// probed with heartbeats and stays connected as long as it answers them.
+static void TestKeepAlive()
+{
+    for (bool alive : { true, false }) {
+        RecordingApplication serverApp;
+        RecordingApplication clientApp;
+        PhotonProtocol server(PhotonProtocol::Role::kServer);
+        server.SetApplication(&serverApp);
+        PhotonProtocol client(PhotonProtocol::Role::kClient);
+        client.SetApplication(&clientApp);
+        TimingWheel wheel(100, 0);
+        Uint64 now = 0;
+        Uint32 heartbeats = 0;
+        Uint64 expiredAt = 0;
+        KeepAlive keepAlive(&server, [&heartbeats]() { ++heartbeats; }, [&expiredAt, &now, &keepAlive](KeepAlive::Expiry expiry) {
+            SSASSERT(expiry == KeepAlive::Expiry::kIdle);
+            expiredAt = now;
+            keepAlive.Stop();
+        });
+        keepAlive.Start(&wheel);
+
+        bool connected = client.Connect("any", { 1 });
+        SSASSERT(connected);
+        ss::DynamicBuffer unused;
+        ss::DynamicBuffer toServer;
+        ss::DynamicBuffer toClient;
+        for (; now <= 3 * KeepAlive::kIdleTimeout && expiredAt == 0; now += 100) {
+            bool ok = client.OnOutBoundData(unused, toServer);
+            if (!toServer.Empty() && (alive || !client.IsEstablished())) {
+                ok = ok && server.OnInBoundData(toServer, toClient);
+                keepAlive.OnReceived();
+            }
+            toServer.Reset(); // A dead client's answers are lost
+            ok = ok && server.SendMessage(1, MessageHeader::Type::kVideo, 0, ByteArray { 1, 2, 3 });
+            wheel.Advance(now);
+            ok = ok && server.OnOutBoundData(unused, toClient) && client.OnInBoundData(toClient, toServer);
+            SSASSERT(ok);
+        }
+        SSASSERT(clientApp.media.size() > KeepAlive::kIdleTimeout / 200); // Streamed all along
+        if (alive) {
+            SSASSERT(expiredAt == 0);
+            SSASSERT(heartbeats >= 3 * KeepAlive::kIdleTimeout / KeepAlive::kHeartbeatInterval - 1);
+        } else {
+            // Probed, then hung up
+            SSASSERT(expiredAt >= KeepAlive::kIdleTimeout && expiredAt <= KeepAlive::kIdleTimeout + 200);
+            SSASSERT(heartbeats >= 2);
+        }
+    }
+
+    // The handshake never completes
+    PhotonProtocol server(PhotonProtocol::Role::kServer);
+    TimingWheel wheel(100, 0);
+    Uint64 now = 0;
+    bool expired = false;
+    KeepAlive keepAlive(&server, []() { SSASSERT(false); }, [&expired, &keepAlive](KeepAlive::Expiry expiry) {
+        SSASSERT(expiry == KeepAlive::Expiry::kHandshake);
+        expired = true;
+        keepAlive.Stop();
+    });
+    keepAlive.Start(&wheel);
+    for (; now <= KeepAlive::kIdleTimeout && !expired; now += 100) {
+        wheel.Advance(now);
+    }
+    SSASSERT(expired && now > KeepAlive::kHandshakeTimeout && now <= KeepAlive::kHandshakeTimeout + 200);
+}
+
+// A message larger than the connection window arrives once the receivers accept it, received as a whole or relayed
+static void TestLargerThanWindow()
+{
+    ByteArray large(kDefaultConnectionWindowSize + kDefaultChannelWindowSize);
+    for (Uint32 i = 0; i < large.Size(); ++i) {
+        large.Data()[i] = Uint8(i * 13);
+    }
+    for (bool relay : { false, true }) {
+        RecordingApplication serverApp;
+        RecordingApplication clientApp;
+        PhotonProtocol server(PhotonProtocol::Role::kServer);
+        server.SetApplication(&serverApp);
+        server.SetMediaRelay(relay);
+        PhotonProtocol client(PhotonProtocol::Role::kClient);
+        client.SetApplication(&clientApp);
+        bool connected = client.Connect("any", { 1 });
+        SSASSERT(connected);
+        ss::DynamicBuffer wire;
+        bool delivered = Deliver(client, server);
+        SSASSERT(delivered);
+        bool accepted = server.SetChannelMaxMessageSize(1, large.Size());
+        SSASSERT(accepted);
+        if (relay) {
+            // Reflected to the client, so the client's windows are exceeded too
+            bool subscribed = server.AddMediaSubscriber(1, &server, 1);
+            SSASSERT(subscribed);
+            accepted = client.SetChannelMaxMessageSize(1, large.Size());
+            SSASSERT(accepted);
+        }
+        bool sent = client.SendMessage(1, MessageHeader::Type::kVideo, 0, ByteArray(large));
+        SSASSERT(sent);
+
+        // Every round trip moves what the windows allow, the chunks unblocked by the WindowUpdates go out at once
+        ss::DynamicBuffer unused;
+        ss::DynamicBuffer toClient;
+        bool written = client.OnOutBoundData(unused, wire);
+        SSASSERT(written);
+        auto& received = relay ? clientApp.media : serverApp.media;
+        for (int i = 0; i < 100 && received.empty(); ++i) {
+            delivered = server.OnInBoundData(wire, toClient) && client.OnInBoundData(toClient, wire);
+            SSASSERT(delivered);
+        }
+        SSASSERT(received.size() == 1 && received[0].second == large);
+    }
+}
+
+// The channel window is credited back when a message is handed over, a message must fit in it
+static void TestMaxMessageSize()
+{
+    RecordingApplication serverApp;
+    PhotonProtocol server(PhotonProtocol::Role::kServer);
+    server.SetApplication(&serverApp);
+    PhotonProtocol client(PhotonProtocol::Role::kClient);
+    bool connected = client.Connect("any", { 1 });
+    SSASSERT(connected);
+    bool delivered = Deliver(client, server);
+    SSASSERT(delivered);
+    bool accepted = server.SetChannelMaxMessageSize(2, 1000);
+    SSASSERT(!accepted); // No such channel
+    accepted = server.SetChannelMaxMessageSize(1, kMaxWindowSize);
+    SSASSERT(!accepted); // The window would be too large
+
+    // The buffered chunks of an incomplete message are not credited back, more than half of the window is
+    // buffered before the second message completes
+    ss::DynamicBuffer unused;
+    ss::DynamicBuffer wire;
+    ss::DynamicBuffer toClient;
+    const Uint32 size = kDefaultChannelWindowSize * 3 / 10;
+    bool sent = client.SendMessage(1, MessageHeader::Type::kVideo, 0, ByteArray(size))
+        && client.SendMessage(1, MessageHeader::Type::kVideo, 0, ByteArray(size));
+    SSASSERT(sent);
+    bool written = client.OnOutBoundData(unused, wire);
+    SSASSERT(written);
+    ss::DynamicBuffer input;
+    input.PushData(wire.GetData<Uint8>(), wire.Size() - size / 10);
+    wire.Skip(wire.Size() - size / 10);
+    ProtocolStats stats;
+    server.GetStats(stats);
+    auto controlMessages = stats.channels[0].messagesOut;
+    delivered = server.OnInBoundData(input, toClient);
+    SSASSERT(delivered && serverApp.media.size() == 1);
+    server.GetStats(stats);
+    SSASSERT(stats.channels[0].messagesOut == controlMessages); // No WindowUpdate yet
+    input.PushData(wire.GetData<Uint8>(), wire.Size());
+    delivered = server.OnInBoundData(input, toClient);
+    SSASSERT(delivered && serverApp.media.size() == 2);
+    server.GetStats(stats);
+    SSASSERT(stats.channels[0].messagesOut == controlMessages + 1);
+
+    // A message larger than the limit closes the connection
+    sent = client.SendMessage(1, MessageHeader::Type::kVideo, 0, ByteArray(PhotonProtocol::kDefaultMaxMessageSize + 1));
+    SSASSERT(sent);
+    delivered = Deliver(client, server);
+    SSASSERT(!delivered);
+}
+
+// The exemption from flow control is sent along with the creation of a channel
+static void TestFlowControlExemption()
+{
+    RecordingApplication serverApp;
+    PhotonProtocol server(PhotonProtocol::Role::kServer);
+    server.SetApplication(&serverApp);
+    PhotonProtocol client(PhotonProtocol::Role::kClient);
+    bool exempted = client.DisableChannelFlowControl(2);
+    SSASSERT(exempted);
+    bool connected = client.Connect("any", { 1, 2 });
+    SSASSERT(connected);
+    exempted = client.DisableChannelFlowControl(1);
+    SSASSERT(!exempted); // Created flow controlled
+    bool delivered = Deliver(client, server);
+    SSASSERT(delivered);
+    exempted = server.DisableChannelFlowControl(2);
+    SSASSERT(exempted); // Exempt on the server too
+    exempted = server.DisableChannelFlowControl(1);
+    SSASSERT(!exempted);
+
+    // More than the connection window passes without any WindowUpdate
+    const Uint32 count = kDefaultConnectionWindowSize / (kDefaultChannelWindowSize / 4) + 2;
+    for (Uint32 i = 0; i < count; ++i) {
+        bool sent = client.SendMessage(2, MessageHeader::Type::kVideo, 0, ByteArray(kDefaultChannelWindowSize / 4));
+        SSASSERT(sent);
+    }
+    ss::DynamicBuffer unused;
+    ss::DynamicBuffer wire;
+    ss::DynamicBuffer toClient;
+    bool written = client.OnOutBoundData(unused, wire);
+    SSASSERT(written);
+    delivered = server.OnInBoundData(wire, toClient);
+    SSASSERT(delivered);
+    SSASSERT(serverApp.media.size() == count);
+
+    // The server refuses a flow controlled channel it has exempted
+    PhotonProtocol strictServer(PhotonProtocol::Role::kServer);
+    strictServer.SetApplication(&serverApp);
+    exempted = strictServer.DisableChannelFlowControl(1);
+    SSASSERT(exempted);
+    PhotonProtocol plainClient(PhotonProtocol::Role::kClient);
+    connected = plainClient.Connect("any", { 1 });
+    SSASSERT(connected);
+    delivered = Deliver(plainClient, strictServer);
+    SSASSERT(!delivered);
+}
+
+void TestPhotonProtocol::test()
+{
+    TestMessageCompressor();
+    TestCompression();
+    TestBufferChains();
+    TestLatencyHistogram();
+    TestStats();
+    TestPipelinedHandshake();
+    TestRefused();
+    TestResumptionTokenStore();
+    TestResume();
+    TestPeekApplicationName();
+    TestInBoundBytes();
+    TestHeartbeat();
+    TestKeepAlive();
+    TestLargerThanWindow();
+    TestMaxMessageSize();
+    TestFlowControlExemption();
+    std::cout << "Test photon protocol pass" << std::endl;
+}
+
+}
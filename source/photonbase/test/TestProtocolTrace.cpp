@@ -0,0 +1,96 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "TestProtocolTrace.h"
+#include <SSBase/Assert.h>
+#include <cstdio>
+#include <iostream>
+#include <photonbase/protocol/ProtocolTrace.h>
+
+namespace pht {
+
+static const char* kTracePath = "photonbase_test.phtrace";
+
+static void TestRoundTrip()
+{
+    ProtocolTraceWriter writer;
+    bool opened = writer.Open(kTracePath);
+    SSASSERT(opened);
+    const Uint8 first[] = { 1, 2, 3 };
+    ByteArray second(300);
+    for (Uint32 i = 0; i < second.Size(); ++i) {
+        second.Data()[i] = Uint8(i);
+    }
+    bool written = writer.Write(first, sizeof(first));
+    SSASSERT(written);
+    written = writer.Write(second.Data(), second.Size());
+    SSASSERT(written);
+    written = writer.Write(nullptr, 0);
+    SSASSERT(written);
+    writer.Close();
+
+    ProtocolTraceReader reader;
+    ProtocolTraceReader::Record record;
+    opened = reader.Open(kTracePath);
+    SSASSERT(opened);
+    bool read = reader.Next(record);
+    SSASSERT(read);
+    SSASSERT(record.time == 0);
+    SSASSERT(record.data == ByteArray({ 1, 2, 3 }));
+    read = reader.Next(record);
+    SSASSERT(read);
+    SSASSERT(record.data == second);
+    Uint64 time = record.time;
+    read = reader.Next(record);
+    SSASSERT(read);
+    SSASSERT(record.data.Size() == 0);
+    SSASSERT(record.time >= time);
+    read = reader.Next(record);
+    SSASSERT(!read);
+    SSASSERT(!reader.IsCorrupted());
+}
+
+static void TestTruncated()
+{
+    ProtocolTraceWriter writer;
+    bool opened = writer.Open(kTracePath);
+    SSASSERT(opened);
+    ByteArray data(100);
+    bool written = writer.Write(data.Data(), data.Size());
+    SSASSERT(written);
+    writer.Close();
+
+    // Cut the last byte of the record
+    std::FILE* file = std::fopen(kTracePath, "rb");
+    SSASSERT(file != nullptr);
+    ByteArray content(8 + 2 + 100);
+    size_t length = std::fread(content.Data(), 1, content.Size(), file);
+    SSASSERT(length == content.Size());
+    std::fclose(file);
+    file = std::fopen(kTracePath, "wb");
+    std::fwrite(content.Data(), 1, content.Size() - 1, file);
+    std::fclose(file);
+
+    ProtocolTraceReader reader;
+    ProtocolTraceReader::Record record;
+    opened = reader.Open(kTracePath);
+    SSASSERT(opened);
+    bool read = reader.Next(record);
+    SSASSERT(!read);
+    SSASSERT(reader.IsCorrupted());
+
+    // Not a trace at all
+    opened = reader.Open("photonbase_test_missing.phtrace");
+    SSASSERT(!opened);
+}
+
+void TestProtocolTrace::test()
+{
+    TestRoundTrip();
+    TestTruncated();
+    std::remove(kTracePath);
+    std::cout << "Test protocol trace pass" << std::endl;
+}
+
+}
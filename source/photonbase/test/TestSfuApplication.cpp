@@ -0,0 +1,333 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "TestSfuApplication.h"
+#include "LoopbackEndpoint.h"
+#include "photonbase/application/ApplicationManager.h"
+#include "photonbase/application/SfuApplication.h"
+#include "photonbase/protocol/MessageHeader.h"
+#include "photonbase/protocol/PhotonProtocol.h"
+#include <SSBase/Assert.h>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace pht {
+
+static Array Params(const String& name)
+{
+    return Array({ std::make_shared<Variant>(name) });
+}
+
+static Array Params(const String& name, Uint16 channelId)
+{
+    return Array({ std::make_shared<Variant>(name), std::make_shared<Variant>(channelId) });
+}
+
+static Array Params(const String& name, Uint16 width, Uint16 height)
+{
+    return Array({ std::make_shared<Variant>(name), std::make_shared<Variant>(width), std::make_shared<Variant>(height) });
+}
+
+static bool SendVideo(LoopbackEndpoint& publisher, ByteArray&& payload, bool keyFrame, Uint16 channelId = 2)
+{
+    MessageHeader header;
+    header.messageType = MessageHeader::Type::kVideo;
+    header.reserved = keyFrame ? MessageHeader::kKeyFrame : 0;
+    return publisher.client.SendMessage(channelId, header, std::move(payload)) && publisher.Send();
+}
+
+static void TestFanOut()
+{
+    SfuApplication sfu(0, 0);
+    bool registered = ApplicationManager::RegisterApplication("sfu", &sfu);
+    SSASSERT(registered);
+    {
+        auto publisher = std::make_unique<LoopbackEndpoint>("sfu");
+        auto viewer1 = std::make_unique<LoopbackEndpoint>("sfu");
+        LoopbackEndpoint viewer2("sfu");
+        LoopbackEndpoint stranger("sfu");
+        publisher->Invoke("sfu.Join", Params("room"));
+        viewer1->Invoke("sfu.Join", Params("room"));
+        viewer2.Invoke("sfu.Join", Params("room"));
+        stranger.Invoke("sfu.Join", Params("lobby"));
+        // Subscribing before the stream is published
+        viewer1->Invoke("sfu.Subscribe", Params("cam", 3));
+        bool sent = viewer1->Send();
+        SSASSERT(sent);
+        publisher->Invoke("sfu.Publish", Params("cam", 2));
+        sent = publisher->Send();
+        SSASSERT(sent);
+        viewer2.Invoke("sfu.Subscribe", Params("cam", 3));
+        sent = viewer2.Send();
+        SSASSERT(sent);
+        stranger.Invoke("sfu.Subscribe", Params("cam", 3));
+        sent = stranger.Send();
+        SSASSERT(sent);
+        SSASSERT(sfu.GetRoomCount() == 2 && sfu.GetClients().size() == 4);
+
+        // Every subscriber gets the message, but reads at its own pace
+        sent = publisher->client.SendMessage(2, MessageHeader::Type::kVideo, 0, ByteArray { 1, 2, 3 });
+        SSASSERT(sent);
+        sent = publisher->Send();
+        SSASSERT(sent);
+        viewer1->Receive();
+        SSASSERT(viewer1->sink.media.size() == 1 && viewer1->sink.media[0].first == 3);
+        SSASSERT(viewer1->sink.media[0].second == (ByteArray { 1, 2, 3 }));
+        sent = publisher->client.SendMessage(2, MessageHeader::Type::kVideo, 0, ByteArray { 4 });
+        SSASSERT(sent);
+        sent = publisher->Send();
+        SSASSERT(sent);
+        viewer1->Receive();
+        SSASSERT(viewer1->sink.media.size() == 2);
+        viewer2.Receive();
+        SSASSERT(viewer2.sink.media.size() == 2 && viewer2.sink.media[1].second == (ByteArray { 4 }));
+        stranger.Receive();
+        SSASSERT(stranger.sink.media.empty());
+
+        // Unsubscribed, and gone without leaving
+        viewer2.Invoke("sfu.Unsubscribe", Params("cam"));
+        sent = viewer2.Send();
+        SSASSERT(sent);
+        viewer1->server = nullptr;
+        sent = publisher->client.SendMessage(2, MessageHeader::Type::kVideo, 0, ByteArray { 5 });
+        SSASSERT(sent);
+        sent = publisher->Send();
+        SSASSERT(sent);
+        viewer2.Receive();
+        SSASSERT(viewer2.sink.media.size() == 2);
+
+        // The subscription waits for the stream of a new publisher
+        viewer2.Invoke("sfu.Subscribe", Params("cam", 3));
+        sent = viewer2.Send();
+        SSASSERT(sent);
+        publisher = nullptr;
+        LoopbackEndpoint publisher2("sfu");
+        publisher2.Invoke("sfu.Join", Params("room"));
+        publisher2.Invoke("sfu.Publish", Params("cam", 2));
+        sent = publisher2.client.SendMessage(2, MessageHeader::Type::kAudio, 0, ByteArray { 6 });
+        SSASSERT(sent);
+        sent = publisher2.Send();
+        SSASSERT(sent);
+        viewer2.Receive();
+        SSASSERT(viewer2.sink.media.size() == 3 && viewer2.sink.media[2].second == (ByteArray { 6 }));
+
+        // Misuse closes the connection
+        LoopbackEndpoint rival("sfu");
+        rival.Invoke("sfu.Join", Params("room"));
+        rival.Invoke("sfu.Publish", Params("cam", 2));
+        sent = rival.Send();
+        SSASSERT(!sent); // Published by publisher2
+        LoopbackEndpoint outsider("sfu");
+        outsider.Invoke("sfu.Subscribe", Params("cam", 3));
+        sent = outsider.Send();
+        SSASSERT(!sent); // Not in a room
+        LoopbackEndpoint clumsy("sfu");
+        clumsy.Invoke("sfu.Join", Params("room"));
+        clumsy.Invoke("sfu.Subscribe", Params("cam", 9));
+        sent = clumsy.Send();
+        SSASSERT(!sent); // No such channel
+
+        // A channel carries one stream, it is reused after unsubscribing
+        LoopbackEndpoint zapper("sfu");
+        zapper.Invoke("sfu.Join", Params("room"));
+        zapper.Invoke("sfu.Subscribe", Params("cam", 3));
+        sent = zapper.Send();
+        SSASSERT(sent);
+        zapper.Invoke("sfu.Unsubscribe", Params("cam"));
+        zapper.Invoke("sfu.Subscribe", Params("cam", 3));
+        sent = zapper.Send();
+        SSASSERT(sent);
+        zapper.Invoke("sfu.Subscribe", Params("screen", 3));
+        sent = zapper.Send();
+        SSASSERT(!sent); // Bound to cam
+        LoopbackEndpoint looper("sfu");
+        looper.Invoke("sfu.Join", Params("room"));
+        looper.Invoke("sfu.Publish", Params("mic", 2));
+        looper.Invoke("sfu.Subscribe", Params("cam", 2));
+        sent = looper.Send();
+        SSASSERT(!sent); // Published in
+    }
+    SSASSERT(sfu.GetRoomCount() == 0 && sfu.GetClients().empty());
+    ApplicationManager::UnregisterApplication("sfu");
+}
+
+static void TestLateSubscriber()
+{
+    SfuApplication sfu(0, 64);
+    bool registered = ApplicationManager::RegisterApplication("sfu", &sfu);
+    SSASSERT(registered);
+    {
+        LoopbackEndpoint publisher("sfu");
+        publisher.Invoke("sfu.Join", Params("room"));
+        publisher.Invoke("sfu.Publish", Params("cam", 2));
+        bool sent = publisher.Send();
+        SSASSERT(sent);
+        sent = SendVideo(publisher, ByteArray { 1 }, false);
+        SSASSERT(sent);
+        sent = SendVideo(publisher, ByteArray { 2 }, true);
+        SSASSERT(sent);
+        sent = SendVideo(publisher, ByteArray { 3 }, false);
+        SSASSERT(sent);
+
+        // The group of pictures from the last key frame comes first, then the live messages
+        LoopbackEndpoint viewer("sfu");
+        viewer.Invoke("sfu.Join", Params("room"));
+        viewer.Invoke("sfu.Subscribe", Params("cam", 3));
+        sent = viewer.Send();
+        SSASSERT(sent);
+        sent = SendVideo(publisher, ByteArray { 4 }, false);
+        SSASSERT(sent);
+        viewer.Receive();
+        SSASSERT(viewer.sink.media.size() == 3);
+        SSASSERT(viewer.sink.media[0].second == (ByteArray { 2 }) && viewer.sink.headers[0].reserved == MessageHeader::kKeyFrame);
+        SSASSERT(viewer.sink.media[1].second == (ByteArray { 3 }) && viewer.sink.headers[1].reserved == 0);
+        SSASSERT(viewer.sink.media[2].second == (ByteArray { 4 }));
+
+        // A group larger than the cache is not cached
+        sent = SendVideo(publisher, ByteArray(60), true);
+        SSASSERT(sent);
+        sent = SendVideo(publisher, ByteArray(10), false);
+        SSASSERT(sent);
+        LoopbackEndpoint viewer2("sfu");
+        viewer2.Invoke("sfu.Join", Params("room"));
+        viewer2.Invoke("sfu.Subscribe", Params("cam", 3));
+        sent = viewer2.Send();
+        SSASSERT(sent);
+        viewer2.Receive();
+        SSASSERT(viewer2.sink.media.empty());
+        sent = SendVideo(publisher, ByteArray { 5 }, true);
+        SSASSERT(sent);
+        viewer2.Receive();
+        SSASSERT(viewer2.sink.media.size() == 1 && viewer2.sink.headers[0].reserved == MessageHeader::kKeyFrame);
+
+        // Only video messages may be key frames
+        MessageHeader header;
+        header.messageType = MessageHeader::Type::kAudio;
+        header.reserved = MessageHeader::kKeyFrame;
+        sent = publisher.client.SendMessage(2, header, ByteArray { 6 });
+        SSASSERT(!sent);
+        header.messageType = MessageHeader::Type::kVideo;
+        header.reserved = MessageHeader::kCompressed;
+        sent = publisher.client.SendMessage(2, header, ByteArray { 6 });
+        SSASSERT(!sent);
+    }
+    ApplicationManager::UnregisterApplication("sfu");
+}
+
+// The payloads of the two layers of the simulcast test: 1x from the low one, 2x from the high one
+static std::vector<Uint8> Received(LoopbackEndpoint& viewer)
+{
+    viewer.Receive();
+    std::vector<Uint8> received;
+    for (auto& [channelId, payload] : viewer.sink.media) {
+        received.push_back(payload.Data()[0]);
+    }
+    viewer.sink.media.clear();
+    viewer.sink.headers.clear();
+    return received;
+}
+
+static void TestSimulcast()
+{
+    const Uint16 kLow = 2;
+    const Uint16 kHigh = 4;
+    SfuApplication sfu(5, 0);
+    bool registered = ApplicationManager::RegisterApplication("sfu", &sfu);
+    SSASSERT(registered);
+    {
+        LoopbackEndpoint publisher("sfu", { 1, kLow, kHigh });
+        publisher.Invoke("sfu.Join", Params("room"));
+        publisher.Invoke("sfu.PublishLayer", Array({ std::make_shared<Variant>(String("cam")), std::make_shared<Variant>(kHigh),
+                                                 std::make_shared<Variant>(Uint32(2500000)), std::make_shared<Variant>(Uint16(1280)),
+                                                 std::make_shared<Variant>(Uint16(720)) }));
+        publisher.Invoke("sfu.PublishLayer", Array({ std::make_shared<Variant>(String("cam")), std::make_shared<Variant>(kLow),
+                                                 std::make_shared<Variant>(Uint32(300000)), std::make_shared<Variant>(Uint16(320)),
+                                                 std::make_shared<Variant>(Uint16(180)) }));
+        bool sent = publisher.Send();
+        SSASSERT(sent);
+        auto sendBoth = [&publisher](Uint8 n, bool keyFrame) {
+            bool sent = SendVideo(publisher, ByteArray { Uint8(0x10 + n) }, keyFrame, kLow);
+            SSASSERT(sent);
+            sent = SendVideo(publisher, ByteArray { Uint8(0x20 + n) }, keyFrame, kHigh);
+            SSASSERT(sent);
+        };
+
+        // Without hints the top layer is forwarded
+        LoopbackEndpoint viewer("sfu");
+        viewer.Invoke("sfu.Join", Params("room"));
+        viewer.Invoke("sfu.Subscribe", Params("cam", 3));
+        sent = viewer.Send();
+        SSASSERT(sent);
+        sendBoth(1, true);
+        auto received = Received(viewer);
+        SSASSERT(received == (std::vector<Uint8> { 0x21 }));
+
+        // A small viewport needs the low layer, the switch waits for its key frame
+        viewer.Invoke("sfu.SetViewport", Params("cam", 320, 180));
+        sent = viewer.Send();
+        SSASSERT(sent);
+        sendBoth(2, false);
+        received = Received(viewer);
+        SSASSERT(received == (std::vector<Uint8> { 0x22 }));
+        sendBoth(3, true);
+        sendBoth(4, false);
+        received = Received(viewer);
+        SSASSERT(received == (std::vector<Uint8> { 0x13, 0x14 }));
+
+        // A large viewport, but not enough bandwidth for the high layer
+        viewer.Invoke("sfu.SetViewport", Params("cam", 1280, 720));
+        viewer.Invoke("sfu.SetBandwidth", Array({ std::make_shared<Variant>(Uint32(1000000)) }));
+        sent = viewer.Send();
+        SSASSERT(sent);
+        sendBoth(5, true);
+        received = Received(viewer);
+        SSASSERT(received == (std::vector<Uint8> { 0x15 }));
+        viewer.Invoke("sfu.SetBandwidth", Array({ std::make_shared<Variant>(Uint32(5000000)) }));
+        sent = viewer.Send();
+        SSASSERT(sent);
+        sendBoth(6, false);
+        sendBoth(7, true);
+        // The low layer goes on until the key frame of the high one
+        received = Received(viewer);
+        SSASSERT(received == (std::vector<Uint8> { 0x16, 0x17, 0x27 }));
+
+        // The viewer falls behind and drops messages, so the layer is lowered until it keeps up for a while
+        sendBoth(8, false);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        received = Received(viewer);
+        SSASSERT(received.empty());
+        sfu.Update();
+        sendBoth(9, true);
+        received = Received(viewer);
+        SSASSERT(received == (std::vector<Uint8> { 0x19 }));
+        for (Uint32 i = 0; i < SfuApplication::kProbeUpdates; ++i) {
+            sfu.Update();
+        }
+        sendBoth(10, true);
+        received = Received(viewer);
+        SSASSERT(received == (std::vector<Uint8> { 0x1A, 0x2A }));
+
+        // Both layers stop when the stream is unpublished
+        publisher.Invoke("sfu.Unpublish", Params("cam"));
+        sent = publisher.Send();
+        SSASSERT(sent);
+        sendBoth(11, true);
+        received = Received(viewer);
+        SSASSERT(received.empty());
+    }
+    ApplicationManager::UnregisterApplication("sfu");
+}
+
+void TestSfuApplication::test()
+{
+    TestFanOut();
+    TestLateSubscriber();
+    TestSimulcast();
+    std::cout << "Test sfu application pass" << std::endl;
+}
+
+}
@@ -0,0 +1,209 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "TestStripedConnection.h"
+#include "photonbase/protocol/ChunkHeader.h"
+#include "photonbase/protocol/DataDeserializer.h"
+#include "photonbase/protocol/DataSerializer.h"
+#include "photonbase/protocol/BaseProtocol.h"
+#include "photonbase/protocol/MessageHeader.h"
+#include "photonbase/protocol/impl/OutboundScheduler.h"
+#include "photonbase/transport/StripedConnection.h"
+#include <SSBase/Assert.h>
+#include <iostream>
+#include <map>
+
+namespace pht {
+
+// Sends what its scheduler queues, and keeps the received chunk data of each channel
+class ChunkProtocol : public BaseProtocol {
+public:
+    bool OnInBoundData(ss::DynamicBuffer& inputBuffer, ss::DynamicBuffer& outputBuffer) override
+    {
+        while (!inputBuffer.Empty()) {
+            ChunkHeader header {};
+            DataDeserializer deserializer(inputBuffer.GetData<Uint8>(), inputBuffer.Size());
+            bool deserialized = deserializer.Deserialize(header);
+            SSASSERT(deserialized);
+            inputBuffer.Skip(deserializer.DataConsumed());
+            SSASSERT(inputBuffer.Size() >= header.chunkSize);
+            auto& stream = streams[header.channelId];
+            stream.insert(stream.end(), inputBuffer.GetData<Uint8>(), inputBuffer.GetData<Uint8>() + header.chunkSize);
+            inputBuffer.Skip(header.chunkSize);
+        }
+        return true;
+    }
+
+    bool OnOutBoundData(ss::DynamicBuffer& inputBuffer, ss::DynamicBuffer& outputBuffer) override
+    {
+        scheduler.WriteChunks(outputBuffer, 0);
+        return true;
+    }
+
+    // The payloads of the messages received on a channel
+    std::vector<ByteArray> GetPayloads(Uint16 channelId)
+    {
+        auto& stream = streams[channelId];
+        std::vector<ByteArray> payloads;
+        Uint32 offset = 0;
+        while (offset < stream.size()) {
+            MessageHeader header {};
+            DataDeserializer deserializer(stream.data() + offset, Uint32(stream.size() - offset));
+            bool deserialized = deserializer.Deserialize(header);
+            SSASSERT(deserialized);
+            offset += deserializer.DataConsumed();
+            SSASSERT(stream.size() - offset >= header.messageLength);
+            ByteArray payload(header.messageLength);
+            memcpy(payload.Data(), stream.data() + offset, header.messageLength);
+            offset += header.messageLength;
+            payloads.push_back(std::move(payload));
+        }
+        return payloads;
+    }
+
+    OutboundScheduler scheduler {};
+    std::map<Uint16, std::vector<Uint8>> streams {};
+};
+
+static ByteArray MakePayload(Uint32 index, Uint32 size)
+{
+    ByteArray payload(size);
+    for (Uint32 i = 0; i < size; ++i) {
+        payload[i] = Uint8(index * 31 + i);
+    }
+    return payload;
+}
+
+static Uint32 CountChunks(ss::DynamicBuffer& buffer, Uint16 channelId)
+{
+    Uint32 count = 0;
+    Uint32 offset = 0;
+    while (offset < buffer.Size()) {
+        ChunkHeader header {};
+        DataDeserializer deserializer(buffer.GetData<Uint8>() + offset, buffer.Size() - offset);
+        bool deserialized = deserializer.Deserialize(header);
+        SSASSERT(deserialized);
+        offset += deserializer.DataConsumed() + header.chunkSize;
+        count += header.channelId == channelId ? 1 : 0;
+    }
+    return count;
+}
+
+static void TestStriping()
+{
+    ChunkProtocol senderProtocol;
+    ChunkProtocol receiverProtocol;
+    StripedConnection sender(&senderProtocol);
+    StripedConnection receiver(&receiverProtocol);
+    for (Uint32 i = 0; i < 3; ++i) {
+        Uint32 senderPath = sender.AddPath();
+        Uint32 receiverPath = receiver.AddPath();
+        SSASSERT(senderPath == i && receiverPath == i);
+    }
+    bool striped = sender.SetChannelStriped(0, true);
+    SSASSERT(!striped);
+    striped = sender.SetChannelStriped(2, true);
+    SSASSERT(striped);
+
+    auto& scheduler = senderProtocol.scheduler;
+    bool added = scheduler.AddChannel(1);
+    SSASSERT(added);
+    added = scheduler.AddChannel(2);
+    SSASSERT(added);
+    bool chunkSizeSet = scheduler.SetChunkSize(2, 1000);
+    SSASSERT(chunkSizeSet);
+
+    // Path 1 is congested, nothing written to it is drained until the end
+    std::vector<ss::DynamicBuffer> wire(3);
+    std::vector<Uint32> stripedChunks(3);
+    for (Uint32 round = 0; round < 5; ++round) {
+        for (Uint32 i = 0; i < 10; ++i) {
+            Uint32 index = round * 10 + i;
+            MessageHeader header;
+            header.messageType = MessageHeader::Type::kRemoteMethodInvoke;
+            bool queued = scheduler.Enqueue(1, header, MakePayload(index, 100));
+            SSASSERT(queued);
+            queued = scheduler.Enqueue(2, header, MakePayload(index, 4000));
+            SSASSERT(queued);
+        }
+        bool polled = sender.Poll();
+        SSASSERT(polled);
+        for (Uint32 path : { 0u, 2u }) {
+            auto& output = sender.GetOutputBuffer(path);
+            stripedChunks[path] += CountChunks(output, 2);
+            wire[path].PushData(output.GetData<Uint8>(), output.Size());
+            output.Skip(output.Size());
+        }
+    }
+    auto& congested = sender.GetOutputBuffer(1);
+    stripedChunks[1] = CountChunks(congested, 2);
+    wire[1].PushData(congested.GetData<Uint8>(), congested.Size());
+    congested.Skip(congested.Size());
+    SSASSERT(stripedChunks[0] + stripedChunks[1] + stripedChunks[2] == 250); // 5 chunks per message with its header
+    SSASSERT(stripedChunks[0] > 0 && stripedChunks[1] > 0 && stripedChunks[2] > 0);
+    SSASSERT(stripedChunks[1] < stripedChunks[0] && stripedChunks[1] < stripedChunks[2]);
+    // A channel that is not striped stays on one path
+    SSASSERT(CountChunks(wire[1], 1) == 50);
+
+    // The paths arrive one after another in odd pieces, the late path holds the earliest chunks
+    bool reordered = false;
+    for (Uint32 path : { 2u, 0u, 1u }) {
+        auto& data = wire[path];
+        while (!data.Empty()) {
+            Uint32 size = std::min(777u, data.Size());
+            bool handled = receiver.OnData(path, data.GetData<Uint8>(), size);
+            SSASSERT(handled);
+            data.Skip(size);
+            reordered = reordered || receiver.GetReorderedBytes() > 0;
+        }
+    }
+    SSASSERT(reordered);
+    SSASSERT(receiver.GetReorderedBytes() == 0);
+
+    auto payloads1 = receiverProtocol.GetPayloads(1);
+    auto payloads2 = receiverProtocol.GetPayloads(2);
+    SSASSERT(payloads1.size() == 50 && payloads2.size() == 50);
+    for (Uint32 i = 0; i < 50; ++i) {
+        SSASSERT(payloads1[i] == MakePayload(i, 100));
+        SSASSERT(payloads2[i] == MakePayload(i, 4000));
+    }
+}
+
+static void TestMalformed()
+{
+    ChunkProtocol protocol;
+    StripedConnection connection(&protocol);
+    connection.AddPath();
+    bool handled = connection.OnData(1, nullptr, 0);
+    SSASSERT(!handled);
+
+    auto makeChunk = [](Uint16 channelId, Uint32 chunkId) {
+        std::vector<Uint8> chunk;
+        DataSerializer::Serialize(ChunkHeader { channelId, chunkId, 1 }, [&chunk](Uint8 b) { chunk.push_back(b); });
+        chunk.push_back(0x5A);
+        return chunk;
+    };
+    auto chunk1 = makeChunk(3, 1);
+    auto chunk0 = makeChunk(3, 0);
+    handled = connection.OnData(0, chunk1.data(), Uint32(chunk1.size()));
+    SSASSERT(handled);
+    SSASSERT(connection.GetReorderedBytes() == chunk1.size());
+    handled = connection.OnData(0, chunk0.data(), Uint32(chunk0.size()));
+    SSASSERT(handled);
+    SSASSERT(connection.GetReorderedBytes() == 0);
+    SSASSERT(protocol.streams[3].size() == 2);
+
+    // A chunk that was already delivered
+    handled = connection.OnData(0, chunk1.data(), Uint32(chunk1.size()));
+    SSASSERT(!handled);
+}
+
+void TestStripedConnection::test()
+{
+    TestStriping();
+    TestMalformed();
+    std::cout << "Test striped connection pass" << std::endl;
+}
+
+}
@@ -0,0 +1,122 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "TestTimingWheel.h"
+#include "photonbase/core/TimingWheel.h"
+#include <SSBase/Assert.h>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+namespace pht {
+
+static void TestDeadlines()
+{
+    const Uint64 start = 1000000;
+    TimingWheel wheel(10, start);
+    std::vector<Uint64> delays { 1, 10, 15, 630, 640, 650, 5000, 40950, 40960, 41000, 3000000, 170000000, 200000000 };
+    std::vector<Uint64> firedAt(delays.size(), 0);
+    Uint64 now = start;
+    std::vector<std::unique_ptr<TimingWheel::Timer>> timers;
+    for (size_t i = 0; i < delays.size(); ++i) {
+        timers.push_back(std::make_unique<TimingWheel::Timer>([&firedAt, &now, i]() {
+            firedAt[i] = now;
+        }));
+        wheel.Arm(*timers.back(), Uint32(delays[i]));
+    }
+    SSASSERT(wheel.GetTimerCount() == delays.size());
+
+    // Every timer fires on the first tick at or after its deadline
+    Uint32 fired = 0;
+    while (fired < delays.size()) {
+        now += 10;
+        if (now - start > 1000000 && now - start < 169000000) {
+            now += 999990; // Nothing in between but the timer of 3000 seconds, skip ahead by many ticks at once
+        }
+        fired += wheel.Advance(now);
+    }
+    SSASSERT(wheel.GetTimerCount() == 0);
+    for (size_t i = 0; i < delays.size(); ++i) {
+        SSASSERT(firedAt[i] >= start + delays[i]);
+        if (delays[i] < 1000000) {
+            SSASSERT(firedAt[i] < start + delays[i] + 10);
+        }
+        SSASSERT(!timers[i]->IsArmed());
+    }
+}
+
+static void TestRearm()
+{
+    TimingWheel wheel(100, 0);
+    int idleFired = 0;
+    int heartbeats = 0;
+    TimingWheel::Timer idle([&idleFired]() {
+        ++idleFired;
+    });
+    // A heartbeat arms itself again
+    TimingWheel::Timer* heartbeatPtr = nullptr;
+    TimingWheel::Timer heartbeat([&]() {
+        ++heartbeats;
+        wheel.Arm(*heartbeatPtr, 1000);
+    });
+    heartbeatPtr = &heartbeat;
+    wheel.Arm(idle, 3000);
+    wheel.Arm(heartbeat, 1000);
+
+    // Activity keeps pushing the idle deadline back
+    for (Uint64 now = 100; now <= 10000; now += 100) {
+        wheel.Advance(now);
+        if (now % 2000 == 0) {
+            wheel.Arm(idle, 3000);
+        }
+    }
+    SSASSERT(idleFired == 0 && heartbeats == 10);
+    wheel.Advance(12900);
+    SSASSERT(idleFired == 0);
+    wheel.Advance(13000);
+    SSASSERT(idleFired == 1 && !idle.IsArmed() && heartbeat.IsArmed());
+
+    // A callback cancels a timer due on the same tick, whichever fires first
+    int firedCount = 0;
+    TimingWheel::Timer* secondPtr = nullptr;
+    TimingWheel::Timer first([&]() {
+        ++firedCount;
+        wheel.Cancel(*secondPtr);
+    });
+    TimingWheel::Timer second([&]() {
+        ++firedCount;
+        wheel.Cancel(first);
+    });
+    secondPtr = &second;
+    wheel.Arm(first, 500);
+    wheel.Arm(second, 500);
+    wheel.Cancel(heartbeat);
+    SSASSERT(wheel.GetTimerCount() == 2);
+    Uint32 fired = wheel.Advance(13500);
+    SSASSERT(fired == 1);
+    SSASSERT(firedCount == 1 && wheel.GetTimerCount() == 0);
+
+    // Destroying an armed timer or the wheel cancels
+    {
+        TimingWheel::Timer scoped([]() {
+            SSASSERT(false);
+        });
+        wheel.Arm(scoped, 100);
+    }
+    fired = wheel.Advance(20000);
+    SSASSERT(wheel.GetTimerCount() == 0 && fired == 0);
+    auto shortLived = std::make_unique<TimingWheel>(10, 0);
+    shortLived->Arm(idle, 100);
+    shortLived = nullptr;
+    SSASSERT(!idle.IsArmed());
+}
+
+void TestTimingWheel::test()
+{
+    TestDeadlines();
+    TestRearm();
+    std::cout << "Test timing wheel pass" << std::endl;
+}
+
+}
@@ -0,0 +1,98 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "TestVideoCompositor.h"
+#include "photonbase/media/VideoCompositor.h"
+#include <SSBase/Assert.h>
+#include <cstring>
+#include <iostream>
+
+namespace pht {
+
+static I420Frame Solid(Uint16 width, Uint16 height, Uint8 luma)
+{
+    I420Frame frame(width, height);
+    memset(frame.MutableY(), luma, Uint32(width) * height);
+    memset(frame.MutableU(), 128, Uint32(frame.GetChromaWidth()) * frame.GetChromaHeight() * 2);
+    return frame;
+}
+
+// The scaling filters may round a solid color off by one
+static bool IsLuma(const I420Frame& frame, Uint16 x, Uint16 y, Uint8 luma)
+{
+    Uint8 value = frame.Y()[Uint32(y) * frame.GetWidth() + x];
+    return value + 1 >= luma && value <= luma + 1;
+}
+
+static void TestFrame()
+{
+    I420Frame frame(5, 3);
+    SSASSERT(frame.GetPayload().Size() == 4 + 15 + 3 * 2 * 2);
+    SSASSERT(frame.GetChromaWidth() == 3 && frame.GetChromaHeight() == 2);
+
+    I420Frame parsed;
+    bool valid = I420Frame::Parse(frame.GetPayload(), parsed);
+    SSASSERT(valid);
+    SSASSERT(parsed.GetWidth() == 5 && parsed.GetHeight() == 3 && parsed.Y() == frame.Y());
+    valid = I420Frame::Parse(frame.GetPayload().Slice(0, frame.GetPayload().Size() - 1), parsed);
+    SSASSERT(!valid);
+    valid = I420Frame::Parse(BufferSlice(3), parsed);
+    SSASSERT(!valid);
+    BufferSlice empty(4);
+    memset(empty.MutableData(), 0, 4);
+    valid = I420Frame::Parse(empty, parsed);
+    SSASSERT(!valid);
+}
+
+static void TestLayout()
+{
+    VideoCompositor compositor(641, 360, 1);
+    SSASSERT(compositor.GetWidth() == 640 && compositor.GetHeight() == 360);
+
+    // Fit into the whole frame, keeping the aspect ratio
+    auto rect = compositor.GetTileRect(1, 0, 320, 240);
+    SSASSERT(rect.x == 80 && rect.y == 0 && rect.width == 480 && rect.height == 360);
+    // A 2x2 grid
+    rect = compositor.GetTileRect(4, 3, 16, 9);
+    SSASSERT(rect.x == 320 && rect.y == 180 && rect.width == 320 && rect.height == 180);
+    rect = compositor.GetTileRect(3, 2, 16, 9);
+    SSASSERT(rect.x == 0 && rect.y == 180 && rect.width == 320 && rect.height == 180);
+    // Two in a row, letterboxed
+    rect = compositor.GetTileRect(2, 1, 16, 9);
+    SSASSERT(rect.x == 320 && rect.y == 90 && rect.width == 320 && rect.height == 180);
+    rect = compositor.GetTileRect(2, 2, 16, 9);
+    SSASSERT(rect.width == 0 && rect.height == 0);
+}
+
+static void TestCompose()
+{
+    std::vector<I420Frame> frames { Solid(32, 18, 50), Solid(160, 90, 100), I420Frame(), Solid(7, 5, 200) };
+    VideoCompositor single(64, 36, 1);
+    VideoCompositor parallel(64, 36, 4);
+    auto expected = single.Compose(frames);
+    SSASSERT(IsLuma(expected, 16, 9, 50));
+    SSASSERT(IsLuma(expected, 48, 9, 100));
+    SSASSERT(IsLuma(expected, 16, 27, 16)); // The empty frame's tile is black
+    SSASSERT(IsLuma(expected, 48, 27, 200));
+    SSASSERT(expected.U()[0] == 128 && expected.V()[0] == 128);
+
+    // The tiles are scaled by any thread, the result is the same
+    for (int i = 0; i < 50; ++i) {
+        auto composite = parallel.Compose(frames);
+        SSASSERT(composite.GetPayload().Size() == expected.GetPayload().Size());
+        SSASSERT(memcmp(composite.GetPayload().Data(), expected.GetPayload().Data(), expected.GetPayload().Size()) == 0);
+    }
+    auto black = parallel.Compose({});
+    SSASSERT(IsLuma(black, 0, 0, 16) && IsLuma(black, 63, 35, 16));
+}
+
+void TestVideoCompositor::test()
+{
+    TestFrame();
+    TestLayout();
+    TestCompose();
+    std::cout << "Test video compositor pass" << std::endl;
+}
+
+}
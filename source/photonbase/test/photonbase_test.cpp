@@ -1,5 +1,22 @@
+#include "TestBandwidthEstimator.h"
+#include "TestBenchApplication.h"
+#include "TestBufferChain.h"
+#include "TestDatagramSession.h"
+#include "TestErasureCode.h"
+#include "TestEventLoop.h"
+#include "TestFlowControl.h"
+#include "TestGopCache.h"
+#include "TestJitterBuffer.h"
+#include "TestMcuApplication.h"
+#include "TestOutboundScheduler.h"
+#include "TestPhotonProtocol.h"
+#include "TestProtocolTrace.h"
 #include "TestRemoteMethodBinding.h"
 #include "TestSerializer.h"
+#include "TestSfuApplication.h"
+#include "TestStripedConnection.h"
+#include "TestTimingWheel.h"
+#include "TestVideoCompositor.h"
 #include "TestVariant.h"
 #include <iostream>
 
@@ -8,7 +25,24 @@ int main()
     using namespace pht;
     TestVariant::test();
     TestSerializer::test();
+    TestBufferChain::test();
+    TestTimingWheel::test();
     TestRemoteMethodBinding::test();
+    TestFlowControl::test();
+    TestOutboundScheduler::test();
+    TestJitterBuffer::test();
+    TestGopCache::test();
+    TestVideoCompositor::test();
+    TestPhotonProtocol::test();
+    TestSfuApplication::test();
+    TestMcuApplication::test();
+    TestBenchApplication::test();
+    TestProtocolTrace::test();
+    TestErasureCode::test();
+    TestBandwidthEstimator::test();
+    TestDatagramSession::test();
+    TestStripedConnection::test();
+    TestEventLoop::test();
 
     std::cout << "All tests passed" << std::endl;
     return 0;
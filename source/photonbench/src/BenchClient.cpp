@@ -0,0 +1,236 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "BenchClient.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <photonbase/protocol/RemoteMethodInfo.h>
+
+namespace phtbench {
+
+static uint64_t GetMicroseconds()
+{
+    return uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void BenchResults::ResetPeriod()
+{
+    rmisSent = 0;
+    rmisAnswered = 0;
+    rmiRoundTrips.clear();
+    mediaMessagesSent = 0;
+    mediaBytesSent = 0;
+    mediaMessagesReceived = 0;
+    mediaBytesReceived = 0;
+}
+
+void BenchResults::Merge(const BenchResults& other)
+{
+    established += other.established;
+    failed += other.failed;
+    closed += other.closed;
+    setupTimes.insert(setupTimes.end(), other.setupTimes.begin(), other.setupTimes.end());
+    rmisSent += other.rmisSent;
+    rmisAnswered += other.rmisAnswered;
+    rmiRoundTrips.insert(rmiRoundTrips.end(), other.rmiRoundTrips.begin(), other.rmiRoundTrips.end());
+    mediaMessagesSent += other.mediaMessagesSent;
+    mediaBytesSent += other.mediaBytesSent;
+    mediaMessagesReceived += other.mediaMessagesReceived;
+    mediaBytesReceived += other.mediaBytesReceived;
+}
+
+const uint16_t BenchClient::kRmiChannel;
+const uint16_t BenchClient::kMediaChannel;
+
+BenchClient::BenchClient(BenchContext* context)
+    : context_(context)
+{
+    protocol_.SetApplication(this);
+}
+
+bool BenchClient::Open(pht::EventLoop* loop, uint64_t now)
+{
+    openTime_ = now;
+    auto* options = context_->options;
+    socket_ = loop->CreateTcpSocket();
+    if (socket_ == nullptr) {
+        closed_ = true;
+        ++context_->results.failed;
+        return false;
+    }
+    if (!socket_->Connect(options->ip, options->port, [this](int status) {
+            OnConnected(status);
+        })) {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void BenchClient::Tick(uint64_t now)
+{
+    if (!established_ || closed_) {
+        return;
+    }
+    auto* options = context_->options;
+    double elapsed = double(now - lastTick_) / 1e6;
+    lastTick_ = now;
+    // A stalled loop catches up with at most a second of traffic
+    rmiCredit_ = std::min(rmiCredit_ + options->rmiRate * elapsed, options->rmiRate + 1);
+    mediaCredit_ = std::min(mediaCredit_ + options->mediaRate * elapsed, options->mediaRate + 1);
+    auto& results = context_->results;
+    for (; rmiCredit_ >= 1; rmiCredit_ -= 1) {
+        // The send time comes back in the echo
+        pht::RemoteMethodInfo echo(pht::Variant::Type::Void, "bench.Echo",
+            pht::Array({ std::make_shared<pht::Variant>(pht::Uint16(kRmiChannel)), std::make_shared<pht::Variant>(pht::Uint64(GetMicroseconds())) }));
+        if (!protocol_.InvokeRemoteMethod(kRmiChannel, echo)) {
+            Close();
+            return;
+        }
+        if (context_->measuring) {
+            ++results.rmisSent;
+        }
+    }
+    for (; mediaCredit_ >= 1; mediaCredit_ -= 1) {
+        pht::ByteArray payload(options->mediaSize);
+        memset(payload.Data(), 0, payload.Size());
+        if (!protocol_.SendMessage(kMediaChannel, pht::MessageHeader::Type::kVideo, protocol_.GetTimestamp(), std::move(payload))) {
+            Close();
+            return;
+        }
+        if (context_->measuring) {
+            ++results.mediaMessagesSent;
+            results.mediaBytesSent += options->mediaSize;
+        }
+    }
+    pht::BufferChain unused;
+    if (!protocol_.OnOutBoundChain(unused, outputChain_)) {
+        Close();
+        return;
+    }
+    SendOutput();
+}
+
+bool BenchClient::OnRemoteMethodInvoke(pht::IProtocol* client, const pht::RemoteMethodInfo& method)
+{
+    pht::RemoteMethodInfo rmi = method;
+    if (!rmi.MatchPrototype(pht::Variant::Type::Void, "bench.Echo", { pht::Variant::Type::Uint16, pht::Variant::Type::Uint64 })) {
+        return false;
+    }
+    auto sent = rmi.GetParameters()[1]->Get<pht::Uint64>();
+    if (context_->measuring && sent >= context_->measureStart) {
+        ++context_->results.rmisAnswered;
+        context_->results.rmiRoundTrips.push_back(uint32_t(GetMicroseconds() - sent));
+    }
+    return true;
+}
+
+bool BenchClient::OnMediaMessage(pht::IProtocol* client, uint16_t channelId, const pht::MessageHeader& header, const pht::ByteArray& payload)
+{
+    if (context_->measuring) {
+        ++context_->results.mediaMessagesReceived;
+        context_->results.mediaBytesReceived += payload.Size();
+    }
+    return true;
+}
+
+void BenchClient::OnConnected(int status)
+{
+    if (status != 0 || closed_) {
+        Close();
+        return;
+    }
+    // Small RMIs must not wait for each other
+    socket_->SetNoDelay(true);
+    auto alloc = [this](size_t /* suggestedSize */, char** base, size_t* len) {
+        *base = context_->receiveBuffer.data();
+        *len = context_->receiveBuffer.size();
+    };
+    if (!socket_->StartReceive(alloc, [this](int64_t nread, const char* data) {
+            OnData(nread, data);
+        })) {
+        Close();
+        return;
+    }
+    // The hello, and the channels in the same flight
+    pht::BufferChain unused;
+    if (!protocol_.Connect("bench", { kRmiChannel, kMediaChannel }) || !protocol_.OnOutBoundChain(unused, outputChain_)) {
+        Close();
+        return;
+    }
+    SendOutput();
+}
+
+void BenchClient::OnData(int64_t nread, const char* data)
+{
+    if (nread < 0) {
+        Close();
+        return;
+    }
+    if (nread == 0) {
+        return;
+    }
+    if (!protocol_.OnInBoundBytes(reinterpret_cast<const uint8_t*>(data), uint32_t(nread), outputChain_)) {
+        Close();
+        return;
+    }
+    if (!established_ && protocol_.IsEstablished()) {
+        OnEstablished();
+    }
+    SendOutput();
+}
+
+void BenchClient::OnEstablished()
+{
+    established_ = true;
+    lastTick_ = GetMicroseconds();
+    auto& results = context_->results;
+    ++results.established;
+    results.setupTimes.push_back(uint32_t(lastTick_ - openTime_));
+    if (context_->options->mediaRate > 0) {
+        pht::RemoteMethodInfo reflect(pht::Variant::Type::Void, "bench.Reflect", pht::Array({ std::make_shared<pht::Variant>(pht::Uint16(kMediaChannel)) }));
+        if (!protocol_.InvokeRemoteMethod(kRmiChannel, reflect)) {
+            Close();
+        }
+    }
+}
+
+void BenchClient::SendOutput()
+{
+    if (outputChain_.Empty() || closed_) {
+        return;
+    }
+    auto sending = std::make_shared<pht::BufferChain>();
+    sending->Append(std::move(outputChain_));
+    sendBuffers_.clear();
+    for (auto& slice : sending->GetSlices()) {
+        sendBuffers_.push_back({ slice.Data(), slice.Size() });
+    }
+    if (!socket_->Send(sendBuffers_.data(), uint32_t(sendBuffers_.size()), [this, sending](int status) {
+            if (status != 0) {
+                Close();
+            }
+        })) {
+        Close();
+    }
+}
+
+void BenchClient::Close()
+{
+    if (closed_) {
+        return;
+    }
+    closed_ = true;
+    if (established_) {
+        ++context_->results.closed;
+    } else {
+        ++context_->results.failed;
+    }
+    if (socket_ != nullptr) {
+        socket_->Close(nullptr);
+    }
+}
+
+}
@@ -0,0 +1,126 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <photonbase/application/IApplication.h>
+#include <photonbase/core/BufferChain.h>
+#include <photonbase/protocol/PhotonProtocol.h>
+#include <photonbase/transport/EventLoop.h>
+#include <photonbase/transport/TcpSocket.h>
+#include <string>
+#include <vector>
+
+namespace phtbench {
+
+struct BenchOptions {
+    std::string ip { "127.0.0.1" };
+    uint16_t port { 6666 };
+    uint32_t connections { 1000 };
+    uint32_t connectRate { 500 }; // New connections per second, of all the threads
+    uint32_t threadCount { 1 };
+    uint32_t duration { 10 }; // Seconds measured once the connections are set up
+    double rmiRate { 1 }; // Per connection per second
+    double mediaRate { 0 }; // Messages per connection per second
+    uint32_t mediaSize { 1000 }; // Bytes of a media message
+    int serverPid { 0 }; // The photonserver process to sample the CPU time of, 0 if unknown
+};
+
+// What the connections of a loop measured, durations in microseconds
+struct BenchResults {
+    uint32_t established { 0 };
+    uint32_t failed { 0 }; // Never established
+    uint32_t closed { 0 }; // Closed after being established
+    std::vector<uint32_t> setupTimes {}; // From connect to the reply of the handshake
+    // The counters below are of the measured period only
+    uint64_t rmisSent { 0 };
+    uint64_t rmisAnswered { 0 };
+    std::vector<uint32_t> rmiRoundTrips {};
+    uint64_t mediaMessagesSent { 0 };
+    uint64_t mediaBytesSent { 0 };
+    uint64_t mediaMessagesReceived { 0 };
+    uint64_t mediaBytesReceived { 0 };
+
+    // Clear the counters of the measured period
+    void ResetPeriod();
+
+    void Merge(const BenchResults& other);
+};
+
+// Shared by the clients of a loop
+struct BenchContext {
+    const BenchOptions* options { nullptr };
+    BenchResults results {};
+    bool measuring { false };
+    uint64_t measureStart { 0 }; // The RMIs sent before are not counted
+    std::vector<char> receiveBuffer {}; // Every read of the loop goes here, handled before the next read
+};
+
+// A client connection of the "bench" application, see pht::BenchApplication. Once established it invokes
+// bench.Echo on channel 1 and sends video messages on channel 2, which the server reflects, at the configured rates.
+class BenchClient : public pht::IApplication {
+public:
+    static const uint16_t kRmiChannel = 1;
+    static const uint16_t kMediaChannel = 2;
+
+    explicit BenchClient(BenchContext* context);
+
+    BenchClient(const BenchClient&) = delete;
+    BenchClient& operator=(const BenchClient&) = delete;
+
+    /**
+     * Connect, the handshake starts once connected
+     * @param now The current time in microseconds, the setup time is counted from it
+     * @return Return false if the connect can't be started
+     */
+    bool Open(pht::EventLoop* loop, uint64_t now);
+
+    // Send what is due by now, in microseconds
+    void Tick(uint64_t now);
+
+    bool IsClosed() const
+    {
+        return closed_;
+    }
+
+    bool OnRemoteMethodInvoke(pht::IProtocol* client, const pht::RemoteMethodInfo& method) override;
+
+    bool OnMediaMessage(pht::IProtocol* client, uint16_t channelId, const pht::MessageHeader& header, const pht::ByteArray& payload) override;
+
+    void OnClientAttached(pht::IProtocol* client) override
+    {
+    }
+
+    void OnClientDetached(pht::IProtocol* client) override
+    {
+    }
+
+private:
+    void OnConnected(int status);
+
+    void OnData(int64_t nread, const char* data);
+
+    void OnEstablished();
+
+    // Write the queued messages without copying, like the server does
+    void SendOutput();
+
+    void Close();
+
+    BenchContext* context_;
+    pht::PhotonProtocol protocol_ { pht::PhotonProtocol::Role::kClient };
+    pht::TcpSocket* socket_ { nullptr }; // Released by the loop once closed
+    pht::BufferChain outputChain_ {};
+    std::vector<pht::ConstBuffer> sendBuffers_ {};
+    uint64_t openTime_ { 0 };
+    uint64_t lastTick_ { 0 };
+    bool established_ { false };
+    bool closed_ { false };
+    double rmiCredit_ { 0 }; // The RMIs due, sent when it reaches 1
+    double mediaCredit_ { 0 };
+};
+
+}
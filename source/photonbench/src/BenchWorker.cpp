@@ -0,0 +1,101 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#include "BenchWorker.h"
+#include <chrono>
+#include <iostream>
+
+namespace phtbench {
+
+static const size_t kReceiveBufferSize = 64 * 1024;
+static const uint64_t kTickInterval = 5; // In milliseconds
+
+static uint64_t GetMicroseconds()
+{
+    return uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+BenchWorker::BenchWorker(uint32_t index, uint32_t connectionCount, double connectRate, const BenchOptions& options)
+    : index_(index)
+    , connectionCount_(connectionCount)
+    , connectRate_(connectRate)
+{
+    context_.options = &options;
+    context_.receiveBuffer.resize(kReceiveBufferSize);
+}
+
+bool BenchWorker::Start()
+{
+    std::promise<bool> ready;
+    auto result = ready.get_future();
+    thread_ = std::thread([this, &ready]() {
+        Run(ready);
+    });
+    if (!result.get()) {
+        thread_.join();
+        return false;
+    }
+    return true;
+}
+
+void BenchWorker::StartMeasuring()
+{
+    loop_->Post([this]() {
+        context_.results.ResetPeriod();
+        context_.measuring = true;
+        context_.measureStart = GetMicroseconds();
+    });
+}
+
+BenchResults BenchWorker::GetResults()
+{
+    std::promise<BenchResults> results;
+    auto future = results.get_future();
+    loop_->Post([this, &results]() {
+        results.set_value(context_.results);
+    });
+    return future.get();
+}
+
+void BenchWorker::Run(std::promise<bool>& ready)
+{
+    // The loop and its sockets belong to this thread
+    pht::EventLoop loop;
+    if (!loop.Init()) {
+        std::cerr << "Worker " << index_ << " create the loop failed" << std::endl;
+        ready.set_value(false);
+        return;
+    }
+    loop_ = &loop;
+    auto* tick = loop.CreateTimer();
+    if (tick == nullptr || !tick->Start(kTickInterval, kTickInterval, [this]() {
+            OnTick();
+        })) {
+        std::cerr << "Worker " << index_ << " start the timer failed" << std::endl;
+        loop_ = nullptr;
+        ready.set_value(false);
+        return;
+    }
+    startTime_ = GetMicroseconds();
+    ready.set_value(true);
+
+    loop.Run();
+}
+
+void BenchWorker::OnTick()
+{
+    uint64_t now = GetMicroseconds();
+    // Ramp up at the connect rate, so the setup time is not dominated by the accept backlog
+    auto due = uint32_t(connectRate_ * double(now - startTime_) / 1e6) + 1;
+    while (clients_.size() < std::min(due, connectionCount_)) {
+        clients_.push_back(std::make_unique<BenchClient>(&context_));
+        clients_.back()->Open(loop_, GetMicroseconds());
+    }
+    for (auto& client : clients_) {
+        client->Tick(now);
+    }
+    settled_ = context_.results.established + context_.results.failed;
+}
+
+}
@@ -0,0 +1,67 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+#pragma once
+
+#include "BenchClient.h"
+#include <atomic>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <photonbase/transport/EventLoop.h>
+#include <thread>
+#include <vector>
+
+namespace phtbench {
+
+// Runs a loop on its own thread, opening its share of the connections at its share of the connect rate and driving
+// their traffic with one periodic tick
+class BenchWorker {
+public:
+    /**
+     * @param connectionCount The connections of this worker
+     * @param connectRate New connections per second of this worker
+     */
+    BenchWorker(uint32_t index, uint32_t connectionCount, double connectRate, const BenchOptions& options);
+
+    BenchWorker(const BenchWorker&) = delete;
+    BenchWorker& operator=(const BenchWorker&) = delete;
+
+    /**
+     * Start the thread, and wait until its loop runs
+     * @return Return false if the loop can't be set up
+     */
+    bool Start();
+
+    // The connections that are established or failed, thread safe
+    uint32_t GetSettledCount() const
+    {
+        return settled_;
+    }
+
+    // Count the traffic from now on, thread safe
+    void StartMeasuring();
+
+    // A copy of the results, thread safe. Blocks until the loop is ready.
+    BenchResults GetResults();
+
+private:
+    // The body of the worker thread, `ready` is set when the loop is set up or failed
+    void Run(std::promise<bool>& ready);
+
+    // Open the connections that are due and send what the connections have due
+    void OnTick();
+
+    uint32_t index_;
+    uint32_t connectionCount_;
+    double connectRate_;
+    BenchContext context_ {};
+    std::vector<std::unique_ptr<BenchClient>> clients_ {};
+    uint64_t startTime_ { 0 }; // In microseconds
+    std::atomic<uint32_t> settled_ { 0 };
+    std::thread thread_ {};
+    pht::EventLoop* loop_ { nullptr }; // Set before Start returns
+};
+
+}
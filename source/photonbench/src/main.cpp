@@ -0,0 +1,208 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+// Load photonserver with many connections of the "bench" application, see pht::BenchApplication.
+// The connections are opened at a steady rate, then the RMIs and the media are measured for a while:
+// the setup time and the RMI round trip percentiles, the throughput, and the server CPU per connection.
+
+#include "BenchWorker.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+static const auto kSetupTimeout = std::chrono::seconds(60); // After the last connection is due
+static const auto kProgressInterval = std::chrono::seconds(1);
+
+static void PrintUsage(const char* program)
+{
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "  --host <ip>           Address of photonserver (default 127.0.0.1)\n"
+              << "  --port <port>         Port of photonserver (default 6666)\n"
+              << "  --connections <n>     Connections to open (default 1000)\n"
+              << "  --connect-rate <n>    New connections per second (default 500)\n"
+              << "  --threads <n>         Loops opening and driving the connections (default 1)\n"
+              << "  --duration <seconds>  Length of the measured period (default 10)\n"
+              << "  --rmi-rate <n>        RMIs per connection per second (default 1)\n"
+              << "  --media-rate <n>      Media messages per connection per second, reflected by the server (default 0)\n"
+              << "  --media-size <bytes>  Size of a media message (default 1000)\n"
+              << "  --server-pid <pid>    photonserver process to report the CPU time of (Linux only)" << std::endl;
+}
+
+static bool ParseOptions(int argc, char** argv, phtbench::BenchOptions& options)
+{
+    for (int i = 1; i < argc; ++i) {
+        bool hasValue = i + 1 < argc;
+        if (std::strcmp(argv[i], "--host") == 0 && hasValue) {
+            options.ip = argv[++i];
+        } else if (std::strcmp(argv[i], "--port") == 0 && hasValue) {
+            options.port = uint16_t(std::stoul(argv[++i]));
+        } else if (std::strcmp(argv[i], "--connections") == 0 && hasValue) {
+            options.connections = uint32_t(std::stoul(argv[++i]));
+        } else if (std::strcmp(argv[i], "--connect-rate") == 0 && hasValue) {
+            options.connectRate = uint32_t(std::stoul(argv[++i]));
+        } else if (std::strcmp(argv[i], "--threads") == 0 && hasValue) {
+            options.threadCount = uint32_t(std::stoul(argv[++i]));
+        } else if (std::strcmp(argv[i], "--duration") == 0 && hasValue) {
+            options.duration = uint32_t(std::stoul(argv[++i]));
+        } else if (std::strcmp(argv[i], "--rmi-rate") == 0 && hasValue) {
+            options.rmiRate = std::stod(argv[++i]);
+        } else if (std::strcmp(argv[i], "--media-rate") == 0 && hasValue) {
+            options.mediaRate = std::stod(argv[++i]);
+        } else if (std::strcmp(argv[i], "--media-size") == 0 && hasValue) {
+            options.mediaSize = uint32_t(std::stoul(argv[++i]));
+        } else if (std::strcmp(argv[i], "--server-pid") == 0 && hasValue) {
+            options.serverPid = std::stoi(argv[++i]);
+        } else {
+            return false;
+        }
+    }
+    return options.connections > 0 && options.connectRate > 0 && options.threadCount > 0 && options.duration > 0
+        && options.rmiRate >= 0 && options.mediaRate >= 0;
+}
+
+// The CPU seconds the process has used, negative if unknown
+static double GetProcessCpuSeconds(int pid)
+{
+#ifdef _WIN32
+    return -1;
+#else
+    if (pid <= 0) {
+        return -1;
+    }
+    std::string path = "/proc/" + std::to_string(pid) + "/stat";
+    FILE* file = std::fopen(path.c_str(), "r");
+    if (file == nullptr) {
+        return -1;
+    }
+    char line[1024] {};
+    bool read = std::fgets(line, sizeof(line), file) != nullptr;
+    std::fclose(file);
+    // The command name may hold spaces, the fields are counted after its closing parenthesis
+    const char* fields = read ? std::strrchr(line, ')') : nullptr;
+    unsigned long long utime = 0;
+    unsigned long long stime = 0;
+    // Fields 3 to 13 are skipped, 14 and 15 are the user and system time in clock ticks
+    if (fields == nullptr
+        || std::sscanf(fields + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) != 2) {
+        return -1;
+    }
+    return double(utime + stime) / double(sysconf(_SC_CLK_TCK));
+#endif
+}
+
+// The value below which the share of the sorted values lies
+static uint32_t GetPercentile(const std::vector<uint32_t>& sorted, double share)
+{
+    if (sorted.empty()) {
+        return 0;
+    }
+    auto index = size_t(share * double(sorted.size() - 1));
+    return sorted[index];
+}
+
+static void PrintPercentiles(const char* name, std::vector<uint32_t>& values)
+{
+    std::sort(values.begin(), values.end());
+    std::printf("%s (ms): p50 %.3f, p99 %.3f, p99.9 %.3f, max %.3f over %zu samples\n", name,
+        GetPercentile(values, 0.5) / 1000.0, GetPercentile(values, 0.99) / 1000.0, GetPercentile(values, 0.999) / 1000.0,
+        (values.empty() ? 0 : values.back()) / 1000.0, values.size());
+}
+
+static phtbench::BenchResults MergeResults(const std::vector<std::unique_ptr<phtbench::BenchWorker>>& workers)
+{
+    phtbench::BenchResults results;
+    for (auto& worker : workers) {
+        results.Merge(worker->GetResults());
+    }
+    return results;
+}
+
+int main(int argc, char** argv)
+{
+    phtbench::BenchOptions options;
+    try {
+        if (!ParseOptions(argc, argv, options)) {
+            PrintUsage(argv[0]);
+            return -1;
+        }
+    } catch (const std::exception&) {
+        PrintUsage(argv[0]);
+        return -1;
+    }
+
+    // Every loop takes an even share of the connections and of the rate
+    std::vector<std::unique_ptr<phtbench::BenchWorker>> workers;
+    for (uint32_t i = 0; i < options.threadCount; ++i) {
+        uint32_t count = options.connections / options.threadCount + (i < options.connections % options.threadCount ? 1 : 0);
+        double rate = double(options.connectRate) / options.threadCount;
+        workers.push_back(std::make_unique<phtbench::BenchWorker>(i, count, rate, options));
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (auto& worker : workers) {
+        if (!worker->Start()) {
+            std::exit(-1); // The started loops never return
+        }
+    }
+
+    // Ramp up
+    auto deadline = start + std::chrono::milliseconds(uint64_t(options.connections) * 1000 / options.connectRate) + kSetupTimeout;
+    uint32_t settled = 0;
+    while (settled < options.connections && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(kProgressInterval);
+        settled = 0;
+        for (auto& worker : workers) {
+            settled += worker->GetSettledCount();
+        }
+        std::cout << "Set up " << settled << "/" << options.connections << std::endl;
+    }
+    auto setupResults = MergeResults(workers);
+    std::printf("Connections: %u established, %u failed, %u closed\n", setupResults.established, setupResults.failed,
+        setupResults.closed);
+    PrintPercentiles("Setup time", setupResults.setupTimes);
+    if (setupResults.established == 0) {
+        std::exit(-1); // The started loops never return
+    }
+
+    // Measure
+    for (auto& worker : workers) {
+        worker->StartMeasuring();
+    }
+    double cpuStart = GetProcessCpuSeconds(options.serverPid);
+    auto measureStart = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::seconds(options.duration));
+    double cpuEnd = GetProcessCpuSeconds(options.serverPid);
+    auto results = MergeResults(workers);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - measureStart).count();
+
+    uint32_t open = results.established - results.closed;
+    std::printf("Measured %.1f s over %u open connections\n", seconds, open);
+    std::printf("RMIs: %llu sent, %llu answered, %.0f answered/s\n", (unsigned long long)results.rmisSent,
+        (unsigned long long)results.rmisAnswered, double(results.rmisAnswered) / seconds);
+    PrintPercentiles("RMI round trip", results.rmiRoundTrips);
+    if (options.mediaRate > 0) {
+        std::printf("Media sent: %.0f msg/s, %.2f Mbit/s\n", double(results.mediaMessagesSent) / seconds,
+            double(results.mediaBytesSent) * 8 / seconds / 1e6);
+        std::printf("Media received: %.0f msg/s, %.2f Mbit/s\n", double(results.mediaMessagesReceived) / seconds,
+            double(results.mediaBytesReceived) * 8 / seconds / 1e6);
+    }
+    if (cpuStart >= 0 && cpuEnd >= 0) {
+        double cpu = (cpuEnd - cpuStart) / seconds;
+        std::printf("Server CPU: %.1f%% of a core, %.2f us per connection per second\n", cpu * 100,
+            open > 0 ? cpu * 1e6 / open : 0.0);
+    } else if (options.serverPid > 0) {
+        std::cerr << "Read the CPU time of process " << options.serverPid << " failed" << std::endl;
+    }
+
+    std::exit(0); // The started loops never return
+}
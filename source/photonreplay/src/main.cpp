@@ -0,0 +1,163 @@
+//
+// Copyright (c) 2020 Carl Chen. All rights reserved.
+//
+
+// Replay a trace recorded by photonserver --trace-dir into PhotonProtocol::OnInBoundData.
+// The replay is deterministic: the same trace and options always feed the same reads,
+// so a failing trace is a regression test and a long trace is a parsing benchmark.
+
+#include <SSBase/Buffer.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <photonbase/protocol/PhotonProtocol.h>
+#include <photonbase/protocol/ProtocolTrace.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct Options {
+    std::string tracePath {};
+    pht::PhotonProtocol::Role role { pht::PhotonProtocol::Role::kServer };
+    uint32_t fragmentSize { 0 }; // 0: keep the recorded read boundaries
+    bool realTime { false };
+    uint32_t repeat { 1 };
+};
+
+static void PrintUsage(const char* program)
+{
+    std::cerr << "Usage: " << program << " <trace file> [options]\n"
+              << "  --role server|client  Role of the protocol fed with the trace (default server)\n"
+              << "  --fragment <bytes>    Re-split the stream into reads of this size\n"
+              << "  --realtime            Honour the recorded arrival times instead of running as fast as possible\n"
+              << "  --repeat <n>          Replay the trace n times (default 1)" << std::endl;
+}
+
+static bool ParseOptions(int argc, char** argv, Options& options)
+{
+    for (int i = 1; i < argc; ++i) {
+        bool hasValue = i + 1 < argc;
+        if (std::strcmp(argv[i], "--role") == 0 && hasValue) {
+            std::string role = argv[++i];
+            if (role == "server") {
+                options.role = pht::PhotonProtocol::Role::kServer;
+            } else if (role == "client") {
+                options.role = pht::PhotonProtocol::Role::kClient;
+            } else {
+                return false;
+            }
+        } else if (std::strcmp(argv[i], "--fragment") == 0 && hasValue) {
+            options.fragmentSize = uint32_t(std::stoul(argv[++i]));
+        } else if (std::strcmp(argv[i], "--realtime") == 0) {
+            options.realTime = true;
+        } else if (std::strcmp(argv[i], "--repeat") == 0 && hasValue) {
+            options.repeat = uint32_t(std::stoul(argv[++i]));
+        } else if (argv[i][0] != '-' && options.tracePath.empty()) {
+            options.tracePath = argv[i];
+        } else {
+            return false;
+        }
+    }
+    return !options.tracePath.empty() && options.repeat > 0;
+}
+
+static bool LoadTrace(const std::string& path, std::vector<pht::ProtocolTraceReader::Record>& records)
+{
+    pht::ProtocolTraceReader reader;
+    if (!reader.Open(path)) {
+        std::cerr << "Open trace " << path << " failed" << std::endl;
+        return false;
+    }
+    pht::ProtocolTraceReader::Record record;
+    while (reader.Next(record)) {
+        records.push_back(std::move(record));
+    }
+    if (reader.IsCorrupted()) {
+        // Replay what we have, a server killed while tracing leaves a truncated record
+        std::cerr << "Trace is truncated after " << records.size() << " records" << std::endl;
+    }
+    return true;
+}
+
+// Feed one read, return false if the protocol rejects it
+static bool Feed(pht::PhotonProtocol& protocol, const pht::Uint8* data, uint32_t length,
+    ss::DynamicBuffer& inputBuffer, ss::DynamicBuffer& outputBuffer, uint64_t& reads)
+{
+    ++reads;
+    inputBuffer.PushData(data, length);
+    bool ok = protocol.OnInBoundData(inputBuffer, outputBuffer);
+    outputBuffer.Reset(); // There is no peer to send to
+    return ok;
+}
+
+// Return the index of the record the protocol failed at, or records.size() if it succeeded
+static size_t Replay(const Options& options, const std::vector<pht::ProtocolTraceReader::Record>& records,
+    uint64_t& reads)
+{
+    pht::PhotonProtocol protocol(options.role);
+    ss::DynamicBuffer inputBuffer;
+    ss::DynamicBuffer outputBuffer;
+    auto start = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < records.size(); ++i) {
+        auto& record = records[i];
+        if (options.realTime) {
+            std::this_thread::sleep_until(start + std::chrono::microseconds(record.time));
+        }
+
+        auto* data = record.data.Data();
+        uint32_t length = record.data.Size();
+        if (options.fragmentSize == 0) {
+            if (!Feed(protocol, data, length, inputBuffer, outputBuffer, reads)) {
+                return i;
+            }
+            continue;
+        }
+        for (uint32_t offset = 0; offset < length; offset += options.fragmentSize) {
+            uint32_t size = std::min(options.fragmentSize, length - offset);
+            if (!Feed(protocol, data + offset, size, inputBuffer, outputBuffer, reads)) {
+                return i;
+            }
+        }
+    }
+    return records.size();
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    if (!ParseOptions(argc, argv, options)) {
+        PrintUsage(argv[0]);
+        return -1;
+    }
+
+    std::vector<pht::ProtocolTraceReader::Record> records;
+    if (!LoadTrace(options.tracePath, records)) {
+        return -1;
+    }
+    uint64_t bytes = 0;
+    for (auto& record : records) {
+        bytes += record.data.Size();
+    }
+    std::cout << "Loaded " << records.size() << " reads, " << bytes << " bytes" << std::endl;
+
+    uint64_t reads = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < options.repeat; ++i) {
+        size_t failedAt = Replay(options, records, reads);
+        if (failedAt != records.size()) {
+            std::cerr << "Protocol failed at record " << failedAt << " of round " << i << std::endl;
+            return 1;
+        }
+    }
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    double totalBytes = double(bytes) * options.repeat;
+    std::cout << "Replayed " << reads << " reads in " << seconds << " s";
+    if (seconds > 0) {
+        std::cout << ", " << totalBytes / seconds / 1024 / 1024 << " MiB/s, " << double(reads) / seconds << " reads/s";
+    }
+    std::cout << std::endl;
+    return 0;
+}
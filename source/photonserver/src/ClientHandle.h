@@ -1,90 +1,246 @@
-//
-// Created by carl on 2020/4/30 0030.
-//
-
-#pragma once
-
-#include <SSNet/AsyncTcpSocket.h>
-#include <photonbase/protocol/PhotonProtocol.h>
-#include <spdlog/spdlog.h>
-
-namespace phtserver {
-
-class ClientHandle {
-public:
-    explicit ClientHandle(ss::AsyncTcpSocket* socket)
-    {
-        peer_ = socket->GetPeer();
-        protocol_ = std::make_unique<pht::PhotonProtocol>();
-        socket_ = socket;
-        SPDLOG_DEBUG("ClientHandle for {}:{} constructed", peer_.IP().ToStdString(), peer_.Port());
-    }
-
-    ~ClientHandle()
-    {
-        SPDLOG_DEBUG("Client handle for {}:{} destroyed", peer_.IP().ToStdString(), peer_.Port());
-    }
-
-    void OnClientData(ssize_t nread, const char* data)
-    {
-        if (nread < 0) {
-            // TODO handle error code
-            SPDLOG_INFO("Got nread {}", nread);
-            socket_->Close(nullptr);
-            return;
-        }
-
-        if (nread == 0) {
-            return; // ignore, this may caused by signals
-        }
-
-        SPDLOG_INFO("Receive {} bytes", nread);
-        if (protocol_ != nullptr) {
-            inputBuffer_.PushData(data, uint32_t(nread));
-
-            if (!protocol_->OnInBoundData(inputBuffer_, outputBuffer_)) {
-                Close();
-                return;
-            }
-            if (outputBuffer_.Empty()) {
-                return;
-            }
-
-            auto ret = OnOutBoundData(outputBuffer_.GetData<void>(), outputBuffer_.Size());
-            if (ret < 0) {
-                Close();
-                return;
-            }
-
-            outputBuffer_.Reset();
-        }
-    }
-
-    int OnOutBoundData(const void* data, uint32_t len)
-    {
-        if (len > 0) {
-            int ret = socket_->Send(data, len, [this](int status) {
-                if (status != 0) {
-                    Close();
-                }
-            });
-            // TODO manipulate the ret code
-            return ret;
-        }
-        return 0;
-    }
-
-    void Close()
-    {
-        socket_->Close(nullptr);
-    }
-
-private:
-    std::unique_ptr<pht::IProtocol> protocol_ { nullptr };
-    ss::AsyncTcpSocket* socket_ { nullptr };
-    ss::EndPoint peer_ {};
-    ss::DynamicBuffer inputBuffer_ {};
-    ss::DynamicBuffer outputBuffer_ {};
-};
-
-}
+//
+// Created by carl on 2020/4/30 0030.
+//
+
+#pragma once
+
+#include "LoopStats.h"
+#include <SSBase/Buffer.h>
+#include <functional>
+#include <photonbase/core/BufferChain.h>
+#include <photonbase/core/BufferPool.h>
+#include <photonbase/core/TimingWheel.h>
+#include <photonbase/protocol/KeepAlive.h>
+#include <photonbase/protocol/PhotonProtocol.h>
+#include <photonbase/protocol/ProtocolStats.h>
+#include <photonbase/protocol/ProtocolTrace.h>
+#include <photonbase/transport/TcpSocket.h>
+#include <spdlog/spdlog.h>
+#include <string>
+#include <vector>
+
+namespace phtserver {
+
+class ClientHandle {
+public:
+    /**
+     * Decides which loop serves the connection once the application is known
+     * @param appName The application of the hello
+     * @param received Everything received so far, nothing has been handled
+     * @return Return true if the connection has been handed off to another loop, together with the received bytes
+     */
+    using HandoffCallback = std::function<bool(const pht::String& appName, const ss::DynamicBuffer& received)>;
+
+    /**
+     * @param loopStats The counters of the loop the socket belongs to, nullptr to not count
+     */
+    explicit ClientHandle(pht::TcpSocket* socket, LoopStats* loopStats = nullptr)
+        : loopStats_(loopStats)
+    {
+        socket->GetPeer(peerIp_, peerPort_);
+        protocol_->SetMediaRelay(true);
+        // Media messages relayed from other clients are queued outside OnClientData
+        protocol_->SetOutBoundDataReadyCallback([this]() {
+            Flush();
+        });
+        socket_ = socket;
+        if (loopStats_ != nullptr) {
+            ++loopStats_->connections;
+        }
+        SPDLOG_DEBUG("ClientHandle for {}:{} constructed", peerIp_, peerPort_);
+    }
+
+    ~ClientHandle()
+    {
+        pht::ProtocolStats stats;
+        if (!handedOff_ && protocol_->GetStats(stats)) {
+            SPDLOG_INFO("{}:{} received {} bytes in {} messages, sent {} bytes in {} messages, {} dropped, {} parse errors, "
+                        "reassembly p99 {}ms",
+                peerIp_, peerPort_, stats.total.bytesIn, stats.total.messagesIn, stats.total.bytesOut,
+                stats.total.messagesOut, stats.total.droppedMessages, stats.parseErrors,
+                stats.total.reassemblyLatency.GetPercentile(99));
+        }
+        if (loopStats_ != nullptr) {
+            --loopStats_->connections;
+        }
+        SPDLOG_DEBUG("Client handle for {}:{} destroyed", peerIp_, peerPort_);
+    }
+
+    // Enforce the handshake and idle timeouts and probe a silent client with heartbeats, with the timers of the loop
+    void SetTimingWheel(pht::TimingWheel* wheel)
+    {
+        keepAlive_.Start(wheel);
+    }
+
+    // The blocks the headers of the outbound chunks are written to
+    void SetBufferPool(pht::BufferPool* pool)
+    {
+        outputChain_.SetBlockPool(pool);
+    }
+
+    void SetResumptionTokenStore(pht::ResumptionTokenStore* store)
+    {
+        tokenStore_ = store;
+        protocol_->SetResumptionTokenStore(store);
+    }
+
+    // Hold the received bytes until the hello, or the token of a resuming client, tells which application the client
+    // connects to, and let the callback hand the connection off. Other connections stay on this loop.
+    void SetHandoffCallback(HandoffCallback&& callback)
+    {
+        handoffCallback_ = std::move(callback);
+    }
+
+    // Record every read of this connection to a trace file, see photonreplay
+    bool StartTrace(const std::string& path)
+    {
+        trace_ = std::make_unique<pht::ProtocolTraceWriter>();
+        if (!trace_->Open(path)) {
+            SPDLOG_WARN("Open trace file {} failed", path);
+            trace_ = nullptr;
+            return false;
+        }
+        SPDLOG_INFO("Tracing {}:{} to {}", peerIp_, peerPort_, path);
+        return true;
+    }
+
+    void OnClientData(int64_t nread, const char* data)
+    {
+        BusyScope busy(loopStats_);
+        if (nread < 0) {
+            // TODO handle error code
+            SPDLOG_INFO("Got nread {}", nread);
+            Close();
+            return;
+        }
+
+        if (nread == 0) {
+            return; // ignore, this may caused by signals
+        }
+
+        SPDLOG_INFO("Receive {} bytes", nread);
+        if (handoffCallback_ != nullptr) {
+            routingBuffer_.PushData(data, uint32_t(nread));
+            if (!Route()) {
+                return; // Waiting for the hello, or handed off
+            }
+            // Served on this loop, handle what has been held
+            HandleInput(routingBuffer_.GetData<char>(), routingBuffer_.Size());
+            routingBuffer_.Reset();
+            return;
+        }
+        HandleInput(data, uint32_t(nread));
+    }
+
+    // Returns true if the connection is served on this loop
+    bool Route()
+    {
+        pht::String appName;
+        auto result = pht::PhotonProtocol::PeekApplicationName(routingBuffer_.GetData<uint8_t>(), routingBuffer_.Size(), appName, tokenStore_);
+        if (result == pht::PhotonProtocol::PeekResult::kNotEnoughData) {
+            return false;
+        }
+        auto callback = std::move(handoffCallback_);
+        handoffCallback_ = nullptr;
+        if (result == pht::PhotonProtocol::PeekResult::kFound && callback(appName, routingBuffer_)) {
+            SPDLOG_DEBUG("{}:{} of application {} handed off", peerIp_, peerPort_, appName.ToStdString());
+            handedOff_ = true;
+            keepAlive_.Stop();
+            return false;
+        }
+        return true;
+    }
+
+    void HandleInput(const char* data, uint32_t size)
+    {
+        if (trace_ != nullptr && !trace_->Write(data, size)) {
+            SPDLOG_WARN("Write trace failed, stop tracing");
+            trace_ = nullptr;
+        }
+        if (protocol_ != nullptr) {
+            // Parsed where it was read, e.g. the receive buffer of the loop
+            processingInput_ = true;
+            bool ok = protocol_->OnInBoundBytes(reinterpret_cast<const uint8_t*>(data), size, outputChain_);
+            processingInput_ = false;
+            if (!ok) {
+                Close();
+                return;
+            }
+            keepAlive_.OnReceived();
+            SendOutput();
+        }
+    }
+
+    // Write the messages queued by other connections
+    void Flush()
+    {
+        if (processingInput_) {
+            return; // OnClientData will send them
+        }
+        BusyScope busy(loopStats_);
+        pht::BufferChain unused;
+        if (!protocol_->OnOutBoundChain(unused, outputChain_)) {
+            Close();
+            return;
+        }
+        SendOutput();
+    }
+
+    // Write the chunks without copying. The write owns the slices until it completes, then the blocks return to
+    // their owners, e.g. the pool of the loop or the queues of the relayed messages.
+    void SendOutput()
+    {
+        if (outputChain_.Empty()) {
+            return;
+        }
+        auto sending = std::make_shared<pht::BufferChain>();
+        sending->Append(std::move(outputChain_));
+        sendBuffers_.clear();
+        for (auto& slice : sending->GetSlices()) {
+            sendBuffers_.push_back({ slice.Data(), slice.Size() });
+        }
+        // One write of all the slices
+        bool ok = socket_->Send(sendBuffers_.data(), uint32_t(sendBuffers_.size()), [this, sending](int status) {
+            if (status != 0) {
+                Close();
+            }
+        });
+        if (!ok) {
+            Close();
+        }
+    }
+
+    void OnExpired(pht::KeepAlive::Expiry expiry)
+    {
+        if (expiry == pht::KeepAlive::Expiry::kHandshake) {
+            SPDLOG_INFO("{}:{} didn't complete the handshake in time", peerIp_, peerPort_);
+        } else {
+            SPDLOG_INFO("{}:{} is idle for too long", peerIp_, peerPort_);
+        }
+        Close();
+    }
+
+    void Close()
+    {
+        keepAlive_.Stop();
+        socket_->Close(nullptr);
+    }
+
+private:
+    std::unique_ptr<pht::PhotonProtocol> protocol_ { std::make_unique<pht::PhotonProtocol>(pht::PhotonProtocol::Role::kServer) };
+    pht::ResumptionTokenStore* tokenStore_ { nullptr };
+    pht::TcpSocket* socket_ { nullptr };
+    std::string peerIp_ {};
+    uint16_t peerPort_ { 0 };
+    std::unique_ptr<pht::ProtocolTraceWriter> trace_ { nullptr };
+    pht::BufferChain outputChain_ {};
+    std::vector<pht::ConstBuffer> sendBuffers_ {}; // Reused by SendOutput
+    bool processingInput_ { false };
+    LoopStats* loopStats_ { nullptr };
+    HandoffCallback handoffCallback_ { nullptr };
+    ss::DynamicBuffer routingBuffer_ {}; // Received before the connection is routed
+    bool handedOff_ { false };
+    pht::KeepAlive keepAlive_ { protocol_.get(), [this]() { Flush(); }, [this](pht::KeepAlive::Expiry expiry) { OnExpired(expiry); } };
+};
+
+}
@@ -0,0 +1,47 @@
+//
+// Created by carl on 2020/5/20.
+//
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace phtserver {
+
+// Counters of one worker loop, updated by the loop's thread and read by the reporter
+struct LoopStats {
+    std::atomic<uint32_t> connections { 0 };
+    std::atomic<uint64_t> acceptedConnections { 0 };
+    std::atomic<uint64_t> handedOffConnections { 0 }; // Accepted by this loop but served by another
+    std::atomic<uint64_t> adoptedConnections { 0 }; // Accepted by another loop
+    std::atomic<uint64_t> busyNanoseconds { 0 }; // Time spent in the event handlers
+};
+
+// Adds the lifetime of the scope to the busy time of a loop
+class BusyScope {
+public:
+    explicit BusyScope(LoopStats* stats)
+        : stats_(stats)
+        , start_(std::chrono::steady_clock::now())
+    {
+    }
+
+    ~BusyScope()
+    {
+        if (stats_ != nullptr) {
+            auto elapsed = std::chrono::steady_clock::now() - start_;
+            stats_->busyNanoseconds += uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+        }
+    }
+
+    BusyScope(const BusyScope&) = delete;
+    BusyScope& operator=(const BusyScope&) = delete;
+
+private:
+    LoopStats* stats_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+}
@@ -0,0 +1,331 @@
+//
+// Created by carl on 2020/5/20.
+//
+
+#include "ServerWorker.h"
+#include "ClientHandle.h"
+#include "spdlog/spdlog.h"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace phtserver {
+
+static std::atomic<uint64_t> gConnectionCount { 0 };
+static const size_t kReceiveBufferSize = 64 * 1024;
+static const uint32_t kSendBlockSize = 4096;
+static const uint32_t kTimerTick = 100; // In milliseconds
+
+static uint64_t GetMilliseconds()
+{
+    return uint64_t(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// A bound socket that shares the port with the other workers' sockets, -1 on failure
+static int CreateReusePortSocket(const std::string& ip, uint16_t port)
+{
+#if defined(_WIN32) || !defined(SO_REUSEPORT)
+    return -1;
+#else
+    sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, ip.c_str(), &addr.sin_addr) != 1) {
+        return -1;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int on = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0
+        || setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0
+        || bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+#endif
+}
+
+bool ServerWorker::IsReusePortSupported()
+{
+#if defined(_WIN32) || !defined(SO_REUSEPORT)
+    return false;
+#else
+    return true;
+#endif
+}
+
+ServerWorker::ServerWorker(uint32_t index, const ServerOptions& options)
+    : index_(index)
+    , options_(options)
+    , receiveBuffer_(kReceiveBufferSize)
+    , sendPool_(kSendBlockSize)
+    , timers_(kTimerTick, GetMilliseconds())
+{
+}
+
+ServerWorker::~ServerWorker()
+{
+    Join();
+}
+
+bool ServerWorker::Start()
+{
+    std::promise<bool> listening;
+    auto result = listening.get_future();
+    thread_ = std::thread([this, &listening]() {
+        Run(listening);
+    });
+    if (!result.get()) {
+        Join();
+        return false;
+    }
+    return true;
+}
+
+void ServerWorker::SetPeers(const std::vector<ServerWorker*>& peers)
+{
+    peers_ = peers;
+}
+
+void ServerWorker::Adopt(Handoff&& handoff)
+{
+    std::lock_guard<std::mutex> lock(handoffMutex_);
+    handoffs_.push_back(std::move(handoff));
+    // Until the loop is created, Run picks them up
+    if (loop_ != nullptr && handoffs_.size() == 1) {
+        loop_->Post([this]() {
+            AdoptPending();
+        });
+    }
+}
+
+void ServerWorker::Join()
+{
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void ServerWorker::Run(std::promise<bool>& listening)
+{
+    // The loop and its sockets belong to this thread
+    pht::EventLoop loop;
+    if (!loop.Init()) {
+        SPDLOG_WARN("Worker {} create the loop failed", index_);
+        listening.set_value(false);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(handoffMutex_);
+        loop_ = &loop;
+        if (!handoffs_.empty()) {
+            loop_->Post([this]() {
+                AdoptPending();
+            });
+        }
+    }
+
+    bool ok = Listen(loop);
+    listening.set_value(ok);
+    if (ok) {
+        loop.Run();
+    }
+
+    // No more handoffs to this loop, the ones not adopted are closed
+    std::lock_guard<std::mutex> lock(handoffMutex_);
+    loop_ = nullptr;
+#ifndef _WIN32
+    for (auto& handoff : handoffs_) {
+        close(handoff.fd);
+    }
+#endif
+    handoffs_.clear();
+}
+
+bool ServerWorker::Listen(pht::EventLoop& loop)
+{
+    auto* server = loop.CreateTcpSocket();
+    bool ok = server != nullptr;
+    if (ok && options_.workerCount > 1) {
+        int fd = CreateReusePortSocket(options_.ip, options_.port);
+        ok = fd >= 0 && server->Open(fd);
+#ifndef _WIN32
+        if (fd >= 0 && !ok) {
+            close(fd);
+        }
+#endif
+    } else if (ok) {
+        ok = server->Bind(options_.ip, options_.port);
+    }
+    if (!ok) {
+        SPDLOG_WARN("Worker {} bind to {}:{} failed", index_, options_.ip, options_.port);
+        return false;
+    }
+    ok = server->Listen(options_.backlog, [this](pht::TcpSocket* server, int status) {
+        BusyScope busy(&stats_);
+        OnConnection(server, status);
+    });
+    if (!ok) {
+        SPDLOG_WARN("Worker {} listening on {}:{} failed", index_, options_.ip, options_.port);
+        return false;
+    }
+    auto* tick = loop.CreateTimer();
+    if (tick == nullptr || !tick->Start(kTimerTick, kTimerTick, [this]() {
+            BusyScope busy(&stats_);
+            timers_.Advance(GetMilliseconds());
+        })) {
+        SPDLOG_WARN("Worker {} start the timer failed", index_);
+        return false;
+    }
+    // Loop timers of their own, the wheel's tick is too coarse for e.g. a frame rate
+    for (auto& [appName, timer] : options_.applicationTimers) {
+        if (GetOwner(pht::String(appName.c_str())) != index_) {
+            continue;
+        }
+        auto& callback = timer.callback;
+        auto* appTimer = loop.CreateTimer();
+        if (appTimer == nullptr || !appTimer->Start(timer.interval, timer.interval, [this, &callback]() {
+                BusyScope busy(&stats_);
+                callback();
+            })) {
+            SPDLOG_WARN("Worker {} start the timer of {} failed", index_, appName);
+            return false;
+        }
+    }
+    SPDLOG_INFO("Worker {} listening on {}:{}", index_, options_.ip, options_.port);
+    return true;
+}
+
+void ServerWorker::OnConnection(pht::TcpSocket* server, int status)
+{
+    if (status != 0) {
+        SPDLOG_WARN("OnConnection got status {}", status);
+        return;
+    }
+    auto client = server->Accept();
+    if (client == nullptr) {
+        SPDLOG_WARN("Accept client failed!");
+        return;
+    }
+    SPDLOG_INFO("A client accepted by worker {}", index_);
+    ++stats_.acceptedConnections;
+    Serve(client, {}, peers_.size() <= 1);
+}
+
+uint32_t ServerWorker::GetOwner(const pht::String& appName) const
+{
+    if (peers_.size() <= 1) {
+        return index_;
+    }
+    return uint32_t(std::hash<std::string>()(appName.ToStdString()) % peers_.size());
+}
+
+bool ServerWorker::HandOff(pht::TcpSocket* client, const pht::String& appName, const ss::DynamicBuffer& received)
+{
+    auto owner = GetOwner(appName);
+    if (owner == index_) {
+        return false;
+    }
+#ifdef _WIN32
+    return false; // Never more than one worker
+#else
+    // This loop closes its handle, the duplicate keeps the connection open for the owner. The bytes the kernel has
+    // not delivered yet are read by the owner, the ones read here go with the handoff, so nothing is lost.
+    int fd = dup(client->GetFd());
+    if (fd < 0) {
+        SPDLOG_WARN("Duplicate the socket of application {} failed, serve it on worker {}", appName.ToStdString(), index_);
+        return false;
+    }
+    client->StopReceive();
+    Handoff handoff;
+    handoff.fd = fd;
+    handoff.received.assign(received.GetData<char>(), received.GetData<char>() + received.Size());
+    client->Close(nullptr);
+    ++stats_.handedOffConnections;
+    peers_[owner]->Adopt(std::move(handoff));
+    return true;
+#endif
+}
+
+void ServerWorker::AdoptPending()
+{
+    std::vector<Handoff> handoffs;
+    {
+        std::lock_guard<std::mutex> lock(handoffMutex_);
+        handoffs.swap(handoffs_);
+    }
+    for (auto& handoff : handoffs) {
+        BusyScope busy(&stats_);
+        auto client = loop_->CreateTcpSocket();
+        if (client == nullptr || !client->Open(handoff.fd)) {
+            SPDLOG_WARN("Worker {} adopt a connection failed", index_);
+            if (client != nullptr) {
+                client->Close(nullptr);
+            }
+#ifndef _WIN32
+            close(handoff.fd);
+#endif
+            continue;
+        }
+        ++stats_.adoptedConnections;
+        Serve(client, handoff.received, true);
+    }
+}
+
+void ServerWorker::Serve(pht::TcpSocket* client, const std::vector<char>& received, bool routed)
+{
+    auto clientHandle = std::make_shared<ClientHandle>(client, &stats_);
+    clientHandle->SetResumptionTokenStore(options_.tokenStore);
+    clientHandle->SetBufferPool(&sendPool_);
+    clientHandle->SetTimingWheel(&timers_);
+    auto connectionNumber = ++gConnectionCount;
+    std::string tracePath;
+    if (!options_.traceDir.empty()) {
+        std::string ip;
+        uint16_t port = 0;
+        client->GetPeer(ip, port);
+        tracePath = fmt::format("{}/{}_{}_{}.phtrace", options_.traceDir, ip, port, connectionNumber);
+    }
+    if (routed) {
+        if (!tracePath.empty()) {
+            clientHandle->StartTrace(tracePath);
+        }
+    } else {
+        // The loop serving the connection traces it
+        auto* handle = clientHandle.get();
+        clientHandle->SetHandoffCallback([this, client, handle, tracePath](const pht::String& appName, const ss::DynamicBuffer& received) {
+            if (HandOff(client, appName, received)) {
+                return true;
+            }
+            if (!tracePath.empty()) {
+                handle->StartTrace(tracePath);
+            }
+            return false;
+        });
+    }
+    // All the connections of the loop read into the same buffer, it is handled before the next read. An idle
+    // connection keeps only its incomplete chunk.
+    auto alloc = [this](size_t /* suggestedSize */, char** base, size_t* len) {
+        *base = receiveBuffer_.data();
+        *len = receiveBuffer_.size();
+    };
+    // keep a reference of client and clientHandle to ensure they are not destructed
+    client->StartReceive(alloc, [clientHandle, client](int64_t nread, const char* data) {
+        clientHandle->OnClientData(nread, data);
+    });
+    if (!received.empty()) {
+        // Handled before anything read from now on
+        clientHandle->OnClientData(int64_t(received.size()), received.data());
+    }
+}
+
+}
@@ -0,0 +1,134 @@
+//
+// Created by carl on 2020/5/20.
+//
+
+#pragma once
+
+#include "LoopStats.h"
+#include <SSBase/Buffer.h>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <photonbase/core/BufferPool.h>
+#include <photonbase/core/TimingWheel.h>
+#include <photonbase/core/Types.h>
+#include <photonbase/transport/EventLoop.h>
+#include <photonbase/transport/TcpSocket.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace pht {
+class ResumptionTokenStore;
+}
+
+namespace phtserver {
+
+// A callback of an application, invoked periodically on the loop serving the application
+struct ApplicationTimer {
+    uint32_t interval { 1000 }; // In milliseconds
+    std::function<void()> callback {};
+};
+
+struct ServerOptions {
+    std::string ip { "0.0.0.0" };
+    uint16_t port { 6666 };
+    int backlog { 100 };
+    uint32_t workerCount { 1 };
+    std::string traceDir {}; // Directory to record inbound traces of all connections to, empty to disable
+    pht::ResumptionTokenStore* tokenStore { nullptr }; // Shared by all the workers
+    // By application name, e.g. for its housekeeping or the frames it produces
+    std::map<std::string, ApplicationTimer> applicationTimers {};
+};
+
+// Runs a loop on its own thread with its own listening socket. The listening sockets of all the workers are bound
+// to the same port with SO_REUSEPORT, so the kernel spreads the incoming connections across the loops.
+// Clients of the same application are served on the same loop, so relaying among them never crosses threads. The
+// loop owning an application is picked by hashing its name, a connection accepted by another loop is handed off as
+// soon as its hello is received, before anything is handled.
+class ServerWorker {
+public:
+    // An accepted connection moving to another loop
+    struct Handoff {
+        int fd { -1 }; // Detached from the loop that accepted it
+        std::vector<char> received {}; // Read by the loop that accepted it, not handled yet
+    };
+
+    ServerWorker(uint32_t index, const ServerOptions& options);
+
+    ~ServerWorker();
+
+    ServerWorker(const ServerWorker&) = delete;
+    ServerWorker& operator=(const ServerWorker&) = delete;
+
+    // More than one worker needs SO_REUSEPORT, e.g. there is no such option on Windows
+    static bool IsReusePortSupported();
+
+    // All the workers including this one, by index. Must be set before any worker starts.
+    void SetPeers(const std::vector<ServerWorker*>& peers);
+
+    /**
+     * Serve a connection accepted by another loop, thread safe
+     * @param handoff The connection, the worker owns the fd from now on
+     */
+    void Adopt(Handoff&& handoff);
+
+    /**
+     * Start the thread, and wait until the worker listens
+     * @return Return false if the listening socket can't be set up
+     */
+    bool Start();
+
+    void Join();
+
+    uint32_t GetIndex() const
+    {
+        return index_;
+    }
+
+    const LoopStats& GetStats() const
+    {
+        return stats_;
+    }
+
+private:
+    // The body of the worker thread, `listening` is set when the socket is listening or failed
+    void Run(std::promise<bool>& listening);
+
+    // Set up the listening socket and the timers of the loop
+    bool Listen(pht::EventLoop& loop);
+
+    void OnConnection(pht::TcpSocket* server, int status);
+
+    // The index of the worker serving an application
+    uint32_t GetOwner(const pht::String& appName) const;
+
+    // Returns true if the connection has been handed off to the owner of the application
+    bool HandOff(pht::TcpSocket* client, const pht::String& appName, const ss::DynamicBuffer& received);
+
+    // Serve the connections handed to this worker, on the loop thread
+    void AdoptPending();
+
+    /**
+     * @param received Bytes read by another loop before the handoff
+     * @param routed Whether the connection is on the loop of its application already
+     */
+    void Serve(pht::TcpSocket* client, const std::vector<char>& received, bool routed);
+
+    uint32_t index_;
+    const ServerOptions& options_;
+    std::vector<ServerWorker*> peers_ {};
+    std::thread thread_ {};
+    LoopStats stats_ {};
+    std::mutex handoffMutex_ {};
+    pht::EventLoop* loop_ { nullptr }; // Set while the loop is usable, guarded by handoffMutex_
+    std::vector<Handoff> handoffs_ {}; // Guarded by handoffMutex_
+    std::vector<char> receiveBuffer_; // Shared by the connections of the loop
+    pht::BufferPool sendPool_; // The blocks of the chunk headers the connections of the loop send
+    pht::TimingWheel timers_; // The timers of all the connections of the loop, driven by one loop timer
+};
+
+}
@@ -2,34 +2,26 @@
 // Created by carl on 20-3-31.
 //
 
-#include "ClientHandle.h"
+#include "ServerWorker.h"
 #include "spdlog/spdlog.h"
-#include <SSNet/AsyncTcpSocket.h>
-#include <SSNet/Loop.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
-#include <photonbase/protocol/PhotonProtocol.h>
+#include <memory>
+#include <photonbase/application/ApplicationManager.h>
+#include <photonbase/application/BenchApplication.h>
+#include <photonbase/application/McuApplication.h>
+#include <photonbase/application/SfuApplication.h>
+#include <photonbase/protocol/ResumptionTokenStore.h>
+#include <thread>
+#include <vector>
 
-
-
-void OnConnection(const ss::SharedPtr<ss::AsyncTcpSocket>& server, int status)
-{
-    if (status != 0) {
-        SPDLOG_WARN("OnConnection got status {}", status);
-        return;
-    }
-    auto client = server->Accept();
-    if (client == nullptr) {
-        SPDLOG_WARN("Accept client failed!");
-        return;
-    }
-    SPDLOG_INFO("A client accepted");
-
-    auto clientHandle = std::make_shared<phtserver::ClientHandle>(client);
-    // keep a reference of client and clientHandle to ensure they are not destructed
-    client->StartReceive([clientHandle, client](ssize_t nread, const char* data) {
-        clientHandle->OnClientData(nread, data);
-    });
-}
+// Shared by all connections, so that a client can resume on a new connection
+static pht::ResumptionTokenStore gTokenStore;
+static const auto kReportInterval = std::chrono::seconds(10);
 
 void ConfigureLog()
 {
@@ -38,37 +30,109 @@ void ConfigureLog()
     spdlog::set_pattern("[%H:%M:%S %z|%t|%l|%s:%#] %v");
 }
 
-int main()
+// Log the connections and the utilization of every loop, the utilization is the share of the interval a loop spent
+// in its event handlers
+void ReportStats(const std::vector<std::unique_ptr<phtserver::ServerWorker>>& workers)
 {
-    ConfigureLog();
-
-    auto loop = ss::MakeShared<ss::Loop>();
-    auto server = loop->CreateTcpSocket();
+    std::vector<uint64_t> lastBusy(workers.size(), 0);
+    auto lastTime = std::chrono::steady_clock::now();
+    while (true) {
+        std::this_thread::sleep_for(kReportInterval);
+        auto now = std::chrono::steady_clock::now();
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - lastTime).count();
+        lastTime = now;
+        for (size_t i = 0; i < workers.size(); ++i) {
+            auto& stats = workers[i]->GetStats();
+            uint64_t busy = stats.busyNanoseconds;
+            SPDLOG_INFO("Loop {}: {} connections, {} accepted, {} handed off, {} adopted, utilization {:.1f}%", i,
+                stats.connections.load(), stats.acceptedConnections.load(), stats.handedOffConnections.load(),
+                stats.adoptedConnections.load(), elapsed > 0 ? double(busy - lastBusy[i]) * 100 / double(elapsed) : 0.0);
+            lastBusy[i] = busy;
+        }
+    }
+}
 
-    // TODO: handle signals
+int main(int argc, char** argv)
+{
+    ConfigureLog();
 
     // TODO: read from configure file
-    const char* ip = "0.0.0.0";
-    uint16_t port = 6666;
-    int backlog = 100;
+    phtserver::ServerOptions options;
+    options.tokenStore = &gTokenStore;
+    options.workerCount = std::max(1u, std::thread::hardware_concurrency());
+    uint32_t gopCacheSize = pht::SfuApplication::kDefaultGopCacheSize;
+    unsigned mcuWidth = pht::McuApplication::kDefaultWidth;
+    unsigned mcuHeight = pht::McuApplication::kDefaultHeight;
+    uint32_t mcuFrameInterval = pht::McuApplication::kDefaultFrameInterval;
+    uint32_t mcuThreadCount = pht::McuApplication::kDefaultThreadCount;
 
-    if (0 != server->Bind("0.0.0.0", 6666)) {
-        SPDLOG_INFO("Start listening: {}:{}", ip, port);
-        return -1;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--trace-dir") == 0 && i + 1 < argc) {
+            options.traceDir = argv[++i];
+        } else if (std::strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            options.port = uint16_t(std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc && std::atoi(argv[i + 1]) > 0) {
+            options.workerCount = uint32_t(std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "--gop-cache") == 0 && i + 1 < argc) {
+            gopCacheSize = uint32_t(std::strtoul(argv[++i], nullptr, 10));
+        } else if (std::strcmp(argv[i], "--mcu-size") == 0 && i + 1 < argc
+            && std::sscanf(argv[i + 1], "%ux%u", &mcuWidth, &mcuHeight) == 2 && mcuWidth > 1 && mcuWidth <= 0xFFFF
+            && mcuHeight > 1 && mcuHeight <= 0xFFFF) {
+            ++i;
+        } else if (std::strcmp(argv[i], "--mcu-fps") == 0 && i + 1 < argc && std::atoi(argv[i + 1]) > 0) {
+            mcuFrameInterval = std::max(1u, 1000u / uint32_t(std::atoi(argv[++i])));
+        } else if (std::strcmp(argv[i], "--mcu-threads") == 0 && i + 1 < argc && std::atoi(argv[i + 1]) > 0) {
+            mcuThreadCount = uint32_t(std::atoi(argv[++i]));
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--trace-dir <directory>] [--port <port>] [--threads <count>] "
+                      << "[--gop-cache <bytes>] [--mcu-size <width>x<height>] [--mcu-fps <fps>] [--mcu-threads <count>]"
+                      << std::endl;
+            return -1;
+        }
     }
-    SPDLOG_INFO("Bind to: {}:{}", ip, port);
+    if (options.workerCount > 1 && !phtserver::ServerWorker::IsReusePortSupported()) {
+        SPDLOG_WARN("The loops can't share the port without SO_REUSEPORT, run on one loop");
+        options.workerCount = 1;
+    }
+
+    // TODO: handle signals
 
-    auto ret = server->Listen(backlog, [](ss::AsyncTcpSocket* server, int status) {
-        OnConnection(server, status);
-    });
+    // Rooms of publishers and subscribers, its connections are served on one loop, see ServerWorker::GetOwner.
+    // Registered before the loops start, the applications are looked up by all of them.
+    pht::SfuApplication sfuApplication(pht::SfuApplication::kDefaultLatencyBudget, gopCacheSize);
+    pht::ApplicationManager::RegisterApplication("sfu", &sfuApplication);
+    options.applicationTimers["sfu"].callback = [&sfuApplication]() {
+        sfuApplication.Update();
+    };
+    // The composites of the rooms, produced on the loop serving the application at the frame rate
+    pht::McuApplication mcuApplication(uint16_t(mcuWidth), uint16_t(mcuHeight), mcuFrameInterval, mcuThreadCount);
+    pht::ApplicationManager::RegisterApplication("mcu", &mcuApplication);
+    auto& mcuTimer = options.applicationTimers["mcu"];
+    mcuTimer.interval = mcuFrameInterval;
+    mcuTimer.callback = [&mcuApplication]() {
+        mcuApplication.Update();
+    };
+    // The counterpart of photonbench
+    pht::BenchApplication benchApplication;
+    pht::ApplicationManager::RegisterApplication("bench", &benchApplication);
 
-    if (0 != ret) {
-        SPDLOG_INFO("Listening on: {}:{} failed", ip, port);
-        return -1;
+    std::vector<std::unique_ptr<phtserver::ServerWorker>> workers;
+    std::vector<phtserver::ServerWorker*> peers;
+    for (uint32_t i = 0; i < options.workerCount; ++i) {
+        workers.push_back(std::make_unique<phtserver::ServerWorker>(i, options));
+        peers.push_back(workers.back().get());
     }
-    SPDLOG_INFO("Listening on: {}:{}", ip, port);
-
-    loop->Run();
+    for (auto& worker : workers) {
+        worker->SetPeers(peers);
+    }
+    for (uint32_t i = 0; i < options.workerCount; ++i) {
+        if (!workers[i]->Start()) {
+            SPDLOG_WARN("Start worker {} failed", i);
+            std::exit(-1); // The started loops never return
+        }
+    }
+    SPDLOG_INFO("Listening on: {}:{} with {} loops", options.ip, options.port, options.workerCount);
 
+    ReportStats(workers);
     return 0;
-}
\ No newline at end of file
+}